@@ -245,6 +245,7 @@ typedef int	archive_close_callback(struct archive *, void *_client_data);
 #define	ARCHIVE_COMPRESSION_XZ		6
 #define	ARCHIVE_COMPRESSION_UU		7
 #define	ARCHIVE_COMPRESSION_RPM		8
+#define	ARCHIVE_COMPRESSION_ZSTD	9
 
 /*
  * Codes returned by archive_format.
@@ -324,6 +325,7 @@ __LA_DECL int		 archive_read_support_compression_program_signature
 __LA_DECL int		 archive_read_support_compression_rpm(struct archive *);
 __LA_DECL int		 archive_read_support_compression_uu(struct archive *);
 __LA_DECL int		 archive_read_support_compression_xz(struct archive *);
+__LA_DECL int		 archive_read_support_compression_zstd(struct archive *);
 
 __LA_DECL int		 archive_read_support_format_all(struct archive *);
 __LA_DECL int		 archive_read_support_format_ar(struct archive *);
@@ -470,6 +472,9 @@ __LA_DECL int		archive_read_set_options(struct archive *_a,
 #define	ARCHIVE_EXTRACT_NO_OVERWRITE_NEWER	(0x0800)
 /* Detect blocks of 0 and write holes instead. */
 #define	ARCHIVE_EXTRACT_SPARSE			(0x1000)
+/* Default: Look up every parent directory on disk for every entry. */
+/* Note: The tree must not be changed behind our back while extracting. */
+#define	ARCHIVE_EXTRACT_CACHE_DIRS		(0x2000)
 
 __LA_DECL int	 archive_read_extract(struct archive *, struct archive_entry *,
 		     int flags);
@@ -530,6 +535,7 @@ __LA_DECL int		 archive_write_set_compression_none(struct archive *);
 __LA_DECL int		 archive_write_set_compression_program(struct archive *,
 		     const char *cmd);
 __LA_DECL int		 archive_write_set_compression_xz(struct archive *);
+__LA_DECL int		 archive_write_set_compression_zstd(struct archive *);
 /* A convenience function to set the format based on the code or name. */
 __LA_DECL int		 archive_write_set_format(struct archive *, int format_code);
 __LA_DECL int		 archive_write_set_format_by_name(struct archive *,
@@ -587,6 +593,7 @@ __LA_DECL __LA_SSIZE_T	 archive_write_data_block(struct archive *,
 				    const void *, size_t, __LA_INT64_T);
 #endif
 __LA_DECL int		 archive_write_finish_entry(struct archive *);
+__LA_DECL int		 archive_write_flush(struct archive *);
 __LA_DECL int		 archive_write_close(struct archive *);
 #if ARCHIVE_VERSION_NUMBER < 2000000
 /* Return value was incorrect in libarchive 1.x. */
@@ -0,0 +1,283 @@
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "archive_platform.h"
+
+__FBSDID("$FreeBSD$");
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
+
+#include "archive.h"
+#include "archive_private.h"
+#include "archive_read_private.h"
+
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+struct private_data {
+	ZSTD_DStream	*dstream;
+	unsigned char	*out_block;
+	size_t		 out_block_size;
+	char		 in_frame; /* True = inside a zstd frame. */
+	char		 eof; /* True = found end of compressed data. */
+};
+
+/* Zstd filter */
+static ssize_t	zstd_filter_read(struct archive_read_filter *, const void **);
+static int	zstd_filter_close(struct archive_read_filter *);
+#endif
+
+/*
+ * Note that we can detect zstd archives even if we can't decompress
+ * them.  (In fact, we like detecting them because we can give better
+ * error messages.)  So the bid framework here gets compiled even
+ * if libzstd is unavailable.
+ */
+static int	zstd_reader_bid(struct archive_read_filter_bidder *, struct archive_read_filter *);
+static int	zstd_reader_init(struct archive_read_filter *);
+static int	zstd_reader_free(struct archive_read_filter_bidder *);
+
+int
+archive_read_support_compression_zstd(struct archive *_a)
+{
+	struct archive_read *a = (struct archive_read *)_a;
+	struct archive_read_filter_bidder *reader = __archive_read_get_bidder(a);
+
+	archive_clear_error(_a);
+	if (reader == NULL)
+		return (ARCHIVE_FATAL);
+
+	reader->data = NULL;
+	reader->bid = zstd_reader_bid;
+	reader->init = zstd_reader_init;
+	reader->options = NULL;
+	reader->free = zstd_reader_free;
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+	return (ARCHIVE_OK);
+#else
+	archive_set_error(_a, ARCHIVE_ERRNO_MISC,
+	    "Using external zstd program for zstd decompression");
+	return (ARCHIVE_WARN);
+#endif
+}
+
+static int
+zstd_reader_free(struct archive_read_filter_bidder *self){
+	(void)self; /* UNUSED */
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Test whether we can handle this data.
+ *
+ * A zstd stream is a sequence of frames, each starting with the magic
+ * number 0xFD2FB528, or 0x184D2A5? for skippable frames, in little
+ * endian byte order.
+ */
+static int
+zstd_reader_bid(struct archive_read_filter_bidder *self, struct archive_read_filter *filter)
+{
+	const unsigned char *buffer;
+	ssize_t avail;
+
+	(void)self; /* UNUSED */
+
+	buffer = __archive_read_filter_ahead(filter, 4, &avail);
+	if (buffer == NULL)
+		return (0);
+
+	if (memcmp(buffer, "\x28\xB5\x2F\xFD", 4) == 0)
+		return (32);
+	if ((buffer[0] & 0xF0) == 0x50 &&
+	    memcmp(buffer + 1, "\x2A\x4D\x18", 3) == 0)
+		return (28);
+	return (0);
+}
+
+#if !defined(HAVE_ZSTD_H) || !defined(HAVE_LIBZSTD)
+
+/*
+ * If we don't have the library on this system, we can't actually do the
+ * decompression.  We can, however, still detect compressed archives
+ * and emit a useful message.
+ */
+static int
+zstd_reader_init(struct archive_read_filter *self)
+{
+	int r;
+
+	r = __archive_read_program(self, "zstd -d -qq");
+	/* Note: We set the format here even if __archive_read_program()
+	 * above fails.  We do, after all, know what the format is
+	 * even if we weren't able to read it. */
+	self->code = ARCHIVE_COMPRESSION_ZSTD;
+	self->name = "zstd";
+	return (r);
+}
+
+#else
+
+/*
+ * Setup the callbacks.
+ */
+static int
+zstd_reader_init(struct archive_read_filter *self)
+{
+	struct private_data *state;
+	size_t out_block_size;
+	void *out_block;
+
+	self->code = ARCHIVE_COMPRESSION_ZSTD;
+	self->name = "zstd";
+
+	/* A full decompressed block per read is the most efficient. */
+	out_block_size = ZSTD_DStreamOutSize();
+	state = (struct private_data *)calloc(sizeof(*state), 1);
+	out_block = (unsigned char *)malloc(out_block_size);
+	if (state == NULL || out_block == NULL) {
+		archive_set_error(&self->archive->archive, ENOMEM,
+		    "Can't allocate data for zstd decompression");
+		free(out_block);
+		free(state);
+		return (ARCHIVE_FATAL);
+	}
+	state->dstream = ZSTD_createDStream();
+	if (state->dstream == NULL) {
+		archive_set_error(&self->archive->archive, ENOMEM,
+		    "Can't allocate data for zstd decompression");
+		free(out_block);
+		free(state);
+		return (ARCHIVE_FATAL);
+	}
+
+	self->data = state;
+	state->out_block_size = out_block_size;
+	state->out_block = out_block;
+	self->read = zstd_filter_read;
+	self->skip = NULL; /* not supported */
+	self->close = zstd_filter_close;
+
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Return the next block of decompressed data.
+ */
+static ssize_t
+zstd_filter_read(struct archive_read_filter *self, const void **p)
+{
+	struct private_data *state;
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer out;
+	const void *read_buf;
+	ssize_t avail_in;
+	size_t ret;
+
+	state = (struct private_data *)self->data;
+
+	if (state->eof) {
+		*p = NULL;
+		return (0);
+	}
+
+	/* Empty our output buffer. */
+	out.dst = state->out_block;
+	out.size = state->out_block_size;
+	out.pos = 0;
+
+	/* Try to fill the output buffer. */
+	while (out.pos < out.size) {
+		/*
+		 * Between frames, stop at anything that isn't another
+		 * frame, such as the zero padding of the last block.
+		 */
+		if (!state->in_frame) {
+			if (zstd_reader_bid(self->bidder, self->upstream) == 0) {
+				state->eof = 1;
+				break;
+			}
+			state->in_frame = 1;
+		}
+
+		read_buf = __archive_read_filter_ahead(self->upstream, 1,
+		    &avail_in);
+		if (read_buf == NULL && avail_in < 0)
+			return (ARCHIVE_FATAL);
+		if (read_buf == NULL || avail_in == 0) {
+			archive_set_error(&self->archive->archive,
+			    ARCHIVE_ERRNO_MISC, "Truncated zstd input");
+			return (ARCHIVE_FATAL);
+		}
+		in.src = read_buf;
+		in.size = avail_in;
+		in.pos = 0;
+
+		/* Decompress as much as we can in one pass. */
+		ret = ZSTD_decompressStream(state->dstream, &out, &in);
+		__archive_read_filter_consume(self->upstream, in.pos);
+		if (ZSTD_isError(ret)) {
+			archive_set_error(&self->archive->archive,
+			    ARCHIVE_ERRNO_MISC, "zstd decompression failed: %s",
+			    ZSTD_getErrorName(ret));
+			return (ARCHIVE_FATAL);
+		}
+		/* Zero means a frame was completely decoded and flushed. */
+		if (ret == 0)
+			state->in_frame = 0;
+	}
+
+	*p = state->out_block;
+	return (out.pos);
+}
+
+/*
+ * Clean up the decompressor.
+ */
+static int
+zstd_filter_close(struct archive_read_filter *self)
+{
+	struct private_data *state;
+
+	state = (struct private_data *)self->data;
+	ZSTD_freeDStream(state->dstream);
+	free(state->out_block);
+	free(state);
+	return (ARCHIVE_OK);
+}
+
+#endif /* HAVE_ZSTD_H && HAVE_LIBZSTD */
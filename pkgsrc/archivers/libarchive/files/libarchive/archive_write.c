@@ -452,6 +452,37 @@ _archive_write_finish_entry(struct archive *_a)
 	return (ret);
 }
 
+/*
+ * Finish the current entry and push everything written so far out of
+ * the compressor.  Afterwards, the first archive_position_compressed()
+ * bytes of output decompress to all of the entries written so far.
+ */
+int
+archive_write_flush(struct archive *_a)
+{
+	struct archive_write *a = (struct archive_write *)_a;
+	int ret, r2;
+
+	__archive_check_magic(&a->archive, ARCHIVE_WRITE_MAGIC,
+	    ARCHIVE_STATE_HEADER | ARCHIVE_STATE_DATA, "archive_write_flush");
+	archive_clear_error(&a->archive);
+
+	ret = archive_write_finish_entry(&a->archive);
+	if (ret < ARCHIVE_OK && ret != ARCHIVE_WARN)
+		return (ret);
+
+	if (a->compressor.flush == NULL) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Flushing is not supported by the %s compressor",
+		    a->archive.compression_name);
+		return (ARCHIVE_WARN);
+	}
+	r2 = (a->compressor.flush)(a);
+	if (r2 < ret)
+		ret = r2;
+	return (ret);
+}
+
 /*
  * Note that the compressor is responsible for blocking.
  */
@@ -104,6 +104,13 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write_disk.c 201159 2009-12-29 0
 #ifndef O_BINARY
 #define O_BINARY 0
 #endif
+#ifndef O_DIRECTORY
+#define O_DIRECTORY 0
+#endif
+
+#if defined(HAVE_OPENAT) && defined(HAVE_MKDIRAT) && defined(HAVE_UNLINKAT)
+#define	USE_DIR_FD	1
+#endif
 
 struct fixup_entry {
 	struct fixup_entry	*next;
@@ -119,6 +126,20 @@ struct fixup_entry {
 	char			*name;
 };
 
+/*
+ * With ARCHIVE_EXTRACT_CACHE_DIRS, the directories known to exist,
+ * hashed by name.  A directory keeps its fixup, so that an entry for
+ * a directory created earlier on the way to some file updates that
+ * instead of adding a second one.
+ */
+struct dir_entry {
+	struct dir_entry	*next;
+	struct fixup_entry	*fixup;
+	unsigned		 hash;
+	int			 created; /* We made it, so it held nothing else. */
+	char			 name[1];
+};
+
 /*
  * We use a bitmask to track which operations remain to be done for
  * this file.  In particular, this helps us avoid unnecessary
@@ -201,6 +222,14 @@ struct archive_write_disk {
 	/* UID/GID to use in restoring this entry. */
 	uid_t			 uid;
 	gid_t			 gid;
+	/* Use the dir cache for this entry; not for deep or '..' paths. */
+	int			 cache_dirs;
+	struct dir_entry	**dir_buckets;
+	size_t			 dir_number_buckets;
+	size_t			 dir_number_entries;
+	/* Dir of the last entry, and an open fd for it from the second on. */
+	struct archive_string	 dir_fd_name;
+	int			 dir_fd;
 };
 
 /*
@@ -227,6 +256,15 @@ static void	edit_deep_directories(struct archive_write_disk *ad);
 static int	cleanup_pathname(struct archive_write_disk *);
 static int	create_dir(struct archive_write_disk *, char *);
 static int	create_parent_dir(struct archive_write_disk *, char *);
+static void	dir_cache_clear(struct archive_write_disk *);
+static struct dir_entry *dir_insert(struct archive_write_disk *,
+		    const char *, int created);
+static struct dir_entry *dir_lookup(struct archive_write_disk *,
+		    const char *);
+static struct dir_entry *dir_lookup_parent(struct archive_write_disk *);
+#ifdef USE_DIR_FD
+static int	parent_dir_fd(struct archive_write_disk *, const char **);
+#endif
 static int	older(struct stat *, struct archive_entry *);
 static int	restore_entry(struct archive_write_disk *);
 #ifdef HAVE_POSIX_ACL
@@ -307,6 +345,8 @@ archive_write_disk_set_options(struct archive *_a, int flags)
 	struct archive_write_disk *a = (struct archive_write_disk *)_a;
 
 	a->flags = flags;
+	/* The client may have changed the tree since the last entry. */
+	dir_cache_clear(a);
 	return (ARCHIVE_OK);
 }
 
@@ -359,6 +399,7 @@ _archive_write_header(struct archive *_a, struct archive_entry *entry)
 		a->filesize = -1;
 	archive_strcpy(&(a->_name_data), archive_entry_pathname(a->entry));
 	a->name = a->_name_data.s;
+	a->cache_dirs = (a->flags & ARCHIVE_EXTRACT_CACHE_DIRS) != 0;
 	archive_clear_error(&a->archive);
 
 	/*
@@ -850,6 +891,8 @@ archive_write_disk_new(void)
 #ifdef HAVE_GETEUID
 	a->user_uid = geteuid();
 #endif /* HAVE_GETEUID */
+	a->restore_pwd = -1;
+	a->dir_fd = -1;
 	if (archive_string_ensure(&a->path_safe, 512) == NULL) {
 		free(a);
 		return (NULL);
@@ -904,6 +947,8 @@ edit_deep_directories(struct archive_write_disk *a)
 		tail++;
 		/* The chdir() succeeded; we've now shortened the path. */
 		a->name = tail;
+		/* The dir cache only knows names relative to the start. */
+		a->cache_dirs = 0;
 	}
 	return;
 }
@@ -915,9 +960,34 @@ edit_deep_directories(struct archive_write_disk *a)
 static int
 restore_entry(struct archive_write_disk *a)
 {
-	int ret = ARCHIVE_OK, en;
+	struct dir_entry *de = NULL;
+	int ret = ARCHIVE_OK, en, r;
+#ifdef USE_DIR_FD
+	const char *base;
+	int dfd;
+#endif
 
-	if (a->flags & ARCHIVE_EXTRACT_UNLINK && !S_ISDIR(a->mode)) {
+	if (a->cache_dirs) {
+		/*
+		 * A non-dir can only take the place of a dir we know
+		 * of if that dir is empty.  That's rare enough to just
+		 * start over rather than keep track of what's left.
+		 */
+		if (!S_ISDIR(a->mode) && (dir_lookup(a, a->name) != NULL ||
+		    (a->dir_fd_name.length > 0 &&
+		    strcmp(a->name, a->dir_fd_name.s) == 0)))
+			dir_cache_clear(a);
+		de = dir_lookup_parent(a);
+	}
+
+	/*
+	 * A dir we created holds only what we put there ourselves,
+	 * so there's nothing to unlink; should this entry be a
+	 * duplicate, the EEXIST handling below takes care of it.
+	 */
+	if (a->flags & ARCHIVE_EXTRACT_UNLINK && !S_ISDIR(a->mode) &&
+	    (de == NULL || !de->created || (a->flags &
+	    (ARCHIVE_EXTRACT_NO_OVERWRITE | ARCHIVE_EXTRACT_NO_OVERWRITE_NEWER)))) {
 		/*
 		 * TODO: Fix this.  Apparently, there are platforms
 		 * that still allow root to hose the entire filesystem
@@ -926,7 +996,13 @@ restore_entry(struct archive_write_disk *a)
 		 * object is a dir, but that doesn't mean the old
 		 * object isn't a dir.
 		 */
-		if (unlink(a->name) == 0) {
+#ifdef USE_DIR_FD
+		if ((dfd = parent_dir_fd(a, &base)) >= 0)
+			r = unlinkat(dfd, base, 0);
+		else
+#endif
+			r = unlink(a->name);
+		if (r == 0) {
 			/* We removed it, reset cached stat. */
 			a->pst = NULL;
 		} else if (errno == ENOENT) {
@@ -947,6 +1023,9 @@ restore_entry(struct archive_write_disk *a)
 
 	if ((en == ENOTDIR || en == ENOENT)
 	    && !(a->flags & ARCHIVE_EXTRACT_NO_AUTODIR)) {
+		/* The tree was changed behind our back. */
+		if (de != NULL)
+			dir_cache_clear(a);
 		/* If the parent dir doesn't exist, try creating it. */
 		create_parent_dir(a, a->name);
 		/* Now try to create the object again. */
@@ -1053,6 +1132,8 @@ restore_entry(struct archive_write_disk *a)
 			if ((a->mode != a->st.st_mode)
 			    && (a->todo & TODO_MODE_FORCE))
 				a->deferred |= (a->todo & TODO_MODE);
+			if (a->cache_dirs)
+				dir_insert(a, a->name, 0);
 			/* Ownership doesn't need deferred fixup. */
 			en = 0; /* Forget the EEXIST. */
 		}
@@ -1081,6 +1162,10 @@ create_filesystem_object(struct archive_write_disk *a)
 	const char *linkname;
 	mode_t final_mode, mode;
 	int r;
+#ifdef USE_DIR_FD
+	const char *base;
+	int dfd;
+#endif
 
 	/* We identify hard/symlinks according to the link names. */
 	/* Since link(2) and symlink(2) don't handle modes, we're done here. */
@@ -1142,8 +1227,14 @@ create_filesystem_object(struct archive_write_disk *a)
 		/* POSIX requires that we fall through here. */
 		/* FALLTHROUGH */
 	case AE_IFREG:
-		a->fd = open(a->name,
-		    O_WRONLY | O_CREAT | O_EXCL | O_BINARY, mode);
+#ifdef USE_DIR_FD
+		if ((dfd = parent_dir_fd(a, &base)) >= 0)
+			a->fd = openat(dfd, base,
+			    O_WRONLY | O_CREAT | O_EXCL | O_BINARY, mode);
+		else
+#endif
+			a->fd = open(a->name,
+			    O_WRONLY | O_CREAT | O_EXCL | O_BINARY, mode);
 		r = (a->fd < 0);
 		break;
 	case AE_IFCHR:
@@ -1170,8 +1261,15 @@ create_filesystem_object(struct archive_write_disk *a)
 #endif /* HAVE_MKNOD */
 	case AE_IFDIR:
 		mode = (mode | MINIMUM_DIR_MODE) & MAXIMUM_DIR_MODE;
-		r = mkdir(a->name, mode);
+#ifdef USE_DIR_FD
+		if ((dfd = parent_dir_fd(a, &base)) >= 0)
+			r = mkdirat(dfd, base, mode);
+		else
+#endif
+			r = mkdir(a->name, mode);
 		if (r == 0) {
+			if (a->cache_dirs)
+				dir_insert(a, a->name, 1);
 			/* Defer setting dir times. */
 			a->deferred |= (a->todo & TODO_TIMES);
 			a->todo &= ~TODO_TIMES;
@@ -1238,6 +1336,9 @@ _archive_write_close(struct archive *_a)
 	    "archive_write_disk_close");
 	ret = _archive_write_finish_entry(&a->archive);
 
+	/* The dir entries point into the fixup list. */
+	dir_cache_clear(a);
+
 	/* Sort dir list so directories are fixed up in depth-first order. */
 	p = sort_dir_list(a->fixup_list);
 
@@ -1309,6 +1410,8 @@ _archive_write_finish(struct archive *_a)
 	archive_string_free(&a->_name_data);
 	archive_string_free(&a->archive.error_string);
 	archive_string_free(&a->path_safe);
+	archive_string_free(&a->dir_fd_name);
+	free(a->dir_buckets);
 	free(a);
 	return (ret);
 }
@@ -1405,11 +1508,178 @@ new_fixup(struct archive_write_disk *a, const char *pathname)
 static struct fixup_entry *
 current_fixup(struct archive_write_disk *a, const char *pathname)
 {
-	if (a->current_fixup == NULL)
+	struct dir_entry *de;
+
+	if (a->current_fixup != NULL)
+		return (a->current_fixup);
+	/* Share the fixup of a dir with its earlier appearances. */
+	if (a->cache_dirs && S_ISDIR(a->mode) &&
+	    (de = dir_lookup(a, a->name)) != NULL) {
+		if (de->fixup == NULL)
+			de->fixup = new_fixup(a, pathname);
+		a->current_fixup = de->fixup;
+	} else
 		a->current_fixup = new_fixup(a, pathname);
 	return (a->current_fixup);
 }
 
+/*
+ * The dir cache.  Entries are only added for directories that have
+ * just been created or seen on disk; they are dropped all at once
+ * whenever something suggests the tree isn't what we think it is.
+ */
+static unsigned
+dir_hash(const char *p)
+{
+	unsigned h = 2166136261U;
+
+	/* FNV-1a */
+	while (*p != '\0')
+		h = (h ^ (unsigned char)*p++) * 16777619U;
+	return (h);
+}
+
+static struct dir_entry *
+dir_lookup(struct archive_write_disk *a, const char *path)
+{
+	struct dir_entry *de;
+	unsigned hash;
+
+	if (a->dir_number_entries == 0)
+		return (NULL);
+	hash = dir_hash(path);
+	for (de = a->dir_buckets[hash % a->dir_number_buckets];
+	    de != NULL; de = de->next) {
+		if (de->hash == hash && strcmp(de->name, path) == 0)
+			return (de);
+	}
+	return (NULL);
+}
+
+/*
+ * Returns the cached parent dir of the current entry, if any.
+ */
+static struct dir_entry *
+dir_lookup_parent(struct archive_write_disk *a)
+{
+	struct dir_entry *de;
+	char *slash;
+
+	slash = strrchr(a->name, '/');
+	if (slash == NULL || slash == a->name)
+		return (NULL);
+	*slash = '\0';
+	de = dir_lookup(a, a->name);
+	*slash = '/';
+	return (de);
+}
+
+static struct dir_entry *
+dir_insert(struct archive_write_disk *a, const char *path, int created)
+{
+	struct dir_entry *de, **new_buckets;
+	size_t i, len, new_size;
+
+	if ((de = dir_lookup(a, path)) != NULL)
+		return (de);
+
+	/* Keep the chains short; if we can't grow, live with it. */
+	if (a->dir_number_entries >= a->dir_number_buckets) {
+		new_size = a->dir_number_buckets ?
+		    a->dir_number_buckets * 2 : 256;
+		new_buckets = calloc(new_size, sizeof(*new_buckets));
+		if (new_buckets != NULL) {
+			for (i = 0; i < a->dir_number_buckets; i++) {
+				while ((de = a->dir_buckets[i]) != NULL) {
+					a->dir_buckets[i] = de->next;
+					de->next =
+					    new_buckets[de->hash % new_size];
+					new_buckets[de->hash % new_size] = de;
+				}
+			}
+			free(a->dir_buckets);
+			a->dir_buckets = new_buckets;
+			a->dir_number_buckets = new_size;
+		} else if (a->dir_number_buckets == 0)
+			return (NULL);
+	}
+
+	len = strlen(path);
+	de = malloc(sizeof(*de) + len);
+	if (de == NULL)
+		return (NULL);
+	memcpy(de->name, path, len + 1);
+	de->hash = dir_hash(path);
+	de->created = created;
+	de->fixup = NULL;
+	i = de->hash % a->dir_number_buckets;
+	de->next = a->dir_buckets[i];
+	a->dir_buckets[i] = de;
+	a->dir_number_entries++;
+	return (de);
+}
+
+static void
+dir_cache_clear(struct archive_write_disk *a)
+{
+	struct dir_entry *de;
+	size_t i;
+
+	for (i = 0; a->dir_number_entries > 0; i++) {
+		while ((de = a->dir_buckets[i]) != NULL) {
+			a->dir_buckets[i] = de->next;
+			free(de);
+			a->dir_number_entries--;
+		}
+	}
+	if (a->dir_fd >= 0) {
+		close(a->dir_fd);
+		a->dir_fd = -1;
+	}
+	archive_string_empty(&a->dir_fd_name);
+}
+
+#ifdef USE_DIR_FD
+/*
+ * Returns an fd for the dir holding the current entry and points
+ * *base at the last element of its name, or returns -1 if the entry
+ * should be created by its full name.  The fd is opened only when a
+ * second entry in a row goes to the same dir, so that dirs holding
+ * a single file don't cost an extra open() and close().
+ */
+static int
+parent_dir_fd(struct archive_write_disk *a, const char **base)
+{
+	char *slash;
+	size_t len;
+
+	if (!a->cache_dirs)
+		return (-1);
+	slash = strrchr(a->name, '/');
+	if (slash == NULL || slash == a->name)
+		return (-1);
+	len = slash - a->name;
+	if (a->dir_fd_name.length != len ||
+	    memcmp(a->dir_fd_name.s, a->name, len) != 0) {
+		if (a->dir_fd >= 0) {
+			close(a->dir_fd);
+			a->dir_fd = -1;
+		}
+		archive_strncpy(&a->dir_fd_name, a->name, len);
+		return (-1);
+	}
+	if (a->dir_fd < 0) {
+		*slash = '\0';
+		a->dir_fd = open(a->name, O_RDONLY | O_DIRECTORY | O_BINARY);
+		*slash = '/';
+		if (a->dir_fd < 0)
+			return (-1);
+	}
+	*base = slash + 1;
+	return (a->dir_fd);
+}
+#endif
+
 /* TODO: Make this work. */
 /*
  * TODO: The deep-directory support bypasses this; disable deep directory
@@ -1608,6 +1878,8 @@ cleanup_pathname(struct archive_write_disk *a)
 				continue;
 			} else if (src[1] == '.') {
 				if (src[2] == '/' || src[2] == '\0') {
+					/* '..' makes names ambiguous. */
+					a->cache_dirs = 0;
 					/* Conditionally warn about '..' */
 					if (a->flags & ARCHIVE_EXTRACT_SECURE_NODOTDOT) {
 						archive_set_error(&a->archive,
@@ -1690,6 +1962,7 @@ create_dir(struct archive_write_disk *a, char *path)
 {
 	struct stat st;
 	struct fixup_entry *le;
+	struct dir_entry *de;
 	char *slash, *base;
 	mode_t mode_final, mode;
 	int r;
@@ -1714,14 +1987,20 @@ create_dir(struct archive_write_disk *a, char *path)
 		return (ARCHIVE_OK);
 	}
 
+	if (a->cache_dirs && dir_lookup(a, path) != NULL)
+		return (ARCHIVE_OK);
+
 	/*
 	 * Yes, this should be stat() and not lstat().  Using lstat()
 	 * here loses the ability to extract through symlinks.  Also note
 	 * that this should not use the a->st cache.
 	 */
 	if (stat(path, &st) == 0) {
-		if (S_ISDIR(st.st_mode))
+		if (S_ISDIR(st.st_mode)) {
+			if (a->cache_dirs)
+				dir_insert(a, path, 0);
 			return (ARCHIVE_OK);
+		}
 		if ((a->flags & ARCHIVE_EXTRACT_NO_OVERWRITE)) {
 			archive_set_error(&a->archive, EEXIST,
 			    "Can't create directory '%s'", path);
@@ -1759,11 +2038,14 @@ create_dir(struct archive_write_disk *a, char *path)
 	mode |= MINIMUM_DIR_MODE;
 	mode &= MAXIMUM_DIR_MODE;
 	if (mkdir(path, mode) == 0) {
+		le = NULL;
 		if (mode != mode_final) {
 			le = new_fixup(a, path);
 			le->fixup |=TODO_MODE_BASE;
 			le->mode = mode_final;
 		}
+		if (a->cache_dirs && (de = dir_insert(a, path, 1)) != NULL)
+			de->fixup = le;
 		return (ARCHIVE_OK);
 	}
 
@@ -85,6 +85,7 @@ struct archive_write {
 			    const char *key, const char *value);
 		int	(*finish)(struct archive_write *);
 		int	(*write)(struct archive_write *, const void *, size_t);
+		int	(*flush)(struct archive_write *);
 	} compressor;
 
 	/*
@@ -37,9 +37,15 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write_set_compression_gzip.c 201
 #include <string.h>
 #endif
 #include <time.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 #ifdef HAVE_ZLIB_H
 #include <zlib.h>
 #endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #include "archive.h"
 #include "archive_private.h"
@@ -56,16 +62,62 @@ archive_write_set_compression_gzip(struct archive *a)
 #else
 /* Don't compile this if we don't have zlib. */
 
+#ifdef HAVE_PTHREAD_H
+/*
+ * With compression-threads > 1, the input is cut into blocks which
+ * are deflated independently by a pool of worker threads, like pigz
+ * does.  Every block but the last ends with a sync flush, so the
+ * compressed blocks simply concatenate into a single deflate stream.
+ * Each block is primed with the last 32k of the preceding input, so
+ * the ratio stays close to that of a single stream.  The output only
+ * depends on the block size, not on the number of threads.
+ */
+#define	GZIP_MT_BLOCK	(128 * 1024)
+#define	GZIP_MT_DICT	(32 * 1024)
+
+struct gzip_job {
+	struct gzip_job	*next;		/* output or free list */
+	struct gzip_job	*work_next;	/* work list */
+	unsigned char	 in[GZIP_MT_BLOCK];
+	size_t		 in_len;
+	unsigned char	 dict[GZIP_MT_DICT];
+	size_t		 dict_len;
+	unsigned char	*out;
+	size_t		 out_len;
+	size_t		 out_size;
+	int		 last;
+	int		 status;	/* 0 pending, 1 done, else zlib error */
+};
+#endif
+
 struct private_data {
 	z_stream	 stream;
 	int64_t		 total_in;
 	unsigned char	*compressed;
 	size_t		 compressed_buffer_size;
 	unsigned long	 crc;
+#ifdef HAVE_PTHREAD_H
+	int		 threads;
+	int		 level;
+	pthread_t	*workers;
+	int		 nworkers;
+	pthread_mutex_t	 lock;
+	pthread_cond_t	 work_cond;
+	pthread_cond_t	 done_cond;
+	int		 shutdown;
+	struct gzip_job	*work_head, **work_tail;	/* to be deflated */
+	struct gzip_job	*out_head, **out_tail;		/* to be written */
+	struct gzip_job	*free_jobs;
+	struct gzip_job	*cur;				/* being filled */
+	int		 njobs;
+	unsigned char	 dict[GZIP_MT_DICT];
+	size_t		 dict_len;
+#endif
 };
 
 struct private_config {
 	int		 compression_level;
+	int		 threads;
 };
 
 
@@ -77,13 +129,25 @@ struct private_config {
 	(st)->stream.next_in = (Bytef *)(uintptr_t)(const void *)(src)
 
 static int	archive_compressor_gzip_finish(struct archive_write *);
+static int	archive_compressor_gzip_flush(struct archive_write *);
 static int	archive_compressor_gzip_init(struct archive_write *);
 static int	archive_compressor_gzip_options(struct archive_write *,
 		    const char *, const char *);
 static int	archive_compressor_gzip_write(struct archive_write *,
 		    const void *, size_t);
+static int	compress_data(struct archive_write *, struct private_data *,
+		    const void *, size_t);
 static int	drive_compressor(struct archive_write *, struct private_data *,
-		    int finishing);
+		    int flush);
+static int	flush_block(struct archive_write *, struct private_data *);
+#ifdef HAVE_PTHREAD_H
+static int	mt_init(struct archive_write *, struct private_data *);
+static int	mt_write(struct archive_write *, struct private_data *,
+		    const void *, size_t);
+static int	mt_flush(struct archive_write *, struct private_data *);
+static int	mt_finish(struct archive_write *, struct private_data *);
+static void	mt_end(struct private_data *);
+#endif
 
 
 /*
@@ -104,6 +168,7 @@ archive_write_set_compression_gzip(struct archive *_a)
 	a->compressor.config = config;
 	a->compressor.finish = &archive_compressor_gzip_finish;
 	config->compression_level = Z_DEFAULT_COMPRESSION;
+	config->threads = 1;
 	a->compressor.init = &archive_compressor_gzip_init;
 	a->compressor.options = &archive_compressor_gzip_options;
 	a->archive.compression_code = ARCHIVE_COMPRESSION_GZIP;
@@ -187,6 +252,21 @@ archive_compressor_gzip_init(struct archive_write *a)
 	state->stream.avail_out -= 10;
 
 	a->compressor.write = archive_compressor_gzip_write;
+	a->compressor.flush = archive_compressor_gzip_flush;
+
+#ifdef HAVE_PTHREAD_H
+	if (config->threads > 1) {
+		state->threads = config->threads;
+		state->level = config->compression_level;
+		if (mt_init(a, state) == ARCHIVE_OK) {
+			a->compressor.data = state;
+			return (0);
+		}
+		free(state->compressed);
+		free(state);
+		return (ARCHIVE_FATAL);
+	}
+#endif
 
 	/* Initialize compression library. */
 	ret = deflateInit2(&(state->stream),
@@ -245,6 +325,19 @@ archive_compressor_gzip_options(struct archive_write *a, const char *key,
 		config->compression_level = value[0] - '0';
 		return (ARCHIVE_OK);
 	}
+	if (strcmp(key, "compression-threads") == 0) {
+		if (value == NULL || !(value[0] >= '0' && value[0] <= '9'))
+			return (ARCHIVE_WARN);
+		config->threads = atoi(value);
+		/* 0 means one thread per online CPU. */
+#ifdef _SC_NPROCESSORS_ONLN
+		if (config->threads == 0)
+			config->threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		if (config->threads < 1)
+			config->threads = 1;
+		return (ARCHIVE_OK);
+	}
 
 	return (ARCHIVE_WARN);
 }
@@ -272,15 +365,50 @@ archive_compressor_gzip_write(struct archive_write *a, const void *buff,
 	state->total_in += length;
 
 	/* Compress input data to output buffer */
-	SET_NEXT_IN(state, buff);
-	state->stream.avail_in = length;
-	if ((ret = drive_compressor(a, state, 0)) != ARCHIVE_OK)
+	if ((ret = compress_data(a, state, buff, length)) != ARCHIVE_OK)
 		return (ret);
 
 	a->archive.file_position += length;
 	return (ARCHIVE_OK);
 }
 
+/*
+ * End the current deflate block and write out the partial output
+ * block, so that all input so far can be decompressed.
+ */
+static int
+archive_compressor_gzip_flush(struct archive_write *a)
+{
+	ssize_t block_length, bytes_written;
+	struct private_data *state;
+	int ret;
+
+	state = (struct private_data *)a->compressor.data;
+#ifdef HAVE_PTHREAD_H
+	if (state->threads > 1)
+		ret = mt_flush(a, state);
+	else
+#endif
+		ret = drive_compressor(a, state, Z_SYNC_FLUSH);
+	if (ret != ARCHIVE_OK)
+		return (ret);
+
+	block_length = state->stream.next_out - state->compressed;
+	while (block_length > 0) {
+		bytes_written = (a->client_writer)(&a->archive,
+		    a->client_data, state->compressed, block_length);
+		if (bytes_written <= 0)
+			return (ARCHIVE_FATAL);
+		a->archive.raw_position += bytes_written;
+		block_length -= bytes_written;
+		memmove(state->compressed, state->compressed + bytes_written,
+		    block_length);
+	}
+	state->stream.next_out = state->compressed;
+	state->stream.avail_out = state->compressed_buffer_size;
+	return (ARCHIVE_OK);
+}
+
 /*
  * Finish the compression...
  */
@@ -310,21 +438,25 @@ archive_compressor_gzip_finish(struct archive_write *a)
 			tocopy = a->bytes_per_block -
 			    (state->total_in % a->bytes_per_block);
 			while (tocopy > 0 && tocopy < (unsigned)a->bytes_per_block) {
-				SET_NEXT_IN(state, a->nulls);
-				state->stream.avail_in = tocopy < a->null_length ?
+				size_t n = tocopy < a->null_length ?
 				    tocopy : a->null_length;
-				state->crc = crc32(state->crc, a->nulls,
-				    state->stream.avail_in);
-				state->total_in += state->stream.avail_in;
-				tocopy -= state->stream.avail_in;
-				ret = drive_compressor(a, state, 0);
+				state->crc = crc32(state->crc, a->nulls, n);
+				state->total_in += n;
+				tocopy -= n;
+				ret = compress_data(a, state, a->nulls, n);
 				if (ret != ARCHIVE_OK)
 					goto cleanup;
 			}
 		}
 
 		/* Finish compression cycle */
-		if (((ret = drive_compressor(a, state, 1))) != ARCHIVE_OK)
+#ifdef HAVE_PTHREAD_H
+		if (state->threads > 1)
+			ret = mt_finish(a, state);
+		else
+#endif
+			ret = drive_compressor(a, state, Z_FINISH);
+		if (ret != ARCHIVE_OK)
 			goto cleanup;
 
 		/* Build trailer: 4-byte CRC and 4-byte length. */
@@ -392,6 +524,11 @@ archive_compressor_gzip_finish(struct archive_write *a)
 
 		/* Cleanup: shut down compressor, release memory, etc. */
 	cleanup:
+#ifdef HAVE_PTHREAD_H
+		if (state->threads > 1)
+			mt_end(state);
+		else
+#endif
 		switch (deflateEnd(&(state->stream))) {
 		case Z_OK:
 			break;
@@ -409,57 +546,97 @@ archive_compressor_gzip_finish(struct archive_write *a)
 	return (ret);
 }
 
+/*
+ * Hand uncompressed data to the compressor.
+ */
+static int
+compress_data(struct archive_write *a, struct private_data *state,
+    const void *buff, size_t length)
+{
+#ifdef HAVE_PTHREAD_H
+	if (state->threads > 1)
+		return (mt_write(a, state, buff, length));
+#endif
+	SET_NEXT_IN(state, buff);
+	state->stream.avail_in = length;
+	return (drive_compressor(a, state, Z_NO_FLUSH));
+}
+
+/*
+ * Write out the output block once it is full.
+ */
+static int
+flush_block(struct archive_write *a, struct private_data *state)
+{
+	ssize_t bytes_written;
+
+	if (state->stream.avail_out != 0)
+		return (ARCHIVE_OK);
+	bytes_written = (a->client_writer)(&a->archive,
+	    a->client_data, state->compressed,
+	    state->compressed_buffer_size);
+	if (bytes_written <= 0) {
+		/* TODO: Handle this write failure */
+		return (ARCHIVE_FATAL);
+	} else if ((size_t)bytes_written < state->compressed_buffer_size) {
+		/* Short write: Move remaining to
+		 * front of block and keep filling */
+		memmove(state->compressed,
+		    state->compressed + bytes_written,
+		    state->compressed_buffer_size - bytes_written);
+	}
+	a->archive.raw_position += bytes_written;
+	state->stream.next_out
+	    = state->compressed +
+	    state->compressed_buffer_size - bytes_written;
+	state->stream.avail_out = bytes_written;
+	return (ARCHIVE_OK);
+}
+
 /*
  * Utility function to push input data through compressor,
  * writing full output blocks as necessary.
  *
- * Note that this handles both the regular write case (finishing ==
- * false) and the end-of-archive case (finishing == true).
+ * Note that this handles the regular write case (Z_NO_FLUSH), the
+ * flush case (Z_SYNC_FLUSH) and the end-of-archive case (Z_FINISH).
  */
 static int
-drive_compressor(struct archive_write *a, struct private_data *state, int finishing)
+drive_compressor(struct archive_write *a, struct private_data *state, int flush)
 {
-	ssize_t bytes_written;
 	int ret;
 
 	for (;;) {
-		if (state->stream.avail_out == 0) {
-			bytes_written = (a->client_writer)(&a->archive,
-			    a->client_data, state->compressed,
-			    state->compressed_buffer_size);
-			if (bytes_written <= 0) {
-				/* TODO: Handle this write failure */
-				return (ARCHIVE_FATAL);
-			} else if ((size_t)bytes_written < state->compressed_buffer_size) {
-				/* Short write: Move remaining to
-				 * front of block and keep filling */
-				memmove(state->compressed,
-				    state->compressed + bytes_written,
-				    state->compressed_buffer_size - bytes_written);
-			}
-			a->archive.raw_position += bytes_written;
-			state->stream.next_out
-			    = state->compressed +
-			    state->compressed_buffer_size - bytes_written;
-			state->stream.avail_out = bytes_written;
-		}
+		if (flush_block(a, state) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
 
 		/* If there's nothing to do, we're done. */
-		if (!finishing && state->stream.avail_in == 0)
+		if (flush == Z_NO_FLUSH && state->stream.avail_in == 0)
 			return (ARCHIVE_OK);
 
-		ret = deflate(&(state->stream),
-		    finishing ? Z_FINISH : Z_NO_FLUSH );
+		ret = deflate(&(state->stream), flush);
 
 		switch (ret) {
 		case Z_OK:
 			/* In non-finishing case, check if compressor
 			 * consumed everything */
-			if (!finishing && state->stream.avail_in == 0)
+			if (flush == Z_NO_FLUSH && state->stream.avail_in == 0)
+				return (ARCHIVE_OK);
+			/* A flush is done once there is room left over. */
+			if (flush == Z_SYNC_FLUSH &&
+			    state->stream.avail_out != 0)
 				return (ARCHIVE_OK);
 			/* In finishing case, this return always means
 			 * there's more work */
 			break;
+		case Z_BUF_ERROR:
+			/* Nothing new since the last flush. */
+			if (flush == Z_SYNC_FLUSH)
+				return (ARCHIVE_OK);
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "GZip compression failed:"
+			    " deflate() call returned status %d",
+			    ret);
+			return (ARCHIVE_FATAL);
 		case Z_STREAM_END:
 			/* This return can only occur in finishing case. */
 			return (ARCHIVE_OK);
@@ -474,4 +651,347 @@ drive_compressor(struct archive_write *a, struct private_data *state, int finish
 	}
 }
 
+#ifdef HAVE_PTHREAD_H
+/*
+ * Deflate one block.  Runs in a worker thread, with a raw deflate
+ * stream owned by the worker.
+ */
+static int
+mt_deflate(z_stream *stream, struct gzip_job *job)
+{
+	unsigned char *p;
+	size_t size;
+	int ret;
+
+	if (deflateReset(stream) != Z_OK)
+		return (Z_STREAM_ERROR);
+	if (job->dict_len > 0 &&
+	    deflateSetDictionary(stream, job->dict, job->dict_len) != Z_OK)
+		return (Z_STREAM_ERROR);
+
+	/* Room for the sync flush marker and some slack. */
+	size = deflateBound(stream, job->in_len) + 16;
+	if (job->out_size < size) {
+		if ((p = realloc(job->out, size)) == NULL)
+			return (Z_MEM_ERROR);
+		job->out = p;
+		job->out_size = size;
+	}
+	stream->next_in = job->in;
+	stream->avail_in = job->in_len;
+	stream->next_out = job->out;
+	stream->avail_out = job->out_size;
+	for (;;) {
+		ret = deflate(stream, job->last ? Z_FINISH : Z_SYNC_FLUSH);
+		if (ret == Z_STREAM_END ||
+		    (ret == Z_OK && !job->last && stream->avail_out != 0))
+			break;
+		if (ret != Z_OK && ret != Z_BUF_ERROR)
+			return (ret);
+		/* Output buffer too small after all. */
+		size = job->out_size * 2;
+		if ((p = realloc(job->out, size)) == NULL)
+			return (Z_MEM_ERROR);
+		job->out = p;
+		stream->next_out = job->out + job->out_size;
+		stream->avail_out = size - job->out_size;
+		job->out_size = size;
+	}
+	job->out_len = job->out_size - stream->avail_out;
+	return (Z_OK);
+}
+
+static void *
+mt_worker(void *arg)
+{
+	struct private_data *state = arg;
+	struct gzip_job *job;
+	z_stream stream;
+	int ret, status;
+
+	memset(&stream, 0, sizeof(stream));
+	ret = deflateInit2(&stream, state->level, Z_DEFLATED, -15, 8,
+	    Z_DEFAULT_STRATEGY);
+
+	pthread_mutex_lock(&state->lock);
+	for (;;) {
+		while (state->work_head == NULL && !state->shutdown)
+			pthread_cond_wait(&state->work_cond, &state->lock);
+		if ((job = state->work_head) == NULL)
+			break;
+		if ((state->work_head = job->work_next) == NULL)
+			state->work_tail = &state->work_head;
+		pthread_mutex_unlock(&state->lock);
+
+		status = ret == Z_OK ? mt_deflate(&stream, job) : ret;
+
+		pthread_mutex_lock(&state->lock);
+		job->status = status == Z_OK ? 1 : status;
+		pthread_cond_broadcast(&state->done_cond);
+	}
+	pthread_mutex_unlock(&state->lock);
+
+	if (ret == Z_OK)
+		deflateEnd(&stream);
+	return (NULL);
+}
+
+static int
+mt_init(struct archive_write *a, struct private_data *state)
+{
+	int i, r = 0;
+
+	state->workers = calloc(state->threads, sizeof(*state->workers));
+	if (state->workers == NULL) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate data for compression");
+		return (ARCHIVE_FATAL);
+	}
+	pthread_mutex_init(&state->lock, NULL);
+	pthread_cond_init(&state->work_cond, NULL);
+	pthread_cond_init(&state->done_cond, NULL);
+	state->work_tail = &state->work_head;
+	state->out_tail = &state->out_head;
+	for (i = 0; i < state->threads; i++) {
+		if ((r = pthread_create(&state->workers[i], NULL, mt_worker,
+		    state)) != 0)
+			break;
+		state->nworkers++;
+	}
+	if (state->nworkers == 0) {
+		archive_set_error(&a->archive, r,
+		    "Can't start compression threads");
+		mt_end(state);
+		return (ARCHIVE_FATAL);
+	}
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Copy the output of a finished block into the output buffer.
+ */
+static int
+mt_output(struct archive_write *a, struct private_data *state,
+    struct gzip_job *job)
+{
+	const unsigned char *p;
+	size_t len, n;
+
+	if (job->status != 1) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "GZip compression failed:"
+		    " deflate() call returned status %d", job->status);
+		return (ARCHIVE_FATAL);
+	}
+	p = job->out;
+	len = job->out_len;
+	while (len > 0) {
+		if (flush_block(a, state) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+		n = len < state->stream.avail_out ?
+		    len : state->stream.avail_out;
+		memcpy(state->stream.next_out, p, n);
+		state->stream.next_out += n;
+		state->stream.avail_out -= n;
+		p += n;
+		len -= n;
+	}
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Write the blocks which are done, in order.  With wait, block
+ * until at least the first one is done.
+ */
+static int
+mt_collect(struct archive_write *a, struct private_data *state, int wait)
+{
+	struct gzip_job *job;
+	int ret = ARCHIVE_OK;
+
+	pthread_mutex_lock(&state->lock);
+	while ((job = state->out_head) != NULL) {
+		while (job->status == 0 && wait)
+			pthread_cond_wait(&state->done_cond, &state->lock);
+		if (job->status == 0)
+			break;
+		if ((state->out_head = job->next) == NULL)
+			state->out_tail = &state->out_head;
+		state->njobs--;
+		pthread_mutex_unlock(&state->lock);
+
+		ret = mt_output(a, state, job);
+		job->next = state->free_jobs;
+		state->free_jobs = job;
+
+		pthread_mutex_lock(&state->lock);
+		if (ret != ARCHIVE_OK)
+			break;
+		wait = 0;
+	}
+	pthread_mutex_unlock(&state->lock);
+	return (ret);
+}
+
+/*
+ * Queue the current block for the workers.
+ */
+static void
+mt_submit(struct private_data *state, int last)
+{
+	struct gzip_job *job = state->cur;
+
+	job->last = last;
+
+	/* Keep the end of the input as dictionary for the next block. */
+	if (job->in_len >= GZIP_MT_DICT) {
+		memcpy(state->dict, job->in + job->in_len - GZIP_MT_DICT,
+		    GZIP_MT_DICT);
+		state->dict_len = GZIP_MT_DICT;
+	} else {
+		if (state->dict_len + job->in_len > GZIP_MT_DICT) {
+			memmove(state->dict, state->dict +
+			    (state->dict_len + job->in_len - GZIP_MT_DICT),
+			    GZIP_MT_DICT - job->in_len);
+			state->dict_len = GZIP_MT_DICT - job->in_len;
+		}
+		memcpy(state->dict + state->dict_len, job->in, job->in_len);
+		state->dict_len += job->in_len;
+	}
+
+	pthread_mutex_lock(&state->lock);
+	job->work_next = NULL;
+	*state->work_tail = job;
+	state->work_tail = &job->work_next;
+	pthread_cond_signal(&state->work_cond);
+	pthread_mutex_unlock(&state->lock);
+	state->cur = NULL;
+}
+
+/*
+ * Start a new block.  The number of blocks in flight is bounded, so
+ * wait for the oldest one to be written out if necessary.
+ */
+static int
+mt_next(struct archive_write *a, struct private_data *state)
+{
+	struct gzip_job *job;
+
+	if (state->njobs >= 2 * state->nworkers &&
+	    mt_collect(a, state, 1) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+	if ((job = state->free_jobs) != NULL)
+		state->free_jobs = job->next;
+	else if ((job = calloc(1, sizeof(*job))) == NULL) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate data for compression");
+		return (ARCHIVE_FATAL);
+	}
+	job->in_len = 0;
+	memcpy(job->dict, state->dict, state->dict_len);
+	job->dict_len = state->dict_len;
+
+	/* The output list keeps the order of the input. */
+	job->next = NULL;
+	pthread_mutex_lock(&state->lock);
+	job->status = 0;
+	*state->out_tail = job;
+	state->out_tail = &job->next;
+	pthread_mutex_unlock(&state->lock);
+	state->njobs++;
+	state->cur = job;
+	return (ARCHIVE_OK);
+}
+
+static int
+mt_write(struct archive_write *a, struct private_data *state,
+    const void *buff, size_t length)
+{
+	const unsigned char *p = buff;
+	size_t n;
+
+	while (length > 0) {
+		if (state->cur == NULL && mt_next(a, state) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+		n = GZIP_MT_BLOCK - state->cur->in_len;
+		if (n > length)
+			n = length;
+		memcpy(state->cur->in + state->cur->in_len, p, n);
+		state->cur->in_len += n;
+		p += n;
+		length -= n;
+		if (state->cur->in_len == GZIP_MT_BLOCK) {
+			mt_submit(state, 0);
+			if (mt_collect(a, state, 0) != ARCHIVE_OK)
+				return (ARCHIVE_FATAL);
+		}
+	}
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Queue the current block early and wait for everything queued to be
+ * written.  The block ends with a sync flush like all others.
+ */
+static int
+mt_flush(struct archive_write *a, struct private_data *state)
+{
+	if (state->cur != NULL && state->cur->in_len > 0)
+		mt_submit(state, 0);
+	/* An empty current block is never queued; don't wait for it. */
+	while (state->out_head != NULL && state->out_head != state->cur)
+		if (mt_collect(a, state, 1) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+	return (ARCHIVE_OK);
+}
+
+static int
+mt_finish(struct archive_write *a, struct private_data *state)
+{
+	/* The last block ends the deflate stream, even if empty. */
+	if (state->cur == NULL && mt_next(a, state) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+	mt_submit(state, 1);
+	while (state->out_head != NULL)
+		if (mt_collect(a, state, 1) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Stop the workers and release the blocks.
+ */
+static void
+mt_end(struct private_data *state)
+{
+	struct gzip_job *job;
+	int i;
+
+	pthread_mutex_lock(&state->lock);
+	state->shutdown = 1;
+	/* Abandoned blocks are not deflated anymore. */
+	state->work_head = NULL;
+	state->work_tail = &state->work_head;
+	pthread_cond_broadcast(&state->work_cond);
+	pthread_mutex_unlock(&state->lock);
+	for (i = 0; i < state->nworkers; i++)
+		pthread_join(state->workers[i], NULL);
+	free(state->workers);
+
+	while ((job = state->out_head) != NULL) {
+		state->out_head = job->next;
+		free(job->out);
+		free(job);
+	}
+	while ((job = state->free_jobs) != NULL) {
+		state->free_jobs = job->next;
+		free(job->out);
+		free(job);
+	}
+	pthread_mutex_destroy(&state->lock);
+	pthread_cond_destroy(&state->work_cond);
+	pthread_cond_destroy(&state->done_cond);
+}
+#endif /* HAVE_PTHREAD_H */
+
 #endif /* HAVE_ZLIB_H */
@@ -41,6 +41,7 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write_set_compression_none.c 201
 #include "archive_write_private.h"
 
 static int	archive_compressor_none_finish(struct archive_write *a);
+static int	archive_compressor_none_flush(struct archive_write *);
 static int	archive_compressor_none_init(struct archive_write *);
 static int	archive_compressor_none_write(struct archive_write *,
 		    const void *, size_t);
@@ -104,6 +105,7 @@ archive_compressor_none_init(struct archive_write *a)
 
 	a->compressor.data = state;
 	a->compressor.write = archive_compressor_none_write;
+	a->compressor.flush = archive_compressor_none_flush;
 	a->compressor.finish = archive_compressor_none_finish;
 	return (ARCHIVE_OK);
 }
@@ -197,6 +199,32 @@ archive_compressor_none_write(struct archive_write *a, const void *vbuff,
 	return (ARCHIVE_OK);
 }
 
+/*
+ * Write out the partial block, without padding.
+ */
+static int
+archive_compressor_none_flush(struct archive_write *a)
+{
+	ssize_t block_length;
+	ssize_t bytes_written;
+	struct archive_none *state;
+
+	state = (struct archive_none *)a->compressor.data;
+	block_length = state->next - state->buffer;
+	while (block_length > 0) {
+		bytes_written = (a->client_writer)(&a->archive,
+		    a->client_data, state->buffer, block_length);
+		if (bytes_written <= 0)
+			return (ARCHIVE_FATAL);
+		a->archive.raw_position += bytes_written;
+		block_length -= bytes_written;
+		memmove(state->buffer, state->buffer + bytes_written,
+		    block_length);
+	}
+	state->next = state->buffer;
+	state->avail = state->buffer_size;
+	return (ARCHIVE_OK);
+}
 
 /*
  * Finish the compression.
@@ -38,6 +38,9 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write_set_compression_xz.c 20110
 #include <string.h>
 #endif
 #include <time.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 #ifdef HAVE_LZMA_H
 #include <lzma.h>
 #endif
@@ -72,20 +75,23 @@ struct private_data {
 	int64_t		 total_in;
 	unsigned char	*compressed;
 	size_t		 compressed_buffer_size;
+	int		 threads;
 };
 
 struct private_config {
 	int		 compression_level;
+	int		 threads;
 };
 
 static int	archive_compressor_xz_init(struct archive_write *);
 static int	archive_compressor_xz_options(struct archive_write *,
 		    const char *, const char *);
 static int	archive_compressor_xz_finish(struct archive_write *);
+static int	archive_compressor_xz_flush(struct archive_write *);
 static int	archive_compressor_xz_write(struct archive_write *,
 		    const void *, size_t);
 static int	drive_compressor(struct archive_write *, struct private_data *,
-		    int finishing);
+		    lzma_action action);
 
 
 /*
@@ -106,6 +112,7 @@ archive_write_set_compression_xz(struct archive *_a)
 	a->compressor.config = config;
 	a->compressor.finish = archive_compressor_xz_finish;
 	config->compression_level = LZMA_PRESET_DEFAULT;
+	config->threads = 1;
 	a->compressor.init = &archive_compressor_xz_init;
 	a->compressor.options = &archive_compressor_xz_options;
 	a->archive.compression_code = ARCHIVE_COMPRESSION_XZ;
@@ -137,6 +144,23 @@ archive_compressor_xz_init_stream(struct archive_write *a,
 	state->stream = (lzma_stream)LZMA_STREAM_INIT;
 	state->stream.next_out = state->compressed;
 	state->stream.avail_out = state->compressed_buffer_size;
+#ifdef HAVE_LZMA_STREAM_ENCODER_MT
+	if (a->archive.compression_code == ARCHIVE_COMPRESSION_XZ &&
+	    state->threads > 1) {
+		lzma_mt mt;
+
+		/*
+		 * The input is split into independent blocks of three
+		 * times the dictionary size, each compressed by one of
+		 * the threads.  The blocks end up in a single .xz stream.
+		 */
+		memset(&mt, 0, sizeof(mt));
+		mt.threads = state->threads;
+		mt.filters = state->lzmafilters;
+		mt.check = LZMA_CHECK_CRC64;
+		ret = lzma_stream_encoder_mt(&(state->stream), &mt);
+	} else
+#endif
 	if (a->archive.compression_code == ARCHIVE_COMPRESSION_XZ)
 		ret = lzma_stream_encoder(&(state->stream),
 		    state->lzmafilters, LZMA_CHECK_CRC64);
@@ -184,6 +208,7 @@ archive_compressor_xz_init(struct archive_write *a)
 	}
 	memset(state, 0, sizeof(*state));
 	config = a->compressor.config;
+	state->threads = config->threads;
 
 	/*
 	 * See comment above.  We should set compressed_buffer_size to
@@ -198,6 +223,9 @@ archive_compressor_xz_init(struct archive_write *a)
 		return (ARCHIVE_FATAL);
 	}
 	a->compressor.write = archive_compressor_xz_write;
+	/* The .lzma format has no way to end a block early. */
+	if (a->archive.compression_code == ARCHIVE_COMPRESSION_XZ)
+		a->compressor.flush = archive_compressor_xz_flush;
 
 	/* Initialize compression library. */
 	if (lzma_lzma_preset(&state->lzma_opt, config->compression_level)) {
@@ -240,6 +268,19 @@ archive_compressor_xz_options(struct archive_write *a, const char *key,
 			config->compression_level = 6;
 		return (ARCHIVE_OK);
 	}
+	if (strcmp(key, "compression-threads") == 0) {
+		if (value == NULL || !(value[0] >= '0' && value[0] <= '9'))
+			return (ARCHIVE_WARN);
+		config->threads = atoi(value);
+		/* 0 means one thread per online CPU. */
+#ifdef _SC_NPROCESSORS_ONLN
+		if (config->threads == 0)
+			config->threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		if (config->threads < 1)
+			config->threads = 1;
+		return (ARCHIVE_OK);
+	}
 
 	return (ARCHIVE_WARN);
 }
@@ -268,13 +309,44 @@ archive_compressor_xz_write(struct archive_write *a, const void *buff,
 	/* Compress input data to output buffer */
 	state->stream.next_in = buff;
 	state->stream.avail_in = length;
-	if ((ret = drive_compressor(a, state, 0)) != ARCHIVE_OK)
+	if ((ret = drive_compressor(a, state, LZMA_RUN)) != ARCHIVE_OK)
 		return (ret);
 
 	a->archive.file_position += length;
 	return (ARCHIVE_OK);
 }
 
+/*
+ * End the current xz block and write out the partial output block,
+ * so that all input so far can be decompressed.
+ */
+static int
+archive_compressor_xz_flush(struct archive_write *a)
+{
+	ssize_t block_length, bytes_written;
+	struct private_data *state;
+	int ret;
+
+	state = (struct private_data *)a->compressor.data;
+	state->stream.avail_in = 0;
+	if ((ret = drive_compressor(a, state, LZMA_FULL_FLUSH)) != ARCHIVE_OK)
+		return (ret);
+
+	block_length = state->stream.next_out - state->compressed;
+	while (block_length > 0) {
+		bytes_written = (a->client_writer)(&a->archive,
+		    a->client_data, state->compressed, block_length);
+		if (bytes_written <= 0)
+			return (ARCHIVE_FATAL);
+		a->archive.raw_position += bytes_written;
+		block_length -= bytes_written;
+		memmove(state->compressed, state->compressed + bytes_written,
+		    block_length);
+	}
+	state->stream.next_out = state->compressed;
+	state->stream.avail_out = state->compressed_buffer_size;
+	return (ARCHIVE_OK);
+}
 
 /*
  * Finish the compression...
@@ -309,14 +381,14 @@ archive_compressor_xz_finish(struct archive_write *a)
 				    tocopy : a->null_length;
 				state->total_in += state->stream.avail_in;
 				tocopy -= state->stream.avail_in;
-				ret = drive_compressor(a, state, 0);
+				ret = drive_compressor(a, state, LZMA_RUN);
 				if (ret != ARCHIVE_OK)
 					goto cleanup;
 			}
 		}
 
 		/* Finish compression cycle */
-		if (((ret = drive_compressor(a, state, 1))) != ARCHIVE_OK)
+		if (((ret = drive_compressor(a, state, LZMA_FINISH))) != ARCHIVE_OK)
 			goto cleanup;
 
 		/* Optionally, pad the final compressed block. */
@@ -363,11 +435,13 @@ archive_compressor_xz_finish(struct archive_write *a)
  * Utility function to push input data through compressor,
  * writing full output blocks as necessary.
  *
- * Note that this handles both the regular write case (finishing ==
- * false) and the end-of-archive case (finishing == true).
+ * Note that this handles the regular write case (LZMA_RUN), the
+ * flush case (LZMA_FULL_FLUSH) and the end-of-archive case
+ * (LZMA_FINISH).
  */
 static int
-drive_compressor(struct archive_write *a, struct private_data *state, int finishing)
+drive_compressor(struct archive_write *a, struct private_data *state,
+    lzma_action action)
 {
 	ssize_t bytes_written;
 	int ret;
@@ -395,24 +469,24 @@ drive_compressor(struct archive_write *a, struct private_data *state, int finish
 		}
 
 		/* If there's nothing to do, we're done. */
-		if (!finishing && state->stream.avail_in == 0)
+		if (action == LZMA_RUN && state->stream.avail_in == 0)
 			return (ARCHIVE_OK);
 
-		ret = lzma_code(&(state->stream),
-		    finishing ? LZMA_FINISH : LZMA_RUN );
+		ret = lzma_code(&(state->stream), action);
 
 		switch (ret) {
 		case LZMA_OK:
 			/* In non-finishing case, check if compressor
 			 * consumed everything */
-			if (!finishing && state->stream.avail_in == 0)
+			if (action == LZMA_RUN && state->stream.avail_in == 0)
 				return (ARCHIVE_OK);
 			/* In finishing case, this return always means
 			 * there's more work */
 			break;
 		case LZMA_STREAM_END:
-			/* This return can only occur in finishing case. */
-			if (finishing)
+			/* This return only occurs when finishing or
+			 * flushing. */
+			if (action != LZMA_RUN)
 				return (ARCHIVE_OK);
 			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
 			    "lzma compression data error");
@@ -0,0 +1,426 @@
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "archive_platform.h"
+
+__FBSDID("$FreeBSD$");
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
+
+#include "archive.h"
+#include "archive_private.h"
+#include "archive_write_private.h"
+
+#if !defined(HAVE_ZSTD_H) || !defined(HAVE_LIBZSTD)
+int
+archive_write_set_compression_zstd(struct archive *a)
+{
+	archive_set_error(a, ARCHIVE_ERRNO_MISC,
+	    "zstd compression not supported on this platform");
+	return (ARCHIVE_FATAL);
+}
+#else
+/* Don't compile this if we don't have libzstd. */
+
+struct private_data {
+	ZSTD_CStream	*cstream;
+	ZSTD_inBuffer	 in;
+	ZSTD_outBuffer	 out;
+	int64_t		 total_in;
+	unsigned char	*compressed;
+	size_t		 compressed_buffer_size;
+};
+
+struct private_config {
+	int		 compression_level;
+	int		 threads;
+};
+
+static int	archive_compressor_zstd_init(struct archive_write *);
+static int	archive_compressor_zstd_options(struct archive_write *,
+		    const char *, const char *);
+static int	archive_compressor_zstd_finish(struct archive_write *);
+static int	archive_compressor_zstd_flush(struct archive_write *);
+static int	archive_compressor_zstd_write(struct archive_write *,
+		    const void *, size_t);
+static int	drive_compressor(struct archive_write *, struct private_data *,
+		    ZSTD_EndDirective mode);
+
+/*
+ * Allocate, initialize and return an archive object.
+ */
+int
+archive_write_set_compression_zstd(struct archive *_a)
+{
+	struct archive_write *a = (struct archive_write *)_a;
+	struct private_config *config;
+	__archive_check_magic(&a->archive, ARCHIVE_WRITE_MAGIC,
+	    ARCHIVE_STATE_NEW, "archive_write_set_compression_zstd");
+	config = calloc(1, sizeof(*config));
+	if (config == NULL) {
+		archive_set_error(&a->archive, ENOMEM, "Out of memory");
+		return (ARCHIVE_FATAL);
+	}
+	a->compressor.config = config;
+	a->compressor.finish = archive_compressor_zstd_finish;
+	config->compression_level = ZSTD_CLEVEL_DEFAULT;
+	config->threads = 1;
+	a->compressor.init = &archive_compressor_zstd_init;
+	a->compressor.options = &archive_compressor_zstd_options;
+	a->archive.compression_code = ARCHIVE_COMPRESSION_ZSTD;
+	a->archive.compression_name = "zstd";
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Setup callback.
+ */
+static int
+archive_compressor_zstd_init(struct archive_write *a)
+{
+	int ret;
+	size_t zret;
+	struct private_data *state;
+	struct private_config *config;
+
+	config = (struct private_config *)a->compressor.config;
+	if (a->client_opener != NULL) {
+		ret = (a->client_opener)(&a->archive, a->client_data);
+		if (ret != ARCHIVE_OK)
+			return (ret);
+	}
+
+	state = (struct private_data *)calloc(1, sizeof(*state));
+	if (state == NULL) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate data for compression");
+		return (ARCHIVE_FATAL);
+	}
+
+	state->compressed_buffer_size = a->bytes_per_block;
+	state->compressed = (unsigned char *)malloc(state->compressed_buffer_size);
+	state->cstream = ZSTD_createCStream();
+	if (state->compressed == NULL || state->cstream == NULL) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate data for compression buffer");
+		ZSTD_freeCStream(state->cstream);
+		free(state->compressed);
+		free(state);
+		return (ARCHIVE_FATAL);
+	}
+	state->out.dst = state->compressed;
+	state->out.size = state->compressed_buffer_size;
+	state->out.pos = 0;
+	a->compressor.write = archive_compressor_zstd_write;
+	a->compressor.flush = archive_compressor_zstd_flush;
+
+	/* Initialize compression library. */
+	zret = ZSTD_CCtx_setParameter(state->cstream,
+	    ZSTD_c_compressionLevel, config->compression_level);
+	if (!ZSTD_isError(zret))
+		zret = ZSTD_CCtx_setParameter(state->cstream,
+		    ZSTD_c_checksumFlag, 1);
+	if (ZSTD_isError(zret)) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Internal error initializing compression library: %s",
+		    ZSTD_getErrorName(zret));
+		ZSTD_freeCStream(state->cstream);
+		free(state->compressed);
+		free(state);
+		return (ARCHIVE_FATAL);
+	}
+	/*
+	 * Worker threads are only available if libzstd was built with
+	 * them; silently compress in this thread otherwise.
+	 */
+	if (config->threads > 1)
+		(void)ZSTD_CCtx_setParameter(state->cstream,
+		    ZSTD_c_nbWorkers, config->threads);
+
+	a->compressor.data = state;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Set write options.
+ */
+static int
+archive_compressor_zstd_options(struct archive_write *a, const char *key,
+    const char *value)
+{
+	struct private_config *config;
+	char *end;
+	long level;
+
+	config = (struct private_config *)a->compressor.config;
+	if (strcmp(key, "compression-level") == 0) {
+		if (value == NULL)
+			return (ARCHIVE_WARN);
+		level = strtol(value, &end, 10);
+		if (end == value || *end != '\0' ||
+		    level < ZSTD_minCLevel() || level > ZSTD_maxCLevel())
+			return (ARCHIVE_WARN);
+		config->compression_level = (int)level;
+		return (ARCHIVE_OK);
+	}
+	if (strcmp(key, "compression-threads") == 0) {
+		if (value == NULL || !(value[0] >= '0' && value[0] <= '9'))
+			return (ARCHIVE_WARN);
+		config->threads = atoi(value);
+		/* 0 means one thread per online CPU. */
+#ifdef _SC_NPROCESSORS_ONLN
+		if (config->threads == 0)
+			config->threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		if (config->threads < 1)
+			config->threads = 1;
+		return (ARCHIVE_OK);
+	}
+
+	return (ARCHIVE_WARN);
+}
+
+/*
+ * Write data to the compressed stream.
+ */
+static int
+archive_compressor_zstd_write(struct archive_write *a, const void *buff,
+    size_t length)
+{
+	struct private_data *state;
+	int ret;
+
+	state = (struct private_data *)a->compressor.data;
+	if (a->client_writer == NULL) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_PROGRAMMER,
+		    "No write callback is registered?  "
+		    "This is probably an internal programming error.");
+		return (ARCHIVE_FATAL);
+	}
+
+	/* Update statistics */
+	state->total_in += length;
+
+	/* Compress input data to output buffer */
+	state->in.src = buff;
+	state->in.size = length;
+	state->in.pos = 0;
+	if ((ret = drive_compressor(a, state, ZSTD_e_continue)) != ARCHIVE_OK)
+		return (ret);
+
+	a->archive.file_position += length;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * End the current zstd block and write out the partial output block,
+ * so that all input so far can be decompressed.
+ */
+static int
+archive_compressor_zstd_flush(struct archive_write *a)
+{
+	ssize_t block_length, bytes_written;
+	struct private_data *state;
+	int ret;
+
+	state = (struct private_data *)a->compressor.data;
+	state->in.size = state->in.pos = 0;
+	if ((ret = drive_compressor(a, state, ZSTD_e_flush)) != ARCHIVE_OK)
+		return (ret);
+
+	block_length = state->out.pos;
+	while (block_length > 0) {
+		bytes_written = (a->client_writer)(&a->archive,
+		    a->client_data, state->compressed, block_length);
+		if (bytes_written <= 0)
+			return (ARCHIVE_FATAL);
+		a->archive.raw_position += bytes_written;
+		block_length -= bytes_written;
+		memmove(state->compressed, state->compressed + bytes_written,
+		    block_length);
+	}
+	state->out.pos = 0;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Finish the compression...
+ */
+static int
+archive_compressor_zstd_finish(struct archive_write *a)
+{
+	ssize_t block_length, target_block_length, bytes_written;
+	int ret;
+	struct private_data *state;
+	unsigned tocopy;
+
+	ret = ARCHIVE_OK;
+	state = (struct private_data *)a->compressor.data;
+	if (state != NULL) {
+		if (a->client_writer == NULL) {
+			archive_set_error(&a->archive,
+			    ARCHIVE_ERRNO_PROGRAMMER,
+			    "No write callback is registered?  "
+			    "This is probably an internal programming error.");
+			ret = ARCHIVE_FATAL;
+			goto cleanup;
+		}
+
+		/* By default, always pad the uncompressed data. */
+		if (a->pad_uncompressed) {
+			tocopy = a->bytes_per_block -
+			    (state->total_in % a->bytes_per_block);
+			while (tocopy > 0 && tocopy < (unsigned)a->bytes_per_block) {
+				state->in.src = a->nulls;
+				state->in.size = tocopy < a->null_length ?
+				    tocopy : a->null_length;
+				state->in.pos = 0;
+				state->total_in += state->in.size;
+				tocopy -= state->in.size;
+				ret = drive_compressor(a, state,
+				    ZSTD_e_continue);
+				if (ret != ARCHIVE_OK)
+					goto cleanup;
+			}
+		}
+
+		/* Finish compression cycle */
+		state->in.size = state->in.pos = 0;
+		if (((ret = drive_compressor(a, state, ZSTD_e_end))) != ARCHIVE_OK)
+			goto cleanup;
+
+		/* Optionally, pad the final compressed block. */
+		block_length = state->out.pos;
+
+		/* Tricky calculation to determine size of last block. */
+		if (a->bytes_in_last_block <= 0)
+			/* Default or Zero: pad to full block */
+			target_block_length = a->bytes_per_block;
+		else
+			/* Round length to next multiple of bytes_in_last_block. */
+			target_block_length = a->bytes_in_last_block *
+			    ( (block_length + a->bytes_in_last_block - 1) /
+				a->bytes_in_last_block);
+		if (target_block_length > a->bytes_per_block)
+			target_block_length = a->bytes_per_block;
+		if (block_length < target_block_length) {
+			memset(state->compressed + block_length, 0,
+			    target_block_length - block_length);
+			block_length = target_block_length;
+		}
+
+		/* Write the last block */
+		bytes_written = (a->client_writer)(&a->archive, a->client_data,
+		    state->compressed, block_length);
+		if (bytes_written <= 0) {
+			ret = ARCHIVE_FATAL;
+			goto cleanup;
+		}
+		a->archive.raw_position += bytes_written;
+
+		/* Cleanup: shut down compressor, release memory, etc. */
+	cleanup:
+		ZSTD_freeCStream(state->cstream);
+		free(state->compressed);
+		free(state);
+	}
+	free(a->compressor.config);
+	a->compressor.config = NULL;
+	return (ret);
+}
+
+/*
+ * Utility function to push input data through compressor,
+ * writing full output blocks as necessary.
+ *
+ * Note that this handles the regular write case (ZSTD_e_continue),
+ * the flush case (ZSTD_e_flush) and the end-of-archive case
+ * (ZSTD_e_end).
+ */
+static int
+drive_compressor(struct archive_write *a, struct private_data *state,
+    ZSTD_EndDirective mode)
+{
+	ssize_t bytes_written;
+	size_t ret;
+
+	for (;;) {
+		if (state->out.pos == state->out.size) {
+			bytes_written = (a->client_writer)(&a->archive,
+			    a->client_data, state->compressed,
+			    state->compressed_buffer_size);
+			if (bytes_written <= 0) {
+				/* TODO: Handle this write failure */
+				return (ARCHIVE_FATAL);
+			} else if ((size_t)bytes_written < state->compressed_buffer_size) {
+				/* Short write: Move remaining to
+				 * front of block and keep filling */
+				memmove(state->compressed,
+				    state->compressed + bytes_written,
+				    state->compressed_buffer_size - bytes_written);
+			}
+			a->archive.raw_position += bytes_written;
+			state->out.pos =
+			    state->compressed_buffer_size - bytes_written;
+		}
+
+		/* If there's nothing to do, we're done. */
+		if (mode == ZSTD_e_continue && state->in.pos == state->in.size)
+			return (ARCHIVE_OK);
+
+		ret = ZSTD_compressStream2(state->cstream, &state->out,
+		    &state->in, mode);
+		if (ZSTD_isError(ret)) {
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "zstd compression failed: %s",
+			    ZSTD_getErrorName(ret));
+			return (ARCHIVE_FATAL);
+		}
+
+		/* When finishing or flushing, zero means all done. */
+		if (mode != ZSTD_e_continue && ret == 0)
+			return (ARCHIVE_OK);
+		/* In non-finishing case, check if compressor
+		 * consumed everything */
+		if (mode == ZSTD_e_continue && state->in.pos == state->in.size)
+			return (ARCHIVE_OK);
+	}
+}
+
+#endif /* HAVE_ZSTD_H && HAVE_LIBZSTD */
@@ -80,8 +80,11 @@ DEFINE_TEST(test_write_compress_bzip2)
 DEFINE_TEST(test_write_compress_gzip)
 DEFINE_TEST(test_write_compress_lzma)
 DEFINE_TEST(test_write_compress_program)
+DEFINE_TEST(test_write_compress_threads)
 DEFINE_TEST(test_write_compress_xz)
+DEFINE_TEST(test_write_compress_zstd)
 DEFINE_TEST(test_write_disk)
+DEFINE_TEST(test_write_disk_cache_dirs)
 DEFINE_TEST(test_write_disk_failures)
 DEFINE_TEST(test_write_disk_hardlink)
 DEFINE_TEST(test_write_disk_perms)
@@ -89,6 +92,7 @@ DEFINE_TEST(test_write_disk_secure)
 DEFINE_TEST(test_write_disk_sparse)
 DEFINE_TEST(test_write_disk_symlink)
 DEFINE_TEST(test_write_disk_times)
+DEFINE_TEST(test_write_flush)
 DEFINE_TEST(test_write_format_ar)
 DEFINE_TEST(test_write_format_cpio)
 DEFINE_TEST(test_write_format_cpio_empty)
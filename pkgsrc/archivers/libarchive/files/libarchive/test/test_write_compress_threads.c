@@ -0,0 +1,268 @@
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+#if !defined(_WIN32) || defined(__CYGWIN__)
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Exercise the compression-threads option of the gzip and xz
+ * compressors: the output must read back, both with libarchive and
+ * with the stock gunzip and xz programs.
+ *
+ * With LIBARCHIVE_BENCH set in the environment, the throughput for
+ * 1, 2, 4 and 8 threads is printed as well.
+ */
+
+#define	NFILES	16
+
+static const char *words[] = {
+	"archive", "block", "compress", "deflate", "entry", "file",
+	"gzip", "header", "inflate", "libarchive", "package", "stream",
+	"tar", "thread", "write", "xz", "\n"
+};
+
+/* Something compressible, but not too much so. */
+static void
+fill(char *data, size_t size)
+{
+	unsigned long seed = 1;
+	size_t i = 0, len;
+	const char *w;
+
+	while (i < size) {
+		seed = seed * 1103515245 + 12345;
+		if ((seed >> 16) % 4 == 0) {
+			data[i++] = (char)(seed >> 8);
+			continue;
+		}
+		w = words[(seed >> 16) % (sizeof(words) / sizeof(words[0]))];
+		len = strlen(w);
+		if (len > size - i)
+			len = size - i;
+		memcpy(data + i, w, len);
+		i += len;
+		if (i < size)
+			data[i++] = ' ';
+	}
+}
+
+static size_t
+write_archive(int (*set_compression)(struct archive *), const char *threads,
+    char *buff, size_t buffsize, const char *data, size_t datasize)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[16], options[64];
+	size_t used;
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertA(0 == archive_write_set_format_ustar(a));
+	if (set_compression(a) != ARCHIVE_OK) {
+		assertEqualInt(ARCHIVE_OK, archive_write_finish(a));
+		return (0);
+	}
+	sprintf(options, "compression-threads=%s", threads);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_compressor_options(a, options));
+	assertA(0 == archive_write_open_memory(a, buff, buffsize, &used));
+	for (i = 0; i < NFILES; i++) {
+		sprintf(path, "file%03d", i);
+		assert((ae = archive_entry_new()) != NULL);
+		archive_entry_copy_pathname(ae, path);
+		archive_entry_set_size(ae, datasize);
+		archive_entry_set_filetype(ae, AE_IFREG);
+		assertA(0 == archive_write_header(a, ae));
+		assertA(datasize == (size_t)archive_write_data(a, data, datasize));
+		archive_entry_free(ae);
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_finish(a));
+	return (used);
+}
+
+static void
+verify_archive(const char *buff, size_t used, const char *data,
+    size_t datasize)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[16], *rbuff;
+	int i;
+
+	assert(NULL != (rbuff = malloc(datasize)));
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_support_compression_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    read_open_memory(a, (void *)(uintptr_t)buff, used, 65536));
+	for (i = 0; i < NFILES; i++) {
+		sprintf(path, "file%03d", i);
+		if (!assertEqualInt(ARCHIVE_OK,
+			archive_read_next_header(a, &ae)))
+			break;
+		assertEqualString(path, archive_entry_pathname(ae));
+		assertEqualInt((int)datasize, archive_entry_size(ae));
+		assertEqualInt((int)datasize,
+		    archive_read_data(a, rbuff, datasize));
+		assertEqualMem(rbuff, data, datasize);
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_finish(a));
+	free(rbuff);
+}
+
+static void
+write_file(const char *name, const char *buff, size_t used)
+{
+	FILE *f;
+
+	assert(NULL != (f = fopen(name, "wb")));
+	assertEqualInt(used, fwrite(buff, 1, used, f));
+	fclose(f);
+}
+
+#if !defined(_WIN32) || defined(__CYGWIN__)
+static double
+seconds(const struct timeval *tv)
+{
+	return (tv->tv_sec + tv->tv_usec / 1e6);
+}
+
+/*
+ * Print throughput, the speedup over one thread and the CPU time
+ * used per second of wall time, which shows how much of the work
+ * actually ran in parallel.
+ */
+static void
+bench(const char *name, int (*set_compression)(struct archive *),
+    char *buff, size_t buffsize, const char *data, size_t datasize)
+{
+	static const char *threads[] = { "1", "2", "4", "8" };
+	struct timeval start, end;
+	struct rusage ru0, ru1;
+	double secs, cpu, base;
+	size_t used;
+	int i;
+
+	base = 0;
+	for (i = 0; i < 4; i++) {
+		getrusage(RUSAGE_SELF, &ru0);
+		gettimeofday(&start, NULL);
+		used = write_archive(set_compression, threads[i], buff,
+		    buffsize, data, datasize);
+		gettimeofday(&end, NULL);
+		getrusage(RUSAGE_SELF, &ru1);
+		secs = seconds(&end) - seconds(&start);
+		cpu = seconds(&ru1.ru_utime) - seconds(&ru0.ru_utime) +
+		    seconds(&ru1.ru_stime) - seconds(&ru0.ru_stime);
+		if (i == 0)
+			base = secs;
+		printf("\n    %s, %s thread(s): %.1f MB/s, speedup %.2f, "
+		    "cpu/wall %.2f, ratio %.3f",
+		    name, threads[i], NFILES * datasize / secs / 1e6,
+		    base / secs, cpu / secs,
+		    (double)used / (NFILES * datasize));
+	}
+	printf("\n");
+}
+#endif
+
+DEFINE_TEST(test_write_compress_threads)
+{
+	char *buff, *buff2, *data;
+	size_t buffsize, datasize, used, used2;
+
+	datasize = 1024 * 1024;
+	if (getenv("LIBARCHIVE_BENCH") != NULL)
+		datasize *= 2;
+	buffsize = NFILES * datasize + 1024 * 1024;
+	assert(NULL != (buff = malloc(buffsize)));
+	assert(NULL != (buff2 = malloc(buffsize)));
+	assert(NULL != (data = malloc(datasize)));
+	fill(data, datasize);
+
+	/*
+	 * gzip: the blocks of all threads make up one stream, and the
+	 * output doesn't depend on the number of threads.  Skip the
+	 * time stamp in the header when comparing.
+	 */
+	used = write_archive(archive_write_set_compression_gzip, "4",
+	    buff, buffsize, data, datasize);
+	if (used == 0) {
+		skipping("gzip writing not supported on this platform");
+	} else {
+		verify_archive(buff, used, data, datasize);
+		used2 = write_archive(archive_write_set_compression_gzip, "2",
+		    buff2, buffsize, data, datasize);
+		assertEqualInt(used, used2);
+		assertEqualMem(buff + 10, buff2 + 10, used - 10);
+		if (!canGunzip()) {
+			skipping("gunzip program not available");
+		} else {
+			write_file("threads.tar.gz", buff, used);
+			assertEqualInt(0,
+			    systemf("gunzip -t threads.tar.gz"));
+		}
+	}
+
+	/* xz: multi-block output. */
+	used = write_archive(archive_write_set_compression_xz, "4",
+	    buff, buffsize, data, datasize);
+	if (used == 0) {
+		skipping("xz writing not supported on this platform");
+	} else {
+		verify_archive(buff, used, data, datasize);
+		if (systemf("xz -V >/dev/null 2>/dev/null") != 0) {
+			skipping("xz program not available");
+		} else {
+			write_file("threads.tar.xz", buff, used);
+			assertEqualInt(0, systemf("xz -t threads.tar.xz"));
+		}
+	}
+
+#if !defined(_WIN32) || defined(__CYGWIN__)
+	if (getenv("LIBARCHIVE_BENCH") != NULL) {
+		printf("\n    %ld CPU(s) online",
+		    (long)sysconf(_SC_NPROCESSORS_ONLN));
+		bench("gzip", archive_write_set_compression_gzip,
+		    buff, buffsize, data, datasize);
+		bench("xz", archive_write_set_compression_xz,
+		    buff, buffsize, data, datasize);
+	}
+#endif
+
+	free(data);
+	free(buff2);
+	free(buff);
+}
@@ -0,0 +1,212 @@
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * A basic exercise of zstd reading and writing.
+ */
+
+static size_t
+write_archive(const char *options, char *buff, size_t buffsize,
+    const char *data, size_t datasize)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[16];
+	size_t used;
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertA(0 == archive_write_set_format_ustar(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_bytes_per_block(a, 10));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_compression_zstd(a));
+	if (options != NULL)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_write_set_compressor_options(a, options));
+	assertEqualInt(ARCHIVE_COMPRESSION_ZSTD, archive_compression(a));
+	assertEqualString("zstd", archive_compression_name(a));
+	assertA(0 == archive_write_open_memory(a, buff, buffsize, &used));
+	for (i = 0; i < 100; i++) {
+		sprintf(path, "file%03d", i);
+		assert((ae = archive_entry_new()) != NULL);
+		archive_entry_copy_pathname(ae, path);
+		archive_entry_set_size(ae, datasize);
+		archive_entry_set_filetype(ae, AE_IFREG);
+		assertA(0 == archive_write_header(a, ae));
+		assertA(datasize == (size_t)archive_write_data(a, data, datasize));
+		archive_entry_free(ae);
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_finish(a));
+	return (used);
+}
+
+static void
+read_archive(const char *buff, size_t used, const char *data, size_t datasize)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[16], *rbuff;
+	int i;
+
+	assert(NULL != (rbuff = malloc(datasize)));
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_support_compression_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_memory(a, (void *)(uintptr_t)buff, used));
+	for (i = 0; i < 100; i++) {
+		sprintf(path, "file%03d", i);
+		failure("Trying to read %s", path);
+		if (!assertEqualIntA(a, ARCHIVE_OK,
+			archive_read_next_header(a, &ae)))
+			break;
+		assertEqualString(path, archive_entry_pathname(ae));
+		assertEqualInt((int)datasize, archive_entry_size(ae));
+		assertEqualInt((int)datasize,
+		    archive_read_data(a, rbuff, datasize));
+		assertEqualMem(rbuff, data, datasize);
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualInt(ARCHIVE_COMPRESSION_ZSTD, archive_compression(a));
+	assertEqualString("zstd", archive_compression_name(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_finish(a));
+	free(rbuff);
+}
+
+DEFINE_TEST(test_write_compress_zstd)
+{
+	struct archive *a;
+	char *buff, *buff2, *data;
+	size_t buffsize, datasize, used1, used2;
+	int i, r;
+
+	buffsize = 2000000;
+	assert(NULL != (buff = (char *)malloc(buffsize)));
+	assert(NULL != (buff2 = (char *)malloc(buffsize)));
+
+	datasize = 10000;
+	assert(NULL != (data = (char *)malloc(datasize)));
+	for (i = 0; i < (int)datasize; i++)
+		data[i] = (char)(i % 251 + i / 1000);
+
+	assert((a = archive_write_new()) != NULL);
+	r = archive_write_set_compression_zstd(a);
+	assertEqualInt(ARCHIVE_OK, archive_write_finish(a));
+	if (r == ARCHIVE_FATAL) {
+		skipping("zstd writing not supported on this platform");
+		free(data);
+		free(buff2);
+		free(buff);
+		return;
+	}
+
+	/*
+	 * Write a 100 files and read them all back.
+	 */
+	used1 = write_archive(NULL, buff, buffsize, data, datasize);
+	assert((a = archive_read_new()) != NULL);
+	r = archive_read_support_compression_zstd(a);
+	assertEqualInt(ARCHIVE_OK, archive_read_finish(a));
+	if (r == ARCHIVE_WARN) {
+		skipping("Can't verify zstd writing by reading back;"
+		    " zstd reading not fully supported on this platform");
+	} else
+		read_archive(buff, used1, data, datasize);
+
+	/*
+	 * Check the option parsing.
+	 */
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_compression_zstd(a));
+	assertEqualIntA(a, ARCHIVE_WARN,
+	    archive_write_set_compressor_options(a, "nonexistent-option=0"));
+	assertEqualIntA(a, ARCHIVE_WARN,
+	    archive_write_set_compressor_options(a, "compression-level=abc"));
+	assertEqualIntA(a, ARCHIVE_WARN,
+	    archive_write_set_compressor_options(a, "compression-level=99"));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_compressor_options(a, "compression-level=19"));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_compressor_options(a, "compression-level=-5"));
+	assertEqualInt(ARCHIVE_OK, archive_write_finish(a));
+
+	/*
+	 * Level 1 is bigger than level 19, and both read back.
+	 */
+	used1 = write_archive("compression-level=1", buff, buffsize,
+	    data, datasize);
+	used2 = write_archive("compression-level=19", buff2, buffsize,
+	    data, datasize);
+	failure("compression-level=19 wrote %d bytes; level 1 wrote %d bytes",
+	    (int)used2, (int)used1);
+	assert(used2 < used1);
+	if (r != ARCHIVE_WARN) {
+		read_archive(buff, used1, data, datasize);
+		read_archive(buff2, used2, data, datasize);
+	}
+
+	/*
+	 * The output must be readable by the zstd program, too.
+	 */
+	if (systemf("zstd -V >/dev/null 2>/dev/null") != 0) {
+		skipping("zstd program not available");
+	} else {
+		FILE *f;
+
+		assert(NULL != (f = fopen("test.tar.zst", "wb")));
+		assertEqualInt(used2, fwrite(buff2, 1, used2, f));
+		fclose(f);
+		assertEqualInt(0, systemf("zstd -q -t test.tar.zst"));
+	}
+
+	/*
+	 * Test various premature shutdown scenarios to make sure we
+	 * don't crash or leak memory.
+	 */
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_compression_zstd(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_finish(a));
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_ustar(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_compression_zstd(a));
+	assertA(0 == archive_write_open_memory(a, buff, buffsize, &used2));
+	assertEqualInt(ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_finish(a));
+
+	/*
+	 * Clean up.
+	 */
+	free(data);
+	free(buff2);
+	free(buff);
+}
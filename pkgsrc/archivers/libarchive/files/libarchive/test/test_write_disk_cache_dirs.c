@@ -0,0 +1,234 @@
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+#if !defined(_WIN32) || defined(__CYGWIN__)
+#include <sys/time.h>
+#endif
+
+/*
+ * ARCHIVE_EXTRACT_CACHE_DIRS must not change what ends up on disk.
+ *
+ * With LIBARCHIVE_BENCH set in the environment, a synthetic archive
+ * of 100000 files is extracted with and without the flag and the
+ * rate is printed.
+ */
+
+#if !defined(_WIN32) || defined(__CYGWIN__)
+
+#define	FLAGS	(ARCHIVE_EXTRACT_OWNER | ARCHIVE_EXTRACT_PERM | \
+		 ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_UNLINK)
+
+static void
+write_entry(struct archive *ad, const char *name, int type, int mode,
+    const char *data)
+{
+	struct archive_entry *ae;
+
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, name);
+	archive_entry_set_mode(ae, type | mode);
+	archive_entry_set_mtime(ae, 123456789, 0);
+	if (type == AE_IFLNK)
+		archive_entry_copy_symlink(ae, data);
+	else if (type == AE_IFREG)
+		archive_entry_set_size(ae, strlen(data));
+	failure("%s", name);
+	assertEqualIntA(ad, 0, archive_write_header(ad, ae));
+	if (type == AE_IFREG)
+		assertEqualInt((int)strlen(data),
+		    archive_write_data(ad, data, strlen(data)));
+	/* Not all systems can set the mode of a symlink. */
+	if (type == AE_IFLNK)
+		assert(archive_write_finish_entry(ad) >= ARCHIVE_WARN);
+	else
+		assertEqualIntA(ad, 0, archive_write_finish_entry(ad));
+	archive_entry_free(ae);
+}
+
+/* Write a synthetic archive of nfiles files, 100 to a dir. */
+static void
+make_archive(const char *name, int nfiles)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[64];
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertA(0 == archive_write_set_format_ustar(a));
+	assertA(0 == archive_write_set_compression_none(a));
+	assertA(0 == archive_write_open_filename(a, name));
+	assert((ae = archive_entry_new()) != NULL);
+	for (i = 0; i < nfiles; i++) {
+		sprintf(path, "share/d%d/sub%d/file%d", i / 1000,
+		    i / 100 % 10, i);
+		archive_entry_copy_pathname(ae, path);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_mtime(ae, 123456789, 0);
+		archive_entry_set_size(ae, 16);
+		assertA(0 == archive_write_header(a, ae));
+		assertA(16 == archive_write_data(a, "0123456789abcdef", 16));
+	}
+	archive_entry_free(ae);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_finish(a));
+}
+
+/* Returns the number of entries extracted. */
+static int
+extract(const char *name, const char *dir, int flags)
+{
+	struct archive_entry *ae;
+	struct archive *a, *ad;
+	int n = 0, r;
+
+	assertMakeDir(dir, 0755);
+	assertChdir(dir);
+	assert((a = archive_read_new()) != NULL);
+	assertA(0 == archive_read_support_format_all(a));
+	assertA(0 == archive_read_open_filename(a, name, 10240));
+	assert((ad = archive_write_disk_new()) != NULL);
+	assertEqualIntA(ad, 0, archive_write_disk_set_options(ad, flags));
+	while ((r = archive_read_next_header(a, &ae)) == ARCHIVE_OK) {
+		assertEqualIntA(ad, 0, archive_read_extract2(a, ae, ad));
+		n++;
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, r);
+	assertEqualInt(ARCHIVE_OK, archive_write_finish(ad));
+	assertEqualInt(ARCHIVE_OK, archive_read_finish(a));
+	assertChdir("..");
+	return (n);
+}
+
+static void
+bench(void)
+{
+	struct timeval start, end;
+	double secs;
+	int n, pass;
+
+	make_archive("bench.tar", 100000);
+	for (pass = 0; pass < 2; pass++) {
+		gettimeofday(&start, NULL);
+		n = extract("../bench.tar", pass ? "bench1" : "bench0",
+		    FLAGS | (pass ? ARCHIVE_EXTRACT_CACHE_DIRS : 0));
+		gettimeofday(&end, NULL);
+		secs = (end.tv_sec - start.tv_sec) +
+		    (end.tv_usec - start.tv_usec) / 1e6;
+		printf("\n    %s: %d files in %.2f s, %.0f files/s",
+		    pass ? "cached dirs" : "default", n, secs, n / secs);
+	}
+	printf("\n");
+}
+#endif
+
+DEFINE_TEST(test_write_disk_cache_dirs)
+{
+#if defined(_WIN32) && !defined(__CYGWIN__)
+	skipping("write_disk_cache_dirs test");
+#else
+	struct archive *ad;
+	struct stat st;
+	char path[64];
+	mode_t old_umask;
+	int i;
+
+	/*
+	 * With umask 0, implicitly created dirs get a deferred chmod;
+	 * the explicit entry for the same dir that follows must win.
+	 */
+	old_umask = umask(0);
+	assertMakeDir("pre", 0755);
+	assertMakeFile("pre/x", 0644, "old");
+	assertMakeHardlink("pre/x2", "pre/x");
+	assertMakeDir("real", 0755);
+
+	assert((ad = archive_write_disk_new()) != NULL);
+	assertEqualIntA(ad, 0, archive_write_disk_set_options(ad,
+	    FLAGS | ARCHIVE_EXTRACT_CACHE_DIRS));
+	write_entry(ad, "d1/d2/f1", AE_IFREG, 0644, "one");
+	write_entry(ad, "d1/d2/f2", AE_IFREG, 0644, "two");
+	write_entry(ad, "d1/d2/f3", AE_IFREG, 0644, "three");
+	write_entry(ad, "d1/d2/", AE_IFDIR, 0750, NULL);
+	/* A duplicate in a dir we made replaces the first copy. */
+	write_entry(ad, "d1/d2/f1", AE_IFREG, 0600, "uno");
+	/* Files in dirs we didn't make are still unlinked first. */
+	write_entry(ad, "pre/x", AE_IFREG, 0644, "new");
+	/* An empty dir we made, replaced by a symlink elsewhere. */
+	write_entry(ad, "k/", AE_IFDIR, 0755, NULL);
+	write_entry(ad, "k", AE_IFLNK, 0755, "real");
+	write_entry(ad, "k/f", AE_IFREG, 0644, "through");
+	write_entry(ad, "t/", AE_IFDIR, 0755, NULL);
+	write_entry(ad, "t/f", AE_IFREG, 0644, "t");
+	/* Names with '..' are left alone. */
+	write_entry(ad, "d1/../d3/f", AE_IFREG, 0644, "dotdot");
+	for (i = 0; i < 300; i++) {
+		sprintf(path, "many/m%d/f", i);
+		write_entry(ad, path, AE_IFREG, 0644, "m");
+	}
+	/* Setting the options forgets about the dir we made. */
+	assertEqualIntA(ad, 0, archive_write_disk_set_options(ad,
+	    FLAGS | ARCHIVE_EXTRACT_CACHE_DIRS));
+	assertMakeFile("d1/d2/f4", 0644, "old");
+	assertMakeHardlink("d1/d2/f5", "d1/d2/f4");
+	write_entry(ad, "d1/d2/f4", AE_IFREG, 0644, "four");
+	assertEqualInt(ARCHIVE_OK, archive_write_finish(ad));
+	umask(old_umask);
+
+	assertIsDir("d1/d2", 0750);
+	assertFileContents("uno", 3, "d1/d2/f1");
+	assertEqualInt(0, stat("d1/d2/f1", &st));
+	assertEqualInt(0600, st.st_mode & 07777);
+	assertFileContents("two", 3, "d1/d2/f2");
+	assertFileContents("three", 5, "d1/d2/f3");
+	assertFileContents("new", 3, "pre/x");
+	assertFileContents("old", 3, "pre/x2");
+	assertIsSymlink("k", "real");
+	assertFileContents("through", 7, "real/f");
+	assertFileContents("dotdot", 6, "d3/f");
+	for (i = 0; i < 300; i++) {
+		sprintf(path, "many/m%d/f", i);
+		assertFileContents("m", 1, path);
+	}
+	assertFileContents("four", 4, "d1/d2/f4");
+	assertFileContents("old", 3, "d1/d2/f5");
+	/* Dir times are restored at the end. */
+	assertEqualInt(0, stat("t", &st));
+	assertEqualInt(123456789, st.st_mtime);
+
+	/* A whole archive comes out the same either way. */
+	make_archive("test.tar", 2500);
+	assertEqualInt(2500, extract("../test.tar", "plain", FLAGS));
+	assertEqualInt(2500, extract("../test.tar", "cached",
+	    FLAGS | ARCHIVE_EXTRACT_CACHE_DIRS));
+	assertEqualInt(0, systemf("diff -r plain cached"));
+
+	if (getenv("LIBARCHIVE_BENCH") != NULL)
+		bench();
+#endif
+}
@@ -0,0 +1,194 @@
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * archive_write_flush() in the middle of an archive: the output up
+ * to the compressed position at that point must decompress to all
+ * entries written before, and the whole archive must still be
+ * readable.  The prefix is decompressed with the stock programs,
+ * which complain about the truncated input but write out what they
+ * could decode.
+ */
+
+#define	NMETA	3
+
+static void
+write_archive(const char *name, int (*set_compression)(struct archive *),
+    const char *options, const char *unpack)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[16], *buff, *data, *rbuff;
+	size_t buffsize, datasize, used;
+	int64_t flushed, flushed_raw;
+	FILE *f;
+	int i;
+
+	buffsize = 2 * 1024 * 1024;
+	datasize = 256 * 1024;
+	assert(NULL != (buff = malloc(buffsize)));
+	assert(NULL != (data = malloc(datasize)));
+	assert(NULL != (rbuff = malloc(datasize)));
+	for (i = 0; i < (int)datasize; i++)
+		data[i] = (char)(rand() % 64 + ' ');
+
+	assert((a = archive_write_new()) != NULL);
+	assertA(0 == archive_write_set_format_ustar(a));
+	if (set_compression(a) != ARCHIVE_OK) {
+		skipping("%s writing not supported on this platform", name);
+		assertEqualInt(ARCHIVE_OK, archive_write_finish(a));
+		goto done;
+	}
+	if (options != NULL)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_write_set_compressor_options(a, options));
+	assertA(0 == archive_write_open_memory(a, buff, buffsize, &used));
+	for (i = 0; i < NMETA; i++) {
+		sprintf(path, "+META%d", i);
+		assert((ae = archive_entry_new()) != NULL);
+		archive_entry_copy_pathname(ae, path);
+		archive_entry_set_size(ae, 100 + i);
+		archive_entry_set_filetype(ae, AE_IFREG);
+		assertA(0 == archive_write_header(a, ae));
+		assertA(100 + i == archive_write_data(a, data, 100 + i));
+		archive_entry_free(ae);
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_flush(a));
+	flushed = archive_position_compressed(a);
+	flushed_raw = archive_position_uncompressed(a);
+	assertEqualInt(NMETA * 1024, flushed_raw);
+	assertEqualInt(flushed, used);
+	/* Flushing again without new data is harmless. */
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_flush(a));
+	assertEqualInt(flushed, archive_position_compressed(a));
+
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "file");
+	archive_entry_set_size(ae, datasize);
+	archive_entry_set_filetype(ae, AE_IFREG);
+	assertA(0 == archive_write_header(a, ae));
+	assertA(datasize == (size_t)archive_write_data(a, data, datasize));
+	archive_entry_free(ae);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_finish(a));
+	assert(flushed < (int64_t)used);
+
+	/* The whole archive reads back. */
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_support_compression_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, read_open_memory(a, buff, used, 7));
+	for (i = 0; i < NMETA; i++) {
+		sprintf(path, "+META%d", i);
+		assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+		assertEqualString(path, archive_entry_pathname(ae));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("file", archive_entry_pathname(ae));
+	assertEqualInt((int)datasize, archive_read_data(a, rbuff, datasize));
+	assertEqualMem(rbuff, data, datasize);
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualInt(ARCHIVE_OK, archive_read_finish(a));
+
+	/* The prefix alone holds the complete leading entries. */
+	if (unpack == NULL)
+		assert(NULL != (f = fopen("prefix.tar", "wb")));
+	else
+		assert(NULL != (f = fopen("prefix", "wb")));
+	assertEqualInt((size_t)flushed, fwrite(buff, 1, (size_t)flushed, f));
+	fclose(f);
+	if (unpack != NULL) {
+		if (systemf("%s -V >/dev/null 2>/dev/null", unpack) != 0 &&
+		    systemf("%s --version >/dev/null 2>/dev/null",
+			unpack) != 0) {
+			skipping("%s program not available", unpack);
+			goto done;
+		}
+		systemf("%s -dc < prefix > prefix.tar 2>/dev/null", unpack);
+	}
+	if (!assertFileSize("prefix.tar", flushed_raw))
+		goto done;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_filename(a, "prefix.tar", 10240));
+	for (i = 0; i < NMETA; i++) {
+		sprintf(path, "+META%d", i);
+		assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+		assertEqualString(path, archive_entry_pathname(ae));
+		assertEqualInt(100 + i, archive_read_data(a, rbuff, 100 + i));
+		assertEqualMem(rbuff, data, 100 + i);
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualInt(ARCHIVE_OK, archive_read_finish(a));
+
+done:
+	free(rbuff);
+	free(data);
+	free(buff);
+}
+
+/* Compressors that can't flush say so, but otherwise keep going. */
+static void
+cannot_flush(int (*set_compression)(struct archive *))
+{
+	struct archive *a;
+
+	assert((a = archive_write_new()) != NULL);
+	assertA(0 == archive_write_set_format_ustar(a));
+	if (set_compression(a) != ARCHIVE_OK) {
+		assertEqualInt(ARCHIVE_OK, archive_write_finish(a));
+		return;
+	}
+	assertA(0 == archive_write_open_filename(a, "test.tar"));
+	assertEqualIntA(a, ARCHIVE_WARN, archive_write_flush(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_finish(a));
+}
+
+DEFINE_TEST(test_write_flush)
+{
+	write_archive("none", archive_write_set_compression_none, NULL, NULL);
+	write_archive("gzip", archive_write_set_compression_gzip, NULL,
+	    "gzip");
+	write_archive("gzip", archive_write_set_compression_gzip,
+	    "compression-threads=2", "gzip");
+	write_archive("xz", archive_write_set_compression_xz, NULL, "xz");
+	write_archive("zstd", archive_write_set_compression_zstd, NULL,
+	    "zstd");
+
+	/*
+	 * The end of a bzip2 block is only written out with the next
+	 * one, so bzip2 can't flush.
+	 */
+	cannot_flush(archive_write_set_compression_bzip2);
+	cannot_flush(archive_write_set_compression_compress);
+	cannot_flush(archive_write_set_compression_lzma);
+}
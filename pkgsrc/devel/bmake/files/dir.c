@@ -137,10 +137,13 @@ __RCSID("$NetBSD: dir.c,v 1.5 2011/06/18 22:39:46 bsiegert Exp $");
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <time.h>
 
 #include "make.h"
 #include "hash.h"
@@ -244,6 +247,44 @@ static Hash_Table mtimes;   /* Results of doing a last-resort stat in
 			     * should be ok, but... */
 
 
+/*
+ * The shared cache.  If MAKEDIRCACHE is in the environment, the top
+ * level make creates a file that it and all its sub-makes map, and
+ * passes its name down in MAKEDIRCACHE.  The file holds the contents
+ * of directories, which are used while the mtime and ctime of the
+ * directory stay the same.  Files are always looked up with stat(2),
+ * as commands still running may change them at any time.
+ *
+ * Records are only ever added, under a lock, and are linked into their
+ * hash chain only once complete, so readers don't need the lock.
+ */
+#define	DC_MAGIC	"bmkdirc2"
+#define	DC_SIZE		(4 * 1024 * 1024)
+#define	DC_BUCKETS	4096
+
+typedef struct {
+    char	  magic[8];
+    unsigned	  entsize;	/* sizeof(DirCacheEntry), for sanity */
+    unsigned	  used;		/* offset of the end of the records */
+    unsigned	  buckets[DC_BUCKETS];	/* offset of first record or 0 */
+} DirCacheHeader;
+
+typedef struct {
+    unsigned	  next;		/* offset of next record in chain or 0 */
+    unsigned	  hash;
+    time_t	  mtime;	/* of the directory */
+    time_t	  ctime;
+    unsigned	  nfiles;	/* names following the key */
+    unsigned	  len;		/* of the record */
+    char	  name[1];	/* absolute path, NUL, names */
+} DirCacheEntry;
+
+static DirCacheHeader *dcache;	/* NULL if not used */
+static int	  dcacheFd = -1;
+static char	  *dcacheFile;	/* if we created it */
+static char	  *dcacheCwd;	/* to make names absolute */
+static int	  dcacheDirs;	/* reused */
+
 static int DirFindName(const void *, const void *);
 static int DirMatchFiles(const char *, Path *, Lst);
 static void DirExpandCurly(const char *, const char *, Lst, Lst);
@@ -267,12 +308,173 @@ static char *DirLookupAbs(Path *, const char *, const char *);
  *	some directories may be opened.
  *-----------------------------------------------------------------------
  */
+static void
+DirCacheRemove(void)
+{
+    if (dcacheFile != NULL)
+	(void)unlink(dcacheFile);
+}
+
+/*
+ * Map the shared cache named by MAKEDIRCACHE, or create it if the
+ * value is not an absolute path.
+ */
+static void
+DirCacheInit(void)
+{
+    DirCacheHeader *hdr;
+    char *name;
+    int fd;
+
+    if ((name = getenv("MAKEDIRCACHE")) == NULL || *name == '\0')
+	return;
+    if (*name == '/') {
+	if ((fd = open(name, O_RDWR)) == -1)
+	    return;
+    } else {
+	fd = mkTempFile("makedir.XXXXXX", &dcacheFile);
+	if (ftruncate(fd, DC_SIZE) == -1) {
+	    DirCacheRemove();
+	    (void)close(fd);
+	    return;
+	}
+    }
+    hdr = mmap(NULL, DC_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED) {
+	DirCacheRemove();
+	(void)close(fd);
+	return;
+    }
+    if (dcacheFile != NULL) {
+	memcpy(hdr->magic, DC_MAGIC, sizeof(hdr->magic));
+	hdr->entsize = sizeof(DirCacheEntry);
+	hdr->used = sizeof(*hdr);
+	setenv("MAKEDIRCACHE", dcacheFile, 1);
+	atexit(DirCacheRemove);
+    } else if (memcmp(hdr->magic, DC_MAGIC, sizeof(hdr->magic)) != 0 ||
+	hdr->entsize != sizeof(DirCacheEntry)) {
+	(void)munmap(hdr, DC_SIZE);
+	(void)close(fd);
+	return;
+    }
+    (void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+    dcacheFd = fd;
+    dcache = hdr;
+}
+
+static void
+DirCacheLock(int type)
+{
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    while (fcntl(dcacheFd, F_SETLKW, &fl) == -1 && errno == EINTR)
+	continue;
+}
+
+/*
+ * The key for name in the shared cache, possibly in buf.  Returns NULL
+ * if it is too long.
+ */
+static const char *
+DirCacheKey(const char *name, char *buf, size_t bufsz)
+{
+    if (*name == '/')
+	return name;
+    if (dcacheCwd == NULL) {
+	if (getcwd(buf, bufsz) == NULL)
+	    return NULL;
+	dcacheCwd = bmake_strdup(buf);
+    }
+    if (name[0] == '.' && name[1] == '\0')
+	return dcacheCwd;
+    if ((size_t)snprintf(buf, bufsz, "%s/%s", dcacheCwd, name) >= bufsz)
+	return NULL;
+    return buf;
+}
+
+static unsigned
+DirCacheHash(const char *key)
+{
+    unsigned h;
+
+    for (h = 0; *key != '\0'; key++)
+	h = (h << 5) - h + *key;
+    return h;
+}
+
+static DirCacheEntry *
+DirCacheFind(const char *key)
+{
+    DirCacheEntry *e;
+    unsigned h, off;
+
+    h = DirCacheHash(key);
+    for (off = dcache->buckets[h % DC_BUCKETS]; off != 0; off = e->next) {
+	e = (DirCacheEntry *)((char *)dcache + off);
+	if (e->hash == h && strcmp(e->name, key) == 0)
+	    return e;
+    }
+    return NULL;
+}
+
+/*
+ * Add a record for the directory key, with the names in files.  It is
+ * found before older records for the same key.  Nothing is added
+ * once the file is full.
+ */
+static void
+DirCacheAdd(const char *key, time_t mtime, time_t ctime, Hash_Table *files)
+{
+    DirCacheEntry *e;
+    Hash_Entry *he;
+    Hash_Search search;
+    size_t len, n;
+    unsigned nfiles;
+    char *cp;
+
+    len = sizeof(DirCacheEntry) + strlen(key);
+    nfiles = 0;
+    for (he = Hash_EnumFirst(files, &search); he != NULL;
+	 he = Hash_EnumNext(&search)) {
+	len += strlen(he->name) + 1;
+	nfiles++;
+    }
+    len = (len + 7) & ~(size_t)7;
+
+    DirCacheLock(F_WRLCK);
+    if (dcache->used + len <= DC_SIZE) {
+	e = (DirCacheEntry *)((char *)dcache + dcache->used);
+	e->hash = DirCacheHash(key);
+	e->mtime = mtime;
+	e->ctime = ctime;
+	e->nfiles = nfiles;
+	e->len = len;
+	n = strlen(key) + 1;
+	memcpy(e->name, key, n);
+	cp = e->name + n;
+	for (he = Hash_EnumFirst(files, &search); he != NULL;
+	     he = Hash_EnumNext(&search)) {
+	    n = strlen(he->name) + 1;
+	    memcpy(cp, he->name, n);
+	    cp += n;
+	}
+	e->next = dcache->buckets[e->hash % DC_BUCKETS];
+	dcache->buckets[e->hash % DC_BUCKETS] = dcache->used;
+	dcache->used += len;
+    }
+    DirCacheLock(F_UNLCK);
+}
+
 void
 Dir_Init(const char *cdname)
 {
     dirSearchPath = Lst_Init(FALSE);
     openDirectories = Lst_Init(FALSE);
     Hash_InitTable(&mtimes, 0);
+    DirCacheInit();
 
     Dir_InitCur(cdname);
 
@@ -333,6 +535,10 @@ Dir_InitDot(void)
 	(void)Lst_Remove(openDirectories, ln);
     }
 
+    /* we have moved to .OBJDIR */
+    free(dcacheCwd);
+    dcacheCwd = NULL;
+
     dot = Dir_AddDir(NULL, ".");
 
     if (dot == NULL) {
@@ -363,6 +569,15 @@ Dir_InitDot(void)
 void
 Dir_End(void)
 {
+    if (DEBUG(DIR) && dcache != NULL) {
+	/*
+	 * Reading a directory takes at least open, getdents and close
+	 * instead of the stat we used to check the record.
+	 */
+	fprintf(debug_file, "#*** Shared directory cache:\n");
+	fprintf(debug_file, "# %d directories reused, %d syscalls saved\n",
+		dcacheDirs, 2 * dcacheDirs);
+    }
 #ifdef CLEANUP
     if (cur) {
 	cur->refCount -= 1;
@@ -1028,6 +1243,53 @@ DirFindDot(Boolean hasSlash __unused, const char *name, const char *cp)
 	return NULL;
 }
 
+/*
+ * Tell the parse cache about the places in p where Dir_FindFile might
+ * find name.
+ */
+static void
+DirRecordIn(Path *p, const char *name, const char *cp)
+{
+    char *file;
+
+    file = str_concat(p->name, name, STR_ADDSLASH);
+    Parse_CachePath(file);
+    free(file);
+    if (cp != name) {
+	file = str_concat(p->name, cp, STR_ADDSLASH);
+	Parse_CachePath(file);
+	free(file);
+    }
+}
+
+/*
+ * Tell the parse cache about every place Dir_FindFile might find name
+ * in, so that a file appearing in an earlier place is noticed.
+ */
+static void
+DirRecordLookup(const char *name, Lst path)
+{
+    LstNode ln;
+    Path *p;
+    const char *cp;
+
+    Parse_CachePath(name);
+    if (*name == '/')
+	return;
+    cp = strrchr(name, '/');
+    cp = cp != NULL ? cp + 1 : name;
+    if (cur != NULL)
+	DirRecordIn(cur, name, cp);
+    if (Lst_Open(path) == FAILURE)
+	return;
+    while ((ln = Lst_Next(path)) != NULL) {
+	p = (Path *)Lst_Datum(ln);
+	if (p != dotLast)
+	    DirRecordIn(p, name, cp);
+    }
+    Lst_Close(path);
+}
+
 /*-
  *-----------------------------------------------------------------------
  * Dir_FindFile  --
@@ -1080,6 +1342,9 @@ Dir_FindFile(const char *name, Lst path)
 	fprintf(debug_file, "Searching for %s ...", name);
     }
 
+    if (Parse_CacheRecording())
+	DirRecordLookup(name, path);
+
     if (Lst_Open(path) == FAILURE) {
 	if (DEBUG(DIR)) {
 	    fprintf(debug_file, "couldn't open path, file not found\n");
@@ -1545,6 +1810,11 @@ Dir_AddDir(Lst path, const char *name)
     Path	  *p = NULL;  /* pointer to new Path structure */
     DIR     	  *d;	      /* for reading directory */
     struct dirent *dp;	      /* entry in directory */
+    struct stat	  st;	      /* of the directory, for the shared cache */
+    DirCacheEntry *e;
+    char	  buf[MAXPATHLEN];
+    const char	  *key, *cp;
+    unsigned	  i;
 
     if (strcmp(name, ".DOTLAST") == 0) {
 	ln = Lst_Find(path, name, DirFindName);
@@ -1569,6 +1839,34 @@ Dir_AddDir(Lst path, const char *name)
 	    fprintf(debug_file, "Caching %s ...", name);
 	}
 
+	key = NULL;
+	if (dcache != NULL &&
+	    (key = DirCacheKey(name, buf, sizeof(buf))) != NULL) {
+	    if (stat(name, &st) == -1 || !S_ISDIR(st.st_mode))
+		key = NULL;
+	    else if ((e = DirCacheFind(key)) != NULL &&
+		e->mtime == st.st_mtime && e->ctime == st.st_ctime) {
+		p = bmake_malloc(sizeof(Path));
+		p->name = bmake_strdup(name);
+		p->hits = 0;
+		p->refCount = 1;
+		Hash_InitTable(&p->files, -1);
+		cp = e->name + strlen(e->name) + 1;
+		for (i = 0; i < e->nfiles; i++) {
+		    (void)Hash_CreateEntry(&p->files, cp, NULL);
+		    cp += strlen(cp) + 1;
+		}
+		(void)Lst_AtEnd(openDirectories, p);
+		if (path != NULL)
+		    (void)Lst_AtEnd(path, p);
+		dcacheDirs++;
+		if (DEBUG(DIR)) {
+		    fprintf(debug_file, "done (shared cache)\n");
+		}
+		return p;
+	    }
+	}
+
 	if ((d = opendir(name)) != NULL) {
 	    p = bmake_malloc(sizeof(Path));
 	    p->name = bmake_strdup(name);
@@ -1590,6 +1888,12 @@ Dir_AddDir(Lst path, const char *name)
 		(void)Hash_CreateEntry(&p->files, dp->d_name, NULL);
 	    }
 	    (void)closedir(d);
+	    /*
+	     * A directory changed in the same second as we read it
+	     * might keep its mtime, so don't share its contents.
+	     */
+	    if (key != NULL && st.st_mtime < time(NULL) - 1)
+		DirCacheAdd(key, st.st_mtime, st.st_ctime, &p->files);
 	    (void)Lst_AtEnd(openDirectories, p);
 	    if (path != NULL)
 		(void)Lst_AtEnd(path, p);
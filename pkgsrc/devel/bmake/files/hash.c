@@ -98,15 +98,36 @@ __RCSID("$NetBSD: hash.c,v 1.4 2009/09/18 21:27:25 joerg Exp $");
  * defined:
  */
 
-static void RebuildTable(Hash_Table *);
+static void RebuildTable(Hash_Table *, int);
 
 /*
- * The following defines the ratio of # entries to # buckets
- * at which we rebuild the table to make it larger.
+ * Deleted entries leave this behind in their slot, so that the search
+ * for entries which were put into the table after them goes on.
+ */
+static Hash_Entry deletedEntry;
+#define	DELETED	(&deletedEntry)
+
+/*
+ * The table is rebuilt when more than rebuildLimit/4 of its slots
+ * are used.
  */
 
 #define rebuildLimit 3
 
+/*
+ * Keys like "V1", "V2", ... hash to neighbouring values, which would
+ * make long runs of used slots with linear probing, so the bits are
+ * mixed before use.
+ */
+#define	HASH_KEY(h, key, p)				\
+	do {						\
+		for ((h) = 0, (p) = (key); *(p);)	\
+			(h) = ((h) << 5) - (h) + *(p)++; \
+		(h) ^= (h) >> 16;			\
+		(h) *= 0x85ebca6bU;			\
+		(h) ^= (h) >> 13;			\
+	} while (0)
+
 /*
  *---------------------------------------------------------
  *
@@ -116,7 +137,7 @@ static void RebuildTable(Hash_Table *);
  *
  * Input:
  *	t		Structure to to hold table.
- *	numBuckets	How many buckets to create for starters. This
+ *	numBuckets	How many slots to create for starters. This
  *			number is rounded up to a power of two.   If
  *			<= 0, a reasonable default is chosen. The
  *			table will grow in size later as needed.
@@ -125,7 +146,7 @@ static void RebuildTable(Hash_Table *);
  *	None.
  *
  * Side Effects:
- *	Memory is allocated for the initial bucket area.
+ *	Memory is allocated for the initial slot area.
  *
  *---------------------------------------------------------
  */
@@ -134,7 +155,6 @@ void
 Hash_InitTable(Hash_Table *t, int numBuckets)
 {
 	int i;
-	struct Hash_Entry **hp;
 
 	/*
 	 * Round up the size to a power of two.
@@ -146,11 +166,11 @@ Hash_InitTable(Hash_Table *t, int numBuckets)
 			 continue;
 	}
 	t->numEntries = 0;
+	t->numDeleted = 0;
 	t->size = i;
 	t->mask = i - 1;
-	t->bucketPtr = hp = bmake_malloc(sizeof(*hp) * i);
-	while (--i >= 0)
-		*hp++ = NULL;
+	t->slots = bmake_malloc(sizeof(*t->slots) * i);
+	memset(t->slots, 0, sizeof(*t->slots) * i);
 }
 
 /*
@@ -174,22 +194,21 @@ Hash_InitTable(Hash_Table *t, int numBuckets)
 void
 Hash_DeleteTable(Hash_Table *t)
 {
-	struct Hash_Entry **hp, *h, *nexth = NULL;
+	Hash_Entry *e;
 	int i;
 
-	for (hp = t->bucketPtr, i = t->size; --i >= 0;) {
-		for (h = *hp++; h != NULL; h = nexth) {
-			nexth = h->next;
-			free(h);
-		}
+	for (i = 0; i < t->size; i++) {
+		e = t->slots[i].entry;
+		if (e != NULL && e != DELETED)
+			bmake_pfree(e, sizeof(*e) + strlen(e->name));
 	}
-	free(t->bucketPtr);
+	free(t->slots);
 
 	/*
 	 * Set up the hash table to cause memory faults on any future access
 	 * attempts until re-initialization.
 	 */
-	t->bucketPtr = NULL;
+	t->slots = NULL;
 }
 
 /*
@@ -217,16 +236,18 @@ Hash_DeleteTable(Hash_Table *t)
 Hash_Entry *
 Hash_FindEntry(Hash_Table *t, const char *key)
 {
-	Hash_Entry *e;
+	Hash_Slot *sp;
 	unsigned h;
 	const char *p;
+	int i;
 
-	for (h = 0, p = key; *p;)
-		h = (h << 5) - h + *p++;
-	p = key;
-	for (e = t->bucketPtr[h & t->mask]; e != NULL; e = e->next)
-		if (e->namehash == h && strcmp(e->name, p) == 0)
-			return (e);
+	HASH_KEY(h, key, p);
+	for (i = h & t->mask; (sp = &t->slots[i])->entry != NULL;
+	     i = (i + 1) & t->mask) {
+		if (sp->namehash == h && sp->entry != DELETED &&
+		    strcmp(sp->entry->name, key) == 0)
+			return (sp->entry);
+	}
 	return NULL;
 }
 
@@ -251,7 +272,7 @@ Hash_FindEntry(Hash_Table *t, const char *key)
  *	with the given key.
  *
  * Side Effects:
- *	Memory may be allocated, and the hash buckets may be modified.
+ *	Memory may be allocated, and the hash slots may be modified.
  *---------------------------------------------------------
  */
 
@@ -259,41 +280,53 @@ Hash_Entry *
 Hash_CreateEntry(Hash_Table *t, const char *key, Boolean *newPtr)
 {
 	Hash_Entry *e;
+	Hash_Slot *sp, *free_sp;
 	unsigned h;
 	const char *p;
-	int keylen;
-	struct Hash_Entry **hp;
+	int i, keylen;
 
 	/*
 	 * Hash the key.  As a side effect, save the length (strlen) of the
 	 * key in case we need to create the entry.
 	 */
-	for (h = 0, p = key; *p;)
-		h = (h << 5) - h + *p++;
+	HASH_KEY(h, key, p);
 	keylen = p - key;
-	p = key;
-	for (e = t->bucketPtr[h & t->mask]; e != NULL; e = e->next) {
-		if (e->namehash == h && strcmp(e->name, p) == 0) {
+	free_sp = NULL;
+	for (i = h & t->mask; (sp = &t->slots[i])->entry != NULL;
+	     i = (i + 1) & t->mask) {
+		if (sp->entry == DELETED) {
+			if (free_sp == NULL)
+				free_sp = sp;
+		} else if (sp->namehash == h &&
+		    strcmp(sp->entry->name, key) == 0) {
 			if (newPtr != NULL)
 				*newPtr = FALSE;
-			return (e);
+			return (sp->entry);
 		}
 	}
 
 	/*
-	 * The desired entry isn't there.  Before allocating a new entry,
-	 * expand the table if necessary (and this changes the resulting
-	 * bucket chain).
+	 * The desired entry isn't there.  Reuse the slot of a deleted
+	 * entry we passed, or take the empty one, first making room
+	 * if the table is getting full.
 	 */
-	if (t->numEntries >= rebuildLimit * t->size)
-		RebuildTable(t);
-	e = bmake_malloc(sizeof(*e) + keylen);
-	hp = &t->bucketPtr[h & t->mask];
-	e->next = *hp;
-	*hp = e;
+	if (free_sp != NULL) {
+		sp = free_sp;
+		t->numDeleted--;
+	} else if (4 * (t->numEntries + t->numDeleted + 1) >
+	    rebuildLimit * t->size) {
+		RebuildTable(t, 4 * (t->numEntries + 1) > 2 * t->size ?
+		    t->size << 1 : t->size);
+		for (i = h & t->mask; (sp = &t->slots[i])->entry != NULL;
+		     i = (i + 1) & t->mask)
+			continue;
+	}
+	e = bmake_palloc(sizeof(*e) + keylen);
 	Hash_SetValue(e, NULL);
 	e->namehash = h;
-	(void)strcpy(e->name, p);
+	memcpy(e->name, key, keylen + 1);
+	sp->namehash = h;
+	sp->entry = e;
 	t->numEntries++;
 
 	if (newPtr != NULL)
@@ -313,7 +346,8 @@ Hash_CreateEntry(Hash_Table *t, const char *key, Boolean *newPtr)
  *	None.
  *
  * Side Effects:
- *	Hash chain that entry lives in is modified and memory is freed.
+ *	The slot of the entry is marked deleted and memory is freed.
+ *	Searches with Hash_EnumNext in progress are not disturbed.
  *
  *---------------------------------------------------------
  */
@@ -321,16 +355,18 @@ Hash_CreateEntry(Hash_Table *t, const char *key, Boolean *newPtr)
 void
 Hash_DeleteEntry(Hash_Table *t, Hash_Entry *e)
 {
-	Hash_Entry **hp, *p;
+	Hash_Slot *sp;
+	int i;
 
 	if (e == NULL)
 		return;
-	for (hp = &t->bucketPtr[e->namehash & t->mask];
-	     (p = *hp) != NULL; hp = &p->next) {
-		if (p == e) {
-			*hp = p->next;
-			free(p);
+	for (i = e->namehash & t->mask; (sp = &t->slots[i])->entry != NULL;
+	     i = (i + 1) & t->mask) {
+		if (sp->entry == e) {
+			sp->entry = DELETED;
+			bmake_pfree(e, sizeof(*e) + strlen(e->name));
 			t->numEntries--;
+			t->numDeleted++;
 			return;
 		}
 	}
@@ -366,7 +402,6 @@ Hash_EnumFirst(Hash_Table *t, Hash_Search *searchPtr)
 {
 	searchPtr->tablePtr = t;
 	searchPtr->nextIndex = 0;
-	searchPtr->hashEntryPtr = NULL;
 	return Hash_EnumNext(searchPtr);
 }
 
@@ -397,67 +432,51 @@ Hash_EnumNext(Hash_Search *searchPtr)
 	Hash_Entry *e;
 	Hash_Table *t = searchPtr->tablePtr;
 
-	/*
-	 * The hashEntryPtr field points to the most recently returned
-	 * entry, or is nil if we are starting up.  If not nil, we have
-	 * to start at the next one in the chain.
-	 */
-	e = searchPtr->hashEntryPtr;
-	if (e != NULL)
-		e = e->next;
-	/*
-	 * If the chain ran out, or if we are starting up, we need to
-	 * find the next nonempty chain.
-	 */
-	while (e == NULL) {
-		if (searchPtr->nextIndex >= t->size)
-			return NULL;
-		e = t->bucketPtr[searchPtr->nextIndex++];
+	while (searchPtr->nextIndex < t->size) {
+		e = t->slots[searchPtr->nextIndex++].entry;
+		if (e != NULL && e != DELETED)
+			return (e);
 	}
-	searchPtr->hashEntryPtr = e;
-	return (e);
+	return NULL;
 }
 
 /*
  *---------------------------------------------------------
  *
  * RebuildTable --
- *	This local routine makes a new hash table that
- *	is larger than the old one.
+ *	This local routine moves the entries into a new slot
+ *	array of the given size, dropping the deleted ones.
  *
  * Results:
  * 	None.
  *
  * Side Effects:
- *	The entire hash table is moved, so any bucket numbers
+ *	The entire hash table is moved, so any slot numbers
  *	from the old table are invalid.
  *
  *---------------------------------------------------------
  */
 
 static void
-RebuildTable(Hash_Table *t)
+RebuildTable(Hash_Table *t, int size)
 {
-	Hash_Entry *e, *next = NULL, **hp, **xp;
-	int i, mask;
-        Hash_Entry **oldhp;
-	int oldsize;
-
-	oldhp = t->bucketPtr;
-	oldsize = i = t->size;
-	i <<= 1;
-	t->size = i;
-	t->mask = mask = i - 1;
-	t->bucketPtr = hp = bmake_malloc(sizeof(*hp) * i);
-	while (--i >= 0)
-		*hp++ = NULL;
-	for (hp = oldhp, i = oldsize; --i >= 0;) {
-		for (e = *hp++; e != NULL; e = next) {
-			next = e->next;
-			xp = &t->bucketPtr[e->namehash & mask];
-			e->next = *xp;
-			*xp = e;
-		}
+	Hash_Slot *oldslots, *sp;
+	Hash_Entry *e;
+	int i, j, oldsize;
+
+	oldslots = t->slots;
+	oldsize = t->size;
+	Hash_InitTable(t, size);
+	for (i = 0; i < oldsize; i++) {
+		e = oldslots[i].entry;
+		if (e == NULL || e == DELETED)
+			continue;
+		for (j = e->namehash & t->mask;
+		     (sp = &t->slots[j])->entry != NULL; j = (j + 1) & t->mask)
+			continue;
+		sp->namehash = e->namehash;
+		sp->entry = e;
+		t->numEntries++;
 	}
-	free(oldhp);
+	free(oldslots);
 }
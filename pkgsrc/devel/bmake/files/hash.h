@@ -86,9 +86,6 @@
  */
 
 typedef struct Hash_Entry {
-    struct Hash_Entry *next;		/* Used to link together all the
-    					 * entries associated with the same
-					 * bucket. */
     union {
 	void	      *clientPtr;	/* Arbitrary pointer */
 	time_t	      clientTime;	/* Arbitrary Time */
@@ -97,11 +94,21 @@ typedef struct Hash_Entry {
     char	      name[1];		/* key string */
 } Hash_Entry;
 
+/*
+ * The table is open addressed with linear probing.  The hash value is
+ * kept next to the entry pointer, so that a probe does not have to look
+ * at the entries which cannot match.
+ */
+typedef struct Hash_Slot {
+    unsigned	      namehash;		/* hash value of entry's key */
+    struct Hash_Entry *entry;		/* NULL if never used */
+} Hash_Slot;
+
 typedef struct Hash_Table {
-    struct Hash_Entry **bucketPtr;/* Pointers to Hash_Entry, one
-    				 * for each bucket in the table. */
+    struct Hash_Slot *slots;	/* size slots */
     int 	size;		/* Actual size of array. */
     int 	numEntries;	/* Number of entries in the table. */
+    int 	numDeleted;	/* Number of slots of deleted entries. */
     int 	mask;		/* Used to select bits for hashing. */
 } Hash_Table;
 
@@ -112,8 +119,7 @@ typedef struct Hash_Table {
 
 typedef struct Hash_Search {
     Hash_Table  *tablePtr;	/* Table being searched. */
-    int 	nextIndex;	/* Next bucket to check (after current). */
-    Hash_Entry 	*hashEntryPtr;	/* Next entry to check in current bucket. */
+    int 	nextIndex;	/* Next slot to check. */
 } Hash_Search;
 
 /*
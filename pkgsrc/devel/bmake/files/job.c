@@ -1363,13 +1363,13 @@ JobExec(Job *job, char **argv)
 	(void)fcntl(0, F_SETFD, 0);
 	(void)lseek(0, (off_t)0, SEEK_SET);
 
-	if (job->node->type & OP_MAKE) {
-		/*
-		 * Pass job token pipe to submakes.
-		 */
-		fcntl(tokenWaitJob.inPipe, F_SETFD, 0);
-		fcntl(tokenWaitJob.outPipe, F_SETFD, 0);		
-	}
+	/*
+	 * Pass job token pipe to submakes.  Not only to those marked
+	 * .MAKE: gmake, ninja and cargo started from any command take
+	 * their tokens from it, too.
+	 */
+	fcntl(tokenWaitJob.inPipe, F_SETFD, 0);
+	fcntl(tokenWaitJob.outPipe, F_SETFD, 0);
 	
 	/*
 	 * Set up the child's output to be routed through the pipe
@@ -2798,6 +2798,13 @@ JobTokenAdd(void)
 {
     char tok = JOB_TOKENS[aborting], tok1;
 
+    /*
+     * A GNU make style job server only knows plain tokens, and the
+     * pipe holds tokens of makes which are not ours to take away.
+     */
+    if (jobServerForeign)
+	tok = '+';
+
     /* If we are depositing an error token flush everything else */
     while (tok != '+' && read(tokenWaitJob.inPipe, &tok1, 1) == 1)
 	continue;
@@ -2826,6 +2833,8 @@ Job_ServerStart(int max_tokens, int jp_0, int jp_1)
 	/* Pipe passed in from parent */
 	tokenWaitJob.inPipe = jp_0;
 	tokenWaitJob.outPipe = jp_1;
+	/* GNU make does the same, but a fifo is opened by us */
+	(void)fcntl(jp_0, F_SETFL, fcntl(jp_0, F_GETFL, 0) | O_NONBLOCK);
 	return;
     }
 
@@ -2837,6 +2846,14 @@ Job_ServerStart(int max_tokens, int jp_0, int jp_1)
     Var_Append(MAKEFLAGS, "-J", VAR_GLOBAL);
     Var_Append(MAKEFLAGS, jobarg, VAR_GLOBAL);			
 
+    /*
+     * Offer the same pipe to GNU make, ninja, cargo and friends, so
+     * that they share our token budget instead of adding their own.
+     */
+    snprintf(jobarg, sizeof(jobarg), "--jobserver-auth=%d,%d",
+	    tokenWaitJob.inPipe, tokenWaitJob.outPipe);
+    Var_Append(MAKEFLAGS, jobarg, VAR_GLOBAL);
+
     /*
      * Preload the job pipe with one token per job, save the one
      * "extra" token for the primary job.
@@ -2863,7 +2880,8 @@ Job_TokenReturn(void)
     jobTokensRunning--;
     if (jobTokensRunning < 0)
 	Punt("token botch");
-    if (jobTokensRunning || JOB_TOKENS[aborting] != '+')
+    if (jobTokensRunning ||
+	(JOB_TOKENS[aborting] != '+' && !jobServerForeign))
 	JobTokenAdd();
 }
 
@@ -2911,7 +2929,7 @@ Job_TokenWithdraw(void)
 	return FALSE;
     }
 
-    if (count == 1 && tok != '+') {
+    if (count == 1 && tok != '+' && !jobServerForeign) {
 	/* make being abvorted - remove any other job tokens */
 	if (DEBUG(JOB))
 	    fprintf(debug_file, "(%d) aborted by token %c\n", getpid(), tok);
@@ -125,7 +125,7 @@ Lst_Concat(Lst l1, Lst l2, int flags)
 	    list1->firstPtr->prevPtr = list1->lastPtr;
 	    list1->lastPtr->nextPtr = list1->firstPtr;
 	}
-	free(l2);
+	PFree(list2);
     } else if (list2->firstPtr != NULL) {
 	/*
 	 * We set the nextPtr of the last element of list 2 to be nil to make
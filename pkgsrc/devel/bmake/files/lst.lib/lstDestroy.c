@@ -80,7 +80,7 @@ Lst_Destroy(Lst list, FreeProc *freeProc)
     if (list->lastPtr != NULL)
 	list->lastPtr->nextPtr = NULL;
     else {
-	free(list);
+	PFree(list);
 	return;
     }
 
@@ -88,14 +88,14 @@ Lst_Destroy(Lst list, FreeProc *freeProc)
 	for (ln = list->firstPtr; ln != NULL; ln = tln) {
 	     tln = ln->nextPtr;
 	     freeProc(ln->datum);
-	     free(ln);
+	     PFree(ln);
 	}
     } else {
 	for (ln = list->firstPtr; ln != NULL; ln = tln) {
 	     tln = ln->nextPtr;
-	     free(ln);
+	     PFree(ln);
 	}
     }
 
-    free(list);
+    PFree(list);
 }
@@ -115,7 +115,7 @@ Lst_ForEachFrom(Lst l, LstNode ln, int (*proc)(void *, void *),
 	}
 
 	if (tln->flags & LN_DELETED) {
-	    free((char *)tln);
+	    PFree(tln);
 	}
 	tln = next;
     } while (!result && !LstIsEmpty(list) && !done);
@@ -81,8 +81,12 @@ typedef struct	List {
 /*
  * PAlloc (var, ptype) --
  *	Allocate a pointer-typedef structure 'ptype' into the variable 'var'
+ *
+ * PFree (var) --
+ *	Release a structure allocated by PAlloc
  */
-#define	PAlloc(var,ptype)	var = (ptype) bmake_malloc(sizeof *(var))
+#define	PAlloc(var,ptype)	var = (ptype) bmake_palloc(sizeof *(var))
+#define	PFree(var)		bmake_pfree((var), sizeof *(var))
 
 /*
  * LstValid (l) --
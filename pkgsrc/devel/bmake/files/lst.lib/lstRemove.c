@@ -126,7 +126,7 @@ Lst_Remove(Lst l, LstNode ln)
      * necessary and as expected.
      */
     if (lNode->useCount == 0) {
-	free(ln);
+	PFree(lNode);
     } else {
 	lNode->flags |= LN_DELETED;
     }
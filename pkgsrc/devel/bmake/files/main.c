@@ -170,15 +170,19 @@ Boolean			oldVars;	/* variable substitution style */
 Boolean			checkEnvFirst;	/* -e flag */
 Boolean			parseWarnFatal;	/* -W flag */
 Boolean			jobServer; 	/* -J flag */
+Boolean			jobServerForeign; /* --jobserver-auth from GNU make */
 static int jp_0 = -1, jp_1 = -1;	/* ends of parent job pipe */
 Boolean			varNoExportEnv;	/* -X flag */
 Boolean			doing_depend;	/* Set while reading .depend */
 static Boolean		jobsRunning;	/* TRUE if the jobs might be running */
+static Boolean		scanServer;	/* -Q flag */
 static const char *	tracefile;
 #ifndef NO_CHECK_MAKE_CHDIR
 static char *		Check_Cwd_av(int, char **, int);
 #endif
 static void		MainParseArgs(int, char **);
+static void		MainFindObjdir(const char *);
+static void		ScanServer(const char *);
 static int		ReadMakefile(const void *, const void *);
 static void		usage(void);
 
@@ -324,6 +328,51 @@ debug_setbuf:
 	}
 }
 
+/*-
+ * MainParseLongArg --
+ *	Handle a --long option.  The only ones understood are the
+ *	job server options of GNU make, --jobserver-auth=R,W (or the
+ *	older --jobserver-fds=R,W) and --jobserver-auth=fifo:PATH,
+ *	so that a make, ninja or cargo further up the tree can hand
+ *	us its token pipe.  Other long options, which GNU make puts
+ *	into MAKEFLAGS, are ignored.
+ */
+static void
+MainParseLongArg(const char *arg)
+{
+	const char *value;
+	char *opt;
+	int fd;
+
+	if (strncmp(arg, "jobserver-auth=", 15) == 0)
+		value = arg + 15;
+	else if (strncmp(arg, "jobserver-fds=", 14) == 0)
+		value = arg + 14;
+	else
+		return;
+
+	if (!jobServer) {
+		if (strncmp(value, "fifo:", 5) == 0) {
+			if ((fd = open(value + 5, O_RDWR)) == -1)
+				return;
+			jp_0 = jp_1 = fd;
+		} else if (sscanf(value, "%d,%d", &jp_0, &jp_1) != 2 ||
+		    fcntl(jp_0, F_GETFD, 0) < 0 ||
+		    fcntl(jp_1, F_GETFD, 0) < 0) {
+			/* As for -J, we were not meant to run parallel */
+			jp_0 = -1;
+			jp_1 = -1;
+			compatMake = TRUE;
+			return;
+		}
+		jobServer = TRUE;
+		jobServerForeign = TRUE;
+	}
+	opt = str_concat("--jobserver-auth=", value, 0);
+	Var_Append(MAKEFLAGS, opt, VAR_GLOBAL);
+	free(opt);
+}
+
 /*-
  * MainParseArgs --
  *	Parse a given argument vector. Called from main() and from
@@ -350,7 +399,7 @@ MainParseArgs(int argc, char **argv)
 	Boolean inOption, dashDash = FALSE;
 	char found_path[MAXPATHLEN + 1];	/* for searching for sys.mk */
 
-#define OPTFLAGS "BC:D:I:J:NST:V:WXd:ef:ij:km:nqrst"
+#define OPTFLAGS "BC:D:I:J:NQST:V:WXd:ef:ij:km:nqrst"
 /* Can't actually use getopt(3) because rescanning is not portable */
 
 	getopt_def = OPTFLAGS;
@@ -373,6 +422,12 @@ rearg:
 		} else {
 			if (c != '-' || dashDash)
 				break;
+			if (*optscan == '-' && optscan[1] != '\0') {
+				MainParseLongArg(optscan + 1);
+				++argv;
+				--argc;
+				continue;
+			}
 			inOption = TRUE;
 			c = *optscan++;
 		}
@@ -451,6 +506,7 @@ rearg:
 			    Var_Append(MAKEFLAGS, "-J", VAR_GLOBAL);
 			    Var_Append(MAKEFLAGS, argvalue, VAR_GLOBAL);
 			    jobServer = TRUE;
+			    jobServerForeign = FALSE;
 			}
 			break;
 		case 'N':
@@ -458,6 +514,10 @@ rearg:
 			noRecursiveExecute = TRUE;
 			Var_Append(MAKEFLAGS, "-N", VAR_GLOBAL);
 			break;
+		case 'Q':
+			/* Not passed on, sub-makes must not read stdin. */
+			scanServer = TRUE;
+			break;
 		case 'S':
 			keepgoing = FALSE;
 			Var_Append(MAKEFLAGS, "-S", VAR_GLOBAL);
@@ -665,6 +725,105 @@ Main_ParseArgLine(const char *line)
 	free(argv);
 }
 
+/*-
+ * MainFindObjdir --
+ *	Find the .OBJDIR for curdir.  If MAKEOBJDIRPREFIX, or failing that,
+ *	MAKEOBJDIR is set in the environment, try only that value
+ *	and fall back to .CURDIR if it does not exist.
+ *
+ *	Otherwise, try _PATH_OBJDIR.MACHINE, _PATH_OBJDIR, and
+ *	finally _PATH_OBJDIRPREFIX`pwd`, in that order.  If none
+ *	of these paths exist, just use .CURDIR.
+ */
+static void
+MainFindObjdir(const char *machine)
+{
+	char mdpath[MAXPATHLEN];
+	char *path;
+
+	(void)Main_SetObjdir(curdir);
+
+	if ((path = getenv("MAKEOBJDIRPREFIX")) != NULL) {
+		(void)snprintf(mdpath, MAXPATHLEN, "%s%s", path, curdir);
+		(void)Main_SetObjdir(mdpath);
+	} else if ((path = getenv("MAKEOBJDIR")) != NULL) {
+		(void)Main_SetObjdir(path);
+	} else {
+		(void)snprintf(mdpath, MAXPATHLEN, "%s.%s", _PATH_OBJDIR, machine);
+		if (!Main_SetObjdir(mdpath) && !Main_SetObjdir(_PATH_OBJDIR)) {
+			(void)snprintf(mdpath, MAXPATHLEN, "%s%s", 
+					_PATH_OBJDIRPREFIX, curdir);
+			(void)Main_SetObjdir(mdpath);
+		}
+	}
+}
+
+/*-
+ * ScanServer --
+ *	Implement -Q.  Read directory names from stdin, one per line.
+ *	For each directory, fork a child that continues like a make
+ *	started there with the system makefile already read.  After the
+ *	child exited, write a NUL byte, its exit status and a newline
+ *	to stdout.
+ *
+ * Results:
+ *	Returns only in the child.  The server exits at end of input.
+ */
+static void
+ScanServer(const char *machine)
+{
+	char dir[MAXPATHLEN + 2], tmp[64];
+	size_t len;
+	pid_t pid;
+	int fd, status;
+
+	while (fgets(dir, sizeof(dir), stdin) != NULL) {
+		len = strlen(dir);
+		if (dir[len - 1] != '\n')
+			Fatal("%s: directory name too long.", progname);
+		dir[len - 1] = '\0';
+
+		(void)fflush(stdout);
+		(void)fflush(debug_file);
+		if ((pid = fork()) == -1)
+			Fatal("%s: fork: %s.", progname, strerror(errno));
+		if (pid == 0) {
+			/* Keep commands from consuming the requests. */
+			if ((fd = open("/dev/null", O_RDONLY)) != -1) {
+				(void)dup2(fd, STDIN_FILENO);
+				(void)close(fd);
+			}
+			if (chdir(dir) == -1 ||
+			    getcwd(curdir, MAXPATHLEN) == NULL) {
+				(void)fprintf(stderr, "%s: chdir %s: %s\n",
+				    progname, dir, strerror(errno));
+				exit(2);
+			}
+			myPid = getpid();
+			snprintf(tmp, sizeof(tmp), "%u", myPid);
+			Var_Set(".MAKE.PID", tmp, VAR_GLOBAL, 0);
+			snprintf(tmp, sizeof(tmp), "%u", getppid());
+			Var_Set(".MAKE.PPID", tmp, VAR_GLOBAL, 0);
+			Var_Set(".CURDIR", curdir, VAR_GLOBAL, 0);
+			Dir_InitCur(curdir);
+			MainFindObjdir(machine);
+			return;
+		}
+		while (waitpid(pid, &status, 0) == -1) {
+			if (errno != EINTR) {
+				status = 2 << 8;
+				break;
+			}
+		}
+		if (WIFEXITED(status))
+			printf("%c%d\n", '\0', WEXITSTATUS(status));
+		else
+			printf("%c%d\n", '\0', 128 + WTERMSIG(status));
+		(void)fflush(stdout);
+	}
+	exit(0);
+}
+
 Boolean
 Main_SetObjdir(const char *path)
 {
@@ -806,6 +965,7 @@ main(int argc, char **argv)
 	const char *machine_arch = getenv("MACHINE_ARCH");
 	char *syspath = getenv("MAKESYSPATH");
 	Lst sysMkPath;			/* Path of sys.mk */
+	Boolean parseCached;		/* makefiles read from parse cache */
 	char *cp = NULL, *start;
 					/* avoid faults on read-only strings */
 	static char defsyspath[] = _PATH_DEFSYSPATH;
@@ -1040,30 +1200,10 @@ main(int argc, char **argv)
 	Var_Set(".CURDIR", curdir, VAR_GLOBAL, 0);
 
 	/*
-	 * Find the .OBJDIR.  If MAKEOBJDIRPREFIX, or failing that,
-	 * MAKEOBJDIR is set in the environment, try only that value
-	 * and fall back to .CURDIR if it does not exist.
-	 *
-	 * Otherwise, try _PATH_OBJDIR.MACHINE, _PATH_OBJDIR, and
-	 * finally _PATH_OBJDIRPREFIX`pwd`, in that order.  If none
-	 * of these paths exist, just use .CURDIR.
+	 * Find the .OBJDIR.
 	 */
 	Dir_Init(curdir);
-	(void)Main_SetObjdir(curdir);
-
-	if ((path = getenv("MAKEOBJDIRPREFIX")) != NULL) {
-		(void)snprintf(mdpath, MAXPATHLEN, "%s%s", path, curdir);
-		(void)Main_SetObjdir(mdpath);
-	} else if ((path = getenv("MAKEOBJDIR")) != NULL) {
-		(void)Main_SetObjdir(path);
-	} else {
-		(void)snprintf(mdpath, MAXPATHLEN, "%s.%s", _PATH_OBJDIR, machine);
-		if (!Main_SetObjdir(mdpath) && !Main_SetObjdir(_PATH_OBJDIR)) {
-			(void)snprintf(mdpath, MAXPATHLEN, "%s%s", 
-					_PATH_OBJDIRPREFIX, curdir);
-			(void)Main_SetObjdir(mdpath);
-		}
-	}
+	MainFindObjdir(machine);
 
 	/*
 	 * Be compatible if user did not specify -j and did not explicitly
@@ -1139,7 +1279,12 @@ main(int argc, char **argv)
 	 * makefile, if it was (makefile != NULL), or the default
 	 * makefile and Makefile, in that order, if it wasn't.
 	 */
-	if (!noBuiltins) {
+	parseCached = FALSE;
+	if (!scanServer && (p1 = getenv("MAKEPARSECACHE")) != NULL &&
+	    *p1 != '\0')
+		parseCached = Parse_CacheStart(p1, argv);
+
+	if (!noBuiltins && !parseCached) {
 		LstNode ln;
 
 		sysMkPath = Lst_Init(FALSE);
@@ -1155,7 +1300,13 @@ main(int argc, char **argv)
 			    (char *)Lst_Datum(ln));
 	}
 
-	if (!Lst_IsEmpty(makefiles)) {
+	/* Only returns in a child for the next directory. */
+	if (scanServer)
+		ScanServer(machine);
+
+	if (parseCached) {
+		/* Already loaded from the parse cache. */
+	} else if (!Lst_IsEmpty(makefiles)) {
 		LstNode ln;
 
 		ln = Lst_Find(makefiles, NULL, ReadAllMakefiles);
@@ -1171,6 +1322,7 @@ main(int argc, char **argv)
 		free(p1);
 	    }
 	}
+	Parse_CacheEnd();
 
 	/* In particular suppress .depend for '-r -V .OBJDIR -f /dev/null' */
 	if (!noBuiltins || !printVars) {
@@ -1355,6 +1507,7 @@ ReadMakefile(const void *p, const void *q __unused)
 			
 			(void)snprintf(path, len, "%s/%s", curdir, fname);
 			fd = open(path, O_RDONLY);
+			Parse_CachePath(path);
 			if (fd != -1) {
 				fname = path;
 				goto found;
@@ -1366,12 +1519,14 @@ ReadMakefile(const void *p, const void *q __unused)
 				path = bmake_realloc(path, len = 2 * plen);
 			(void)snprintf(path, len, "%s/%s", objdir, fname);
 			fd = open(path, O_RDONLY);
+			Parse_CachePath(path);
 			if (fd != -1) {
 				fname = path;
 				goto found;
 			}
 		} else {
 			fd = open(fname, O_RDONLY);
+			Parse_CachePath(fname);
 			if (fd != -1)
 				goto found;
 		}
@@ -1393,8 +1548,10 @@ ReadMakefile(const void *p, const void *q __unused)
 		 * makefile specified, as it is set by SysV make.
 		 */
 found:
-		if (!doing_depend)
+		if (!doing_depend) {
 			Var_Set("MAKEFILE", fname, VAR_GLOBAL, 0);
+			Parse_CacheVar("MAKEFILE", fname);
+		}
 		Parse_File(fname, fd);
 	}
 	free(path);
@@ -1737,6 +1894,7 @@ Cmd_Exec(const char *cmd, const char **errnum)
 	    }
 	    cp--;
 	}
+	Parse_CacheCommand(cmd, res);
 	break;
     }
     return res;
@@ -1763,6 +1921,8 @@ Error(const char *fmt, ...)
 	va_list ap;
 	FILE *err_file;
 
+	Parse_CacheAbort("diagnostics printed");
+
 	err_file = debug_file;
 	if (err_file == stdout)
 		err_file = stderr;
@@ -1943,7 +2103,7 @@ static void
 usage(void)
 {
 	(void)fprintf(stderr,
-"usage: %s [-BeikNnqrstWX] \n\
+"usage: %s [-BeikNnQqrstWX] \n\
             [-C directory] [-D variable] [-d flags] [-f makefile]\n\
             [-I directory] [-J private] [-j max_jobs] [-m directory] [-T file]\n\
             [-V variable] [variable=value] [target ...]\n", progname);
@@ -384,6 +384,7 @@ extern Boolean	doing_depend;	/* TRUE if processing .depend */
 extern Boolean	checkEnvFirst;	/* TRUE if environment should be searched for
 				 * variables before the global context */
 extern Boolean	jobServer;	/* a jobServer already exists */
+extern Boolean	jobServerForeign; /* ... and it isn't a bmake */
 
 extern Boolean	parseWarnFatal;	/* TRUE if makefile parsing warnings are
 				 * treated as errors */
@@ -117,3 +117,70 @@ bmake_realloc(void *ptr, size_t size)
 	return(ptr);
 }
 #endif
+
+/*
+ * Small objects which are allocated and freed in great numbers (list
+ * nodes, hash entries, variables and targets) are carved from large
+ * chunks and recycled through one free list per size class, instead
+ * of a malloc(3) each.  The caller must pass the size it asked for to
+ * bmake_pfree.
+ */
+#define	POOL_ALIGN	16		/* size classes are multiples of this */
+#define	POOL_MAX	256		/* larger objects use malloc */
+#define	POOL_CHUNK	65536
+
+struct pool_free {
+	struct pool_free *next;
+};
+
+static struct pool_free *pool_freelist[POOL_MAX / POOL_ALIGN];
+static char *pool_next, *pool_end;
+
+/*
+ * bmake_palloc --
+ *	allocate len bytes from the pool, die on error.
+ */
+void *
+bmake_palloc(size_t len)
+{
+	struct pool_free **fp, *p;
+
+	if (len == 0 || len > POOL_MAX)
+		return bmake_malloc(len);
+	len = (len + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+	fp = &pool_freelist[len / POOL_ALIGN - 1];
+	if ((p = *fp) != NULL) {
+		*fp = p->next;
+		return p;
+	}
+	if (pool_next == NULL || (size_t)(pool_end - pool_next) < len) {
+		/* the rest of the old chunk is lost, it is < POOL_MAX */
+		pool_next = bmake_malloc(POOL_CHUNK);
+		pool_end = pool_next + POOL_CHUNK;
+	}
+	p = (struct pool_free *)pool_next;
+	pool_next += len;
+	return p;
+}
+
+/*
+ * bmake_pfree --
+ *	return an object of len bytes from bmake_palloc to the pool.
+ */
+void
+bmake_pfree(void *ptr, size_t len)
+{
+	struct pool_free *p = ptr;
+	struct pool_free **fp;
+
+	if (ptr == NULL)
+		return;
+	if (len == 0 || len > POOL_MAX) {
+		free(ptr);
+		return;
+	}
+	len = (len + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+	fp = &pool_freelist[len / POOL_ALIGN - 1];
+	p->next = *fp;
+	*fp = p;
+}
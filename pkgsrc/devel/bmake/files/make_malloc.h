@@ -39,3 +39,6 @@ char *bmake_strndup(const char *, size_t);
 #define bmake_strndup(x,y)      estrndup(x,y)
 #endif
 
+
+void *bmake_palloc(size_t);
+void bmake_pfree(void *, size_t);
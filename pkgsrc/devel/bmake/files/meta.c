@@ -53,6 +53,21 @@
 #if !defined(USE_FILEMON) && defined(FILEMON_SET_FD)
 # define USE_FILEMON
 #endif
+#if !defined(USE_FILEMON) && defined(__linux__)
+# include <sys/ptrace.h>
+# ifdef PTRACE_GET_SYSCALL_INFO
+#  define USE_FILEMON
+#  define USE_FILEMON_PTRACE
+#  include <sys/prctl.h>
+#  include <sys/socket.h>
+#  include <sys/syscall.h>
+#  include <sys/uio.h>
+#  include <sys/wait.h>
+#  include <dirent.h>
+#  include <signal.h>
+#  include <stdarg.h>
+# endif
+#endif
 
 static BuildMon Mybm;			/* for compat */
 static Lst metaBailiwick;			/* our scope of control */
@@ -98,7 +113,510 @@ extern Boolean comatMake;
  * We can still use meta mode without filemon, but 
  * the benefits are more limited.
  */
-#ifdef USE_FILEMON
+#ifdef USE_FILEMON_PTRACE
+/*
+ * Linux has no filemon device, so a tracer process follows the
+ * commands with ptrace(2) and writes the same records filemon would.
+ *
+ * filemon_open() starts the tracer, which is not our child, and keeps
+ * one end of a socket to it in filemon_fd.  For each command, the
+ * tracer sends its pid; the child allows it to trace (needed with
+ * Yama), sends its own pid and waits until it is attached.  When the
+ * command exits the tracer detaches from any processes left behind
+ * and waits for the next one; it exits when we close the socket.
+ */
+typedef struct {
+    pid_t	pid;
+    long	nr;			/* syscall in progress or -1 */
+    int		flags;			/* open(2) flags */
+    char	path[MAXPATHLEN];
+    char	path2[MAXPATHLEN];
+} Tracee;
+
+static Tracee *tracees;
+static int ntracees, maxtracees;
+static int traceFd;			/* where records go */
+static unsigned int traceArch;		/* AUDIT_ARCH of the command */
+
+static Tracee *
+tracee_find(pid_t pid, Boolean create)
+{
+    Tracee *tp;
+    int i;
+
+    for (i = 0; i < ntracees; i++)
+	if (tracees[i].pid == pid)
+	    return &tracees[i];
+    if (!create)
+	return NULL;
+    if (ntracees == maxtracees) {
+	maxtracees = maxtracees ? maxtracees * 2 : 16;
+	tracees = bmake_realloc(tracees, maxtracees * sizeof(*tracees));
+    }
+    tp = &tracees[ntracees++];
+    tp->pid = pid;
+    tp->nr = -1;
+    return tp;
+}
+
+static void
+tracee_remove(pid_t pid)
+{
+    Tracee *tp;
+
+    if ((tp = tracee_find(pid, FALSE)) != NULL)
+	*tp = tracees[--ntracees];
+}
+
+static void
+tracer_record(const char *fmt, ...)
+{
+    char buf[2 * MAXPATHLEN + 64];
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n >= (int)sizeof(buf))
+	n = sizeof(buf) - 1;
+    if (n > 0)
+	(void)write(traceFd, buf, n);
+}
+
+/*
+ * Copy a string from the tracee, resolving a relative path against
+ * atfd unless that is AT_FDCWD.  Paths that don't fit are an error.
+ */
+static int
+tracer_path(pid_t pid, long atfd, unsigned long addr, char *buf, size_t bufsz)
+{
+    char tmp[MAXPATHLEN], dir[MAXPATHLEN], link[64];
+    struct iovec local, remote;
+    size_t off, len;
+    ssize_t n;
+    int rc;
+
+    for (off = 0; ; off += n) {
+	if (off == sizeof(tmp))
+	    return -1;			/* no terminating NUL */
+	/* one page at a time, the next one may not be mapped */
+	len = 4096 - ((addr + off) & 4095);
+	if (len > sizeof(tmp) - off)
+	    len = sizeof(tmp) - off;
+	local.iov_base = tmp + off;
+	local.iov_len = len;
+	remote.iov_base = (void *)(addr + off);
+	remote.iov_len = len;
+	if ((n = process_vm_readv(pid, &local, 1, &remote, 1, 0)) <= 0)
+	    return -1;
+	if (memchr(tmp + off, '\0', n) != NULL)
+	    break;
+    }
+
+    if (tmp[0] == '/' || (int)atfd == AT_FDCWD) {
+	if ((len = strlen(tmp)) >= bufsz)
+	    return -1;
+	memcpy(buf, tmp, len + 1);
+	return 0;
+    }
+    snprintf(link, sizeof(link), "/proc/%d/fd/%d", pid, (int)atfd);
+    if ((n = readlink(link, dir, sizeof(dir))) < 0 ||
+	(size_t)n == sizeof(dir))
+	return -1;
+    dir[n] = '\0';
+    rc = snprintf(buf, bufsz, "%s/%s", dir, tmp);
+    if (rc < 0 || (size_t)rc >= bufsz)
+	return -1;
+    return 0;
+}
+
+/*
+ * Handle a syscall stop: remember the arguments on entry and write a
+ * record on successful return.
+ */
+static void
+tracer_syscall(Tracee *tp)
+{
+    struct __ptrace_syscall_info info;
+    unsigned long *a;
+    char link[64];
+    ssize_t n;
+    int ok;
+
+    if (ptrace(PTRACE_GET_SYSCALL_INFO, tp->pid, sizeof(info), &info) <= 0)
+	return;
+    if (info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+	tp->nr = -1;
+	if (traceArch == 0)
+	    traceArch = info.arch;
+	if (info.arch != traceArch)
+	    return;			/* different syscall numbers */
+	a = (unsigned long *)info.entry.args;
+	ok = 0;
+	tp->flags = 0;
+	switch (info.entry.nr) {
+#ifdef SYS_open
+	case SYS_open:
+	    tp->flags = a[1];
+	    ok = tracer_path(tp->pid, AT_FDCWD, a[0], tp->path, MAXPATHLEN);
+	    break;
+#endif
+#ifdef SYS_creat
+	case SYS_creat:
+	    tp->flags = O_WRONLY;
+	    ok = tracer_path(tp->pid, AT_FDCWD, a[0], tp->path, MAXPATHLEN);
+	    break;
+#endif
+	case SYS_openat:
+	    tp->flags = a[2];
+	    ok = tracer_path(tp->pid, a[0], a[1], tp->path, MAXPATHLEN);
+	    break;
+	case SYS_execve:
+#ifdef SYS_unlink
+	case SYS_unlink:
+#endif
+	    ok = tracer_path(tp->pid, AT_FDCWD, a[0], tp->path, MAXPATHLEN);
+	    break;
+#ifdef SYS_execveat
+	case SYS_execveat:
+#endif
+	case SYS_unlinkat:
+	    ok = tracer_path(tp->pid, a[0], a[1], tp->path, MAXPATHLEN);
+	    break;
+	case SYS_chdir:
+	case SYS_fchdir:
+	    break;
+#ifdef SYS_rename
+	case SYS_rename:
+#endif
+#ifdef SYS_link
+	case SYS_link:
+#endif
+#if defined(SYS_rename) || defined(SYS_link)
+	    if ((ok = tracer_path(tp->pid, AT_FDCWD, a[0], tp->path,
+				  MAXPATHLEN)) == 0)
+		ok = tracer_path(tp->pid, AT_FDCWD, a[1], tp->path2,
+				 MAXPATHLEN);
+	    break;
+#endif
+#ifdef SYS_symlink
+	case SYS_symlink:
+	    if ((ok = tracer_path(tp->pid, AT_FDCWD, a[0], tp->path,
+				  MAXPATHLEN)) == 0)
+		ok = tracer_path(tp->pid, AT_FDCWD, a[1], tp->path2,
+				 MAXPATHLEN);
+	    break;
+#endif
+	case SYS_symlinkat:
+	    if ((ok = tracer_path(tp->pid, AT_FDCWD, a[0], tp->path,
+				  MAXPATHLEN)) == 0)
+		ok = tracer_path(tp->pid, a[1], a[2], tp->path2, MAXPATHLEN);
+	    break;
+	case SYS_renameat:
+#ifdef SYS_renameat2
+	case SYS_renameat2:
+#endif
+	case SYS_linkat:
+	    if ((ok = tracer_path(tp->pid, a[0], a[1], tp->path,
+				  MAXPATHLEN)) == 0)
+		ok = tracer_path(tp->pid, a[2], a[3], tp->path2, MAXPATHLEN);
+	    break;
+	default:
+	    return;
+	}
+	if (ok == 0)
+	    tp->nr = info.entry.nr;
+	return;
+    }
+    if (info.op != PTRACE_SYSCALL_INFO_EXIT || tp->nr == -1)
+	return;
+    if (info.exit.is_error) {
+	tp->nr = -1;
+	return;
+    }
+    switch (tp->nr) {
+#ifdef SYS_open
+    case SYS_open:
+#endif
+#ifdef SYS_creat
+    case SYS_creat:
+#endif
+    case SYS_openat:
+	if ((tp->flags & O_ACCMODE) != O_WRONLY)
+	    tracer_record("R %d %s\n", tp->pid, tp->path);
+	if ((tp->flags & O_ACCMODE) != O_RDONLY)
+	    tracer_record("W %d %s\n", tp->pid, tp->path);
+	break;
+    case SYS_execve:
+#ifdef SYS_execveat
+    case SYS_execveat:
+#endif
+	tracer_record("E %d %s\n", tp->pid, tp->path);
+	break;
+    case SYS_chdir:
+    case SYS_fchdir:
+	snprintf(link, sizeof(link), "/proc/%d/cwd", tp->pid);
+	if ((n = readlink(link, tp->path, MAXPATHLEN)) > 0 &&
+	    n < MAXPATHLEN) {
+	    tp->path[n] = '\0';
+	    tracer_record("C %d %s\n", tp->pid, tp->path);
+	}
+	break;
+#ifdef SYS_unlink
+    case SYS_unlink:
+#endif
+    case SYS_unlinkat:
+	tracer_record("D %d %s\n", tp->pid, tp->path);
+	break;
+#ifdef SYS_rename
+    case SYS_rename:
+#endif
+#ifdef SYS_renameat2
+    case SYS_renameat2:
+#endif
+    case SYS_renameat:
+	tracer_record("M %d '%s' '%s'\n", tp->pid, tp->path, tp->path2);
+	break;
+    default:
+	tracer_record("L %d '%s' '%s'\n", tp->pid, tp->path, tp->path2);
+	break;
+    }
+    tp->nr = -1;
+}
+
+/*
+ * Let go of all processes still traced.
+ */
+static void
+tracer_detach(void)
+{
+    unsigned long msg;
+    int i, status, event, sig;
+    pid_t pid;
+
+    for (i = 0; i < ntracees; i++)
+	(void)ptrace(PTRACE_INTERRUPT, tracees[i].pid, 0, 0);
+    while (ntracees > 0) {
+	if ((pid = waitpid(-1, &status, __WALL)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	if (!WIFSTOPPED(status)) {
+	    tracee_remove(pid);
+	    continue;
+	}
+	event = (unsigned int)status >> 16;
+	sig = 0;
+	if (event == PTRACE_EVENT_FORK || event == PTRACE_EVENT_VFORK ||
+	    event == PTRACE_EVENT_CLONE) {
+	    /* the new process is traced and needs letting go too */
+	    if (ptrace(PTRACE_GETEVENTMSG, pid, 0, &msg) == 0)
+		(void)tracee_find(msg, TRUE);
+	} else if (event == 0 && WSTOPSIG(status) != (SIGTRAP | 0x80))
+	    sig = WSTOPSIG(status);
+	(void)ptrace(PTRACE_DETACH, pid, 0, sig);
+	tracee_remove(pid);
+    }
+    ntracees = 0;
+}
+
+/*
+ * Trace pid and its descendants until it exits.
+ */
+static void
+tracer_run(pid_t root)
+{
+    unsigned long msg;
+    Tracee *tp;
+    int status, event, sig;
+    pid_t pid;
+
+    tracer_record("# filemon version 4\n# Target pid %d\nV 4\n", root);
+    while (ntracees > 0) {
+	if ((pid = waitpid(-1, &status, __WALL)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	if (!WIFSTOPPED(status)) {
+	    tracee_remove(pid);
+	    if (pid == root) {
+		tracer_record("X %d %d\n", pid,
+			      WIFEXITED(status) ? WEXITSTATUS(status) : 1);
+		break;
+	    }
+	    continue;
+	}
+	tp = tracee_find(pid, TRUE);	/* new ones may stop before F */
+	event = (unsigned int)status >> 16;
+	sig = 0;
+	switch (event) {
+	case 0:
+	    if (WSTOPSIG(status) == (SIGTRAP | 0x80))
+		tracer_syscall(tp);
+	    else
+		sig = WSTOPSIG(status);
+	    break;
+	case PTRACE_EVENT_FORK:
+	case PTRACE_EVENT_VFORK:
+	case PTRACE_EVENT_CLONE:
+	    if (ptrace(PTRACE_GETEVENTMSG, pid, 0, &msg) == 0) {
+		tracer_record("F %d %lu\n", pid, msg);
+		(void)tracee_find(msg, TRUE);
+	    }
+	    break;
+	case PTRACE_EVENT_EXIT:
+	    if (ptrace(PTRACE_GETEVENTMSG, pid, 0, &msg) == 0)
+		tracer_record("X %d %d\n", pid,
+			      WIFEXITED(msg) ? WEXITSTATUS(msg) : 1);
+	    if (pid == root) {
+		/*
+		 * Our parent may read the records as soon as the
+		 * command is gone, so nothing can be added after this.
+		 */
+		(void)ptrace(PTRACE_DETACH, pid, 0, 0);
+		tracee_remove(pid);
+		goto out;
+	    }
+	    break;
+	default:
+	    /*
+	     * Exec and ptrace stops.  We do not support job control
+	     * stops; the tracee is just continued.
+	     */
+	    break;
+	}
+	(void)ptrace(PTRACE_SYSCALL, pid, 0, sig);
+    }
+ out:
+    tracer_detach();
+}
+
+static void
+tracer_main(int ctl, int mon_fd)
+{
+    struct __ptrace_syscall_info info;
+    char path[64];
+    struct dirent *de;
+    DIR *dirp;
+    pid_t me, pid;
+    int fd, result, status;
+
+    /*
+     * Our own description of the records file, so that appending to
+     * it does not move the offset our parent reads from.
+     */
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", mon_fd);
+    if ((traceFd = open(path, O_WRONLY | O_APPEND)) < 0)
+	_exit(1);
+    if ((fd = open("/dev/null", O_RDWR)) >= 0) {
+	(void)dup2(fd, 0);
+	(void)dup2(fd, 1);
+    }
+    if ((dirp = opendir("/proc/self/fd")) != NULL) {
+	while ((de = readdir(dirp)) != NULL) {
+	    fd = atoi(de->d_name);
+	    if (fd > 2 && fd != ctl && fd != traceFd && fd != dirfd(dirp))
+		(void)close(fd);
+	}
+	closedir(dirp);
+    }
+    (void)signal(SIGPIPE, SIG_IGN);
+    (void)signal(SIGINT, SIG_IGN);
+
+    me = getpid();
+    for (;;) {
+	if (write(ctl, &me, sizeof(me)) != sizeof(me) ||
+	    read(ctl, &pid, sizeof(pid)) != sizeof(pid))
+	    break;
+	result = 0;
+	traceArch = 0;
+	if (ptrace(PTRACE_SEIZE, pid, 0, PTRACE_O_TRACESYSGOOD |
+		   PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK |
+		   PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC |
+		   PTRACE_O_TRACEEXIT) < 0 ||
+	    ptrace(PTRACE_INTERRUPT, pid, 0, 0) < 0)
+	    result = errno;
+	else {
+	    while (waitpid(pid, &status, __WALL) < 0 && errno == EINTR)
+		continue;
+	    /* PTRACE_GET_SYSCALL_INFO is new in Linux 5.3 */
+	    if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info),
+		       &info) <= 0) {
+		result = errno;
+		(void)ptrace(PTRACE_DETACH, pid, 0, 0);
+	    } else
+		(void)ptrace(PTRACE_SYSCALL, pid, 0, 0);
+	}
+	if (write(ctl, &result, sizeof(result)) != sizeof(result))
+	    break;
+	if (result == 0) {
+	    (void)tracee_find(pid, TRUE);
+	    tracer_run(pid);
+	}
+    }
+    _exit(0);
+}
+
+/*
+ * Start the tracer.
+ */
+static void
+filemon_open(BuildMon *pbm)
+{
+    int sv[2];
+    pid_t pid;
+
+    pbm->mon_fd = pbm->filemon_fd = -1;
+    if (!useFilemon)
+	return;
+
+    pbm->mon_fd = mkTempFile("filemon.XXXXXX", NULL);
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+	err(1, "Could not create socket for the tracer");
+    if ((pid = fork()) < 0)
+	err(1, "Could not fork the tracer");
+    if (pid == 0) {
+	/* fork again so that it is not our child */
+	(void)close(sv[0]);
+	if (fork() == 0)
+	    tracer_main(sv[1], pbm->mon_fd);
+	_exit(0);
+    }
+    while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+	continue;
+    (void)close(sv[1]);
+    pbm->filemon_fd = sv[0];
+    /* we don't need these once we exec */
+    (void)fcntl(pbm->mon_fd, F_SETFD, 1);
+    (void)fcntl(pbm->filemon_fd, F_SETFD, 1);
+}
+
+/*
+ * Have the tracer follow us.  Called in the child.
+ */
+static void
+filemon_attach(BuildMon *pbm)
+{
+    pid_t pid, tracer;
+    int result;
+
+    pid = getpid();
+    if (read(pbm->filemon_fd, &tracer, sizeof(tracer)) != sizeof(tracer))
+	return;
+#ifdef PR_SET_PTRACER
+    (void)prctl(PR_SET_PTRACER, tracer, 0, 0, 0);
+#endif
+    if (write(pbm->filemon_fd, &pid, sizeof(pid)) != sizeof(pid) ||
+	read(pbm->filemon_fd, &result, sizeof(result)) != sizeof(result))
+	return;
+    if (result != 0)
+	warnx("Could not trace pid %d: %s", pid, strerror(result));
+}
+
+#elif defined(USE_FILEMON)
 # ifndef _PATH_FILEMON
 #   define _PATH_FILEMON "/dev/filemon"
 # endif
@@ -140,7 +658,9 @@ filemon_open(BuildMon *pbm)
     (void)fcntl(pbm->mon_fd, F_SETFD, 1);
     (void)fcntl(pbm->filemon_fd, F_SETFD, 1);
 }
+#endif
 
+#ifdef USE_FILEMON
 /*
  * Read the build monitor output file and write records to the target's
  * metadata file.
@@ -622,18 +1142,24 @@ meta_job_child(Job *job)
 {
 #ifdef USE_FILEMON
     BuildMon *pbm;
+#ifndef USE_FILEMON_PTRACE
     pid_t pid;
+#endif
 
     if (job != NULL) {
 	pbm = &job->bm;
     } else {
 	pbm = &Mybm;
     }
-    pid = getpid();
-    if (pbm->mfp != NULL && useFilemon) {
+    if (pbm->mfp != NULL && useFilemon && pbm->filemon_fd >= 0) {
+#ifdef USE_FILEMON_PTRACE
+	filemon_attach(pbm);
+#else
+	pid = getpid();
 	if (ioctl(pbm->filemon_fd, FILEMON_SET_PID, &pid) < 0) {
 	    err(1, "Could not set filemon pid!");
 	}
+#endif
     }
 #endif
 }
@@ -1079,6 +1605,11 @@ meta_oodate(GNode *gn, Boolean oodate)
 		    if (strncmp(p, "/dev/", 5) == 0)
 			break;
 
+		    /* Ignore the Linux pseudo file systems. */
+		    if (strncmp(p, "/proc/", 6) == 0 ||
+			strncmp(p, "/sys/", 5) == 0)
+			break;
+
 		    /* Ignore /etc/ files. */
 		    if (strncmp(p, "/etc/", 5) == 0)
 			break;
@@ -140,6 +140,13 @@ void Parse_Init(void);
 void Parse_End(void);
 void Parse_SetInput(const char *, int, int, char *(*)(void *, size_t *), void *);
 Lst Parse_MainName(void);
+Boolean Parse_CacheStart(const char *, char **);
+void Parse_CacheEnd(void);
+void Parse_CacheAbort(const char *);
+void Parse_CacheVar(const char *, const char *);
+void Parse_CachePath(const char *);
+void Parse_CacheCommand(const char *, const char *);
+Boolean Parse_CacheRecording(void);
 
 /* str.c */
 char *str_concat(const char *, const char *, int);
@@ -199,6 +206,7 @@ void Var_Init(void);
 void Var_End(void);
 void Var_Dump(GNode *);
 void Var_ExportVars(void);
+Boolean Var_Exporting(void);
 void Var_Export(char *, int);
 void Var_UnExport(char *);
 
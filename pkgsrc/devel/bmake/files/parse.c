@@ -131,6 +131,7 @@ __RCSID("$NetBSD: parse.c,v 1.9 2011/06/18 22:39:46 bsiegert Exp $");
 #include <fcntl.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <time.h>
 
 #ifndef MAP_FILE
 #define MAP_FILE 0
@@ -376,6 +377,12 @@ static int ParseEOF(void);
 static char *ParseReadLine(void);
 static void ParseFinishLine(void);
 static void ParseMark(GNode *);
+static void ParseVarSpecial(const char *, char *);
+static void ParseCacheRecord(int, int, const char *, size_t);
+static void ParseCacheLine(const char *);
+static void ParseCacheDropLine(void);
+static void ParseCacheShellVar(const char *, const char *, const char *);
+static void ParseCacheFile(const char *, int, const char *, size_t);
 
 ////////////////////////////////////////////////////////////
 // file loader
@@ -580,6 +587,7 @@ loadfile(const char *path, int fd)
 done:
 #endif
 	if (path != NULL) {
+		ParseCacheFile(path, fd, lf->buf, lf->len);
 		close(fd);
 	}
 	return lf;
@@ -765,6 +773,9 @@ Parse_Error(int type, const char *fmt, ...)
 		lineno = curFile->lineno;
 	}
 
+	/* Messages from conditionals couldn't be reproduced. */
+	Parse_CacheAbort("diagnostics printed");
+
 	va_start(ap, fmt);
 	(void)fflush(stdout);
 	ParseVErrorInternal(stderr, fname, lineno, type, fmt, ap);
@@ -1912,6 +1923,8 @@ Parse_DoVar(char *line, GNode *ctxt)
 
 	res = Cmd_Exec(cp, &error);
 	Var_Set(line, res, ctxt, 0);
+	if (ctxt == VAR_GLOBAL)
+	    ParseCacheShellVar(line, res, cp);
 	free(res);
 
 	if (error)
@@ -1922,6 +1935,17 @@ Parse_DoVar(char *line, GNode *ctxt)
 	 */
 	Var_Set(line, cp, ctxt, 0);
     }
+    ParseVarSpecial(line, cp);
+    if (freeCp)
+	free(cp);
+}
+
+/*
+ * Side effects of assigning to some special variables.
+ */
+static void
+ParseVarSpecial(const char *line, char *cp)
+{
     if (strcmp(line, MAKEOVERRIDES) == 0)
 	Main_ExportMAKEFLAGS(FALSE);	/* re-export MAKEFLAGS */
     else if (strcmp(line, ".CURDIR") == 0) {
@@ -1937,8 +1961,6 @@ Parse_DoVar(char *line, GNode *ctxt)
     } else if (strcmp(line, MAKE_EXPORTED) == 0) {
 	Var_Export(cp, 0);
     }
-    if (freeCp)
-	free(cp);
 }
 
 
@@ -2147,6 +2169,7 @@ Parse_include_file(char *file, Boolean isSystem, int silent)
     /* Actually open the file... */
     fd = open(fullname, O_RDONLY);
     if (fd == -1) {
+	Parse_CachePath(fullname);
 	if (!silent)
 	    Parse_Error(PARSE_FATAL, "Cannot open %s", fullname);
 	free(fullname);
@@ -2303,8 +2326,10 @@ Parse_SetInput(const char *name, int line, int fd,
 
     if (name == NULL)
 	name = curFile->fname;
-    else
+    else {
 	ParseTrackInput(name);
+	ParseCacheRecord('T', 0, name, strlen(name));
+    }
 
     if (DEBUG(PARSE))
 	fprintf(debug_file, "Parse_SetInput: file %s, line %d, fd %d, nextbuf %p, arg %p\n",
@@ -2731,6 +2756,232 @@ ParseFinishLine(void)
 }
 
 
+/*-
+ *---------------------------------------------------------------------
+ * ParseShellCommand --
+ *	Add a shell command to all targets of the current dependency line.
+ *
+ * Input:
+ *	cp		the command, possibly preceded by whitespace
+ *---------------------------------------------------------------------
+ */
+static void
+ParseShellCommand(char *cp)
+{
+    for (; isspace ((unsigned char)*cp); cp++) {
+	continue;
+    }
+    if (*cp) {
+	if (!inLine)
+	    Parse_Error(PARSE_FATAL,
+			 "Unassociated shell command \"%s\"",
+			 cp);
+	/*
+	 * So long as it's not a blank line and we're actually
+	 * in a dependency spec, add the command to the list of
+	 * commands of all targets in the dependency spec
+	 */
+	if (targets) {
+	    cp = bmake_strdup(cp);
+	    Lst_ForEach(targets, ParseAddCmd, cp);
+#ifdef CLEANUP
+	    Lst_AtEnd(targCmds, cp);
+#endif
+	}
+    }
+}
+
+/*-
+ *---------------------------------------------------------------------
+ * ParseLine --
+ *	Handle one logical line, after conditionals and loops have been
+ *	processed.
+ *
+ * Input:
+ *	line		the line, which may be modified
+ *---------------------------------------------------------------------
+ */
+static void
+ParseLine(char *line)
+{
+    char	  *cp;		/* pointer into the line */
+
+    if (*line == '.') {
+	/*
+	 * Lines that begin with the special character may be
+	 * include or undef directives.
+	 * On the other hand they can be suffix rules (.c.o: ...)
+	 * or just dependencies for filenames that start '.'.
+	 */
+	for (cp = line + 1; isspace((unsigned char)*cp); cp++) {
+	    continue;
+	}
+	if (strncmp(cp, "include", 7) == 0 ||
+		((cp[0] == 's' || cp[0] == '-') &&
+		    strncmp(&cp[1], "include", 7) == 0)) {
+	    ParseCacheDropLine();
+	    ParseDoInclude(cp);
+	    return;
+	}
+	if (strncmp(cp, "undef", 5) == 0) {
+	    char *cp2;
+	    for (cp += 5; isspace((unsigned char) *cp); cp++)
+		continue;
+	    for (cp2 = cp; !isspace((unsigned char) *cp2) &&
+			   (*cp2 != '\0'); cp2++)
+		continue;
+	    *cp2 = '\0';
+	    Var_Delete(cp, VAR_GLOBAL);
+	    return;
+	} else if (strncmp(cp, "export", 6) == 0) {
+	    for (cp += 6; isspace((unsigned char) *cp); cp++)
+		continue;
+	    Var_Export(cp, 1);
+	    return;
+	} else if (strncmp(cp, "unexport", 8) == 0) {
+	    Var_UnExport(cp);
+	    return;
+	} else if (strncmp(cp, "info", 4) == 0 ||
+		   strncmp(cp, "error", 5) == 0 ||
+		   strncmp(cp, "warning", 7) == 0) {
+	    if (ParseMessage(cp))
+		return;
+	}		    
+    }
+
+    if (*line == '\t') {
+	/*
+	 * If a line starts with a tab, it can only hope to be
+	 * a creation command.
+	 */
+	ParseShellCommand(line + 1);
+	return;
+    }
+
+#ifdef SYSVINCLUDE
+    if (((strncmp(line, "include", 7) == 0 &&
+	    isspace((unsigned char) line[7])) ||
+		((line[0] == 's' || line[0] == '-') &&
+		    strncmp(&line[1], "include", 7) == 0 &&
+		    isspace((unsigned char) line[8]))) &&
+	    strchr(line, ':') == NULL) {
+	/*
+	 * It's an S3/S5-style "include".
+	 */
+	ParseCacheDropLine();
+	ParseTraditionalInclude(line);
+	return;
+    }
+#endif
+    if (Parse_IsVar(line)) {
+	ParseFinishLine();
+	Parse_DoVar(line, VAR_GLOBAL);
+	return;
+    }
+
+#ifndef POSIX
+    /*
+     * To make life easier on novices, if the line is indented we
+     * first make sure the line has a dependency operator in it.
+     * If it doesn't have an operator and we're in a dependency
+     * line's script, we assume it's actually a shell command
+     * and add it to the current list of targets.
+     */
+    cp = line;
+    if (isspace((unsigned char) line[0])) {
+	while ((*cp != '\0') && isspace((unsigned char) *cp))
+	    cp++;
+	while (*cp && (ParseIsEscaped(line, cp) ||
+		(*cp != ':') && (*cp != '!'))) {
+	    cp++;
+	}
+	if (*cp == '\0') {
+	    if (inLine) {
+		Parse_Error(PARSE_WARNING,
+			     "Shell command needs a leading tab");
+		ParseShellCommand(cp);
+		return;
+	    }
+	}
+    }
+#endif
+    ParseFinishLine();
+
+    /*
+     * For some reason - probably to make the parser impossible -
+     * a ';' can be used to separate commands from dependencies.
+     * Attempt to avoid ';' inside substitution patterns.
+     */
+    {
+	int level = 0;
+
+	for (cp = line; *cp != 0; cp++) {
+	    if (*cp == '\\' && cp[1] != 0) {
+		cp++;
+		continue;
+	    }
+	    if (*cp == '$' &&
+		(cp[1] == '(' || cp[1] == '{')) {
+		level++;
+		continue;
+	    }
+	    if (level > 0) {
+		if (*cp == ')' || *cp == '}') {
+		    level--;
+		    continue;
+		}
+	    } else if (*cp == ';') {
+		break;
+	    }
+	}
+    }
+    if (*cp != 0)
+	/* Terminate the dependency list at the ';' */
+	*cp++ = 0;
+    else
+	cp = NULL;
+
+    /*
+     * We now know it's a dependency line so it needs to have all
+     * variables expanded before being parsed. Tell the variable
+     * module to complain if some variable is undefined...
+     */
+    line = Var_Subst(NULL, line, VAR_CMD, TRUE);
+
+    /*
+     * Need a non-circular list for the target nodes
+     */
+    if (targets)
+	Lst_Destroy(targets, NULL);
+
+    targets = Lst_Init(FALSE);
+    inLine = TRUE;
+
+    ParseDoDependency(line);
+    free(line);
+
+    /* If there were commands after a ';', add them now */
+    if (cp != NULL) {
+	ParseShellCommand(cp);
+    }
+}
+
+/*
+ * Give up if there were fatal errors in the makefile just read.
+ */
+static void
+ParseCheckFatals(void)
+{
+    if (fatals) {
+	(void)fflush(stdout);
+	(void)fprintf(stderr,
+	    "%s: Fatal errors encountered -- cannot continue",
+	    progname);
+	PrintOnError(NULL, NULL);
+	exit(1);
+    }
+}
+
 /*-
  *---------------------------------------------------------------------
  * Parse_File --
@@ -2754,7 +3005,6 @@ ParseFinishLine(void)
 void
 Parse_File(const char *name, int fd)
 {
-    char	  *cp;		/* pointer into the line */
     char          *line;	/* the line we're working on */
     struct loadedfile *lf;
 
@@ -2764,9 +3014,11 @@ Parse_File(const char *name, int fd)
     fatals = 0;
 
     if (name == NULL) {
+	    Parse_CacheAbort("makefile read from stdin");
 	    name = "(stdin)";
     }
 
+    ParseCacheRecord('B', 0, "", 0);
     Parse_SetInput(name, 0, -1, loadedfile_nextbuf, lf);
     curFile->lf = lf;
 
@@ -2775,197 +3027,16 @@ Parse_File(const char *name, int fd)
 	    if (DEBUG(PARSE))
 		fprintf(debug_file, "ParseReadLine (%d): '%s'\n",
 			curFile->lineno, line);
-	    if (*line == '.') {
-		/*
-		 * Lines that begin with the special character may be
-		 * include or undef directives.
-		 * On the other hand they can be suffix rules (.c.o: ...)
-		 * or just dependencies for filenames that start '.'.
-		 */
-		for (cp = line + 1; isspace((unsigned char)*cp); cp++) {
-		    continue;
-		}
-		if (strncmp(cp, "include", 7) == 0 ||
-			((cp[0] == 's' || cp[0] == '-') &&
-			    strncmp(&cp[1], "include", 7) == 0)) {
-		    ParseDoInclude(cp);
-		    continue;
-		}
-		if (strncmp(cp, "undef", 5) == 0) {
-		    char *cp2;
-		    for (cp += 5; isspace((unsigned char) *cp); cp++)
-			continue;
-		    for (cp2 = cp; !isspace((unsigned char) *cp2) &&
-				   (*cp2 != '\0'); cp2++)
-			continue;
-		    *cp2 = '\0';
-		    Var_Delete(cp, VAR_GLOBAL);
-		    continue;
-		} else if (strncmp(cp, "export", 6) == 0) {
-		    for (cp += 6; isspace((unsigned char) *cp); cp++)
-			continue;
-		    Var_Export(cp, 1);
-		    continue;
-		} else if (strncmp(cp, "unexport", 8) == 0) {
-		    Var_UnExport(cp);
-		    continue;
-		} else if (strncmp(cp, "info", 4) == 0 ||
-			   strncmp(cp, "error", 5) == 0 ||
-			   strncmp(cp, "warning", 7) == 0) {
-		    if (ParseMessage(cp))
-			continue;
-		}		    
-	    }
-
-	    if (*line == '\t') {
-		/*
-		 * If a line starts with a tab, it can only hope to be
-		 * a creation command.
-		 */
-		cp = line + 1;
-	      shellCommand:
-		for (; isspace ((unsigned char)*cp); cp++) {
-		    continue;
-		}
-		if (*cp) {
-		    if (!inLine)
-			Parse_Error(PARSE_FATAL,
-				     "Unassociated shell command \"%s\"",
-				     cp);
-		    /*
-		     * So long as it's not a blank line and we're actually
-		     * in a dependency spec, add the command to the list of
-		     * commands of all targets in the dependency spec
-		     */
-		    if (targets) {
-			cp = bmake_strdup(cp);
-			Lst_ForEach(targets, ParseAddCmd, cp);
-#ifdef CLEANUP
-			Lst_AtEnd(targCmds, cp);
-#endif
-		    }
-		}
-		continue;
-	    }
-
-#ifdef SYSVINCLUDE
-	    if (((strncmp(line, "include", 7) == 0 &&
-		    isspace((unsigned char) line[7])) ||
-			((line[0] == 's' || line[0] == '-') &&
-			    strncmp(&line[1], "include", 7) == 0 &&
-			    isspace((unsigned char) line[8]))) &&
-		    strchr(line, ':') == NULL) {
-		/*
-		 * It's an S3/S5-style "include".
-		 */
-		ParseTraditionalInclude(line);
-		continue;
-	    }
-#endif
-	    if (Parse_IsVar(line)) {
-		ParseFinishLine();
-		Parse_DoVar(line, VAR_GLOBAL);
-		continue;
-	    }
-
-#ifndef POSIX
-	    /*
-	     * To make life easier on novices, if the line is indented we
-	     * first make sure the line has a dependency operator in it.
-	     * If it doesn't have an operator and we're in a dependency
-	     * line's script, we assume it's actually a shell command
-	     * and add it to the current list of targets.
-	     */
-	    cp = line;
-	    if (isspace((unsigned char) line[0])) {
-		while ((*cp != '\0') && isspace((unsigned char) *cp))
-		    cp++;
-		while (*cp && (ParseIsEscaped(line, cp) ||
-			(*cp != ':') && (*cp != '!'))) {
-		    cp++;
-		}
-		if (*cp == '\0') {
-		    if (inLine) {
-			Parse_Error(PARSE_WARNING,
-				     "Shell command needs a leading tab");
-			goto shellCommand;
-		    }
-		}
-	    }
-#endif
-	    ParseFinishLine();
-
-	    /*
-	     * For some reason - probably to make the parser impossible -
-	     * a ';' can be used to separate commands from dependencies.
-	     * Attempt to avoid ';' inside substitution patterns.
-	     */
-	    {
-		int level = 0;
-
-		for (cp = line; *cp != 0; cp++) {
-		    if (*cp == '\\' && cp[1] != 0) {
-			cp++;
-			continue;
-		    }
-		    if (*cp == '$' &&
-			(cp[1] == '(' || cp[1] == '{')) {
-			level++;
-			continue;
-		    }
-		    if (level > 0) {
-			if (*cp == ')' || *cp == '}') {
-			    level--;
-			    continue;
-			}
-		    } else if (*cp == ';') {
-			break;
-		    }
-		}
-	    }
-	    if (*cp != 0)
-		/* Terminate the dependency list at the ';' */
-		*cp++ = 0;
-	    else
-		cp = NULL;
-
-	    /*
-	     * We now know it's a dependency line so it needs to have all
-	     * variables expanded before being parsed. Tell the variable
-	     * module to complain if some variable is undefined...
-	     */
-	    line = Var_Subst(NULL, line, VAR_CMD, TRUE);
-
-	    /*
-	     * Need a non-circular list for the target nodes
-	     */
-	    if (targets)
-		Lst_Destroy(targets, NULL);
-
-	    targets = Lst_Init(FALSE);
-	    inLine = TRUE;
-
-	    ParseDoDependency(line);
-	    free(line);
-
-	    /* If there were commands after a ';', add them now */
-	    if (cp != NULL) {
-		goto shellCommand;
-	    }
+	    ParseCacheLine(line);
+	    ParseLine(line);
 	}
 	/*
 	 * Reached EOF, but it may be just EOF of an include file...
 	 */
     } while (ParseEOF() == CONTINUE);
 
-    if (fatals) {
-	(void)fflush(stdout);
-	(void)fprintf(stderr,
-	    "%s: Fatal errors encountered -- cannot continue",
-	    progname);
-	PrintOnError(NULL, NULL);
-	exit(1);
-    }
+    ParseCacheRecord('E', 0, "", 0);
+    ParseCheckFatals();
 }
 
 /*-
@@ -3059,3 +3130,647 @@ ParseMark(GNode *gn)
     gn->fname = curFile->fname;
     gn->lineno = curFile->lineno;
 }
+
+////////////////////////////////////////////////////////////
+// parse cache
+
+/*
+ * The parse cache records what the parser did while reading the
+ * system and main makefiles: the lines that reached ParseLine, i.e.
+ * after conditionals, loops and includes were processed, the files
+ * they came from and the results of != assignments.  The next
+ * invocation with the same arguments, environment and directories
+ * replays the records instead of parsing, as long as none of the
+ * makefiles changed, every place a file was looked up in still has
+ * or lacks the file as before, and every shell command run while
+ * parsing still gives the same output.
+ *
+ * Shell commands are run again to check them, so they must not
+ * depend on variables the makefiles export; makefiles that change
+ * the environment before running a command, or that use the ::=
+ * modifiers, are not cached.
+ *
+ * The cache file contains a header, the dependencies and the records:
+ *
+ *	bmake parse cache <version> <key>
+ *	F <size> <mtime> <hash> <path>	makefile read
+ *	E <0|1> <path>			file looked up
+ *	C <len> <len> <cmd><output>	shell command run
+ *	R
+ *	<type> <lineno> <length>	followed by <length> bytes and
+ *					a newline
+ */
+
+#define PCACHE_VERSION	3
+
+typedef struct {
+    char	*path;		/* cache file to write */
+    char	*key;		/* hash of the invocation */
+    Buffer	deps;		/* F and E lines */
+    Buffer	recs;		/* records */
+    Hash_Table	files;		/* files already in deps */
+    Hash_Table	paths;		/* lookups already in deps */
+    unsigned long long env;	/* hash of the environment */
+    const char	*fname;		/* file of the last line recorded */
+    int		lastRec;	/* offset of the last record */
+} ParseCache;
+
+static ParseCache *pcache;	/* non-NULL while recording */
+
+#define FNV_OFFSET	0xcbf29ce484222325ULL
+#define FNV_PRIME	0x100000001b3ULL
+
+static unsigned long long
+ParseCacheHash(unsigned long long h, const void *p, size_t len)
+{
+    const unsigned char *cp = p;
+
+    while (len-- > 0) {
+	h ^= *cp++;
+	h *= FNV_PRIME;
+    }
+    return h;
+}
+
+static int
+ParseCacheEnvCmp(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ * Hash the environment as it is, to notice changes made by makefiles.
+ */
+static unsigned long long
+ParseCacheEnvHash(void)
+{
+    extern char **environ;
+    unsigned long long h;
+    char **ep;
+
+    h = FNV_OFFSET;
+    for (ep = environ; *ep != NULL; ep++)
+	h = ParseCacheHash(h, *ep, strlen(*ep) + 1);
+    return h;
+}
+
+/*
+ * Everything that influences the parse except the makefiles: the
+ * version, the directories, the arguments and the environment.
+ */
+static char *
+ParseCacheKey(char **argv)
+{
+    extern char **environ;
+    static const char *ignored[] = {
+	"MAKEDIRCACHE=", "OLDPWD=", "PWD=", "SHLVL=", "_=", NULL
+    };
+    unsigned long long h;
+    const char *vars[] = { "MAKE_VERSION", ".CURDIR", ".OBJDIR", NULL };
+    char **env, *p1, *value, key[17];
+    int i, j, n;
+
+    h = ParseCacheHash(FNV_OFFSET, "bmake parse cache", 18);
+    for (i = 0; vars[i] != NULL; i++) {
+	value = Var_Value(vars[i], VAR_GLOBAL, &p1);
+	if (value != NULL)
+	    h = ParseCacheHash(h, value, strlen(value));
+	h = ParseCacheHash(h, "", 1);
+	if (p1)
+	    free(p1);
+    }
+    for (; *argv != NULL; argv++)
+	h = ParseCacheHash(h, *argv, strlen(*argv) + 1);
+
+    for (n = 0; environ[n] != NULL; n++)
+	continue;
+    env = bmake_malloc((n + 1) * sizeof(*env));
+    memcpy(env, environ, n * sizeof(*env));
+    qsort(env, n, sizeof(*env), ParseCacheEnvCmp);
+    for (i = 0; i < n; i++) {
+	for (j = 0; ignored[j] != NULL; j++) {
+	    if (strncmp(env[i], ignored[j], strlen(ignored[j])) == 0)
+		break;
+	}
+	if (ignored[j] == NULL)
+	    h = ParseCacheHash(h, env[i], strlen(env[i]) + 1);
+    }
+    free(env);
+
+    snprintf(key, sizeof(key), "%016llx", h);
+    return bmake_strdup(key);
+}
+
+/*
+ * Hash the first size bytes of a file.  Returns FALSE if it can't be
+ * read.
+ */
+static Boolean
+ParseCacheHashFile(const char *path, off_t size, unsigned long long *hash)
+{
+    char buf[8192];
+    ssize_t n;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+	return FALSE;
+    *hash = FNV_OFFSET;
+    while (size > 0 && (n = read(fd, buf, sizeof(buf))) > 0) {
+	if (n > size)
+	    n = size;
+	*hash = ParseCacheHash(*hash, buf, n);
+	size -= n;
+    }
+    close(fd);
+    return size == 0;
+}
+
+/*
+ * Check the dependencies of a cache file.  Returns a pointer to the
+ * records or NULL if the cache can't be used.
+ */
+static char *
+ParseCacheCheck(char *buf, char *end, const char *key)
+{
+    struct stat st;
+    unsigned long long hash, cur;
+    unsigned long clen, rlen;
+    long long size, mtime;
+    char *line, *eol, *path, *res;
+    const char *error;
+    int version, found, n, same;
+
+    eol = strchr(buf, '\n');
+    n = 0;
+    if (eol == NULL ||
+	sscanf(buf, "bmake parse cache %d %n", &version, &n) != 1 || n == 0 ||
+	version != PCACHE_VERSION ||
+	strncmp(buf + n, key, strlen(key)) != 0) {
+	if (DEBUG(PARSE))
+	    fprintf(debug_file, "ParseCache: invalid header\n");
+	return NULL;
+    }
+
+    for (line = eol + 1; (eol = strchr(line, '\n')) != NULL;
+	 line = eol + 1) {
+	n = 0;
+	if (line[0] == 'C' &&
+	    sscanf(line, "C %lu %lu %n", &clen, &rlen, &n) == 2 && n != 0) {
+	    /* The command and its output may contain newlines. */
+	    path = line + n;
+	    if (clen > (unsigned long)(end - path) ||
+		rlen >= (unsigned long)(end - path) - clen ||
+		path[clen + rlen] != '\n')
+		break;
+	    eol = path + clen + rlen;
+	    *eol = '\0';
+	    res = bmake_malloc(clen + 1);
+	    memcpy(res, path, clen);
+	    res[clen] = '\0';
+	    path = Cmd_Exec(res, &error);
+	    same = strlen(path) == rlen &&
+		memcmp(path, line + n + clen, rlen) == 0;
+	    free(path);
+	    if (same) {
+		free(res);
+		continue;
+	    }
+	    if (DEBUG(PARSE))
+		fprintf(debug_file, "ParseCache: output of \"%s\" changed\n",
+		    res);
+	    free(res);
+	    return NULL;
+	}
+	*eol = '\0';
+	if (strcmp(line, "R") == 0)
+	    return eol + 1;
+	n = 0;
+	if (line[0] == 'F' &&
+	    sscanf(line, "F %lld %lld %llx %n", &size, &mtime, &hash,
+		&n) == 3 && n != 0) {
+	    path = line + n;
+	    if (stat(path, &st) == -1) {
+		if (DEBUG(PARSE))
+		    fprintf(debug_file, "ParseCache: %s removed\n", path);
+		return NULL;
+	    }
+	    if (st.st_size == size && st.st_mtime == mtime)
+		continue;
+	    if (st.st_size == size &&
+		ParseCacheHashFile(path, st.st_size, &cur) && cur == hash)
+		continue;
+	    if (DEBUG(PARSE))
+		fprintf(debug_file, "ParseCache: %s changed\n", path);
+	    return NULL;
+	}
+	if (line[0] == 'E' &&
+	    sscanf(line, "E %d %n", &found, &n) == 1 && n != 0) {
+	    path = line + n;
+	    if ((stat(path, &st) == 0) == found)
+		continue;
+	    if (DEBUG(PARSE))
+		fprintf(debug_file, "ParseCache: %s %s\n", path,
+		    found ? "removed" : "appeared");
+	    return NULL;
+	}
+	break;
+    }
+    if (DEBUG(PARSE))
+	fprintf(debug_file, "ParseCache: invalid dependencies\n");
+    return NULL;
+}
+
+/*
+ * Replay the records of a cache file.  Strings are used in place,
+ * the buffer must not be freed.
+ */
+static Boolean
+ParseCacheReplay(char *rec, char *end)
+{
+    IFile file;
+    char *cp, *data, *value, *arg;
+    long lineno;
+    unsigned long len;
+    int type;
+
+    memset(&file, 0, sizeof(file));
+    curFile = &file;
+    while (rec < end) {
+	type = (unsigned char)*rec;
+	lineno = strtol(rec + 1, &cp, 10);
+	len = strtoul(cp, &cp, 10);
+	if (*cp != '\n')
+	    return FALSE;
+	data = cp + 1;
+	if (len >= (unsigned long)(end - data) || data[len] != '\n')
+	    return FALSE;
+	data[len] = '\0';
+	rec = data + len + 1;
+
+	switch (type) {
+	case 'B':
+	    inLine = FALSE;
+	    fatals = 0;
+	    break;
+	case 'T':
+	    ParseTrackInput(data);
+	    break;
+	case 'F':
+	    file.fname = data;
+	    ParseSetParseFile(data);
+	    break;
+	case 'L':
+	    file.lineno = lineno;
+	    if (DEBUG(PARSE))
+		fprintf(debug_file, "ParseCache (%d): '%s'\n",
+			file.lineno, data);
+	    ParseLine(data);
+	    break;
+	case 'S':
+	    value = data + strlen(data) + 1;
+	    arg = value + strlen(value) + 1;
+	    if (arg > data + len)
+		return FALSE;
+	    file.lineno = lineno;
+	    Var_Set(data, value, VAR_GLOBAL, 0);
+	    ParseVarSpecial(data, arg);
+	    break;
+	case 'E':
+	    Var_Delete(".PARSEDIR", VAR_GLOBAL);
+	    Var_Delete(".PARSEFILE", VAR_GLOBAL);
+	    ParseCheckFatals();
+	    break;
+	default:
+	    return FALSE;
+	}
+    }
+    curFile = NULL;
+    return TRUE;
+}
+
+/*-
+ *---------------------------------------------------------------------
+ * Parse_CacheStart --
+ *	Use the parse cache in the given directory for reading the
+ *	makefiles.
+ *
+ * Results:
+ *	TRUE if the makefiles were loaded from the cache.  Otherwise
+ *	they must be read and Parse_CacheEnd called afterwards.
+ *---------------------------------------------------------------------
+ */
+Boolean
+Parse_CacheStart(const char *dir, char **argv)
+{
+    struct stat st;
+    char *key, *path, *buf, *rec;
+    ssize_t n;
+    int fd;
+
+    key = ParseCacheKey(argv);
+    path = str_concat(dir, key, STR_ADDSLASH);
+
+    if ((fd = open(path, O_RDONLY)) != -1) {
+	buf = NULL;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+	    buf = bmake_malloc(st.st_size + 1);
+	    n = read(fd, buf, st.st_size);
+	    if (n != st.st_size) {
+		free(buf);
+		buf = NULL;
+	    } else
+		buf[n] = '\0';
+	}
+	close(fd);
+	if (buf != NULL &&
+	    (rec = ParseCacheCheck(buf, buf + st.st_size, key)) != NULL) {
+	    if (DEBUG(PARSE))
+		fprintf(debug_file, "ParseCache: hit %s\n", path);
+	    if (!ParseCacheReplay(rec, buf + st.st_size))
+		Fatal("%s: invalid parse cache %s", progname, path);
+	    free(key);
+	    free(path);
+	    return TRUE;
+	}
+	free(buf);
+    }
+    if (DEBUG(PARSE))
+	fprintf(debug_file, "ParseCache: miss %s\n", path);
+
+    pcache = bmake_malloc(sizeof(*pcache));
+    pcache->path = path;
+    pcache->key = key;
+    Buf_Init(&pcache->deps, 0);
+    Buf_Init(&pcache->recs, 0);
+    Hash_InitTable(&pcache->files, 0);
+    Hash_InitTable(&pcache->paths, 0);
+    pcache->env = ParseCacheEnvHash();
+    pcache->fname = NULL;
+    pcache->lastRec = 0;
+    return FALSE;
+}
+
+static void
+ParseCacheFree(void)
+{
+    Buf_Destroy(&pcache->deps, TRUE);
+    Buf_Destroy(&pcache->recs, TRUE);
+    Hash_DeleteTable(&pcache->files);
+    Hash_DeleteTable(&pcache->paths);
+    free(pcache->path);
+    free(pcache->key);
+    free(pcache);
+    pcache = NULL;
+}
+
+/*-
+ *---------------------------------------------------------------------
+ * Parse_CacheEnd --
+ *	Write the parse cache after the makefiles were read.
+ *---------------------------------------------------------------------
+ */
+void
+Parse_CacheEnd(void)
+{
+    char *tmp, header[64];
+    int fd, len, ok;
+
+    if (pcache == NULL)
+	return;
+
+    tmp = str_concat(pcache->path, "XXXXXX", 0);
+    if ((fd = mkstemp(tmp)) == -1) {
+	if (DEBUG(PARSE))
+	    fprintf(debug_file, "ParseCache: cannot create %s: %s\n",
+		tmp, strerror(errno));
+	free(tmp);
+	ParseCacheFree();
+	return;
+    }
+    len = snprintf(header, sizeof(header), "bmake parse cache %d %s\n",
+	PCACHE_VERSION, pcache->key);
+    ok = write(fd, header, len) == len &&
+	write(fd, pcache->deps.buffer, pcache->deps.count) ==
+	    pcache->deps.count &&
+	write(fd, "R\n", 2) == 2 &&
+	write(fd, pcache->recs.buffer, pcache->recs.count) ==
+	    pcache->recs.count;
+    (void)fchmod(fd, 0644);
+    if (close(fd) == -1 || !ok || rename(tmp, pcache->path) == -1) {
+	if (DEBUG(PARSE))
+	    fprintf(debug_file, "ParseCache: cannot write %s\n",
+		pcache->path);
+	(void)unlink(tmp);
+    } else if (DEBUG(PARSE))
+	fprintf(debug_file, "ParseCache: wrote %s\n", pcache->path);
+    free(tmp);
+    ParseCacheFree();
+}
+
+/*-
+ *---------------------------------------------------------------------
+ * Parse_CacheAbort --
+ *	Don't write the parse cache, the makefiles can't be replayed.
+ *---------------------------------------------------------------------
+ */
+void
+Parse_CacheAbort(const char *reason)
+{
+    if (pcache == NULL)
+	return;
+    if (DEBUG(PARSE))
+	fprintf(debug_file, "ParseCache: not cached: %s\n", reason);
+    ParseCacheFree();
+}
+
+static void
+ParseCacheRecord(int type, int lineno, const char *data, size_t len)
+{
+    char header[64];
+    int n;
+
+    if (pcache == NULL)
+	return;
+    if (type == 'B' || type == 'E')
+	pcache->fname = NULL;
+    pcache->lastRec = Buf_Size(&pcache->recs);
+    n = snprintf(header, sizeof(header), "%c %d %lu\n", type, lineno,
+	(unsigned long)len);
+    Buf_AddBytes(&pcache->recs, n, header);
+    Buf_AddBytes(&pcache->recs, len, data);
+    Buf_AddByte(&pcache->recs, '\n');
+}
+
+/*
+ * Record a line about to be passed to ParseLine.
+ */
+static void
+ParseCacheLine(const char *line)
+{
+    if (pcache == NULL)
+	return;
+    if (pcache->fname != curFile->fname) {
+	ParseCacheRecord('F', 0, curFile->fname, strlen(curFile->fname));
+	pcache->fname = curFile->fname;
+    }
+    ParseCacheRecord('L', curFile->lineno, line, strlen(line));
+}
+
+/*
+ * Forget the last line again, includes are recorded by their content.
+ */
+static void
+ParseCacheDropLine(void)
+{
+    if (pcache == NULL)
+	return;
+    pcache->recs.count = pcache->lastRec;
+    pcache->recs.buffer[pcache->lastRec] = '\0';
+}
+
+/*
+ * Replace the != assignment just recorded by its result.
+ */
+static void
+ParseCacheShellVar(const char *name, const char *value, const char *arg)
+{
+    Buffer data;
+
+    if (pcache == NULL)
+	return;
+    ParseCacheDropLine();
+    Buf_Init(&data, 0);
+    Buf_AddBytes(&data, strlen(name) + 1, name);
+    Buf_AddBytes(&data, strlen(value) + 1, value);
+    Buf_AddBytes(&data, strlen(arg), arg);
+    ParseCacheRecord('S', curFile->lineno, data.buffer, Buf_Size(&data));
+    Buf_Destroy(&data, TRUE);
+}
+
+/*-
+ *---------------------------------------------------------------------
+ * Parse_CacheVar --
+ *	Record a variable set while reading the makefiles outside of
+ *	the parser.
+ *---------------------------------------------------------------------
+ */
+void
+Parse_CacheVar(const char *name, const char *value)
+{
+    Buffer data;
+
+    if (pcache == NULL)
+	return;
+    Buf_Init(&data, 0);
+    Buf_AddBytes(&data, strlen(name) + 1, name);
+    Buf_AddBytes(&data, strlen(value) + 1, value);
+    Buf_AddBytes(&data, strlen(value), value);
+    ParseCacheRecord('S', 0, data.buffer, Buf_Size(&data));
+    Buf_Destroy(&data, TRUE);
+}
+
+/*
+ * Record a makefile read, with its content hash.  A file modified in
+ * the second it was read may change again without a new mtime, so its
+ * mtime is not recorded and the hash is always checked.
+ */
+static void
+ParseCacheFile(const char *path, int fd, const char *buf, size_t len)
+{
+    struct stat st;
+    Boolean isNew;
+    char line[128];
+    long long mtime;
+    int n;
+
+    if (pcache == NULL)
+	return;
+    Hash_CreateEntry(&pcache->files, path, &isNew);
+    if (!isNew)
+	return;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+	(size_t)st.st_size > len) {
+	Parse_CacheAbort("makefile is not a regular file");
+	return;
+    }
+    mtime = st.st_mtime < time(NULL) ? (long long)st.st_mtime : -1;
+    n = snprintf(line, sizeof(line), "F %lld %lld %016llx ",
+	(long long)st.st_size, mtime,
+	ParseCacheHash(FNV_OFFSET, buf, st.st_size));
+    Buf_AddBytes(&pcache->deps, n, line);
+    Buf_AddBytes(&pcache->deps, strlen(path), path);
+    Buf_AddByte(&pcache->deps, '\n');
+}
+
+/*-
+ *---------------------------------------------------------------------
+ * Parse_CacheRecording --
+ *	Return TRUE while the makefiles are read for the parse cache.
+ *---------------------------------------------------------------------
+ */
+Boolean
+Parse_CacheRecording(void)
+{
+    return pcache != NULL;
+}
+
+/*-
+ *---------------------------------------------------------------------
+ * Parse_CachePath --
+ *	Record whether a file exists at a place looked at while parsing.
+ *	Relative paths are recorded relative to the current directory.
+ *---------------------------------------------------------------------
+ */
+void
+Parse_CachePath(const char *path)
+{
+    struct stat st;
+    char cwd[MAXPATHLEN], *abs;
+    Boolean isNew;
+
+    if (pcache == NULL)
+	return;
+    if (*path == '/')
+	abs = bmake_strdup(path);
+    else if (getcwd(cwd, sizeof(cwd)) != NULL)
+	abs = str_concat(cwd, path, STR_ADDSLASH);
+    else {
+	Parse_CacheAbort("cannot get the current directory");
+	return;
+    }
+    Hash_CreateEntry(&pcache->paths, abs, &isNew);
+    if (isNew) {
+	Buf_AddBytes(&pcache->deps, 4,
+	    stat(abs, &st) == 0 ? "E 1 " : "E 0 ");
+	Buf_AddBytes(&pcache->deps, strlen(abs), abs);
+	Buf_AddByte(&pcache->deps, '\n');
+    }
+    free(abs);
+}
+
+/*-
+ *---------------------------------------------------------------------
+ * Parse_CacheCommand --
+ *	Record the output of a shell command run while parsing, so it
+ *	can be run again and compared before the cache is used.
+ *---------------------------------------------------------------------
+ */
+void
+Parse_CacheCommand(const char *cmd, const char *res)
+{
+    char line[64];
+    int n;
+
+    if (pcache == NULL)
+	return;
+    if (Var_Exporting() || ParseCacheEnvHash() != pcache->env) {
+	Parse_CacheAbort("shell command run with a changed environment");
+	return;
+    }
+    n = snprintf(line, sizeof(line), "C %lu %lu ",
+	(unsigned long)strlen(cmd), (unsigned long)strlen(res));
+    Buf_AddBytes(&pcache->deps, n, line);
+    Buf_AddBytes(&pcache->deps, strlen(cmd), cmd);
+    Buf_AddBytes(&pcache->deps, strlen(res), res);
+    Buf_AddByte(&pcache->deps, '\n');
+}
@@ -233,7 +233,7 @@ Targ_NewGN(const char *name)
 {
     GNode *gn;
 
-    gn = bmake_malloc(sizeof(GNode));
+    gn = bmake_palloc(sizeof(GNode));
     gn->name = bmake_strdup(name);
     gn->uname = NULL;
     gn->path = NULL;
@@ -306,7 +306,7 @@ TargFreeGN(void *gnp)
     Lst_Destroy(gn->order_pred, NULL);
     Hash_DeleteTable(&gn->context);
     Lst_Destroy(gn->commands, NULL);
-    free(gn);
+    bmake_pfree(gn, sizeof(GNode));
 }
 #endif
 
@@ -124,6 +124,7 @@ __RCSID("$NetBSD: var.c,v 1.9 2011/06/18 22:39:46 bsiegert Exp $");
  */
 
 #include    <sys/stat.h>
+#include    <sys/time.h>
 #ifndef NO_REGEX
 #include    <sys/types.h>
 #include    <regex.h>
@@ -272,6 +273,58 @@ typedef struct {
     int		end;		/* last word to select */
 } VarSelectWords_t;
 
+/*
+ * A modifier list is compiled once into a VarModProg, with its patterns
+ * unescaped and its regular expressions compiled, and reused for every
+ * expansion with the same text.  Only the patterns of :M and :N may
+ * refer to variables; they are expanded each time.
+ */
+#define VARMOD_MATCH	1	/* :M */
+#define VARMOD_NOMATCH	2	/* :N */
+#define VARMOD_SUBST	3	/* :S */
+#define VARMOD_REGEX	4	/* :C */
+#define VARMOD_QUOTE	5	/* :Q */
+#define VARMOD_TAIL	6	/* :T */
+#define VARMOD_HEAD	7	/* :H */
+#define VARMOD_SUFFIX	8	/* :E */
+#define VARMOD_ROOT	9	/* :R */
+#define VARMOD_ORDER	10	/* :O, :Ox */
+#define VARMOD_UNIQ	11	/* :u */
+#define VARMOD_CASE	12	/* :tl, :tu */
+#define VARMOD_WORDS	13	/* :tW, :tw */
+#define VARMOD_REALPATH	14	/* :tA */
+#define VARMOD_SYSV	15	/* :lhs=rhs */
+#define VARMOD_DEFINED	16	/* :D */
+#define VARMOD_UNDEF	17	/* :U */
+#define VARMOD_NAME	18	/* :L */
+
+typedef struct {
+    int		op;		/* VARMOD_* */
+    char	modifier;	/* modifier character, for debugging */
+    char	arg;		/* :O type or :tl/:tu case */
+    Var_Parse_State state;	/* word handling for this step */
+    char	*pattern;	/* :M, :N, :D, :U */
+    Boolean	needSubst;	/* pattern must be expanded first */
+    VarPattern	sub;		/* :S, :lhs=rhs */
+#ifndef NO_REGEX
+    VarREPattern re;		/* :C */
+#endif
+} VarModStep;
+
+typedef struct {
+    int		len;		/* length of the modifier text */
+    int		nsteps;
+    VarModStep	*steps;
+} VarModProg;
+
+static Hash_Table varModCache;	/* modifier text -> VarModProg or NULL */
+static Buffer	varModKey;
+
+/* Statistics for -dv */
+static struct timeval varStartTime;
+static unsigned long varExpansions;
+static unsigned long varModHits, varModMisses, varModUncached;
+
 static Var *VarFind(const char *, GNode *, int);
 static void VarAdd(const char *, const char *, GNode *);
 static Boolean VarHead(GNode *, Var_Parse_State *,
@@ -409,7 +462,7 @@ VarFind(const char *name, GNode *ctxt, int flags)
 	if ((env = getenv(name)) != NULL) {
 	    int		len;
 
-	    v = bmake_malloc(sizeof(Var));
+	    v = bmake_palloc(sizeof(Var));
 	    v->name = bmake_strdup(name);
 
 	    len = strlen(env);
@@ -461,7 +514,7 @@ VarFreeEnv(Var *v, Boolean destroy)
 	return FALSE;
     free(v->name);
     Buf_Destroy(&v->val, destroy);
-    free(v);
+    bmake_pfree(v, sizeof(Var));
     return TRUE;
 }
 
@@ -491,7 +544,7 @@ VarAdd(const char *name, const char *val, GNode *ctxt)
     int		  len;
     Hash_Entry    *h;
 
-    v = bmake_malloc(sizeof(Var));
+    v = bmake_palloc(sizeof(Var));
 
     len = val ? strlen(val) : 0;
     Buf_Init(&v->val, len+1);
@@ -544,7 +597,7 @@ Var_Delete(const char *name, GNode *ctxt)
 		free(v->name);
 	Hash_DeleteEntry(&ctxt->context, ln);
 	Buf_Destroy(&v->val, TRUE);
-	free(v);
+	bmake_pfree(v, sizeof(Var));
     }
 }
 
@@ -679,6 +732,15 @@ Var_ExportVars(void)
     }
 }
 
+/*
+ * Return TRUE if our children get variables exported to them.
+ */
+Boolean
+Var_Exporting(void)
+{
+    return var_exportedVars != VAR_EXPORTED_NONE;
+}
+
 /*
  * This is called when .export is seen or
  * .MAKE.EXPORTED is modified.
@@ -2382,6 +2444,540 @@ VarStrftime(const char *fmt, int zulu)
     return bmake_strdup(buf);
 }
 
+/*
+ * Return TRUE if VarGetPattern would expand a variable in the pattern
+ * at cp, which ends at delim.
+ */
+static Boolean
+VarModNeedsVar(const char *cp, int delim)
+{
+    for (; *cp && *cp != delim; cp++) {
+	if (cp[0] == '\\' &&
+	    (cp[1] == delim || cp[1] == '\\' || cp[1] == '$' || cp[1] == '&'))
+	    cp++;
+	else if (*cp == '$' && cp[1] != delim)
+	    return TRUE;
+    }
+    return FALSE;
+}
+
+static void
+VarModFree(VarModProg *prog)
+{
+    VarModStep *step;
+    int i;
+
+    for (i = 0; i < prog->nsteps; i++) {
+	step = &prog->steps[i];
+	switch (step->op) {
+	case VARMOD_MATCH:
+	case VARMOD_NOMATCH:
+	case VARMOD_DEFINED:
+	case VARMOD_UNDEF:
+	    free(step->pattern);
+	    break;
+	case VARMOD_SUBST:
+	case VARMOD_SYSV:
+	    free(UNCONST(step->sub.lhs));
+	    free(UNCONST(step->sub.rhs));
+	    break;
+#ifndef NO_REGEX
+	case VARMOD_REGEX:
+	    regfree(&step->re.re);
+	    free(step->re.replace);
+	    free(step->re.matches);
+	    break;
+#endif
+	}
+    }
+    free(prog->steps);
+    free(prog);
+}
+
+/*-
+ *-----------------------------------------------------------------------
+ * VarModCompile --
+ *	Compile the modifiers in tstr, which is terminated by endc.
+ *	The parsing follows ApplyModifiers exactly, but gives up on
+ *	modifiers that would expand a variable while parsing, have side
+ *	effects or are not well-formed, so that ApplyModifiers handles
+ *	and reports them.
+ *
+ * Results:
+ *	The program, or NULL if the modifiers cannot be compiled.
+ *-----------------------------------------------------------------------
+ */
+static VarModProg *
+VarModCompile(const char *tstr, int startc, int endc)
+{
+    VarModProg	   *prog;
+    VarModStep	   *step;
+    Var_Parse_State parsestate;
+    const char	   *start, *cp;
+    char	   *cp2;
+    Boolean	    copy;
+    int		    nalloc, nest;
+#ifndef NO_REGEX
+    char	   *re;
+#endif
+
+    parsestate.oneBigWord = FALSE;
+    parsestate.varSpace = ' ';
+    prog = bmake_malloc(sizeof(*prog));
+    prog->nsteps = 0;
+    prog->steps = NULL;
+    nalloc = 0;
+
+    start = tstr;
+    while (*tstr && *tstr != endc) {
+	if (prog->nsteps == nalloc) {
+	    nalloc = nalloc ? nalloc * 2 : 4;
+	    prog->steps = bmake_realloc(prog->steps,
+					nalloc * sizeof(*prog->steps));
+	}
+	step = &prog->steps[prog->nsteps];
+	memset(step, 0, sizeof(*step));
+	step->modifier = *tstr;
+	step->state = parsestate;
+
+	switch (*tstr) {
+	case 'N':
+	case 'M':
+	    step->op = *tstr == 'M' ? VARMOD_MATCH : VARMOD_NOMATCH;
+	    copy = FALSE;
+	    nest = 1;
+	    for (cp = tstr + 1;
+		 *cp != '\0' && !(*cp == ':' && nest == 1);
+		 cp++) {
+		if (*cp == '\\' &&
+		    (cp[1] == ':' || cp[1] == endc || cp[1] == startc)) {
+		    if (!step->needSubst)
+			copy = TRUE;
+		    cp++;
+		    continue;
+		}
+		if (*cp == '$')
+		    step->needSubst = TRUE;
+		if (*cp == '(' || *cp == '{')
+		    ++nest;
+		if (*cp == ')' || *cp == '}') {
+		    --nest;
+		    if (nest == 0)
+			break;
+		}
+	    }
+	    if (!copy) {
+		step->pattern = bmake_strndup(tstr + 1, cp - (tstr + 1));
+		break;
+	    }
+	    step->pattern = cp2 = bmake_malloc(cp - tstr);
+	    for (tstr++; tstr < cp; tstr++) {
+		if (*tstr == '\\' && tstr + 1 < cp &&
+		    (tstr[1] == ':' || tstr[1] == endc))
+		    tstr++;
+		*cp2++ = *tstr;
+	    }
+	    *cp2 = '\0';
+	    break;
+	case 'D':
+	case 'U':
+	    step->op = *tstr == 'U' ? VARMOD_UNDEF : VARMOD_DEFINED;
+	    step->pattern = cp2 = bmake_malloc(strlen(tstr));
+	    for (cp = tstr + 1; *cp != endc && *cp != ':' && *cp != '\0';
+		 cp++) {
+		if (*cp == '\\' &&
+		    (cp[1] == ':' || cp[1] == '$' || cp[1] == endc ||
+		     cp[1] == '\\'))
+		    cp++;
+		else if (*cp == '$') {
+		    prog->nsteps++;	/* free pattern */
+		    goto fail;
+		}
+		*cp2++ = *cp;
+	    }
+	    *cp2 = '\0';
+	    break;
+	case 'L':
+	    step->op = VARMOD_NAME;
+	    cp = tstr + 1;
+	    break;
+	case 'S':
+	    step->op = VARMOD_SUBST;
+	    cp = tstr + 2;
+	    if (*cp == '^') {
+		step->sub.flags |= VAR_MATCH_START;
+		cp++;
+	    }
+	    if (VarModNeedsVar(cp, tstr[1]) ||
+		(step->sub.lhs = VarGetPattern(VAR_GLOBAL, &parsestate, 0,
+					       &cp, tstr[1], &step->sub.flags,
+					       &step->sub.leftLen,
+					       NULL)) == NULL)
+		goto fail;
+	    if (VarModNeedsVar(cp, tstr[1]) ||
+		(step->sub.rhs = VarGetPattern(VAR_GLOBAL, &parsestate, 0,
+					       &cp, tstr[1], NULL,
+					       &step->sub.rightLen,
+					       &step->sub)) == NULL) {
+		prog->nsteps++;		/* free lhs */
+		goto fail;
+	    }
+	    for (;; cp++) {
+		if (*cp == 'g')
+		    step->sub.flags |= VAR_SUB_GLOBAL;
+		else if (*cp == '1')
+		    step->sub.flags |= VAR_SUB_ONE;
+		else if (*cp == 'W')
+		    step->state.oneBigWord = TRUE;
+		else
+		    break;
+	    }
+	    break;
+#ifndef NO_REGEX
+	case 'C':
+	    step->op = VARMOD_REGEX;
+	    cp = tstr + 2;
+	    if (VarModNeedsVar(cp, tstr[1]) ||
+		(re = VarGetPattern(VAR_GLOBAL, &parsestate, 0, &cp,
+				    tstr[1], NULL, NULL, NULL)) == NULL)
+		goto fail;
+	    if (VarModNeedsVar(cp, tstr[1]) ||
+		(step->re.replace = VarGetPattern(VAR_GLOBAL, &parsestate, 0,
+						  &cp, tstr[1], NULL,
+						  NULL, NULL)) == NULL) {
+		free(re);
+		goto fail;
+	    }
+	    for (;; cp++) {
+		if (*cp == 'g')
+		    step->re.flags |= VAR_SUB_GLOBAL;
+		else if (*cp == '1')
+		    step->re.flags |= VAR_SUB_ONE;
+		else if (*cp == 'W')
+		    step->state.oneBigWord = TRUE;
+		else
+		    break;
+	    }
+	    if (regcomp(&step->re.re, re, REG_EXTENDED) != 0) {
+		free(re);
+		free(step->re.replace);
+		goto fail;
+	    }
+	    free(re);
+	    step->re.nsub = step->re.re.re_nsub + 1;
+	    if (step->re.nsub < 1)
+		step->re.nsub = 1;
+	    if (step->re.nsub > 10)
+		step->re.nsub = 10;
+	    step->re.matches = bmake_malloc(step->re.nsub *
+					    sizeof(regmatch_t));
+	    break;
+#endif
+	case 'Q':
+	case 'T':
+	case 'H':
+	case 'E':
+	case 'R':
+	case 'u':
+	    if (tstr[1] != endc && tstr[1] != ':')
+		goto sysv;
+	    switch (*tstr) {
+	    case 'Q': step->op = VARMOD_QUOTE; break;
+	    case 'T': step->op = VARMOD_TAIL; break;
+	    case 'H': step->op = VARMOD_HEAD; break;
+	    case 'E': step->op = VARMOD_SUFFIX; break;
+	    case 'R': step->op = VARMOD_ROOT; break;
+	    default: step->op = VARMOD_UNIQ; break;
+	    }
+	    cp = tstr + 1;
+	    break;
+	case 'O':
+	    step->op = VARMOD_ORDER;
+	    if (tstr[1] == endc || tstr[1] == ':') {
+		step->arg = 's';
+		cp = tstr + 1;
+	    } else if (tstr[1] == 'x' &&
+		       (tstr[2] == endc || tstr[2] == ':')) {
+		step->arg = 'x';
+		cp = tstr + 2;
+	    } else
+		goto fail;
+	    break;
+	case 't':
+	    if (tstr[1] == endc || tstr[1] == ':' ||
+		(tstr[2] != endc && tstr[2] != ':'))
+		goto fail;
+	    switch (tstr[1]) {
+	    case 'l':
+	    case 'u':
+		step->op = VARMOD_CASE;
+		step->arg = tstr[1];
+		break;
+	    case 'W':
+	    case 'w':
+		step->op = VARMOD_WORDS;
+		parsestate.oneBigWord = (tstr[1] == 'W');
+		break;
+	    case 'A':
+		step->op = VARMOD_REALPATH;
+		break;
+	    default:
+		goto fail;
+	    }
+	    cp = tstr + 2;
+	    break;
+	case ':': case '@': case 'P':
+	case '!': case '[': case 'g': case 'h': case 'l': case '?':
+	case 's':
+	    goto fail;
+	default:
+	sysv:
+#ifdef SYSVVARSUB
+	    {
+		Boolean eqFound;
+		int cnt;
+
+		step->op = VARMOD_SYSV;
+		eqFound = FALSE;
+		cnt = 1;
+		for (cp = tstr; *cp != '\0' && cnt; ) {
+		    if (*cp == '=')
+			eqFound = TRUE;
+		    else if (*cp == endc)
+			cnt--;
+		    else if (*cp == startc)
+			cnt++;
+		    if (cnt)
+			cp++;
+		}
+		if (*cp != endc || !eqFound)
+		    goto fail;
+		cp = tstr;
+		if (VarModNeedsVar(cp, '=') ||
+		    (step->sub.lhs = VarGetPattern(VAR_GLOBAL, &parsestate, 0,
+						   &cp, '=', &step->sub.flags,
+						   &step->sub.leftLen,
+						   NULL)) == NULL)
+		    goto fail;
+		if (VarModNeedsVar(cp, endc) ||
+		    (step->sub.rhs = VarGetPattern(VAR_GLOBAL, &parsestate, 0,
+						   &cp, endc, NULL,
+						   &step->sub.rightLen,
+						   &step->sub)) == NULL) {
+		    prog->nsteps++;	/* free lhs */
+		    goto fail;
+		}
+		cp--;
+		break;
+	    }
+#else
+	    goto fail;
+#endif
+	}
+	prog->nsteps++;
+	if (*cp == '\0')
+	    goto fail;
+	if (*cp == ':')
+	    cp++;
+	tstr = cp;
+    }
+    if (*tstr != endc)
+	goto fail;
+    prog->len = tstr - start;
+    return prog;
+
+ fail:
+    VarModFree(prog);
+    return NULL;
+}
+
+/*-
+ *-----------------------------------------------------------------------
+ * VarModLookup --
+ *	Find the compiled form of the modifiers at tstr, compiling
+ *	them on first use.
+ *
+ * Results:
+ *	The program, or NULL if ApplyModifiers must interpret tstr.
+ *-----------------------------------------------------------------------
+ */
+static VarModProg *
+VarModLookup(const char *tstr, int startc, int endc)
+{
+    Hash_Entry	   *he;
+    VarModProg	   *prog;
+    const char	   *cp;
+    Boolean	    isNew;
+    int		    depth;
+
+    /*
+     * Find the end of the expression without interpreting the
+     * modifiers; VarModCompile checks that they end at the same place.
+     * A leading '$' is a complex modifier.
+     */
+    depth = 0;
+    for (cp = tstr; *cp != endc || depth > 0; cp++) {
+	if (*cp == '\0' || *tstr == '$') {
+	    varModUncached++;
+	    return NULL;
+	}
+	if (*cp == '\\' && cp[1] != '\0')
+	    cp++;
+	else if (*cp == startc)
+	    depth++;
+	else if (*cp == endc)
+	    depth--;
+    }
+
+    Buf_Empty(&varModKey);
+    Buf_AddBytes(&varModKey, cp - tstr + 1, (const Byte *)tstr);
+    he = Hash_CreateEntry(&varModCache,
+			  (char *)Buf_GetAll(&varModKey, NULL), &isNew);
+    if (isNew) {
+	prog = VarModCompile(tstr, startc, endc);
+	if (prog != NULL && prog->len != cp - tstr) {
+	    VarModFree(prog);
+	    prog = NULL;
+	}
+	Hash_SetValue(he, prog);
+	if (DEBUG(VAR))
+	    fprintf(debug_file, "Modifiers \"%.*s\" %s\n", (int)(cp - tstr),
+		    tstr, prog ? "compiled" : "not cacheable");
+    } else
+	prog = Hash_GetValue(he);
+
+    if (prog == NULL)
+	varModUncached++;
+    else if (isNew)
+	varModMisses++;
+    else
+	varModHits++;
+    return prog;
+}
+
+/*-
+ *-----------------------------------------------------------------------
+ * VarModRun --
+ *	Apply a compiled modifier list to nstr, like ApplyModifiers.
+ *-----------------------------------------------------------------------
+ */
+static char *
+VarModRun(VarModProg *prog, char *nstr, Var *v, GNode *ctxt,
+	  Boolean errnum, void **freePtr)
+{
+    VarModStep	   *step;
+    VarPattern	    pattern;
+    char	   *newStr, *mpattern;
+    int		    i;
+
+    for (i = 0; i < prog->nsteps; i++) {
+	step = &prog->steps[i];
+	if (DEBUG(VAR)) {
+	    fprintf(debug_file, "Applying :%c to \"%s\"\n",
+		    step->modifier, nstr);
+	}
+	switch (step->op) {
+	case VARMOD_MATCH:
+	case VARMOD_NOMATCH:
+	    mpattern = step->pattern;
+	    if (step->needSubst)
+		mpattern = Var_Subst(NULL, mpattern, ctxt, errnum);
+	    if (DEBUG(VAR))
+		fprintf(debug_file, "Pattern for [%s] is [%s]\n", nstr,
+			mpattern);
+	    newStr = VarModify(ctxt, &step->state, nstr,
+			       step->op == VARMOD_MATCH ? VarMatch : VarNoMatch,
+			       mpattern);
+	    if (mpattern != step->pattern)
+		free(mpattern);
+	    break;
+	case VARMOD_DEFINED:
+	case VARMOD_UNDEF:
+	    if (((v->flags & VAR_JUNK) != 0) == (step->op == VARMOD_UNDEF))
+		newStr = bmake_strdup(step->pattern);
+	    else
+		newStr = nstr;
+	    if ((v->flags & VAR_JUNK) != 0)
+		v->flags |= VAR_KEEP;
+	    break;
+	case VARMOD_NAME:
+	    if ((v->flags & VAR_JUNK) != 0)
+		v->flags |= VAR_KEEP;
+	    newStr = bmake_strdup(v->name);
+	    break;
+	case VARMOD_SUBST:
+	    /* VarSubstitute records matches in the flags. */
+	    pattern = step->sub;
+	    newStr = VarModify(ctxt, &step->state, nstr, VarSubstitute,
+			       &pattern);
+	    break;
+#ifndef NO_REGEX
+	case VARMOD_REGEX:
+	    step->re.flags &= ~VAR_SUB_MATCHED;
+	    newStr = VarModify(ctxt, &step->state, nstr, VarRESubstitute,
+			       &step->re);
+	    break;
+#endif
+	case VARMOD_QUOTE:
+	    newStr = VarQuote(nstr);
+	    break;
+	case VARMOD_TAIL:
+	    newStr = VarModify(ctxt, &step->state, nstr, VarTail, NULL);
+	    break;
+	case VARMOD_HEAD:
+	    newStr = VarModify(ctxt, &step->state, nstr, VarHead, NULL);
+	    break;
+	case VARMOD_SUFFIX:
+	    newStr = VarModify(ctxt, &step->state, nstr, VarSuffix, NULL);
+	    break;
+	case VARMOD_ROOT:
+	    newStr = VarModify(ctxt, &step->state, nstr, VarRoot, NULL);
+	    break;
+	case VARMOD_ORDER:
+	    newStr = VarOrder(nstr, step->arg);
+	    break;
+	case VARMOD_UNIQ:
+	    newStr = VarUniq(nstr);
+	    break;
+	case VARMOD_CASE:
+	    newStr = VarChangeCase(nstr, step->arg == 'u');
+	    break;
+	case VARMOD_REALPATH:
+	    newStr = VarModify(ctxt, &step->state, nstr, VarRealpath, NULL);
+	    break;
+#ifdef SYSVVARSUB
+	case VARMOD_SYSV:
+	    if (step->sub.leftLen == 0 && *nstr == '\0') {
+		newStr = nstr;	/* special case */
+	    } else {
+		pattern = step->sub;
+		newStr = VarModify(ctxt, &step->state, nstr, VarSYSVMatch,
+				   &pattern);
+	    }
+	    break;
+#endif
+	default:		/* VARMOD_WORDS */
+	    newStr = nstr;
+	    break;
+	}
+	if (DEBUG(VAR)) {
+	    fprintf(debug_file, "Result of :%c is \"%s\"\n",
+		    step->modifier, newStr);
+	}
+	if (newStr != nstr) {
+	    if (*freePtr) {
+		free(nstr);
+		*freePtr = NULL;
+	    }
+	    nstr = newStr;
+	    if (nstr != var_Error && nstr != varNoError) {
+		*freePtr = nstr;
+	    }
+	}
+    }
+    return nstr;
+}
+
 /*
  * Now we need to apply any modifiers the user wants applied.
  * These are:
@@ -2487,6 +3083,12 @@ ApplyModifiers(char *nstr, const char *tstr,
     char	delim;
     int		modifier;	/* that we are processing */
     Var_Parse_State parsestate; /* Flags passed to helper functions */
+    VarModProg	   *prog;
+
+    if (startc != 0 && (prog = VarModLookup(tstr, startc, endc)) != NULL) {
+	*lengthPtr = prog->len;
+	return VarModRun(prog, nstr, v, ctxt, errnum, freePtr);
+    }
 
     delim = '\0';
     parsestate.oneBigWord = FALSE;
@@ -2574,6 +3176,9 @@ ApplyModifiers(char *nstr, const char *tstr,
 		    if (v->name[0] == 0)
 			goto bad_modifier;
 
+		    /* Assignments in conditionals would be lost. */
+		    Parse_CacheAbort("::= modifier used");
+
 		    v_ctxt = ctxt;
 		    sv_name = NULL;
 		    ++tstr;
@@ -3602,6 +4207,7 @@ Var_Parse(const char *str, GNode *ctxt, Boolean errnum, int *lengthPtr,
     *freePtr = NULL;
     dynamic = FALSE;
     start = str;
+    varExpansions++;
     parsestate.oneBigWord = FALSE;
     parsestate.varSpace = ' ';	/* word separator */
 
@@ -3812,7 +4418,7 @@ Var_Parse(const char *str, GNode *ctxt, Boolean errnum, int *lengthPtr,
 		 * Still need to get to the end of the variable specification,
 		 * so kludge up a Var structure for the modifications
 		 */
-		v = bmake_malloc(sizeof(Var));
+		v = bmake_palloc(sizeof(Var));
 		v->name = UNCONST(str);
 		Buf_Init(&v->val, 1);
 		v->flags = VAR_JUNK;
@@ -3896,7 +4502,7 @@ Var_Parse(const char *str, GNode *ctxt, Boolean errnum, int *lengthPtr,
 	if (nstr != Buf_GetAll(&v->val, NULL))
 	    Buf_Destroy(&v->val, TRUE);
 	free(v->name);
-	free(v);
+	bmake_pfree(v, sizeof(Var));
     }
     return (nstr);
 }
@@ -4144,13 +4750,32 @@ Var_Init(void)
 {
     VAR_GLOBAL = Targ_NewGN("Global");
     VAR_CMD = Targ_NewGN("Command");
-
+    Hash_InitTable(&varModCache, 0);
+    Buf_Init(&varModKey, 0);
+    gettimeofday(&varStartTime, NULL);
 }
 
 
 void
 Var_End(void)
 {
+    struct timeval now;
+    double elapsed;
+    unsigned long lookups;
+
+    if (DEBUG(VAR)) {
+	gettimeofday(&now, NULL);
+	elapsed = (now.tv_sec - varStartTime.tv_sec) +
+	    (now.tv_usec - varStartTime.tv_usec) / 1e6;
+	lookups = varModHits + varModMisses + varModUncached;
+	fprintf(debug_file, "#*** Variable expansion:\n");
+	fprintf(debug_file, "# Stats: %lu expansions in %.3fs (%.0f/s)\n",
+		varExpansions, elapsed,
+		elapsed > 0 ? varExpansions / elapsed : 0.0);
+	fprintf(debug_file, "# Modifier cache: %lu hits %lu misses %lu uncached (%lu%%)\n",
+		varModHits, varModMisses, varModUncached,
+		lookups ? varModHits * 100 / lookups : 0);
+    }
 }
 
 
@@ -48,6 +48,7 @@ extern int	compile_time;	/* 1 if compiling, 0 if running */
 extern int	safe;		/* 0 => unsafe, 1 => safe */
 
 #define	RECSIZE	(8 * 1024)	/* sets limit on records, fields, etc., etc. */
+#define	INBUFSIZE (64 * 1024)	/* size of input file buffers */
 extern int	recsize;	/* size of current record, orig RECSIZE */
 
 extern char	**FS;
@@ -67,6 +68,7 @@ extern char	*record;	/* points to $0 */
 extern int	lineno;		/* line number in awk program */
 extern int	errorflag;	/* 1 if error has occurred */
 extern int	donefld;	/* 1 if record broken into fields */
+extern int	splitfld;	/* if !donefld, number of fields split so far */
 extern int	donerec;	/* 1 if record is valid (no fld has changed */
 
 extern int	dbg;
@@ -223,6 +225,11 @@ typedef struct fa {
 	int	*posns[NSTATES];
 	int	anchor;
 	int	use;
+	unsigned int hash;	/* of restr and anchor, for the cache */
+	struct	fa *next;	/* in the same cache bucket */
+	char	*lit;	/* every match starts with this, or NULL */
+	int	litlen;
+	int	bol;	/* ... and only at the beginning */
 	int	initstat;
 	int	curstat;
 	int	accept;
@@ -38,6 +38,7 @@ THIS SOFTWARE.
 #define	HAT	(NCHARS+2)	/* matches ^ in regular expr */
 				/* NCHARS is 2**n */
 #define MAXLIN 22
+#define	MAXLIT	32	/* longest literal prefix looked for */
 
 #define type(v)		(v)->nobj	/* badly overloaded here */
 #define info(v)		(v)->ntype	/* badly overloaded here */
@@ -73,14 +74,90 @@ static	int poscnt;
 char	*patbeg;
 int	patlen;
 
-#define	NFA	20	/* cache this many dynamic fa's */
-fa	*fatab[NFA];
+#define	NFA	32	/* cache this many dynamic fa's at first */
+#define	MAXNFA	1024	/* and up to this many as scripts need them */
+fa	**fatab;	/* hash table of cached fa's, chained by next */
 int	nfatab	= 0;	/* entries in fatab */
+int	sizefatab = 0;	/* buckets in fatab, and most entries it holds */
+
+struct dfastat {	/* per-regex counts, printed with -d */
+	char	*restr;
+	int	anchor;
+	int	hits;
+	int	compiles;
+	struct	dfastat *next;
+};
+static struct dfastat *dfastat;
+
+static void dfacount(const char *s, int anchor, int compiled)
+{
+	struct dfastat *p;
+
+	for (p = dfastat; p != NULL; p = p->next)
+		if (p->anchor == anchor && strcmp(p->restr, s) == 0)
+			break;
+	if (p == NULL) {
+		if ((p = (struct dfastat *) calloc(1, sizeof(*p))) == NULL)
+			overflo("out of space in dfacount");
+		p->restr = tostring(s);
+		p->anchor = anchor;
+		p->next = dfastat;
+		dfastat = p;
+	}
+	if (compiled)
+		p->compiles++;
+	else
+		p->hits++;
+}
+
+void dfastats(void)	/* print how well the dfa cache did */
+{
+	struct dfastat *p;
+	int hits = 0, compiles = 0;
+
+	for (p = dfastat; p != NULL; p = p->next) {
+		hits += p->hits;
+		compiles += p->compiles;
+	}
+	printf("dfa cache: %d entries, %d hits, %d compiles\n",
+	    nfatab, hits, compiles);
+	for (p = dfastat; p != NULL; p = p->next)
+		printf("%8d hits %6d compiles  %s/%s/\n", p->hits, p->compiles,
+		    p->anchor ? "anchored " : "", p->restr);
+}
+
+static unsigned int fahash(const char *s, int anchor)
+{
+	unsigned int h = 2166136261U;
+
+	while (*s)
+		h = (h ^ (uschar) *s++) * 16777619U;
+	return h ^ anchor;
+}
+
+static void growfatab(int n)	/* rehash fatab into n buckets */
+{
+	fa **tab, *pfa, *next;
+	int i;
+
+	if ((tab = (fa **) calloc(n, sizeof(fa *))) == NULL)
+		overflo("out of space in growfatab");
+	for (i = 0; i < sizefatab; i++)
+		for (pfa = fatab[i]; pfa != NULL; pfa = next) {
+			next = pfa->next;
+			pfa->next = tab[pfa->hash & (n-1)];
+			tab[pfa->hash & (n-1)] = pfa;
+		}
+	xfree(fatab);
+	fatab = tab;
+	sizefatab = n;
+}
 
 fa *makedfa(const char *s, int anchor)	/* returns dfa for reg expr s */
 {
-	int i, use, nuse;
-	fa *pfa;
+	int i, use;
+	unsigned int h;
+	fa *pfa, *lrufa, **ppfa, **lru;
 	static int now = 1;
 
 	if (setvec == 0) {	/* first time through any RE */
@@ -89,43 +166,89 @@ fa *makedfa(const char *s, int anchor)	/* returns dfa for reg expr s */
 		tmpset = (int *) malloc(maxsetvec * sizeof(int));
 		if (setvec == 0 || tmpset == 0)
 			overflo("out of space initializing makedfa");
+		growfatab(NFA);
 	}
 
 	if (compile_time)	/* a constant for sure */
 		return mkdfa(s, anchor);
-	for (i = 0; i < nfatab; i++)	/* is it there already? */
-		if (fatab[i]->anchor == anchor
-		  && strcmp((const char *) fatab[i]->restr, s) == 0) {
-			fatab[i]->use = now++;
-			return fatab[i];
+	h = fahash(s, anchor);
+	for (pfa = fatab[h & (sizefatab-1)]; pfa != NULL; pfa = pfa->next)
+		if (pfa->hash == h && pfa->anchor == anchor
+		  && strcmp((const char *) pfa->restr, s) == 0) {
+			pfa->use = now++;	/* is it there already? */
+			if (dbg)
+				dfacount(s, anchor, 0);
+			return pfa;
 		}
 	pfa = mkdfa(s, anchor);
-	if (nfatab < NFA) {	/* room for another */
-		fatab[nfatab] = pfa;
-		fatab[nfatab]->use = now++;
-		nfatab++;
-		return pfa;
+	if (dbg)
+		dfacount(s, anchor, 1);
+	if (nfatab >= sizefatab && sizefatab < MAXNFA)
+		growfatab(2 * sizefatab);	/* make room for another */
+	else if (nfatab >= sizefatab) {	/* replace least-recently used */
+		lru = NULL;
+		use = now;
+		for (i = 0; i < sizefatab; i++)
+			for (ppfa = &fatab[i]; *ppfa != NULL; ppfa = &(*ppfa)->next)
+				if ((*ppfa)->use < use) {
+					use = (*ppfa)->use;
+					lru = ppfa;
+				}
+		lrufa = *lru;
+		*lru = lrufa->next;
+		freefa(lrufa);
+		nfatab--;
 	}
-	use = fatab[0]->use;	/* replace least-recently used */
-	nuse = 0;
-	for (i = 1; i < nfatab; i++)
-		if (fatab[i]->use < use) {
-			use = fatab[i]->use;
-			nuse = i;
-		}
-	freefa(fatab[nuse]);
-	fatab[nuse] = pfa;
+	pfa->hash = h;
 	pfa->use = now++;
+	pfa->next = fatab[h & (sizefatab-1)];
+	fatab[h & (sizefatab-1)] = pfa;
+	nfatab++;
 	return pfa;
 }
 
+/*
+ * Collect the literal chars every match of re p has to start with,
+ * so the matchers can skip input where it can't possibly match.
+ * Returns 0 once something other than a plain char turns up.
+ */
+static int litprefix(Node *p, char *buf, int *n, int *bol)
+{
+	int c;
+
+	switch (type(p)) {
+	case CAT:
+		return litprefix(left(p), buf, n, bol)
+		    && litprefix(right(p), buf, n, bol);
+	case CHAR:
+		c = ptoi(right(p));
+		if (c == HAT && *n == 0 && !*bol) {
+			*bol = 1;
+			return 1;
+		}
+		if (c <= 0 || c >= NCHARS-3 || *n >= MAXLIT)
+			return 0;
+		buf[(*n)++] = c;
+		return 1;
+	case PLUS:	/* at least one of them */
+		if (type(left(p)) == CHAR)
+			litprefix(left(p), buf, n, bol);
+		return 0;
+	default:
+		return 0;
+	}
+}
+
 fa *mkdfa(const char *s, int anchor)	/* does the real work of making a dfa */
 				/* anchor = 1 for anchored matches, else 0 */
 {
 	Node *p, *p1;
 	fa *f;
+	char lit[MAXLIT+1];
+	int litlen = 0, bol = 0;
 
 	p = reparse(s);
+	litprefix(p, lit, &litlen, &bol);
 	p1 = op2(CAT, op2(STAR, op2(ALL, NIL, NIL), NIL), p);
 		/* put ALL STAR in front of reg.  exp. */
 	p1 = op2(CAT, p1, op2(FINAL, NIL, NIL));
@@ -146,6 +269,12 @@ fa *mkdfa(const char *s, int anchor)	/* does the real work of making a dfa */
 	f->initstat = makeinit(f, anchor);
 	f->anchor = anchor;
 	f->restr = (uschar *) tostring(s);
+	if (litlen > 0) {
+		lit[litlen] = '\0';
+		f->lit = tostring(lit);
+		f->litlen = litlen;
+		f->bol = bol;
+	}
 	return f;
 }
 
@@ -463,6 +592,9 @@ int match(fa *f, const char *p0)	/* shortest match ? */
 	int s, ns;
 	uschar *p = (uschar *) p0;
 
+	if (f->lit != NULL && (f->bol ? strncmp(p0, f->lit, f->litlen) != 0
+	    : strstr(p0, f->lit) == NULL))
+		return(0);
 	s = f->reset ? makeinit(f,0) : f->initstat;
 	if (f->out[s])
 		return(1);
@@ -493,6 +625,9 @@ int pmatch(fa *f, const char *p0)	/* longest match, for sub */
 	}
 	patbeg = (char *) p;
 	patlen = -1;
+	if (f->lit != NULL && (f->bol ? strncmp(p0, f->lit, f->litlen) != 0
+	    : strstr(p0, f->lit) == NULL))
+		return(0);
 	do {
 		q = p;
 		do {
@@ -533,6 +668,12 @@ int pmatch(fa *f, const char *p0)	/* longest match, for sub */
 			for (i = 0; i < NCHARS; i++)
 				f->gototab[2][i] = 0;
 		}
+		if (f->lit != NULL && !f->bol && *p != 0) {
+			/* a match can only start where lit is */
+			if ((q = (uschar *) strstr((char *) p+1, f->lit)) == NULL)
+				return (0);
+			p = q-1;
+		}
 	} while (*p++ != 0);
 	return (0);
 }
@@ -551,6 +692,9 @@ int nematch(fa *f, const char *p0)	/* non-empty match, for sub */
 		s = f->initstat;
 	}
 	patlen = -1;
+	if (f->lit != NULL && (f->bol ? strncmp(p0, f->lit, f->litlen) != 0
+	    : strstr(p0, f->lit) == NULL))
+		return(0);
 	while (*p) {
 		q = p;
 		do {
@@ -590,6 +734,12 @@ int nematch(fa *f, const char *p0)	/* non-empty match, for sub */
 			for (i = 0; i < NCHARS; i++)
 				f->gototab[2][i] = 0;
 		}
+		if (f->lit != NULL && !f->bol) {
+			/* a match can only start where lit is */
+			if ((q = (uschar *) strstr((char *) p+1, f->lit)) == NULL)
+				return (0);
+			p = q-1;
+		}
 		p++;
 	}
 	return (0);
@@ -937,5 +1087,6 @@ void freefa(fa *f)	/* free a finite automaton */
 			xfree((f->re[i].lval.np));
 	}
 	xfree(f->restr);
+	xfree(f->lit);
 	xfree(f);
 }
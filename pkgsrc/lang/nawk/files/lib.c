@@ -31,6 +31,8 @@ THIS SOFTWARE.
 #include <errno.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <unistd.h>
 #include "awk.h"
 #include "ytab.h"
 
@@ -51,6 +53,10 @@ int	nfields	= MAXFLD;	/* last allocated slot for $i */
 
 int	donefld;	/* 1 = implies rec broken into fields */
 int	donerec;	/* 1 = record is valid (no flds have changed) */
+int	splitfld;	/* if !donefld, $1..$splitfld are valid already */
+static char *splitr;	/* where splitting $0 stopped */
+static char *splitfr;	/* next free byte in fields */
+static int splitrt;	/* char that ends fields besides FS, see fldbldn */
 
 int	lastfld	= 0;	/* last used field */
 int	argno	= 1;	/* current input argument number */
@@ -120,6 +126,7 @@ int getrec(char **pbuf, int *pbufsize, int isrecord)	/* get next input record */
 		*RS, *FS, *ARGC, *FILENAME) );
 	if (isrecord) {
 		donefld = 0;
+		splitfld = 0;
 		donerec = 1;
 	}
 	saveb0 = buf[0];
@@ -164,8 +171,10 @@ int getrec(char **pbuf, int *pbufsize, int isrecord)	/* get next input record */
 			return 1;
 		}
 		/* EOF arrived on this file; set up next */
-		if (infile != stdin)
+		if (infile != stdin) {
+			freeinbuf(infile);
 			fclose(infile);
+		}
 		infile = NULL;
 		argno++;
 	}
@@ -177,19 +186,98 @@ int getrec(char **pbuf, int *pbufsize, int isrecord)	/* get next input record */
 
 void nextfile(void)
 {
-	if (infile != stdin)
+	if (infile != stdin) {
+		freeinbuf(infile);
 		fclose(infile);
+	}
 	infile = NULL;
 	argno++;
 }
 
+/*
+ * Input files are read in large blocks, bypassing stdio, so that a
+ * record can be found with memchr() and copied out at once instead
+ * of getc()ing it one char at a time.  read() returns what is there,
+ * so reading from terminals and pipes doesn't wait for more input
+ * than one record needs.
+ */
+typedef struct Inbuf {
+	FILE	*fp;
+	char	*buf;
+	char	*pos;	/* next unread byte */
+	char	*end;	/* end of valid data */
+	int	eof;
+	struct Inbuf *next;
+} Inbuf;
+
+static Inbuf *inbufs;
+
+static Inbuf *getinbuf(FILE *fp)	/* find or make the buffer for fp */
+{
+	Inbuf *ib;
+
+	for (ib = inbufs; ib != NULL; ib = ib->next)
+		if (ib->fp == fp)
+			return ib;
+	if ((ib = (Inbuf *) malloc(sizeof(Inbuf))) == NULL
+	  || (ib->buf = (char *) malloc(INBUFSIZE)) == NULL)
+		FATAL("out of space for input buffer");
+	ib->fp = fp;
+	ib->pos = ib->end = ib->buf;
+	ib->eof = 0;
+	ib->next = inbufs;
+	inbufs = ib;
+	return ib;
+}
+
+void freeinbuf(FILE *fp)	/* forget buffered input of fp before closing it */
+{
+	Inbuf *ib, **pib;
+
+	for (pib = &inbufs; (ib = *pib) != NULL; pib = &ib->next)
+		if (ib->fp == fp) {
+			*pib = ib->next;
+			free(ib->buf);
+			free(ib);
+			return;
+		}
+}
+
+static int fillinbuf(Inbuf *ib)	/* refill ib; returns 0 at end of file */
+{
+	ssize_t n;
+
+	if (ib->eof)
+		return 0;
+	do
+		n = read(fileno(ib->fp), ib->buf, INBUFSIZE);
+	while (n < 0 && errno == EINTR);
+	if (n <= 0) {
+		ib->eof = 1;
+		return 0;
+	}
+	ib->pos = ib->buf;
+	ib->end = ib->buf + n;
+	return 1;
+}
+
+static int inbufgetc(Inbuf *ib)
+{
+	if (ib->pos == ib->end && !fillinbuf(ib))
+		return EOF;
+	return (uschar) *ib->pos++;
+}
+
 int readrec(char **pbuf, int *pbufsize, FILE *inf)	/* read one record into buf */
 {
-	int sep, c;
-	char *rr, *buf = *pbuf;
+	int sep, c, n;
+	char *rr, *p, *buf = *pbuf;
 	int bufsize = *pbufsize;
 	size_t len;
+	Inbuf *ib;
 
+	if (donefld == 0 && splitfld > 0)
+		fldbld();	/* finish $0 with the FS it was started with */
 	if ((len = strlen(*FS)) <= len_inputFS) {
 		strcpy(inputFS, *FS);	/* for subsequent field splitting */
 	} else {
@@ -201,23 +289,37 @@ int readrec(char **pbuf, int *pbufsize, FILE *inf)	/* read one record into buf *
 		len_inputFS = len;
 		memcpy(inputFS, *FS, len + 1);
 	}
+	ib = getinbuf(inf);
 	if ((sep = **RS) == 0) {
 		sep = '\n';
-		while ((c=getc(inf)) == '\n' && c != EOF)	/* skip leading \n's */
+		while ((c=inbufgetc(ib)) == '\n' && c != EOF)	/* skip leading \n's */
 			;
 		if (c != EOF)
-			ungetc(c, inf);
+			ib->pos--;
 	}
 	for (rr = buf; ; ) {
-		for (; (c=getc(inf)) != sep && c != EOF; ) {
-			if (rr-buf+1 > bufsize)
-				if (!adjbuf(&buf, &bufsize, 1+rr-buf, recsize, &rr, "readrec 1"))
+		for (;;) {	/* copy up to the next sep at once */
+			if (ib->pos == ib->end && !fillinbuf(ib)) {
+				c = EOF;
+				break;
+			}
+			p = memchr(ib->pos, sep, ib->end - ib->pos);
+			n = (p != NULL ? p : ib->end) - ib->pos;
+			if (rr-buf+n+1 > bufsize)
+				if (!adjbuf(&buf, &bufsize, 1+n+rr-buf, recsize, &rr, "readrec 1"))
 					FATAL("input record `%.30s...' too long", buf);
-			*rr++ = c;
+			memcpy(rr, ib->pos, n);
+			rr += n;
+			ib->pos += n;
+			if (p != NULL) {
+				ib->pos++;
+				c = sep;
+				break;
+			}
 		}
 		if (**RS == sep || c == EOF)
 			break;
-		if ((c = getc(inf)) == '\n' || c == EOF) /* 2 in a row */
+		if ((c = inbufgetc(ib)) == '\n' || c == EOF) /* 2 in a row */
 			break;
 		if (!adjbuf(&buf, &bufsize, 2+rr-buf, recsize, &rr, "readrec 2"))
 			FATAL("input record `%.30s...' too long", buf);
@@ -266,35 +368,60 @@ void setclvar(char *s)	/* set var=value from s */
 
 
 void fldbld(void)	/* create fields from current record */
+{
+	fldbldn(INT_MAX);
+}
+
+/*
+ * Create fields from the current record, but for the common cases of
+ * blanks or a single char as FS only up to $n; the rest is split when
+ * a later field or NF is asked for.  Fields end up exactly where
+ * splitting all of $0 at once would put them.
+ */
+void fldbldn(int n)
 {
 	/* this relies on having fields[] the same length as $0 */
 	/* the fields are all stored in this one array with \0's */
 	char *r, *fr, sep;
 	Cell *p;
-	int i, j, n;
+	int i, j, len;
 
-	if (donefld)
+	if (donefld || n <= splitfld)
 		return;
-	if (!isstr(fldtab[0]))
-		getsval(fldtab[0]);
-	r = fldtab[0]->sval;
-	n = strlen(r);
-	if (n > fieldssize) {
-		xfree(fields);
-		if ((fields = (char *) malloc(n+1)) == NULL)
-			FATAL("out of space for fields in fldbld %d", n);
-		fieldssize = n;
+	if (splitfld == 0) {	/* start on a new $0 */
+		if (!isstr(fldtab[0]))
+			getsval(fldtab[0]);
+		r = fldtab[0]->sval;
+		len = strlen(r);
+		if (len > fieldssize) {
+			xfree(fields);
+			if ((fields = (char *) malloc(len+1)) == NULL)
+				FATAL("out of space for fields in fldbld %d", len);
+			fieldssize = len;
+		}
+		fr = fields;
+		/* subtlecase : if length(FS) == 1 && length(RS > 0)
+		 * \n is NOT a field separator (cf awk book 61,84).
+		 * this variable is tested in the inner while loop.
+		 */
+		splitrt = '\n';  /* normal case */
+		if (strlen(*RS) > 0)
+			splitrt = '\0';
+	} else {
+		r = splitr;
+		fr = splitfr;
 	}
-	fr = fields;
-	i = 0;	/* number of fields accumulated here */
+	i = splitfld;	/* number of fields accumulated here */
 	if (inputFS[0] && inputFS[1]) {	/* it's a regular expression */
 		i = refldbld(r, inputFS);
 	} else if ((sep = *inputFS) == ' ') {	/* default whitespace */
-		for (i = 0; ; ) {
+		for (;;) {
 			while (*r == ' ' || *r == '\t' || *r == '\n')
 				r++;
 			if (*r == 0)
 				break;
+			if (i >= n)
+				goto partial;
 			i++;
 			if (i > nfields)
 				growfldtab(i);
@@ -322,15 +449,10 @@ void fldbld(void)	/* create fields from current record */
 			fldtab[i]->tval = FLD | STR;
 		}
 		*fr = 0;
-	} else if (*r != 0) {	/* if 0, it's a null field */
-		/* subtlecase : if length(FS) == 1 && length(RS > 0)
-		 * \n is NOT a field separator (cf awk book 61,84).
-		 * this variable is tested in the inner while loop.
-		 */
-		int rtest = '\n';  /* normal case */
-		if (strlen(*RS) > 0)
-			rtest = '\0';
+	} else if (*r != 0 || i > 0) {	/* if 0, it's a null field */
 		for (;;) {
+			if (i >= n)
+				goto partial;
 			i++;
 			if (i > nfields)
 				growfldtab(i);
@@ -338,7 +460,7 @@ void fldbld(void)	/* create fields from current record */
 				xfree(fldtab[i]->sval);
 			fldtab[i]->sval = fr;
 			fldtab[i]->tval = FLD | STR | DONTFREE;
-			while (*r != sep && *r != rtest && *r != '\0')	/* \n is always a separator */
+			while (*r != sep && *r != splitrt && *r != '\0')	/* \n is always a separator */
 				*fr++ = *r++;
 			*fr++ = 0;
 			if (*r++ == 0)
@@ -348,16 +470,16 @@ void fldbld(void)	/* create fields from current record */
 	}
 	if (i > nfields)
 		FATAL("record `%.30s...' has too many fields; can't happen", r);
-	cleanfld(i+1, lastfld);	/* clean out junk from previous record */
-	lastfld = i;
-	donefld = 1;
-	for (j = 1; j <= lastfld; j++) {
+	for (j = splitfld+1; j <= i; j++) {
 		p = fldtab[j];
 		if(is_number(p->sval)) {
 			p->fval = atof(p->sval);
 			p->tval |= NUM;
 		}
 	}
+	cleanfld(i+1, lastfld);	/* clean out junk from previous record */
+	lastfld = i;
+	donefld = 1;
 	setfval(nfloc, (Awkfloat) lastfld);
 	if (dbg) {
 		for (j = 0; j <= lastfld; j++) {
@@ -365,6 +487,21 @@ void fldbld(void)	/* create fields from current record */
 			printf("field %d (%s): |%s|\n", j, p->nval, p->sval);
 		}
 	}
+	return;
+
+  partial:
+	for (j = splitfld+1; j <= i; j++) {
+		p = fldtab[j];
+		if(is_number(p->sval)) {
+			p->fval = atof(p->sval);
+			p->tval |= NUM;
+		}
+	}
+	if (i > lastfld)	/* so they get cleaned out later */
+		lastfld = i;
+	splitfld = i;
+	splitr = r;
+	splitfr = fr;
 }
 
 void cleanfld(int n1, int n2)	/* clean out fields n1 .. n2 inclusive */
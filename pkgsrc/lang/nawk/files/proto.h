@@ -42,6 +42,7 @@ extern	int	yyinput(void);
 
 extern	fa	*makedfa(const char *, int);
 extern	fa	*mkdfa(const char *, int);
+extern	void	dfastats(void);
 extern	int	makeinit(fa *, int);
 extern	void	penter(Node *);
 extern	void	freetr(Node *);
@@ -121,9 +122,11 @@ extern	void	growfldtab(int n);
 extern	int	getrec(char **, int *, int);
 extern	void	nextfile(void);
 extern	int	readrec(char **buf, int *bufsize, FILE *inf);
+extern	void	freeinbuf(FILE *);
 extern	char	*getargv(int);
 extern	void	setclvar(char *);
 extern	void	fldbld(void);
+extern	void	fldbldn(int);
 extern	void	cleanfld(int, int);
 extern	void	newfld(int);
 extern	int	refldbld(const char *, const char *);
@@ -131,6 +131,8 @@ void run(Node *a)	/* execution of parse tree starts here */
 
 	stdinit();
 	execute(a);
+	if (dbg)
+		dfastats();
 	closeall();
 }
 
@@ -147,7 +149,7 @@ Cell *execute(Node *u)	/* execute a node of the parse tree */
 		if (isvalue(a)) {
 			x = (Cell *) (a->narg[0]);
 			if (isfld(x) && !donefld)
-				fldbld();
+				fldbldn(atoi(x->nval));
 			else if (isrec(x) && !donerec)
 				recbld();
 			return(x);
@@ -157,7 +159,7 @@ Cell *execute(Node *u)	/* execute a node of the parse tree */
 		proc = proctab[a->nobj-FIRSTTOKEN];
 		x = (*proc)(a->narg, a->nobj);
 		if (isfld(x) && !donefld)
-			fldbld();
+			fldbldn(atoi(x->nval));
 		else if (isrec(x) && !donerec)
 			recbld();
 		if (isexpr(a))
@@ -1695,6 +1697,7 @@ Cell *closefile(Node **a, int n)
 		if (files[i].fname && strcmp(x->sval, files[i].fname) == 0) {
 			if (ferror(files[i].fp))
 				WARNING( "i/o error occurred on %s", files[i].fname );
+			freeinbuf(files[i].fp);
 			if (files[i].mode == '|' || files[i].mode == LE)
 				stat = pclose(files[i].fp);
 			else
@@ -1721,6 +1724,7 @@ void closeall(void)
 		if (files[i].fp) {
 			if (ferror(files[i].fp))
 				WARNING( "i/o error occurred on %s", files[i].fname );
+			freeinbuf(files[i].fp);
 			if (files[i].mode == '|' || files[i].mode == LE)
 				stat = pclose(files[i].fp);
 			else
@@ -287,6 +287,8 @@ Awkfloat setfval(Cell *vp, Awkfloat f)	/* set float val of a Cell */
 	if ((vp->tval & (NUM | STR)) == 0) 
 		funnyvar(vp, "assign to");
 	if (isfld(vp)) {
+		if (donefld == 0 && splitfld > 0)
+			fldbld();	/* NF is not known yet */
 		donerec = 0;	/* mark $0 invalid */
 		fldno = atoi(vp->nval);
 		if (fldno > *NF)
@@ -294,6 +296,7 @@ Awkfloat setfval(Cell *vp, Awkfloat f)	/* set float val of a Cell */
 		   dprintf( ("setting field %d to %g\n", fldno, f) );
 	} else if (isrec(vp)) {
 		donefld = 0;	/* mark $1... invalid */
+		splitfld = 0;
 		donerec = 1;
 	}
 	if (freeable(vp))
@@ -324,6 +327,8 @@ char *setsval(Cell *vp, const char *s)	/* set string val of a Cell */
 	if ((vp->tval & (NUM | STR)) == 0)
 		funnyvar(vp, "assign to");
 	if (isfld(vp)) {
+		if (donefld == 0 && splitfld > 0)
+			fldbld();	/* NF is not known yet */
 		donerec = 0;	/* mark $0 invalid */
 		fldno = atoi(vp->nval);
 		if (fldno > *NF)
@@ -331,6 +336,7 @@ char *setsval(Cell *vp, const char *s)	/* set string val of a Cell */
 		   dprintf( ("setting field %d to %s (%p)\n", fldno, s, s) );
 	} else if (isrec(vp)) {
 		donefld = 0;	/* mark $1... invalid */
+		splitfld = 0;
 		donerec = 1;
 	}
 	t = tostring(s);	/* in case it's self-assign */
@@ -349,7 +355,7 @@ Awkfloat getfval(Cell *vp)	/* get float val of a Cell */
 	if ((vp->tval & (NUM | STR)) == 0)
 		funnyvar(vp, "read value of");
 	if (isfld(vp) && donefld == 0)
-		fldbld();
+		fldbldn(atoi(vp->nval));
 	else if (isrec(vp) && donerec == 0)
 		recbld();
 	if (!isnum(vp)) {	/* not a number */
@@ -369,7 +375,7 @@ static char *get_str_val(Cell *vp, char **fmt)        /* get string val of a Cel
 	if ((vp->tval & (NUM | STR)) == 0)
 		funnyvar(vp, "read value of");
 	if (isfld(vp) && donefld == 0)
-		fldbld();
+		fldbldn(atoi(vp->nval));
 	else if (isrec(vp) && donerec == 0)
 		recbld();
 	if (isstr(vp) == 0) {
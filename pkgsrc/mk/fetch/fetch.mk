@@ -195,6 +195,10 @@ fetch-check-interactive: .USEBEFORE
 # FETCH_USE_IPV4_ONLY, if defined, will cause the fetch command to force
 #	connecting to only IPv4 addresses.
 #
+# FETCH_SEGMENTS, if defined, makes the fetch command split large files
+#	into up to this many byte ranges fetched in parallel.  Only
+#	FETCH_USING=fetch supports this.
+#
 
 # If this host is behind a filtering firewall, use passive ftp(1)
 _FETCH_BEFORE_ARGS.ftp=		${PASSIVE_FETCH:D-p} \
@@ -206,6 +210,7 @@ _FETCH_OUTPUT_ARGS.ftp=		-o
 _FETCH_CMD.ftp=			${TOOLS_PATH.ftp}
 
 _FETCH_BEFORE_ARGS.fetch=	${FETCH_TIMEOUT:D-T ${FETCH_TIMEOUT}} \
+				${FETCH_SEGMENTS:D-j ${FETCH_SEGMENTS}} \
 				${FETCH_USE_IPV4_ONLY:D-4}
 _FETCH_AFTER_ARGS.fetch=	# empty
 _FETCH_RESUME_ARGS.fetch=	-r
@@ -54,6 +54,9 @@ stage-package-create:	stage-install stage-package-remove ${STAGE_PKGFILE}
 
 _PKG_ARGS_PACKAGE+=	${_PKG_CREATE_ARGS}
 _PKG_ARGS_PACKAGE+=	-F ${PKG_COMPRESSION}
+.if defined(PKG_COMPRESSION_THREADS)
+_PKG_ARGS_PACKAGE+=	-j ${PKG_COMPRESSION_THREADS}
+.endif
 .if ${_USE_DESTDIR} == "no"
 _PKG_ARGS_PACKAGE+=	-p ${PREFIX}
 .else
@@ -48,12 +48,14 @@
 #if HAVE_SYS_TIME_H
 #include <sys/time.h>
 #endif
+#include <sys/wait.h>
 
 #include <ctype.h>
 #if HAVE_ERR_H
 #include <err.h>
 #endif
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #if HAVE_STDINT_H
 #include <stdint.h>
@@ -64,6 +66,7 @@
 #if HAVE_TERMIOS_H
 #include <termios.h>
 #endif
+#include <time.h>
 #include <unistd.h>
 
 #include <fetch.h>
@@ -93,6 +96,7 @@ off_t	 B_size;	/*    -B: buffer size */
 int	 d_flag;	/*    -d: direct connection */
 int	 F_flag;	/*    -F: restart without checking mtime  */
 int	 i_flag;	/*    -i: fetch file if modified */
+int	 j_segs;	/*    -j: number of parallel segments */
 int	 l_flag;	/*    -l: link rather than copy file: URLs */
 int	 m_flag;	/* -[Mm]: mirror mode */
 char	*N_filename;	/*    -N: netrc file name */
@@ -383,6 +387,434 @@ query_auth(struct url *URL)
 	return (0);
 }
 
+/*
+ * Segmented retrieval
+ *
+ * A large file is split into byte ranges which are fetched by child
+ * processes, each over its own connection, straight into their place
+ * in a preallocated "<path>.part" file.  The progress of each range is
+ * kept in a trailer after the end of the data, so that an interrupted
+ * transfer is picked up where it left off by the next run.
+ */
+#define SEGMAGIC	"fetch segments 1"
+#define SEGLINE		64	/* length of a trailer line */
+#define MAXSEGS		16
+#define MINSEGSIZE	(1024 * 1024)
+#define SEGRETRIES	3	/* attempts without progress per range */
+
+/* child exit codes */
+#define SEG_OK		0
+#define SEG_FAIL	1
+#define SEG_NORANGE	2	/* server ignored the range request */
+#define SEG_CHANGED	3	/* remote file changed */
+
+struct segment {
+	off_t	 start;		/* first byte of the range */
+	off_t	 end;		/* last byte + 1 */
+	off_t	 done;		/* bytes received */
+	off_t	 base;		/* bytes received before this attempt */
+	pid_t	 pid;		/* child fetching the range, or 0 */
+	int	 tries;		/* attempts that made no progress */
+};
+
+/*
+ * Write line n of the trailer, which starts at offset size
+ */
+static int
+seg_putline(int fd, off_t size, int n, const char *str)
+{
+	char line[SEGLINE + 1];
+
+	snprintf(line, sizeof line, "%-*s\n", SEGLINE - 1, str);
+	if (pwrite(fd, line, SEGLINE, size + (off_t)n * SEGLINE) != SEGLINE)
+		return (-1);
+	return (0);
+}
+
+/*
+ * Record the progress of segment i
+ */
+static int
+seg_save(int fd, off_t size, int i, const struct segment *seg)
+{
+	char str[SEGLINE];
+
+	snprintf(str, sizeof str, "%jd %jd %jd", (intmax_t)seg->start,
+	    (intmax_t)seg->end, (intmax_t)seg->done);
+	return (seg_putline(fd, size, i + 1, str));
+}
+
+/*
+ * Read back the progress of segment i
+ */
+static int
+seg_read(int fd, off_t size, int i, struct segment *seg)
+{
+	char line[SEGLINE + 1];
+	intmax_t start, end, done;
+
+	if (pread(fd, line, SEGLINE, size + (off_t)(i + 1) * SEGLINE) !=
+	    SEGLINE)
+		return (-1);
+	line[SEGLINE] = '\0';
+	if (sscanf(line, "%jd %jd %jd", &start, &end, &done) != 3 ||
+	    start < 0 || start > end || end > size ||
+	    done < 0 || done > end - start)
+		return (-1);
+	seg->start = start;
+	seg->end = end;
+	seg->done = done;
+	return (0);
+}
+
+/*
+ * Load the trailer of a partial file; returns the number of segments,
+ * or 0 if it doesn't describe the given remote file.
+ */
+static int
+seg_load(int fd, off_t size, time_t mtime, struct segment *segs)
+{
+	char line[SEGLINE + 1];
+	intmax_t lsize, lmtime;
+	int i, n;
+
+	if (pread(fd, line, SEGLINE, size) != SEGLINE)
+		return (0);
+	line[SEGLINE] = '\0';
+	if (strncmp(line, SEGMAGIC " ", sizeof(SEGMAGIC)) != 0 ||
+	    sscanf(line + sizeof(SEGMAGIC), "%jd %jd %d",
+	    &lsize, &lmtime, &n) != 3)
+		return (0);
+	if (lsize != size || lmtime != mtime || n < 1 || n > MAXSEGS)
+		return (0);
+	for (i = 0; i < n; i++) {
+		if (seg_read(fd, size, i, &segs[i]) == -1 ||
+		    segs[i].start != (i ? segs[i - 1].end : 0))
+			return (0);
+	}
+	if (segs[n - 1].end != size)
+		return (0);
+	return (n);
+}
+
+/*
+ * Fetch one range into the partial file; runs in a child process.
+ */
+static void
+seg_child(struct url *url, const char *URL, const char *flags,
+    const char *partpath, int fd, off_t size, time_t mtime, int i,
+    struct segment *seg)
+{
+	struct sigaction sa;
+	struct url_stat us;
+	fetchIO *f;
+	ssize_t ssize, wr;
+	off_t pos, want;
+	size_t len;
+	char *ptr;
+
+	/* a second SIGINT from our parent must not kill us */
+	sa.sa_flags = 0;
+	sa.sa_handler = sig_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	fetchAuthMethod = NULL;
+
+	pos = seg->start + seg->done;
+	want = seg->end - pos;
+	url->offset = pos;
+	url->length = want;
+	if (fetchTimeout)
+		alarm(fetchTimeout);
+	f = fetchXGet(url, &us, flags);
+	if (fetchTimeout)
+		alarm(0);
+	if (f == NULL) {
+		if (!sigint)
+			warnx("%s: %s", URL, fetchLastErrString);
+		_exit(SEG_FAIL);
+	}
+	if (url->offset != pos || url->length > want) {
+		fetchIO_close(f);
+		_exit(SEG_NORANGE);
+	}
+	if (us.size != size || (mtime && us.mtime && us.mtime != mtime)) {
+		warnx("%s: file has changed", URL);
+		fetchIO_close(f);
+		_exit(SEG_CHANGED);
+	}
+
+	while (want > 0 && !sigint) {
+		len = want < B_size ? (size_t)want : (size_t)B_size;
+		if ((ssize = fetchIO_read(f, buf, len)) == 0)
+			break;
+		if (ssize == -1 && errno == EINTR)
+			continue;
+		if (ssize == -1) {
+			if (!sigint)
+				warnx("%s: %s", URL, fetchLastErrString);
+			break;
+		}
+		for (ptr = buf; ssize > 0; ptr += wr, ssize -= wr, pos += wr) {
+			if ((wr = pwrite(fd, ptr, ssize, pos)) == -1 &&
+			    errno != EINTR) {
+				warn("%s: pwrite()", partpath);
+				break;
+			}
+			if (wr == -1)
+				wr = 0;
+		}
+		if (ssize > 0)
+			break;
+		seg->done = pos - seg->start;
+		want = seg->end - pos;
+		seg_save(fd, size, i, seg);
+	}
+	fetchIO_close(f);
+	_exit(want == 0 ? SEG_OK : SEG_FAIL);
+}
+
+/*
+ * Fetch a file in parallel ranges.  Returns 1 if the file is not
+ * suitable and should be fetched the normal way.
+ */
+static int
+fetch_segmented(struct url *url, const char *URL, const char *path,
+    const char *flags)
+{
+	struct segment segs[MAXSEGS];
+	struct url_stat us;
+	struct xferstat xs;
+	struct stat sb;
+	struct timespec ts;
+	char *partpath;
+	char str[SEGLINE];
+	off_t count;
+	int fd, i, forwarded, nrun, nsegs, probing, r, status, stop;
+	pid_t pid;
+
+	if (fetchTimeout)
+		alarm(fetchTimeout);
+	r = fetchStat(url, &us, flags);
+	if (fetchTimeout)
+		alarm(0);
+	/* fetchStat() reports the range it saw here */
+	url->offset = url->length = 0;
+	if (sigint)
+		return (-1);
+	if (r == -1 || sigalrm || us.size < 2 * MINSEGSIZE ||
+	    (S_size && us.size != S_size))
+		return (1);
+
+	if (asprintf(&partpath, "%s.part", path) == -1) {
+		warn("asprintf()");
+		return (-1);
+	}
+	if ((fd = open(partpath, O_RDWR | O_CREAT, 0666)) == -1 ||
+	    fstat(fd, &sb) == -1) {
+		warn("%s: open()", partpath);
+		if (fd != -1)
+			close(fd);
+		free(partpath);
+		return (-1);
+	}
+
+	/* pick up where an earlier run stopped, or start over */
+	count = 0;
+	nsegs = 0;
+	if (sb.st_size > us.size)
+		nsegs = seg_load(fd, us.size, us.mtime, segs);
+	if (nsegs > 0) {
+		for (i = 0; i < nsegs; i++)
+			count += segs[i].done;
+		if (v_level > 1)
+			fprintf(stderr, "%s: resuming at %jd of %jd bytes\n",
+			    partpath, (intmax_t)count, (intmax_t)us.size);
+	} else {
+		nsegs = us.size / MINSEGSIZE;
+		if (nsegs > j_segs)
+			nsegs = j_segs;
+		/* leave holes for the data, the file system may care */
+		if (ftruncate(fd, 0) == -1 || ftruncate(fd, us.size) == -1) {
+			warn("%s: ftruncate()", partpath);
+			goto failure;
+		}
+		for (i = 0; i < nsegs; i++) {
+			segs[i].start = us.size / nsegs * i;
+			segs[i].end = i == nsegs - 1 ? us.size :
+			    us.size / nsegs * (i + 1);
+			segs[i].done = 0;
+		}
+		snprintf(str, sizeof str, "%s %jd %jd %d", SEGMAGIC,
+		    (intmax_t)us.size, (intmax_t)us.mtime, nsegs);
+		r = seg_putline(fd, us.size, 0, str);
+		for (i = 0; r == 0 && i < nsegs; i++)
+			r = seg_save(fd, us.size, i, &segs[i]);
+		if (r == -1) {
+			warn("%s: pwrite()", partpath);
+			goto failure;
+		}
+	}
+	for (i = 0; i < nsegs; i++) {
+		segs[i].pid = 0;
+		segs[i].tries = 0;
+	}
+
+	/* the children must not share our cached connections */
+	fetchConnectionCacheClose();
+	fflush(stdout);
+
+#ifdef SIGINFO
+	siginfo = 0;
+	signal(SIGINFO, sig_handler);
+#endif
+	/*
+	 * Start with a single range, and only once it delivers data
+	 * do we know that the server honours range requests.
+	 */
+	probing = 1;
+	forwarded = nrun = stop = 0;
+	for (;;) {
+		for (i = 0; !stop && !sigint && i < nsegs; i++) {
+			if (probing && nrun > 0)
+				break;
+			if (segs[i].pid != 0 ||
+			    segs[i].done == segs[i].end - segs[i].start ||
+			    segs[i].tries >= SEGRETRIES)
+				continue;
+			segs[i].base = segs[i].done;
+			if ((pid = fork()) == -1) {
+				warn("fork()");
+				stop = SEG_FAIL;
+				break;
+			}
+			if (pid == 0)
+				seg_child(url, URL, flags, partpath, fd,
+				    us.size, us.mtime, i, &segs[i]);
+			segs[i].pid = pid;
+			nrun++;
+		}
+		if (nrun == 0)
+			break;
+		if (sigint && !forwarded) {
+			for (i = 0; i < nsegs; i++)
+				if (segs[i].pid != 0)
+					kill(segs[i].pid, SIGINT);
+			forwarded = 1;
+		}
+
+		if ((pid = waitpid(-1, &status, WNOHANG)) == 0 ||
+		    (pid == -1 && errno == EINTR)) {
+			ts.tv_sec = 0;
+			ts.tv_nsec = 200000000;
+			nanosleep(&ts, NULL);
+			for (i = 0; i < nsegs; i++) {
+				seg_read(fd, us.size, i, &segs[i]);
+				if (probing && segs[i].done > segs[i].base) {
+					stat_start(&xs, path, us.size, count);
+					probing = 0;
+				}
+			}
+			if (probing)
+				continue;
+			for (count = 0, i = 0; i < nsegs; i++)
+				count += segs[i].done;
+			stat_update(&xs, count);
+#ifdef SIGINFO
+			if (siginfo) {
+				stat_display(&xs, 1);
+				siginfo = 0;
+			}
+#endif
+			continue;
+		}
+		if (pid == -1) {
+			warn("waitpid()");
+			break;
+		}
+		for (i = 0; i < nsegs && segs[i].pid != pid; i++)
+			continue;
+		if (i == nsegs)
+			continue;
+		segs[i].pid = 0;
+		nrun--;
+		seg_read(fd, us.size, i, &segs[i]);
+		if (segs[i].done == segs[i].base) {
+			segs[i].tries++;
+		} else {
+			segs[i].tries = 0;
+			if (probing) {
+				stat_start(&xs, path, us.size, count);
+				probing = 0;
+			}
+		}
+		if (WIFEXITED(status) && WEXITSTATUS(status) > SEG_FAIL &&
+		    !stop) {
+			/* no use going on, kill the others */
+			stop = WEXITSTATUS(status);
+			for (i = 0; i < nsegs; i++)
+				if (segs[i].pid != 0)
+					kill(segs[i].pid, SIGTERM);
+		}
+	}
+#ifdef SIGINFO
+	signal(SIGINFO, SIG_DFL);
+#endif
+	if (stop == SEG_NORANGE || stop == SEG_CHANGED) {
+		if (stop == SEG_NORANGE && v_level > 1)
+			fprintf(stderr, "%s: server does not support ranges\n",
+			    URL);
+		unlink(partpath);
+		r = 1;
+		goto done;
+	}
+	if (probing)
+		stat_start(&xs, path, us.size, count);
+	for (count = 0, i = 0; i < nsegs; i++)
+		count += segs[i].done;
+	xs.rcvd = count;
+	stat_end(&xs);
+
+	if (sigint) {
+		warnx("transfer interrupted");
+		goto failure;
+	}
+	if (count < us.size) {
+		warnx("%s appears to be truncated: %jd/%jd bytes",
+		    partpath, (intmax_t)count, (intmax_t)us.size);
+		/* a soft failure; -a will resume the transfer */
+		fetchLastErrCode = FETCH_NETWORK;
+		goto failure;
+	}
+
+	/* drop the trailer and move the file into place */
+	if (ftruncate(fd, us.size) == -1) {
+		warn("%s: ftruncate()", partpath);
+		goto failure;
+	}
+	if (!n_flag && us.mtime) {
+		struct timeval tv[2];
+
+		tv[0].tv_sec = (long)(us.atime ? us.atime : us.mtime);
+		tv[1].tv_sec = (long)us.mtime;
+		tv[0].tv_usec = tv[1].tv_usec = 0;
+		if (utimes(partpath, tv))
+			warn("%s: utimes()", partpath);
+	}
+	if (rename(partpath, path) == -1) {
+		warn("%s: rename()", path);
+		goto failure;
+	}
+	r = 0;
+	goto done;
+ failure:
+	r = -1;
+ done:
+	close(fd);
+	free(partpath);
+	return (r);
+}
+
 /*
  * Fetch a file
  */
@@ -496,6 +928,17 @@ fetch(char *URL, const char *path)
 		goto success;
 	}
 
+	/* split large files into ranges fetched in parallel */
+	if (j_segs > 1 && !o_stdout && !i_flag && !m_flag &&
+	    (strcmp(url->scheme, SCHEME_HTTP) == 0 ||
+	    strcmp(url->scheme, SCHEME_HTTPS) == 0 ||
+	    strcmp(url->scheme, SCHEME_FTP) == 0) &&
+	    !(r_flag && stat(path, &sb) == 0)) {
+		r = fetch_segmented(url, URL, path, flags);
+		if (r != 1)
+			goto done;
+	}
+
 	/*
 	 * If the -r flag was specified, we have to compare the local
 	 * and remote files, so we should really do a fetchStat()
@@ -653,6 +1096,7 @@ fetch(char *URL, const char *path)
 			 * from scratch if we want the whole file
 			 */
 			url->offset = 0;
+			url->length = 0;
 			if ((f = fetchXGet(url, &us, flags)) == NULL) {
 				warnx("%s: %s", URL, fetchLastErrString);
 				goto failure;
@@ -835,7 +1279,7 @@ usage(void)
 {
 	fprintf(stderr, "%s\n%s\n%s\n",
 	    "usage: fetch [-146AFMPRUadilmnpqrsv] [-N netrc] [-o outputfile]",
-	    "             [-S bytes] [-B bytes] [-T seconds] [-w seconds]",
+	    "             [-S bytes] [-B bytes] [-j segments] [-T seconds] [-w seconds]",
 	    "             [-h host -f file [-c dir] | URL ...]");
 }
 
@@ -853,7 +1297,7 @@ main(int argc, char *argv[])
 	int c, e, r;
 
 	while ((c = getopt(argc, argv,
-	    "146AaB:dFilMmN:no:qRrS:sT:Uvw:")) != -1)
+	    "146AaB:dFij:lMmN:no:qRrS:sT:Uvw:")) != -1)
 		switch (c) {
 		case '1':
 			once_flag = 1;
@@ -884,6 +1328,13 @@ main(int argc, char *argv[])
 		case 'i':
 			i_flag = 1;
 			break;
+		case 'j':
+			j_segs = (int)strtol(optarg, &end, 10);
+			if (*optarg == '\0' || *end != '\0' ||
+			    j_segs < 1 || j_segs > MAXSEGS)
+				errx(1, "invalid number of segments (%s)",
+				    optarg);
+			break;
 		case 'l':
 			l_flag = 1;
 			break;
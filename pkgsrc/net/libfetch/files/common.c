@@ -324,10 +324,85 @@ fetch_connect(struct url *url, int af, int verbose)
 	return (conn);
 }
 
-static conn_t *connection_cache;
+/*
+ * Idle connections are kept in one pool per host, found through a
+ * small hash table, so a lookup only looks at connections to the
+ * right host.  Each pool is ordered most recently used first; the
+ * sequence number decides which connection is oldest overall.
+ */
+#define	POOL_HASHSIZE	64
+
+struct conn_pool {
+	struct conn_pool *next;		/* next pool in hash chain */
+	char		 host[URL_HOSTLEN + 1];
+	conn_t		*conns;		/* idle connections, newest first */
+	int		 count;		/* number of idle connections */
+};
+
+static struct conn_pool *conn_pools[POOL_HASHSIZE];
+static int cache_count;
+static unsigned long cache_seq;
 static int cache_global_limit = 0;
 static int cache_per_host_limit = 0;
 
+static struct conn_pool *
+pool_lookup(const char *host, int create)
+{
+	struct conn_pool *pool;
+	const char *p;
+	unsigned int h;
+
+	for (h = 5381, p = host; *p != '\0'; ++p)
+		h = h * 33 + (unsigned char)*p;
+	h %= POOL_HASHSIZE;
+
+	for (pool = conn_pools[h]; pool != NULL; pool = pool->next) {
+		if (strcmp(pool->host, host) == 0)
+			return (pool);
+	}
+	if (!create || (pool = calloc(1, sizeof(*pool))) == NULL)
+		return (NULL);
+	strcpy(pool->host, host);
+	pool->next = conn_pools[h];
+	conn_pools[h] = pool;
+	return (pool);
+}
+
+/*
+ * Close the least recently used connection of pool, or of all pools
+ * if pool is NULL.
+ */
+static void
+pool_drop_oldest(struct conn_pool *pool)
+{
+	struct conn_pool *iter, *owner;
+	conn_t **cp, **oldest;
+	size_t i;
+
+	owner = NULL;
+	oldest = NULL;
+	for (i = 0; i < POOL_HASHSIZE; ++i) {
+		for (iter = conn_pools[i]; iter != NULL; iter = iter->next) {
+			if (iter->conns == NULL || (pool && iter != pool))
+				continue;
+			for (cp = &iter->conns; (*cp)->next_cached != NULL;
+			    cp = &(*cp)->next_cached)
+				;
+			if (oldest == NULL ||
+			    (*cp)->cache_seq < (*oldest)->cache_seq) {
+				oldest = cp;
+				owner = iter;
+			}
+		}
+	}
+	if (oldest == NULL)
+		return;
+	--owner->count;
+	--cache_count;
+	(*(*oldest)->cache_close)(*oldest);
+	*oldest = NULL;
+}
+
 /*
  * Initialise cache with the given limits.
  */
@@ -353,12 +428,21 @@ fetchConnectionCacheInit(int global_limit, int per_host_limit)
 void
 fetchConnectionCacheClose(void)
 {
+	struct conn_pool *pool;
 	conn_t *conn;
+	size_t i;
 
-	while ((conn = connection_cache) != NULL) {
-		connection_cache = conn->next_cached;
-		(*conn->cache_close)(conn);
+	for (i = 0; i < POOL_HASHSIZE; ++i) {
+		while ((pool = conn_pools[i]) != NULL) {
+			conn_pools[i] = pool->next;
+			while ((conn = pool->conns) != NULL) {
+				pool->conns = conn->next_cached;
+				(*conn->cache_close)(conn);
+			}
+			free(pool);
+		}
 	}
+	cache_count = 0;
 }
 
 /*
@@ -368,25 +452,27 @@ fetchConnectionCacheClose(void)
 conn_t *
 fetch_cache_get(const struct url *url, int af)
 {
-	conn_t *conn, *last_conn = NULL;
+	struct conn_pool *pool;
+	conn_t *conn, **cp;
+
+	if ((pool = pool_lookup(url->host, 0)) == NULL)
+		return (NULL);
 
-	for (conn = connection_cache; conn; conn = conn->next_cached) {
+	for (cp = &pool->conns; (conn = *cp) != NULL; cp = &conn->next_cached) {
 		if (conn->cache_url->port == url->port &&
 		    strcmp(conn->cache_url->scheme, url->scheme) == 0 &&
-		    strcmp(conn->cache_url->host, url->host) == 0 &&
 		    strcmp(conn->cache_url->user, url->user) == 0 &&
 		    strcmp(conn->cache_url->pwd, url->pwd) == 0 &&
 		    (conn->cache_af == AF_UNSPEC || af == AF_UNSPEC ||
 		     conn->cache_af == af)) {
-			if (last_conn != NULL)
-				last_conn->next_cached = conn->next_cached;
-			else
-				connection_cache = conn->next_cached;
-			return conn;
+			*cp = conn->next_cached;
+			--pool->count;
+			--cache_count;
+			return (conn);
 		}
 	}
 
-	return NULL;
+	return (NULL);
 }
 
 /*
@@ -397,35 +483,26 @@ fetch_cache_get(const struct url *url, int af)
 void
 fetch_cache_put(conn_t *conn, int (*closecb)(conn_t *))
 {
-	conn_t *iter, *last;
-	int global_count, host_count;
+	struct conn_pool *pool;
 
-	if (conn->cache_url == NULL || cache_global_limit == 0) {
+	if (conn->cache_url == NULL || cache_global_limit == 0 ||
+	    cache_per_host_limit == 0 ||
+	    (pool = pool_lookup(conn->cache_url->host, 1)) == NULL) {
 		(*closecb)(conn);
 		return;
 	}
 
-	global_count = host_count = 0;
-	last = NULL;
-	for (iter = connection_cache; iter;
-	    last = iter, iter = iter->next_cached) {
-		++global_count;
-		if (strcmp(conn->cache_url->host, iter->cache_url->host) == 0)
-			++host_count;
-		if (global_count < cache_global_limit &&
-		    host_count < cache_per_host_limit)
-			continue;
-		--global_count;
-		if (last != NULL)
-			last->next_cached = iter->next_cached;
-		else
-			connection_cache = iter->next_cached;
-		(*iter->cache_close)(iter);
-	}
+	if (pool->count >= cache_per_host_limit)
+		pool_drop_oldest(pool);
+	if (cache_count >= cache_global_limit)
+		pool_drop_oldest(NULL);
 
 	conn->cache_close = closecb;
-	conn->next_cached = connection_cache;
-	connection_cache = conn;
+	conn->cache_seq = ++cache_seq;
+	conn->next_cached = pool->conns;
+	pool->conns = conn;
+	++pool->count;
+	++cache_count;
 }
 
 /*
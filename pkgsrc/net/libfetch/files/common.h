@@ -85,6 +85,7 @@ struct fetchconn {
 	struct url	*cache_url;
 	int		cache_af;
 	int		(*cache_close)(conn_t *);
+	unsigned long	cache_seq;
 	conn_t		*next_cached;
 };
 
@@ -136,6 +137,8 @@ fetchIO		*http_request(struct url *, const char *,
 		     struct url_stat *, struct url *, const char *);
 fetchIO		*ftp_request(struct url *, const char *, const char *,
 		     struct url_stat *, struct url *, const char *);
+int		 http_get_many(struct url **, size_t, fetch_many_t, void *,
+		     const char *);
 
 
 /*
@@ -108,6 +108,17 @@ fetchGet(struct url *URL, const char *flags)
 	return (fetchXGet(URL, NULL, flags));
 }
 
+/*
+ * Retrieve a batch of documents, handing each one to the callback.
+ * Requests to the same HTTP server are pipelined on one connection.
+ */
+int
+fetchXGetMany(struct url **urls, size_t n, fetch_many_t cb, void *cookie,
+    const char *flags)
+{
+	return (http_get_many(urls, n, cb, cookie, flags));
+}
+
 /*
  * Select the appropriate protocol for the URL scheme, and return a
  * write-only stream connected to the document referenced by the URL.
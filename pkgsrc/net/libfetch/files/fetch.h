@@ -143,6 +143,12 @@ int		 fetchStat(struct url *, struct url_stat *, const char *);
 int		 fetchList(struct url_list *, struct url *, const char *,
 		    const char *);
 
+/* Batch retrieval */
+typedef int (*fetch_many_t)(void *, size_t, struct url *, fetchIO *,
+    const struct url_stat *);
+int		 fetchXGetMany(struct url **, size_t, fetch_many_t, void *,
+		    const char *);
+
 /* URL parsing */
 struct url	*fetchMakeURL(const char *, const char *, int,
 		     const char *, const char *, const char *);
@@ -549,6 +549,7 @@ struct ftpio {
 	int	 dir;		/* Direction */
 	int	 eof;		/* EOF reached */
 	int	 err;		/* Error code */
+	off_t	 resid;		/* Bytes left to read, or -1 */
 };
 
 static ssize_t	 ftp_readfn(void *, void *, size_t);
@@ -574,11 +575,16 @@ ftp_readfn(void *v, void *buf, size_t len)
 		errno = io->err;
 		return (-1);
 	}
-	if (io->eof)
+	if (io->eof || io->resid == 0)
 		return (0);
+	if (io->resid > 0 && (off_t)len > io->resid)
+		len = io->resid;
 	r = fetch_read(io->dconn, buf, len);
-	if (r > 0)
+	if (r > 0) {
+		if (io->resid > 0)
+			io->resid -= r;
 		return (r);
+	}
 	if (r == 0) {
 		io->eof = 1;
 		return (0);
@@ -641,14 +647,19 @@ ftp_closefn(void *v)
 	fetch_close(io->dconn);
 	io->dconn = NULL;
 	io->dir = -1;
-	ftp_chkerr(io->cconn);
-	fetch_cache_put(io->cconn, ftp_disconnect);
+	if (io->resid == 0 && !io->eof) {
+		/* we cut the transfer short; don't wait for the reply */
+		fetch_close(io->cconn);
+	} else {
+		ftp_chkerr(io->cconn);
+		fetch_cache_put(io->cconn, ftp_disconnect);
+	}
 	free(io);
 	return;
 }
 
 static fetchIO *
-ftp_setup(conn_t *cconn, conn_t *dconn, int mode)
+ftp_setup(conn_t *cconn, conn_t *dconn, int mode, off_t length)
 {
 	struct ftpio *io;
 	fetchIO *f;
@@ -661,6 +672,7 @@ ftp_setup(conn_t *cconn, conn_t *dconn, int mode)
 	io->dconn = dconn;
 	io->dir = mode;
 	io->eof = io->err = 0;
+	io->resid = length > 0 ? length : -1;
 	f = fetchIO_unopen(io, ftp_readfn, ftp_writefn, ftp_closefn);
 	if (f == NULL)
 		free(io);
@@ -672,7 +684,7 @@ ftp_setup(conn_t *cconn, conn_t *dconn, int mode)
  */
 static fetchIO *
 ftp_transfer(conn_t *conn, const char *oper, const char *file, const char *op_arg,
-    int mode, off_t offset, const char *flags)
+    int mode, off_t offset, off_t length, const char *flags)
 {
 	union anonymous {
 		struct sockaddr_storage ss;
@@ -958,7 +970,7 @@ retry_mode:
 		sd = d;
 	}
 
-	if ((df = ftp_setup(conn, fetch_reopen(sd), mode)) == NULL)
+	if ((df = ftp_setup(conn, fetch_reopen(sd), mode, length)) == NULL)
 		goto sysouch;
 	return (df);
 
@@ -1209,7 +1221,8 @@ ftp_request(struct url *url, const char *op, const char *op_arg,
 		oflag = O_RDONLY;
 
 	/* initiate the transfer */
-	f = (ftp_transfer(conn, op, path, op_arg, oflag, url->offset, flags));
+	f = (ftp_transfer(conn, op, path, op_arg, oflag, url->offset,
+	    oflag == O_RDONLY ? url->length : 0, flags));
 	free(path);
 	return f;
 }
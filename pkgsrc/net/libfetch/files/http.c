@@ -225,6 +225,12 @@ http_fillbuf(struct httpio *io, size_t len)
 			io->error = 1;
 			return (-1);
 		}
+		if (io->buflen == 0 && io->contentlength > 0) {
+			/* connection closed before the end of the body */
+			http_seterr(HTTP_PROTOCOL_ERROR);
+			io->error = 1;
+			return (-1);
+		}
 		if (io->contentlength)
 			io->contentlength -= io->buflen;
 		io->bufpos = 0;
@@ -252,6 +258,11 @@ http_fillbuf(struct httpio *io, size_t len)
 		io->error = 1;
 		return (-1);
 	}
+	if (io->buflen == 0) {
+		http_seterr(HTTP_PROTOCOL_ERROR);
+		io->error = 1;
+		return (-1);
+	}
 	io->chunksize -= io->buflen;
 	if (io->contentlength >= 0)
 		io->contentlength -= io->buflen;
@@ -322,7 +333,12 @@ http_closefn(void *v)
 {
 	struct httpio *io = (struct httpio *)v;
 
-	if (io->keep_alive) {
+	/*
+	 * Only hand the connection back to the cache if the whole
+	 * body was read; otherwise the rest of it would be taken as
+	 * the reply to the next request.
+	 */
+	if (io->keep_alive && (io->eof || io->contentlength == 0)) {
 		int val;
 
 		val = 0;
@@ -436,13 +452,15 @@ http_cmd(conn_t *conn, const char *fmt, ...)
 }
 
 /*
- * Get and parse status line
+ * Get and parse status line; HTTP/1.1 connections are persistent
+ * unless the headers say otherwise.
  */
 static int
-http_get_reply(conn_t *conn)
+http_get_reply(conn_t *conn, int *keep_alive)
 {
 	char *p;
 
+	*keep_alive = 0;
 	if (fetch_getln(conn) == -1)
 		return (-1);
 	/*
@@ -460,6 +478,7 @@ http_get_reply(conn_t *conn)
 	if (*p == '/') {
 		if (p[1] != '1' || p[2] != '.' || (p[3] != '0' && p[3] != '1'))
 			return (HTTP_PROTOCOL_ERROR);
+		*keep_alive = (p[3] == '1');
 		p += 4;
 	}
 	if (*p != ' ' ||
@@ -516,6 +535,19 @@ http_next_header(conn_t *conn, const char **p)
 	return (hdr_unknown);
 }
 
+/*
+ * Parse a Connection header
+ */
+static void
+http_parse_connection(const char *p, int *keep_alive)
+{
+	/* XXX too weak? */
+	if (strcasecmp(p, "close") == 0)
+		*keep_alive = 0;
+	else if (strcasecmp(p, "keep-alive") == 0)
+		*keep_alive = 1;
+}
+
 /*
  * Parse a last-modified header
  */
@@ -715,7 +747,7 @@ http_connect(struct url *URL, struct url *purl, const char *flags, int *cached)
 	int val;
 #endif
 
-	*cached = 1;
+	*cached = 0;
 
 #ifdef INET6
 	af = AF_UNSPEC;
@@ -805,6 +837,118 @@ set_if_modified_since(conn_t *conn, time_t last_modified)
 	http_cmd(conn, "If-Modified-Since: %s\r\n", buf);
 }
 
+/*
+ * Write a request for url, up to and including the empty line that
+ * ends the headers.  Returns -1 if authorization is needed but not
+ * available; a broken connection shows up when reading the reply.
+ */
+static int
+http_send_request(conn_t *conn, struct url *url, const char *op,
+    struct url *purl, int need_auth, const char *flags)
+{
+	char hbuf[URL_HOSTLEN + 7], *host;
+	const char *p;
+
+	host = url->host;
+#ifdef INET6
+	if (strchr(url->host, ':')) {
+		snprintf(hbuf, sizeof(hbuf), "[%s]", url->host);
+		host = hbuf;
+	}
+#endif
+	if (url->port != fetch_default_port(url->scheme)) {
+		if (host != hbuf) {
+			strcpy(hbuf, host);
+			host = hbuf;
+		}
+		snprintf(hbuf + strlen(hbuf),
+		    sizeof(hbuf) - strlen(hbuf), ":%d", url->port);
+	}
+
+	if (CHECK_FLAG('v'))
+		fetch_info("requesting %s://%s%s",
+		    url->scheme, host, url->doc);
+	if (purl) {
+		http_cmd(conn, "%s %s://%s%s HTTP/1.1\r\n",
+		    op, url->scheme, host, url->doc);
+	} else {
+		http_cmd(conn, "%s %s HTTP/1.1\r\n",
+		    op, url->doc);
+	}
+
+	if (CHECK_FLAG('i') && url->last_modified > 0)
+		set_if_modified_since(conn, url->last_modified);
+
+	/* virtual host */
+	http_cmd(conn, "Host: %s\r\n", host);
+
+	/* proxy authorization */
+	if (purl) {
+		if (*purl->user || *purl->pwd)
+			http_basic_auth(conn, "Proxy-Authorization",
+			    purl->user, purl->pwd);
+		else if ((p = getenv("HTTP_PROXY_AUTH")) != NULL && *p != '\0')
+			http_authorize(conn, "Proxy-Authorization", p);
+	}
+
+	/* server authorization */
+	if (need_auth || *url->user || *url->pwd) {
+		if (*url->user || *url->pwd)
+			http_basic_auth(conn, "Authorization", url->user, url->pwd);
+		else if ((p = getenv("HTTP_AUTH")) != NULL && *p != '\0')
+			http_authorize(conn, "Authorization", p);
+		else if (fetchAuthMethod && fetchAuthMethod(url) == 0) {
+			http_basic_auth(conn, "Authorization", url->user, url->pwd);
+		} else {
+			http_seterr(HTTP_NEED_AUTH);
+			return (-1);
+		}
+	}
+
+	/* other headers */
+	if ((p = getenv("HTTP_REFERER")) != NULL && *p != '\0') {
+		if (strcasecmp(p, "auto") == 0)
+			http_cmd(conn, "Referer: %s://%s%s\r\n",
+			    url->scheme, host, url->doc);
+		else
+			http_cmd(conn, "Referer: %s\r\n", p);
+	}
+	if ((p = getenv("HTTP_USER_AGENT")) != NULL && *p != '\0')
+		http_cmd(conn, "User-Agent: %s\r\n", p);
+	else
+		http_cmd(conn, "User-Agent: %s\r\n", _LIBFETCH_VER);
+	if (url->length > 0)
+		http_cmd(conn, "Range: bytes=%lld-%lld\r\n",
+		    (long long)url->offset,
+		    (long long)(url->offset + url->length - 1));
+	else if (url->offset > 0)
+		http_cmd(conn, "Range: bytes=%lld-\r\n", (long long)url->offset);
+	http_cmd(conn, "\r\n");
+	return (0);
+}
+
+/*
+ * Force the queued requests to be dispatched.  Normally, one would do
+ * this with shutdown(2) but squid proxies can be configured to disallow
+ * such half-closed connections.  To be compatible with such
+ * configurations, fiddle with socket options to force the pending data
+ * to be written.
+ */
+static void
+http_push(conn_t *conn)
+{
+	int val;
+
+#ifdef TCP_NOPUSH
+	val = 0;
+	setsockopt(conn->sd, IPPROTO_TCP, TCP_NOPUSH, &val,
+		   sizeof(val));
+#endif
+	val = 1;
+	setsockopt(conn->sd, IPPROTO_TCP, TCP_NODELAY, &val,
+		   sizeof(val));
+}
+
 
 /*****************************************************************************
  * Core
@@ -822,20 +966,18 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 {
 	conn_t *conn;
 	struct url *url, *new;
-	int chunked, direct, if_modified_since, need_auth, noredirect;
+	int chunked, direct, need_auth, noredirect;
 	int keep_alive, verbose, cached;
-	int e, i, n, val;
+	int e, i, n;
 	off_t offset, clength, length, size;
 	time_t mtime;
 	const char *p;
 	fetchIO *f;
 	hdr_t h;
-	char hbuf[URL_HOSTLEN + 7], *host;
 
 	direct = CHECK_FLAG('d');
 	noredirect = CHECK_FLAG('A');
 	verbose = CHECK_FLAG('v');
-	if_modified_since = CHECK_FLAG('i');
 	keep_alive = 0;
 
 	if (direct && purl) {
@@ -877,97 +1019,14 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 		if ((conn = http_connect(url, purl, flags, &cached)) == NULL)
 			goto ouch;
 
-		host = url->host;
-#ifdef INET6
-		if (strchr(url->host, ':')) {
-			snprintf(hbuf, sizeof(hbuf), "[%s]", url->host);
-			host = hbuf;
-		}
-#endif
-		if (url->port != fetch_default_port(url->scheme)) {
-			if (host != hbuf) {
-				strcpy(hbuf, host);
-				host = hbuf;
-			}
-			snprintf(hbuf + strlen(hbuf),
-			    sizeof(hbuf) - strlen(hbuf), ":%d", url->port);
-		}
-
 		/* send request */
-		if (verbose)
-			fetch_info("requesting %s://%s%s",
-			    url->scheme, host, url->doc);
-		if (purl) {
-			http_cmd(conn, "%s %s://%s%s HTTP/1.1\r\n",
-			    op, url->scheme, host, url->doc);
-		} else {
-			http_cmd(conn, "%s %s HTTP/1.1\r\n",
-			    op, url->doc);
-		}
-
-		if (if_modified_since && url->last_modified > 0)
-			set_if_modified_since(conn, url->last_modified);
-
-		/* virtual host */
-		http_cmd(conn, "Host: %s\r\n", host);
-
-		/* proxy authorization */
-		if (purl) {
-			if (*purl->user || *purl->pwd)
-				http_basic_auth(conn, "Proxy-Authorization",
-				    purl->user, purl->pwd);
-			else if ((p = getenv("HTTP_PROXY_AUTH")) != NULL && *p != '\0')
-				http_authorize(conn, "Proxy-Authorization", p);
-		}
-
-		/* server authorization */
-		if (need_auth || *url->user || *url->pwd) {
-			if (*url->user || *url->pwd)
-				http_basic_auth(conn, "Authorization", url->user, url->pwd);
-			else if ((p = getenv("HTTP_AUTH")) != NULL && *p != '\0')
-				http_authorize(conn, "Authorization", p);
-			else if (fetchAuthMethod && fetchAuthMethod(url) == 0) {
-				http_basic_auth(conn, "Authorization", url->user, url->pwd);
-			} else {
-				http_seterr(HTTP_NEED_AUTH);
-				goto ouch;
-			}
-		}
-
-		/* other headers */
-		if ((p = getenv("HTTP_REFERER")) != NULL && *p != '\0') {
-			if (strcasecmp(p, "auto") == 0)
-				http_cmd(conn, "Referer: %s://%s%s\r\n",
-				    url->scheme, host, url->doc);
-			else
-				http_cmd(conn, "Referer: %s\r\n", p);
-		}
-		if ((p = getenv("HTTP_USER_AGENT")) != NULL && *p != '\0')
-			http_cmd(conn, "User-Agent: %s\r\n", p);
-		else
-			http_cmd(conn, "User-Agent: %s\r\n", _LIBFETCH_VER);
-		if (url->offset > 0)
-			http_cmd(conn, "Range: bytes=%lld-\r\n", (long long)url->offset);
-		http_cmd(conn, "\r\n");
-
-		/*
-		 * Force the queued request to be dispatched.  Normally, one
-		 * would do this with shutdown(2) but squid proxies can be
-		 * configured to disallow such half-closed connections.  To
-		 * be compatible with such configurations, fiddle with socket
-		 * options to force the pending data to be written.
-		 */
-#ifdef TCP_NOPUSH
-		val = 0;
-		setsockopt(conn->sd, IPPROTO_TCP, TCP_NOPUSH, &val,
-			   sizeof(val));
-#endif
-		val = 1;
-		setsockopt(conn->sd, IPPROTO_TCP, TCP_NODELAY, &val,
-			   sizeof(val));
+		if (http_send_request(conn, url, op, purl, need_auth,
+		    flags) == -1)
+			goto ouch;
+		http_push(conn);
 
 		/* get reply */
-		switch (http_get_reply(conn)) {
+		switch (http_get_reply(conn, &keep_alive)) {
 		case HTTP_OK:
 		case HTTP_PARTIAL:
 		case HTTP_NOT_MODIFIED:
@@ -1012,9 +1071,13 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 		case HTTP_PROTOCOL_ERROR:
 			/* fall through */
 		case -1:
+			/* a cached connection may have timed out; retry */
 			--i;
-			if (cached)
+			if (cached) {
+				fetch_close(conn);
+				conn = NULL;
 				continue;
+			}
 			fetch_syserr();
 			goto ouch;
 		default:
@@ -1034,8 +1097,7 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 				http_seterr(HTTP_PROTOCOL_ERROR);
 				goto ouch;
 			case hdr_connection:
-				/* XXX too weak? */
-				keep_alive = (strcasecmp(p, "keep-alive") == 0);
+				http_parse_connection(p, &keep_alive);
 				break;
 			case hdr_content_length:
 				http_parse_length(p, &clength);
@@ -1143,7 +1205,9 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 		clength = length;
 	if (clength != -1)
 		length = offset + clength;
-	if (length != -1 && size != -1 && length != size) {
+	/* A bounded range may end before the end of the document. */
+	if (length != -1 && size != -1 &&
+	    (URL->length > 0 ? length > size : length != size)) {
 		http_seterr(HTTP_PROTOCOL_ERROR);
 		goto ouch;
 	}
@@ -1214,6 +1278,325 @@ ouch:
 }
 
 
+/*****************************************************************************
+ * Pipelined retrieval of many documents
+ */
+
+/* Number of requests sent ahead of the replies on one connection */
+#define HTTP_PIPELINE	16
+
+/*
+ * Close function for a body read off a pipelined connection; the
+ * connection and the httpio belong to http_get_pipelined().
+ */
+static void
+http_pipe_closefn(void *v)
+{
+	(void)v;
+}
+
+/*
+ * Read the status line and headers of the next reply on a pipelined
+ * connection and set up io to read its body.  Returns the reply code,
+ * or -1 if the connection can't be used any more.
+ */
+static int
+http_pipe_reply(conn_t *conn, struct url *url, struct httpio *io,
+    struct url_stat *us, int *keep_alive)
+{
+	off_t offset, clength, length, size;
+	time_t mtime;
+	const char *p;
+	hdr_t h;
+	int code;
+
+	offset = 0;
+	clength = length = size = -1;
+	mtime = 0;
+	io->chunked = 0;
+	io->chunksize = 0;
+	io->buflen = io->bufpos = 0;
+	io->eof = io->error = 0;
+
+	code = http_get_reply(conn, keep_alive);
+	if (code == -1 || code == HTTP_PROTOCOL_ERROR)
+		return (-1);
+
+	do {
+		switch ((h = http_next_header(conn, &p))) {
+		case hdr_syserror:
+		case hdr_error:
+			return (-1);
+		case hdr_connection:
+			http_parse_connection(p, keep_alive);
+			break;
+		case hdr_content_length:
+			http_parse_length(p, &clength);
+			break;
+		case hdr_content_range:
+			http_parse_range(p, &offset, &length, &size);
+			break;
+		case hdr_last_modified:
+			http_parse_mtime(p, &mtime);
+			break;
+		case hdr_transfer_encoding:
+			io->chunked = (strcasecmp(p, "chunked") == 0);
+			break;
+		default:
+			break;
+		}
+	} while (h > hdr_end);
+
+	if (code == HTTP_NOT_MODIFIED)
+		clength = 0;
+	if (clength != -1 && length != -1 && clength != length)
+		return (-1);
+	if (clength == -1)
+		clength = length;
+	if (clength != -1)
+		length = offset + clength;
+	io->contentlength = clength;
+	if (clength == -1 && !io->chunked)
+		*keep_alive = 0;
+
+	if (code != HTTP_OK && code != HTTP_PARTIAL)
+		return (code);
+
+	/* same checks as in http_request() */
+	if (length != -1 && size != -1 &&
+	    (url->length > 0 ? length > size : length != size))
+		return (HTTP_PROTOCOL_ERROR);
+	if (url->offset > 0 && offset > url->offset)
+		return (HTTP_PROTOCOL_ERROR);
+	if (size == -1)
+		size = length;
+	us->size = size;
+	us->atime = us->mtime = mtime;
+	url->offset = offset;
+	url->length = clength;
+	return (code);
+}
+
+/*
+ * Read whatever the callback left of the body, so that the next reply
+ * can be read.  Returns -1 if the connection is out of step.
+ */
+static int
+http_pipe_drain(fetchIO *f, struct httpio *io)
+{
+	char buf[4096];
+
+	while (fetchIO_read(f, buf, sizeof(buf)) > 0)
+		;
+	if (io->error || !(io->eof || io->contentlength == 0))
+		return (-1);
+	return (0);
+}
+
+/*
+ * Retrieve a single document for the batch the normal way.
+ */
+static int
+http_get_one(struct url **urls, size_t i, fetch_many_t cb, void *cookie,
+    const char *flags)
+{
+	struct url_stat us;
+	fetchIO *f;
+	int r;
+
+	f = fetchXGet(urls[i], &us, flags);
+	r = (*cb)(cookie, i, urls[i], f, f != NULL ? &us : NULL);
+	if (f != NULL)
+		fetchIO_close(f);
+	return (r);
+}
+
+/*
+ * Retrieve urls[idx[0]] .. urls[idx[n - 1]], which all live on the
+ * same server, over one connection with up to HTTP_PIPELINE requests
+ * in flight.  Anything but a plain 200 or 206 reply (redirects,
+ * authorization, errors) is retried alone with fetchXGet().
+ *
+ * If the server closes the connection, the requests not answered yet
+ * are sent again on a new one, and no more requests than the server
+ * answered are sent on any later connection.  A body cut short that
+ * way is fetched again and handed to the callback a second time.
+ */
+static int
+http_get_pipelined(struct url **urls, size_t *idx, size_t n,
+    fetch_many_t cb, void *cookie, const char *flags)
+{
+	struct httpio io;
+	struct url_stat us;
+	struct url *purl;
+	conn_t *conn;
+	fetchIO *f;
+	size_t answered, done, limit, sent, nsent;
+	int cached, code, keep_alive, r;
+
+	memset(&io, 0, sizeof(io));
+	purl = http_get_proxy(urls[idx[0]], flags);
+	conn = NULL;
+	limit = (size_t)-1;
+	answered = done = sent = nsent = 0;
+	cached = keep_alive = 0;
+	r = 0;
+
+	while (done < n && r == 0) {
+		if (conn == NULL) {
+			conn = http_connect(urls[idx[done]], purl, flags,
+			    &cached);
+			if (conn == NULL)
+				break;
+			answered = nsent = 0;
+			sent = done;
+		}
+		for (; sent < n && sent - done < HTTP_PIPELINE &&
+		    nsent < limit; ++sent, ++nsent) {
+			if (http_send_request(conn, urls[idx[sent]], "GET",
+			    purl, 0, flags) == -1)
+				break;
+		}
+		if (sent == done) {
+			if (nsent == limit) {
+				/* the server would close it anyway */
+				fetch_close(conn);
+				conn = NULL;
+				continue;
+			}
+			/* needs authorization we can't give */
+			r = http_get_one(urls, idx[done++], cb, cookie, flags);
+			sent = done;
+			continue;
+		}
+		http_push(conn);
+
+		io.conn = conn;
+		code = http_pipe_reply(conn, urls[idx[done]], &io, &us,
+		    &keep_alive);
+		if (code == -1) {
+			fetch_close(conn);
+			conn = NULL;
+			if (answered > 0) {
+				limit = answered;
+			} else if (!cached) {
+				/*
+				 * A server that drops the first request on
+				 * a new connection won't do any better the
+				 * next time.
+				 */
+				limit = 1;
+				r = http_get_one(urls, idx[done++], cb, cookie,
+				    flags);
+			}
+			continue;
+		}
+		++answered;
+		if (!keep_alive)
+			limit = answered;
+
+		if ((f = fetchIO_unopen(&io, http_readfn, http_writefn,
+		    http_pipe_closefn)) == NULL) {
+			fetch_syserr();
+			break;
+		}
+		if (code == HTTP_OK || code == HTTP_PARTIAL)
+			r = (*cb)(cookie, idx[done], urls[idx[done]], f, &us);
+		if (http_pipe_drain(f, &io) == -1) {
+			/* cut short by a connection we overloaded? */
+			if (io.error && answered > 1 && nsent > answered) {
+				if (keep_alive)
+					limit = answered - 1;
+				code = -1;
+			}
+			keep_alive = 0;
+		}
+		fetchIO_close(f);
+		if (code == HTTP_OK || code == HTTP_PARTIAL)
+			++done;
+		else if (code != -1 && r == 0)
+			r = http_get_one(urls, idx[done++], cb, cookie, flags);
+
+		if (!keep_alive) {
+			fetch_close(conn);
+			conn = NULL;
+		}
+	}
+
+	/* whatever is left over goes one by one */
+	while (done < n && r == 0)
+		r = http_get_one(urls, idx[done++], cb, cookie, flags);
+
+	if (conn != NULL) {
+		if (keep_alive && sent == done)
+			fetch_cache_put(conn, fetch_close);
+		else
+			fetch_close(conn);
+	}
+	free(io.buf);
+	if (purl)
+		fetchFreeURL(purl);
+	return (r);
+}
+
+/*
+ * Retrieve a batch of documents, pipelining the requests for each
+ * HTTP server.  Other schemes are fetched one by one.
+ */
+int
+http_get_many(struct url **urls, size_t n, fetch_many_t cb, void *cookie,
+    const char *flags)
+{
+	struct url *u, *v;
+	size_t *idx, i, j, m;
+	char *seen;
+	int r;
+
+	if (n == 0)
+		return (0);
+	if ((idx = calloc(n, sizeof(*idx))) == NULL ||
+	    (seen = calloc(n, 1)) == NULL) {
+		free(idx);
+		fetch_syserr();
+		return (-1);
+	}
+
+	r = 0;
+	for (i = 0; i < n && r == 0; ++i) {
+		if (seen[i])
+			continue;
+		u = urls[i];
+		if (strcasecmp(u->scheme, SCHEME_HTTP) != 0 &&
+		    strcasecmp(u->scheme, SCHEME_HTTPS) != 0) {
+			r = http_get_one(urls, i, cb, cookie, flags);
+			continue;
+		}
+		if (!u->port)
+			u->port = fetch_default_port(u->scheme);
+		/* collect everything else for the same server */
+		for (m = 0, j = i; j < n; ++j) {
+			v = urls[j];
+			if (seen[j] || strcasecmp(u->scheme, v->scheme) != 0 ||
+			    strcmp(u->host, v->host) != 0 ||
+			    strcmp(u->user, v->user) != 0 ||
+			    strcmp(u->pwd, v->pwd) != 0)
+				continue;
+			if (!v->port)
+				v->port = fetch_default_port(v->scheme);
+			if (u->port != v->port)
+				continue;
+			seen[j] = 1;
+			idx[m++] = j;
+		}
+		r = http_get_pipelined(urls, idx, m, cb, cookie, flags);
+	}
+
+	free(seen);
+	free(idx);
+	return (r);
+}
+
+
 /*****************************************************************************
  * Entry points
  */
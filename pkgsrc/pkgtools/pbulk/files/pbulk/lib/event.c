@@ -35,6 +35,7 @@
 
 #include <nbcompat/types.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
 #ifdef __sun
 #include <sys/filio.h>
 #endif
@@ -44,15 +45,31 @@
 #if HAVE_SYS_POLL_H
 #include <sys/poll.h>
 #endif
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+#include <nbcompat/err.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <nbcompat/time.h>
 #include <nbcompat/stdlib.h>
+#include <nbcompat/string.h>
 #include <nbcompat/unistd.h>
 
 #include <signal.h>
 
+#include <netinet/tcp.h>
+
 #include "pbulk.h"
 
-struct deferred_read_arg {
+/*
+ * State of a pending deferred_read or deferred_write. The structures
+ * are kept on a free list and reused, so that the steady state of a
+ * master does not allocate memory for each message.
+ */
+struct deferred_arg {
+	SLIST_ENTRY(deferred_arg) free_link;
+
 	void *cb_arg;
 	void (*cb_ok)(void *);
 	void (*cb_error)(void *);
@@ -60,39 +77,65 @@ struct deferred_read_arg {
 	struct event ev;
 	int fd;
 
-	char *buf;
+	union {
+		char *read;
+		const char *write;
+	} buf;
 	size_t remaining;
 };
 
-struct deferred_write_arg {
-	void *cb_arg;
-	void (*cb_ok)(void *);
-	void (*cb_error)(void *);
+static SLIST_HEAD(, deferred_arg) deferred_pool =
+    SLIST_HEAD_INITIALIZER(deferred_pool);
 
-	struct event ev;
-	int fd;
+static struct deferred_arg *
+deferred_alloc(int fd, void *arg, void (*cb_ok)(void *),
+    void (*cb_error)(void *))
+{
+	struct deferred_arg *data;
 
-	const char *buf;
-	size_t remaining;
-};
+	if ((data = SLIST_FIRST(&deferred_pool)) != NULL)
+		SLIST_REMOVE_HEAD(&deferred_pool, free_link);
+	else
+		data = xmalloc(sizeof(*data));
+	data->cb_arg = arg;
+	data->cb_ok = cb_ok;
+	data->cb_error = cb_error;
+	data->fd = fd;
+	return data;
+}
+
+/*
+ * Return ''data'' to the pool and run the callback. The callback
+ * commonly starts the next deferred operation, which can then
+ * reuse the structure right away.
+ */
+static void
+deferred_finish(struct deferred_arg *data, int ok)
+{
+	void (*cb)(void *);
+	void *cb_arg;
+
+	cb = ok ? data->cb_ok : data->cb_error;
+	cb_arg = data->cb_arg;
+	SLIST_INSERT_HEAD(&deferred_pool, data, free_link);
+	(*cb)(cb_arg);
+}
 
 static void
 deferred_read_handler(int fd, void *arg)
 {
-	struct deferred_read_arg *data = arg;
+	struct deferred_arg *data = arg;
 	ssize_t received;
 
-	received = read(data->fd, data->buf, data->remaining);
+	received = read(data->fd, data->buf.read, data->remaining);
 	if (received == -1 || received == 0) {
-		(*data->cb_error)(data->cb_arg);
-		free(data);
+		deferred_finish(data, 0);
 		return;
 	}
-	data->buf += received;
+	data->buf.read += received;
 	data->remaining -= received;
 	if (data->remaining == 0) {
-		(*data->cb_ok)(data->cb_arg);
-		free(data);
+		deferred_finish(data, 1);
 		return;
 	}
 	event_add(&data->ev, data->fd, 0, 0, deferred_read_handler, data);
@@ -102,14 +145,10 @@ void
 deferred_read(int fd, void *buf, size_t buf_len, void *arg,
     void (*cb_ok)(void *), void (*cb_error)(void *))
 {
-	struct deferred_read_arg *data;
+	struct deferred_arg *data;
 
-	data = xmalloc(sizeof(*data));
-	data->cb_arg = arg;
-	data->cb_ok = cb_ok;
-	data->cb_error = cb_error;
-	data->fd = fd;
-	data->buf = buf;
+	data = deferred_alloc(fd, arg, cb_ok, cb_error);
+	data->buf.read = buf;
 	data->remaining = buf_len;
 
 	event_add(&data->ev, data->fd, 0, 0, deferred_read_handler, data);
@@ -118,20 +157,18 @@ deferred_read(int fd, void *buf, size_t buf_len, void *arg,
 static void
 deferred_write_handler(int fd, void *arg)
 {
-	struct deferred_write_arg *data = arg;
+	struct deferred_arg *data = arg;
 	ssize_t sent;
 
-	sent = write(data->fd, data->buf, data->remaining);
+	sent = write(data->fd, data->buf.write, data->remaining);
 	if (sent == -1 || sent == 0) {
-		(*data->cb_error)(data->cb_arg);
-		free(data);
+		deferred_finish(data, 0);
 		return;
 	}
-	data->buf += sent;
+	data->buf.write += sent;
 	data->remaining -= sent;
 	if (data->remaining == 0) {
-		(*data->cb_ok)(data->cb_arg);
-		free(data);
+		deferred_finish(data, 1);
 		return;
 	}
 	event_add(&data->ev, data->fd, 1, 0, deferred_write_handler, data);
@@ -141,14 +178,10 @@ void
 deferred_write(int fd, const void *buf, size_t buf_len, void *arg,
     void (*cb_ok)(void *), void (*cb_error)(void *))
 {
-	struct deferred_write_arg *data;
+	struct deferred_arg *data;
 
-	data = xmalloc(sizeof(*data));
-	data->cb_arg = arg;
-	data->cb_ok = cb_ok;
-	data->cb_error = cb_error;
-	data->fd = fd;
-	data->buf = buf;
+	data = deferred_alloc(fd, arg, cb_ok, cb_error);
+	data->buf.write = buf;
 	data->remaining = buf_len;
 
 	event_add(&data->ev, data->fd, 1, 0, deferred_write_handler, data);
@@ -165,23 +198,310 @@ set_nonblocking(int fd)
 	return 0;
 }
 
+/*
+ * The masters send small messages in several writes. Disable the Nagle
+ * algorithm to avoid waiting for delayed acknowledgements of the peer.
+ */
+int
+set_nodelay(int fd)
+{
+	int on;
+
+	on = 1;
+	return setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+/*
+ * The event loop supports different mechanisms for waiting on file
+ * descriptors. poll(2) is always available. It rebuilds the descriptor
+ * list on every iteration, so the cost of each wakeup grows with the
+ * number of registered events. Where available, epoll(7) keeps the
+ * registrations in the kernel and only returns the ready descriptors.
+ * The environment variable PBULK_EVENT_BACKEND can be set to "poll"
+ * to force the portable backend.
+ */
+struct event_backend {
+	const char *name;
+	int (*init)(void);
+	void (*add)(struct event *);
+	void (*del)(struct event *);
+	int (*wait)(int);
+};
+
+static const struct event_backend *backend;
+
 static size_t active_events;
 static LIST_HEAD(, event) all_events;
 static LIST_HEAD(, signal_event) all_signals;
-static struct pollfd *poll_list;
-static size_t poll_allocated;
 
 static int signal_pipe[2];
 static struct event signal_event;
 
 static void signal_read_handler(int, void *);
 
+static void
+fire_event(struct event *ev)
+{
+	if (!ev->ev_persistent)
+		event_del(ev);
+	(*ev->ev_handler)(ev->ev_fd, ev->ev_arg);
+}
+
+static struct pollfd *poll_list;
+static size_t poll_allocated;
+
+static int
+poll_init(void)
+{
+	return 0;
+}
+
+static void
+poll_add(struct event *ev)
+{
+}
+
+static void
+poll_del(struct event *ev)
+{
+}
+
+static int
+poll_wait(int timeout)
+{
+	struct event *ev, *next;
+	struct pollfd *iter, *last_iter;
+	int ret;
+
+	if (active_events > poll_allocated) {
+		if (poll_allocated == 0)
+			poll_allocated = 512;
+		while (active_events > poll_allocated)
+			poll_allocated <<= 1;
+		poll_list = xrealloc(poll_list,
+		    sizeof(struct pollfd) * poll_allocated);
+	}
+
+	iter = poll_list;
+	LIST_FOREACH(ev, &all_events, ev_link) {
+		iter->fd = ev->ev_fd;
+		if (ev->ev_write)
+			iter->events = POLLOUT;
+		else
+			iter->events = POLLIN;
+		++iter;
+	}
+	last_iter = iter;
+
+	ret = poll(poll_list, active_events, timeout);
+	if (ret > 0) {
+		iter = poll_list;
+		for (ev = LIST_FIRST(&all_events);
+		    iter < last_iter && ev && (next = LIST_NEXT(ev, ev_link), 1);
+		    ev = next, ++iter) {
+			if (iter->revents)
+				fire_event(ev);
+		}
+	}
+	return ret;
+}
+
+static const struct event_backend poll_backend = {
+	"poll", poll_init, poll_add, poll_del, poll_wait
+};
+
+#ifdef HAVE_EPOLL
+/*
+ * Per descriptor state of the epoll backend. The registration of a
+ * descriptor is kept when its events fire or are removed, so that the
+ * common case of re-adding an event from its own handler only needs a
+ * single EPOLL_CTL_MOD. Descriptors with only non-persistent events
+ * use EPOLLONESHOT, so the kernel disarms them when they fire.
+ * Each arming gets a new generation number, which is passed back by
+ * epoll_wait. This allows ignoring results for a descriptor that was
+ * closed and reused by a handler earlier in the same iteration.
+ */
+struct epoll_fd {
+	struct event *read_ev;
+	struct event *write_ev;
+	int registered;
+	int armed;
+	uint32_t generation;
+};
+
+#define	EPOLL_BATCH	256
+
+static int epoll_fd = -1;
+static struct epoll_fd *epoll_fds;
+static size_t epoll_fds_allocated;
+
+static int
+epoll_backend_init(void)
+{
+	if (epoll_fd != -1)
+		return 0;
+	epoll_fd = epoll_create(EPOLL_BATCH);
+	if (epoll_fd == -1)
+		return -1;
+	if (fcntl(epoll_fd, F_SETFD, FD_CLOEXEC) == -1) {
+		(void)close(epoll_fd);
+		epoll_fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+static struct epoll_fd *
+epoll_lookup(int fd)
+{
+	size_t new_allocated;
+
+	if ((size_t)fd >= epoll_fds_allocated) {
+		new_allocated = epoll_fds_allocated ? epoll_fds_allocated : 256;
+		while ((size_t)fd >= new_allocated)
+			new_allocated <<= 1;
+		epoll_fds = xrealloc(epoll_fds,
+		    new_allocated * sizeof(*epoll_fds));
+		memset(epoll_fds + epoll_fds_allocated, 0,
+		    (new_allocated - epoll_fds_allocated) * sizeof(*epoll_fds));
+		epoll_fds_allocated = new_allocated;
+	}
+	return &epoll_fds[fd];
+}
+
+static void
+epoll_update(int fd, struct epoll_fd *state)
+{
+	struct epoll_event ev;
+	uint32_t mask;
+
+	memset(&ev, 0, sizeof(ev));
+
+	mask = 0;
+	if (state->read_ev != NULL)
+		mask |= EPOLLIN;
+	if (state->write_ev != NULL)
+		mask |= EPOLLOUT;
+
+	if (mask == 0) {
+		/*
+		 * A disarmed registration is harmless and can be
+		 * reused by the next event_add. Otherwise remove it.
+		 * The descriptor might already be closed, so ignore
+		 * errors.
+		 */
+		if (state->armed)
+			(void)epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+		if (state->armed)
+			state->registered = 0;
+		state->armed = 0;
+		return;
+	}
+
+	if ((state->read_ev == NULL || !state->read_ev->ev_persistent) &&
+	    (state->write_ev == NULL || !state->write_ev->ev_persistent))
+		mask |= EPOLLONESHOT;
+
+	++state->generation;
+	ev.events = mask;
+	ev.data.u64 = (uint64_t)(unsigned int)fd |
+	    ((uint64_t)state->generation << 32);
+	state->armed = 1;
+	if (state->registered) {
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0)
+			return;
+		if (errno != ENOENT)
+			err(1, "epoll_ctl failed");
+	}
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+		err(1, "epoll_ctl failed");
+	state->registered = 1;
+}
+
+static void
+epoll_add(struct event *ev)
+{
+	struct epoll_fd *state = epoll_lookup(ev->ev_fd);
+
+	if (ev->ev_write)
+		state->write_ev = ev;
+	else
+		state->read_ev = ev;
+	epoll_update(ev->ev_fd, state);
+}
+
+static void
+epoll_del(struct event *ev)
+{
+	struct epoll_fd *state = epoll_lookup(ev->ev_fd);
+
+	if (ev->ev_write && state->write_ev == ev)
+		state->write_ev = NULL;
+	else if (!ev->ev_write && state->read_ev == ev)
+		state->read_ev = NULL;
+	else
+		return;
+	epoll_update(ev->ev_fd, state);
+}
+
+static int
+epoll_wait_events(int timeout)
+{
+	struct epoll_event ready[EPOLL_BATCH];
+	struct epoll_fd *state;
+	struct event *ev;
+	uint32_t generation;
+	int fd, i, ret;
+
+	ret = epoll_wait(epoll_fd, ready, EPOLL_BATCH, timeout);
+	for (i = 0; i < ret; ++i) {
+		fd = (int)(ready[i].data.u64 & 0xffffffffU);
+		generation = (uint32_t)(ready[i].data.u64 >> 32);
+		state = epoll_lookup(fd);
+		if (state->generation != generation)
+			continue;
+		if ((state->read_ev == NULL || !state->read_ev->ev_persistent) &&
+		    (state->write_ev == NULL || !state->write_ev->ev_persistent))
+			state->armed = 0;
+		if ((ev = state->read_ev) != NULL &&
+		    (ready[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+			fire_event(ev);
+			/* The handler changed the registration. */
+			if (state->generation != generation)
+				continue;
+		}
+		if ((ev = state->write_ev) != NULL &&
+		    (ready[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)))
+			fire_event(ev);
+	}
+	return ret;
+}
+
+static const struct event_backend epoll_backend = {
+	"epoll", epoll_backend_init, epoll_add, epoll_del, epoll_wait_events
+};
+#endif
+
 void
 event_init(void)
 {
+	const char *name;
+
 	LIST_INIT(&all_events);
 	LIST_INIT(&all_signals);
 
+	name = getenv("PBULK_EVENT_BACKEND");
+	backend = &poll_backend;
+#ifdef HAVE_EPOLL
+	if ((name == NULL || strcmp(name, "epoll") == 0) &&
+	    epoll_backend_init() == 0)
+		backend = &epoll_backend;
+#endif
+	if (name != NULL && strcmp(name, backend->name) != 0)
+		warnx("Event backend %s not available, using %s", name,
+		    backend->name);
+	(void)(*backend->init)();
+
 	if (pipe(signal_pipe))
 		err(1, "can't create signal pipe");
 
@@ -191,6 +511,12 @@ event_init(void)
 	set_nonblocking(signal_pipe[1]);
 }
 
+const char *
+event_backend_name(void)
+{
+	return backend->name;
+}
+
 void
 event_add(struct event *ev, int fd, int do_write, int is_persistent,
     void (*handler)(int, void *), void *arg)
@@ -202,6 +528,7 @@ event_add(struct event *ev, int fd, int do_write, int is_persistent,
 	ev->ev_arg = arg;
 	LIST_INSERT_HEAD(&all_events, ev, ev_link);
 	++active_events;
+	(*backend->add)(ev);
 }
 
 void
@@ -209,6 +536,7 @@ event_del(struct event *ev)
 {
 	LIST_REMOVE(ev, ev_link);
 	--active_events;
+	(*backend->del)(ev);
 }
 
 static void
@@ -303,61 +631,24 @@ void
 event_dispatch(void)
 {
 	struct timeval now;
-	struct event *ev, *next;
-	struct pollfd *iter, *last_iter;
 	int ret, timeout;
 
-loop:
-	if (active_events > poll_allocated) {
-		if (poll_allocated == 0)
-			poll_allocated = 512;
-		while (active_events > poll_allocated)
-			poll_allocated <<= 1;
-		poll_list = xrealloc(poll_list,
-		    sizeof(struct pollfd) * poll_allocated);
-	}
-
-	iter = poll_list;
-	LIST_FOREACH(ev, &all_events, ev_link) {
-		iter->fd = ev->ev_fd;
-		if (ev->ev_write)
-			iter->events = POLLOUT;
-		else
-			iter->events = POLLIN;
-		++iter;
-	}
-	last_iter = iter;
-
-	if (exit_time.tv_sec || exit_time.tv_usec) {
-		gettimeofday(&now, NULL);
-		timeout = (exit_time.tv_sec - now.tv_sec) * 1000;
-		timeout += (exit_time.tv_usec - now.tv_usec + 999) / 1000;
-		if (timeout < 0)
-			timeout = 0;
-	} else
-		timeout = -1;
-
-	ret = poll(poll_list, active_events, timeout);
-	if (ret < 0 && errno != EINTR)
-		return;
-	if (ret == 0 && timeout == 0)
-		return;
-	if (ret > 0) {
-		iter = poll_list;
-		for (ev = LIST_FIRST(&all_events);
-		    iter < last_iter && ev && (next = LIST_NEXT(ev, ev_link), 1);
-		    ev = next, ++iter) {
-			if (iter->revents) {
-				if (!ev->ev_persistent) {
-					--active_events;
-					LIST_REMOVE(ev, ev_link);
-				}
-				(*ev->ev_handler)(ev->ev_fd, ev->ev_arg);
-				--ret;
-			}
-		}
+	for (;;) {
+		if (exit_time.tv_sec || exit_time.tv_usec) {
+			gettimeofday(&now, NULL);
+			timeout = (exit_time.tv_sec - now.tv_sec) * 1000;
+			timeout += (exit_time.tv_usec - now.tv_usec + 999) / 1000;
+			if (timeout < 0)
+				timeout = 0;
+		} else
+			timeout = -1;
+
+		ret = (*backend->wait)(timeout);
+		if (ret < 0 && errno != EINTR)
+			return;
+		if (ret == 0 && timeout == 0)
+			return;
 	}
-	goto loop;
 }
 
 void
@@ -59,6 +59,7 @@ char		*xasprintf(const char *, ...);
 #endif
 
 void		 event_init(void);
+const char	*event_backend_name(void);
 void		 event_add(struct event *, int, int, int,
     void (*)(int, void *), void *);
 void		 event_del(struct event *);
@@ -68,6 +69,7 @@ void		 signal_del(struct signal_event *);
 void		 event_dispatch(void);
 void		 event_loopexit(struct timeval *tv);
 int		 set_nonblocking(int);
+int		 set_nodelay(int);
 
 void		 deferred_read(int fd, void *, size_t, void *,
 			       void (*)(void *), void (*)(void *));
@@ -0,0 +1,315 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <nbcompat.h>
+
+#include <nbcompat/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <nbcompat/err.h>
+#include <errno.h>
+#include <signal.h>
+#include <nbcompat/stdio.h>
+#include <nbcompat/stdlib.h>
+#include <nbcompat/string.h>
+#include <nbcompat/time.h>
+#include <nbcompat/unistd.h>
+
+#include <arpa/inet.h>
+
+#include "pbulk.h"
+#include "pbuild.h"
+
+/*
+ * Benchmark mode: generate a synthetic resolved scan with the given
+ * number of packages, run the scheduler over it without building
+ * anything and report the time spent per job.
+ *
+ * If a master port and a number of clients is given, the jobs are
+ * instead handed out by the normal master mode to fake clients
+ * connecting over the network. The clients report immediate success
+ * and measure the time from requesting a job to receiving it.
+ */
+
+struct bench_client_stat {
+	unsigned long jobs;
+	double total_latency;
+	double max_latency;
+};
+
+#define	BENCH_MAX_DEPENDS	4
+#define	BENCH_WINDOW		1000
+
+static unsigned long bench_seed = 1;
+
+static unsigned long
+bench_random(void)
+{
+	bench_seed = bench_seed * 1103515245 + 12345;
+	return (bench_seed / 65536) % 32768;
+}
+
+static double
+elapsed(const struct timeval *start)
+{
+	struct timeval now;
+
+	(void)gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) +
+	    (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static void
+write_scan(FILE *scan, FILE *durations, unsigned long nodes)
+{
+	unsigned long i, deps[BENCH_MAX_DEPENDS], dep, window;
+	size_t j, k, len_deps;
+
+	for (i = 0; i < nodes; ++i) {
+		fprintf(scan, "PKGNAME=bench%lu-1.0\n", i);
+		fprintf(scan, "PKG_LOCATION=bench/bench%lu\n", i);
+		fprintf(scan, "PKG_SKIP_REASON=\n");
+		fprintf(scan, "PKG_FAIL_REASON=\n");
+		fprintf(scan, "DEPENDS=");
+
+		window = i < BENCH_WINDOW ? i : BENCH_WINDOW;
+		len_deps = 0;
+		for (j = bench_random() % (BENCH_MAX_DEPENDS + 1);
+		    window != 0 && j > 0; --j) {
+			dep = i - 1 - bench_random() % window;
+			for (k = 0; k < len_deps; ++k) {
+				if (deps[k] == dep)
+					break;
+			}
+			if (k != len_deps)
+				continue;
+			deps[len_deps] = dep;
+			fprintf(scan, "%sbench%lu-1.0", len_deps ? " " : "",
+			    dep);
+			++len_deps;
+		}
+		fprintf(scan, "\n");
+
+		if (bench_random() % 2)
+			fprintf(durations, "bench%lu-0.9 %lu\n", i,
+			    bench_random() % 3600);
+	}
+}
+
+static void
+bench_client(const char *master_port, struct bench_client_stat *st)
+{
+	struct sockaddr_in dst;
+	struct timeval start;
+	uint32_t build_info_len;
+	ssize_t recv_bytes;
+	char *build_info;
+	double latency;
+	int fd, tries;
+
+	if (parse_sockaddr_in(master_port, &dst))
+		errx(1, "Could not parse addr/port");
+
+	for (tries = 0;; ++tries) {
+		fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (fd == -1)
+			err(1, "Could not create socket");
+		if (connect(fd, (struct sockaddr *)&dst, sizeof(dst)) == 0) {
+			(void)set_nodelay(fd);
+			break;
+		}
+		if (tries == 100)
+			err(1, "Could not connect socket");
+		(void)close(fd);
+		(void)usleep(100000);
+	}
+
+	for (;;) {
+		(void)gettimeofday(&start, NULL);
+		if (atomic_write(fd, "G", 1) != 1)
+			break;
+		recv_bytes = atomic_read(fd, &build_info_len, 4);
+		if (recv_bytes != 4)
+			break;
+		build_info_len = ntohl(build_info_len);
+		if (build_info_len > 0xffffff)
+			errx(1, "Invalid build info length from master");
+		build_info = xmalloc(build_info_len);
+		recv_bytes = atomic_read(fd, build_info, build_info_len);
+		free(build_info);
+		if (recv_bytes != (ssize_t)build_info_len)
+			break;
+
+		latency = elapsed(&start);
+		++st->jobs;
+		st->total_latency += latency;
+		if (latency > st->max_latency)
+			st->max_latency = latency;
+
+		if (atomic_write(fd, "D", 1) != 1)
+			break;
+	}
+	_exit(0);
+}
+
+static void
+bench_master(const char *master_port, const char *clients_arg)
+{
+	struct bench_client_stat *stats, total;
+	struct timeval start;
+	unsigned long clients, i;
+	pid_t *pids;
+	char *end;
+	double run_time;
+
+	clients = strtoul(clients_arg, &end, 10);
+	if (*clients_arg == '\0' || *end != '\0' || clients == 0)
+		errx(1, "Invalid number of clients: %s", clients_arg);
+
+	stats = mmap(NULL, clients * sizeof(*stats), PROT_READ | PROT_WRITE,
+	    MAP_ANON | MAP_SHARED, -1, 0);
+	if (stats == MAP_FAILED)
+		err(1, "Cannot allocate shared memory");
+	memset(stats, 0, clients * sizeof(*stats));
+	pids = xmalloc(clients * sizeof(*pids));
+
+	(void)fflush(stdout);
+	for (i = 0; i < clients; ++i) {
+		if ((pids[i] = fork()) == -1)
+			err(1, "Could not fork client");
+		if (pids[i] == 0)
+			bench_client(master_port, &stats[i]);
+	}
+
+	(void)gettimeofday(&start, NULL);
+	master_mode(master_port, NULL);
+	run_time = elapsed(&start);
+
+	/* Idle clients wait for jobs that never come. */
+	for (i = 0; i < clients; ++i)
+		(void)kill(pids[i], SIGTERM);
+	for (i = 0; i < clients; ++i)
+		(void)waitpid(pids[i], NULL, 0);
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < clients; ++i) {
+		total.jobs += stats[i].jobs;
+		total.total_latency += stats[i].total_latency;
+		if (stats[i].max_latency > total.max_latency)
+			total.max_latency = stats[i].max_latency;
+	}
+
+	printf("Event backend: %s, clients: %lu\n", event_backend_name(),
+	    clients);
+	printf("Master: %.3f s for %lu jobs, %.0f jobs/s "
+	    "(including 1 s shutdown delay)\n", run_time, total.jobs,
+	    run_time > 0 ? total.jobs / run_time : 0.0);
+	printf("Dispatch latency: %.3f ms average, %.3f ms maximum\n",
+	    total.jobs ? total.total_latency * 1000 / total.jobs : 0.0,
+	    total.max_latency * 1000);
+
+	(void)munmap(stats, clients * sizeof(*stats));
+	free(pids);
+}
+
+void
+bench_mode(const char *arg, const char *master_port, const char *clients_arg)
+{
+	struct timeval start;
+	struct build_job *job;
+	struct build_stat st;
+	const char *tmpdir;
+	char *dir, *scan_file, *success_file, *error_file, *durations_file;
+	char *end;
+	FILE *scan, *durations;
+	unsigned long nodes, processed;
+	double init_time, sched_time;
+
+	nodes = strtoul(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || nodes == 0)
+		errx(1, "Invalid number of packages: %s", arg);
+
+	if ((tmpdir = getenv("TMPDIR")) == NULL)
+		tmpdir = "/tmp";
+	dir = xasprintf("%s/pbulk-bench.XXXXXX", tmpdir);
+	if (mkdtemp(dir) == NULL)
+		err(1, "Cannot create temporary directory");
+	scan_file = xasprintf("%s/presolve", dir);
+	success_file = xasprintf("%s/success", dir);
+	error_file = xasprintf("%s/error", dir);
+	durations_file = xasprintf("%s/durations", dir);
+
+	if ((scan = fopen(scan_file, "w")) == NULL)
+		err(1, "Cannot create scan file");
+	if ((durations = fopen(durations_file, "w")) == NULL)
+		err(1, "Cannot create durations file");
+	write_scan(scan, durations, nodes);
+	if (fclose(scan) == EOF || fclose(durations) == EOF)
+		err(1, "Cannot write scan file");
+
+	verbosity = 0;
+
+	(void)gettimeofday(&start, NULL);
+	init_jobs(scan_file, success_file, error_file, durations_file);
+	init_time = elapsed(&start);
+
+	if (master_port != NULL) {
+		printf("Initialisation: %.3f s\n", init_time);
+		bench_master(master_port, clients_arg);
+		goto cleanup;
+	}
+
+	processed = 0;
+	(void)gettimeofday(&start, NULL);
+	while ((job = get_job()) != NULL) {
+		/* Emulate the statistics queries of -v and pbulk-build -s. */
+		build_stats(&st);
+		process_job(job, JOB_DONE, 0);
+		++processed;
+	}
+	sched_time = elapsed(&start);
+
+	build_stats(&st);
+	printf("Packages: %lu (%lu scheduled)\n", nodes, processed);
+	printf("Initialisation: %.3f s\n", init_time);
+	printf("Scheduling: %.3f s, %.3f us per job\n", sched_time,
+	    processed ? sched_time * 1000000.0 / processed : 0.0);
+
+cleanup:
+	(void)unlink(scan_file);
+	(void)unlink(success_file);
+	(void)unlink(error_file);
+	(void)unlink(durations_file);
+	(void)rmdir(dir);
+
+	exit(0);
+}
@@ -51,6 +51,7 @@ static int post_initial;
 
 static int log_success;
 static int log_failed;
+static int log_durations = -1;
 
 SLIST_HEAD(buildhash, build_job);
 
@@ -59,12 +60,23 @@ static void mark_initial(void);
 static struct buildhash *get_hash_chain(const char *, size_t);
 static void hash_entries(void);
 static void add_to_build_list(struct build_job *);
+static void read_durations(const char *);
+static void compute_weights(void);
 
 static struct build_job *jobs;
 static size_t allocated_jobs, len_jobs;
 static char *scan_output_content;
 
-static TAILQ_HEAD(, build_job) buildable_jobs;
+/**
+ * The jobs ready to be built form a binary heap ordered by
+ * build_before, so that get_job and add_to_build_list are O(log n).
+ */
+static struct build_job **buildable_jobs;
+static size_t allocated_buildable, len_buildable;
+static unsigned long build_seq;
+
+/** Number of jobs in each state, updated by process_job. */
+static struct build_stat job_stats;
 
 static void
 ts_printf(const char *fmt, ...)
@@ -146,57 +158,126 @@ pbulk_item_end(const char *line)
 	return line;
 }
 
-SLIST_HEAD(depth_tree_head, build_job);
+/*
+ * The depth of a package is the number of packages that directly or
+ * indirectly depend on it, including the package itself. It is computed
+ * by a single depth first search that orders the packages such that all
+ * depending packages come first, followed by passes that propagate
+ * reachability bitsets along this order. Each pass handles a block of
+ * DEPTH_BLOCK_BITS packages to bound the memory use.
+ */
+#define	DEPTH_BLOCK_WORDS	64
+#define	DEPTH_BLOCK_BITS	(DEPTH_BLOCK_WORDS * 64)
+
+enum { DFS_NEW, DFS_ACTIVE, DFS_DONE };
+
+static struct build_job *cycle_start;
 
 static int
-compute_tree_depth_rec(struct build_job *job, struct build_job *root,
-    struct depth_tree_head *head, int *count)
+order_tree_rec(struct build_job *job, unsigned char *dfs_state,
+    struct build_job **order, size_t *len_order)
 {
 	struct dependency_list *dep_iter;
-	struct build_job *job_iter;
+	struct build_job *dep;
 
-	if (job == root && *count != 0) {
-		fprintf(stderr, "Cyclic dependency for package:\n%s\n", job->pkgname);
-		return -1;
-	}
-
-	SLIST_FOREACH(job_iter, head, depth_tree_link) {
-		if (job_iter == job)
-			return 0;
-	}
-	SLIST_INSERT_HEAD(head, job, depth_tree_link);
-	*count = *count + 1;
+	dfs_state[job - jobs] = DFS_ACTIVE;
 	SLIST_FOREACH(dep_iter, &job->depending_pkgs, depends_link) {
-		if (compute_tree_depth_rec(dep_iter->dependency, root,
-		    head, count)) {
-			fprintf(stderr, "%s\n", job->pkgname);
-			return -1;
+		dep = dep_iter->dependency;
+		if (dfs_state[dep - jobs] == DFS_DONE)
+			continue;
+		if (dfs_state[dep - jobs] == DFS_ACTIVE) {
+			fprintf(stderr, "Cyclic dependency for package:\n%s\n",
+			    dep->pkgname);
+			cycle_start = dep;
+			goto cycle;
 		}
+		if (order_tree_rec(dep, dfs_state, order, len_order))
+			goto cycle;
 	}
+	dfs_state[job - jobs] = DFS_DONE;
+	order[(*len_order)++] = job;
 	return 0;
+
+cycle:
+	if (cycle_start != NULL) {
+		fprintf(stderr, "%s\n", job->pkgname);
+		if (job == cycle_start)
+			cycle_start = NULL;
+	}
+	return -1;
+}
+
+static size_t
+popcount64(uint64_t x)
+{
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (size_t)((x * 0x0101010101010101ULL) >> 56);
 }
 
 static void
-compute_tree_depth(struct build_job *job)
+compute_tree_depth(void)
 {
-	struct depth_tree_head head;
+	struct dependency_list *dep_iter;
+	struct build_job **order, *job;
+	unsigned char *dfs_state;
+	uint64_t *bits, *job_bits, *dep_bits;
+	size_t i, j, k, len_order, base, words, idx;
+
+	order = xmalloc(len_jobs * sizeof(*order));
+	dfs_state = xmalloc(len_jobs);
+	memset(dfs_state, DFS_NEW, len_jobs);
 
-	SLIST_INIT(&head);
-	job->pkg_depth = 0;
-	if (compute_tree_depth_rec(job, job, &head, &job->pkg_depth))
-		exit(1);
+	len_order = 0;
+	for (i = 0; i < len_jobs; ++i) {
+		jobs[i].pkg_depth = 0;
+		if (dfs_state[i] != DFS_NEW)
+			continue;
+		if (order_tree_rec(&jobs[i], dfs_state, order, &len_order))
+			exit(1);
+	}
+	free(dfs_state);
+
+	words = (len_jobs + 63) / 64;
+	if (words > DEPTH_BLOCK_WORDS)
+		words = DEPTH_BLOCK_WORDS;
+	bits = xmalloc(len_jobs * words * sizeof(*bits));
+
+	for (base = 0; base < len_jobs; base += words * 64) {
+		memset(bits, 0, len_jobs * words * sizeof(*bits));
+		for (i = 0; i < len_order; ++i) {
+			job = order[i];
+			idx = job - jobs;
+			job_bits = bits + idx * words;
+			if (idx >= base && idx - base < words * 64)
+				job_bits[(idx - base) / 64] |=
+				    (uint64_t)1 << ((idx - base) % 64);
+			SLIST_FOREACH(dep_iter, &job->depending_pkgs,
+			    depends_link) {
+				dep_bits = bits +
+				    (dep_iter->dependency - jobs) * words;
+				for (k = 0; k < words; ++k)
+					job_bits[k] |= dep_bits[k];
+			}
+			for (j = 0; j < words; ++j)
+				job->pkg_depth += popcount64(job_bits[j]);
+		}
+	}
+
+	free(bits);
+	free(order);
 }
 
 void
-init_jobs(const char *scan_output, const char *success_file, const char *error_file)
+init_jobs(const char *scan_output, const char *success_file,
+    const char *error_file, const char *durations_file)
 {
 	char *input;
 	const char *input_iter;
 	int fd;
 	size_t i;
 
-	TAILQ_INIT(&buildable_jobs);
-
 	if ((fd = open(scan_output, O_RDONLY, 0)) == -1)
 		err(1, "Cannot open input");
 
@@ -208,6 +289,13 @@ init_jobs(const char *scan_output, const char *success_file, const char *error_f
 	if (log_failed == -1)
 		err(1, "Cannot open log file for failed builds");
 
+	if (durations_file != NULL) {
+		log_durations = open(durations_file,
+		    O_RDWR | O_CREAT | O_APPEND, 0666);
+		if (log_durations == -1)
+			err(1, "Cannot open log file for build durations");
+	}
+
 	input = read_from_file(fd);
 	(void)close(fd);
 
@@ -222,6 +310,8 @@ init_jobs(const char *scan_output, const char *success_file, const char *error_f
 		jobs[len_jobs].end = pbulk_item_end(input_iter);
 		jobs[len_jobs].state = JOB_INIT;
 		jobs[len_jobs].open_depends = 0;
+		jobs[len_jobs].build_duration = -1;
+		jobs[len_jobs].pkg_weight = 0;
 		SLIST_INIT(&jobs[len_jobs].depending_pkgs);
 		if (jobs[len_jobs].end == NULL)
 			errx(1, "Invalid input");
@@ -240,8 +330,12 @@ init_jobs(const char *scan_output, const char *success_file, const char *error_f
 	hash_entries();
 	build_tree();
 
-	for (i = 0; i < len_jobs; ++i)
-		compute_tree_depth(&jobs[i]);
+	compute_tree_depth();
+
+	if (log_durations != -1) {
+		read_durations(durations_file);
+		compute_weights();
+	}
 
 	mark_initial();
 
@@ -311,18 +405,299 @@ mark_initial(void)
 	post_initial = 1;
 }
 
+struct duration_entry {
+	const char *pkgname;
+	size_t pkgname_len;
+	size_t pkgbase_len;
+	long duration;
+	int keep;
+	SLIST_ENTRY(duration_entry) hash_link;
+};
+
+SLIST_HEAD(duration_hash, duration_entry);
+
+static size_t
+pkgbase_len(const char *pkgname, size_t len)
+{
+	size_t i;
+
+	for (i = len; i > 0; --i) {
+		if (pkgname[i - 1] == '-')
+			return i - 1;
+	}
+	return len;
+}
+
+/**
+ * Replace the durations file with the entries marked to be kept, in the
+ * original order, and reopen it for appending.
+ */
 static void
-add_to_build_list(struct build_job *job)
+write_durations(const char *path, struct duration_entry *entries,
+    size_t len_entries)
 {
-	struct build_job *iter;
+	char *tmp;
+	FILE *f;
+	size_t i;
 
-	TAILQ_FOREACH(iter, &buildable_jobs, build_link) {
-		if (iter->pkg_depth < job->pkg_depth) {
-			TAILQ_INSERT_BEFORE(iter, job, build_link);
-			return;
+	tmp = xasprintf("%s.tmp", path);
+	if ((f = fopen(tmp, "w")) == NULL)
+		err(1, "Cannot create %s", tmp);
+	for (i = 0; i < len_entries; ++i) {
+		if (entries[i].keep)
+			fprintf(f, "%.*s %ld\n", (int)entries[i].pkgname_len,
+			    entries[i].pkgname, entries[i].duration);
+	}
+	if (ferror(f) || fclose(f) == EOF)
+		err(1, "Cannot write %s", tmp);
+	if (rename(tmp, path) == -1)
+		err(1, "Cannot rename %s to %s", tmp, path);
+	free(tmp);
+
+	(void)close(log_durations);
+	log_durations = open(path, O_RDWR | O_CREAT | O_APPEND, 0666);
+	if (log_durations == -1)
+		err(1, "Cannot open log file for build durations");
+}
+
+/**
+ * Reads the build durations logged by previous runs. Each line has the
+ * form "pkgname seconds". Later entries override earlier ones. If no
+ * entry for the exact package name exists, the most recent entry for
+ * another version of the same PKGBASE is used instead.
+ *
+ * Invalid lines are skipped with a warning. The file is rewritten with
+ * only the entries that can still be used: the newest one for each
+ * package to build and the newest one for each PKGBASE.
+ */
+static void
+read_durations(const char *path)
+{
+	struct duration_hash *hash;
+	struct duration_entry *entries, *iter, *match;
+	size_t i, len, line, allocated_entries, len_entries, len_kept;
+	size_t hash_size, hash_val;
+	char *input, *input_iter, *eol, *num, *end;
+	long duration;
+	int invalid;
+
+	input = read_from_file(log_durations);
+
+	allocated_entries = 1024;
+	len_entries = 0;
+	entries = xmalloc(allocated_entries * sizeof(*entries));
+
+	invalid = 0;
+	for (input_iter = input, line = 1; *input_iter != '\0';
+	    input_iter = eol, ++line) {
+		eol = input_iter + strcspn(input_iter, "\n");
+		len = strcspn(input_iter, " \t\n");
+		duration = -1;
+		end = NULL;
+		/* strtol would skip a newline, so check for a digit first */
+		num = input_iter + len + strspn(input_iter + len, " \t");
+		if (len != 0 && *num >= '0' && *num <= '9')
+			duration = strtol(num, &end, 10);
+		if (*eol == '\n')
+			++eol;
+		if (duration < 0 || *end != '\n') {
+			warnx("Ignoring invalid line %lu in durations file",
+			    (unsigned long)line);
+			invalid = 1;
+			continue;
+		}
+		if (len_entries == allocated_entries) {
+			allocated_entries *= 2;
+			entries = xrealloc(entries,
+			    allocated_entries * sizeof(*entries));
 		}
+		entries[len_entries].pkgname = input_iter;
+		entries[len_entries].pkgname_len = len;
+		entries[len_entries].pkgbase_len = pkgbase_len(input_iter, len);
+		entries[len_entries].duration = duration;
+		entries[len_entries].keep = 0;
+		++len_entries;
+	}
+
+	hash_size = len_jobs + 1;
+	hash = xmalloc(hash_size * sizeof(*hash));
+	for (i = 0; i < hash_size; ++i)
+		SLIST_INIT(&hash[i]);
+	for (i = 0; i < len_entries; ++i) {
+		iter = &entries[i];
+		hash_val = djb_hash2(iter->pkgname,
+		    iter->pkgname + iter->pkgbase_len) % hash_size;
+		SLIST_INSERT_HEAD(&hash[hash_val], iter, hash_link);
+	}
+
+	/* Keep the newest entry of each PKGBASE for later versions. */
+	for (i = 0; i < hash_size; ++i) {
+		SLIST_FOREACH(iter, &hash[i], hash_link) {
+			SLIST_FOREACH(match, &hash[i], hash_link) {
+				if (match == iter ||
+				    (match->pkgbase_len == iter->pkgbase_len &&
+				    strncmp(match->pkgname, iter->pkgname,
+				    iter->pkgbase_len) == 0))
+					break;
+			}
+			iter->keep = match == iter;
+		}
+	}
+
+	for (i = 0; i < len_jobs; ++i) {
+		len = pkgbase_len(jobs[i].pkgname, jobs[i].pkgname_len);
+		hash_val = djb_hash2(jobs[i].pkgname,
+		    jobs[i].pkgname + len) % hash_size;
+		match = NULL;
+		/* Entries are in reverse order, the first match is the newest. */
+		SLIST_FOREACH(iter, &hash[hash_val], hash_link) {
+			if (iter->pkgbase_len != len ||
+			    strncmp(iter->pkgname, jobs[i].pkgname, len) != 0)
+				continue;
+			if (iter->pkgname_len == jobs[i].pkgname_len &&
+			    strncmp(iter->pkgname, jobs[i].pkgname,
+			    iter->pkgname_len) == 0) {
+				match = iter;
+				match->keep = 1;
+				break;
+			}
+			if (match == NULL)
+				match = iter;
+		}
+		if (match != NULL)
+			jobs[i].build_duration = match->duration;
+	}
+
+	len_kept = 0;
+	for (i = 0; i < len_entries; ++i) {
+		if (entries[i].keep)
+			++len_kept;
+	}
+	if (invalid || len_kept != len_entries)
+		write_durations(path, entries, len_entries);
+
+	free(hash);
+	free(entries);
+	free(input);
+}
+
+static unsigned long
+compute_weight_rec(struct build_job *job, unsigned long default_duration)
+{
+	struct dependency_list *dep_iter;
+	unsigned long weight, max_weight;
+
+	if (job->pkg_weight != 0)
+		return job->pkg_weight;
+
+	max_weight = 0;
+	SLIST_FOREACH(dep_iter, &job->depending_pkgs, depends_link) {
+		weight = compute_weight_rec(dep_iter->dependency,
+		    default_duration);
+		if (weight > max_weight)
+			max_weight = weight;
 	}
-	TAILQ_INSERT_TAIL(&buildable_jobs, job, build_link);
+	if (job->build_duration >= 0)
+		weight = (unsigned long)job->build_duration + 1;
+	else
+		weight = default_duration;
+	job->pkg_weight = max_weight + weight;
+	return job->pkg_weight;
+}
+
+/**
+ * Computes the critical path weight of all jobs. Packages without
+ * known build duration are assumed to take the average time of all
+ * packages with known duration. If nothing is known, the weights stay
+ * zero and the build order is determined by the depth of the tree.
+ * compute_tree_depth has already verified that the graph is acyclic.
+ */
+static void
+compute_weights(void)
+{
+	unsigned long total, known, default_duration;
+	size_t i;
+
+	total = known = 0;
+	for (i = 0; i < len_jobs; ++i) {
+		if (jobs[i].build_duration < 0)
+			continue;
+		total += (unsigned long)jobs[i].build_duration + 1;
+		++known;
+	}
+	if (known == 0)
+		return;
+	default_duration = total / known;
+
+	for (i = 0; i < len_jobs; ++i)
+		compute_weight_rec(&jobs[i], default_duration);
+
+	if (verbosity >= 1)
+		printf("Build durations known for %lu of %lu packages.\n",
+		    known, (unsigned long)len_jobs);
+}
+
+/**
+ * Returns non-zero if ''job'' should be built before ''other''.
+ * Jobs of equal priority are built in the order they became ready.
+ */
+static int
+build_before(struct build_job *job, struct build_job *other)
+{
+	if (job->pkg_weight != other->pkg_weight)
+		return job->pkg_weight > other->pkg_weight;
+	if (job->pkg_depth != other->pkg_depth)
+		return job->pkg_depth > other->pkg_depth;
+	return job->build_seq < other->build_seq;
+}
+
+static void
+add_to_build_list(struct build_job *job)
+{
+	size_t i, parent;
+
+	if (len_buildable == allocated_buildable) {
+		allocated_buildable = allocated_buildable ?
+		    allocated_buildable * 2 : 1024;
+		buildable_jobs = xrealloc(buildable_jobs,
+		    allocated_buildable * sizeof(*buildable_jobs));
+	}
+
+	job->build_seq = build_seq++;
+
+	for (i = len_buildable++; i > 0; i = parent) {
+		parent = (i - 1) / 2;
+		if (!build_before(job, buildable_jobs[parent]))
+			break;
+		buildable_jobs[i] = buildable_jobs[parent];
+	}
+	buildable_jobs[i] = job;
+}
+
+static struct build_job *
+remove_from_build_list(void)
+{
+	struct build_job *job, *last;
+	size_t i, child;
+
+	if (len_buildable == 0)
+		return NULL;
+
+	job = buildable_jobs[0];
+	last = buildable_jobs[--len_buildable];
+
+	for (i = 0; (child = 2 * i + 1) < len_buildable; i = child) {
+		if (child + 1 < len_buildable &&
+		    build_before(buildable_jobs[child + 1],
+		    buildable_jobs[child]))
+			++child;
+		if (!build_before(buildable_jobs[child], last))
+			break;
+		buildable_jobs[i] = buildable_jobs[child];
+	}
+	buildable_jobs[i] = last;
+
+	return job;
 }
 
 static void
@@ -366,11 +741,8 @@ get_job(void)
 {
 	struct build_job *job;
 
-	if ((job = TAILQ_FIRST(&buildable_jobs)) != NULL) {
-		TAILQ_REMOVE(&buildable_jobs, job, build_link);
-
+	if ((job = remove_from_build_list()) != NULL)
 		process_job(job, JOB_IN_PROCESSING, 0);
-	}
 	return job;
 }
 
@@ -386,6 +758,30 @@ recursive_mark_broken(struct build_job *job, enum job_state state)
 	}	
 }
 
+static size_t *
+stat_counter(struct build_stat *st, enum job_state state)
+{
+	switch (state) {
+	case JOB_INIT:
+		return NULL;
+	case JOB_OPEN:
+		return &st->open_jobs;
+	case JOB_IN_PROCESSING:
+		return &st->in_processing;
+	case JOB_FAILED:
+		return &st->failed;
+	case JOB_PREFAILED:
+		return &st->prefailed;
+	case JOB_INDIRECT_FAILED:
+		return &st->indirect_failed;
+	case JOB_INDIRECT_PREFAILED:
+		return &st->indirect_prefailed;
+	case JOB_DONE:
+		return &st->done;
+	}
+	return NULL;
+}
+
 /**
  * Changes the state of the ''job'' to ''state'' and runs some code
  * depending on the new state. If ''log_state'' is non-zero, the package
@@ -396,8 +792,13 @@ void
 process_job(struct build_job *job, enum job_state state, int log_state)
 {
 	struct dependency_list *iter;
+	size_t *counter;
 	char *buf;
 
+	if ((counter = stat_counter(&job_stats, job->state)) != NULL)
+		--*counter;
+	if ((counter = stat_counter(&job_stats, state)) != NULL)
+		++*counter;
 	job->state = state;
 
 	switch (state) {
@@ -416,6 +817,13 @@ process_job(struct build_job *job, enum job_state state, int log_state)
 				err(1, "Cannot log successful build");
 			free(buf);
 		}
+		if (log_state && log_durations != -1) {
+			buf = xasprintf("%s %ld\n", job->pkgname,
+			    (long)(time(NULL) - job->build_start));
+			if (write(log_durations, buf, strlen(buf)) == -1)
+				err(1, "Cannot log build duration");
+			free(buf);
+		}
 		if (verbosity >= 1 && post_initial)
 			ts_printf("Successfully built %s\n", job->pkgname);
 		break;
@@ -438,6 +846,7 @@ process_job(struct build_job *job, enum job_state state, int log_state)
 		recursive_mark_broken(job, JOB_INDIRECT_PREFAILED);
 		break;
 	case JOB_IN_PROCESSING:
+		job->build_start = time(NULL);
 		if (verbosity >= 1)
 			ts_printf("Starting build of  %s\n", job->pkgname);
 		break;
@@ -451,43 +860,7 @@ process_job(struct build_job *job, enum job_state state, int log_state)
 void
 build_stats(struct build_stat *st)
 {
-	size_t i;
-
-	st->open_jobs = 0;
-	st->in_processing = 0;
-	st->failed = 0;
-	st->prefailed = 0;
-	st->indirect_failed = 0;
-	st->indirect_prefailed = 0;
-	st->done = 0;
-
-	for (i = 0; i < len_jobs; ++i) {
-		switch (jobs[i].state) {
-		case JOB_DONE:
-			++st->done;
-			break;
-		case JOB_FAILED:
-			++st->failed;
-			break;
-		case JOB_PREFAILED:
-			++st->prefailed;
-			break;
-		case JOB_INDIRECT_FAILED:
-			++st->indirect_failed;
-			break;
-		case JOB_INDIRECT_PREFAILED:
-			++st->indirect_prefailed;
-			break;
-		case JOB_OPEN:
-			++st->open_jobs;
-			break;
-		case JOB_IN_PROCESSING:
-			++st->in_processing;
-			break;
-		case JOB_INIT:
-			break;
-		}
-	}
+	*st = job_stats;
 }
 
 void
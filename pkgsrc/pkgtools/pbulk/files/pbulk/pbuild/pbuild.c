@@ -56,34 +56,44 @@ static void
 usage(void)
 {
 	(void)fprintf(stderr, "usage: pbulk-build -s <master>\n");
+	(void)fprintf(stderr, "usage: pbulk-build -B <number of packages> [ -j <clients> -m <port> ]\n");
 	(void)fprintf(stderr, "usage: pbulk-build [ -v ] -c <master> -b <build script>\n");
-	(void)fprintf(stderr, "usage: pbulk-build [ -v ] [ -I <start> ] [ -r <report> ] -m <port> <tree scan> <success file> <error file>\n");
-	(void)fprintf(stderr, "usage: pbulk-build [ -v ] [ -r <report> ] -b <build script> <tree scan> <success file> <error file>\n");
+	(void)fprintf(stderr, "usage: pbulk-build [ -v ] [ -I <start> ] [ -d <durations> ] [ -r <report> ] -m <port> <tree scan> <success file> <error file>\n");
+	(void)fprintf(stderr, "usage: pbulk-build [ -v ] [ -d <durations> ] [ -r <report> ] -b <build script> <tree scan> <success file> <error file>\n");
 	exit(1);
 }
 
 int
 main(int argc, char **argv)
 {
+	const char *bench_count;
+	const char *bench_clients;
 	const char *stat_port;
 	const char *client_port;
 	const char *master_port;
 	const char *report_file;
 	const char *start_script;
+	const char *durations_file;
 	struct sigaction sa;
 	int ch, modes;
 
 	setprogname("pbulk-build");
 
+	bench_count = NULL;
+	bench_clients = NULL;
 	client_port = NULL;
 	master_port = NULL;
 	stat_port = NULL;
 	start_script = NULL;
 	report_file = NULL;
+	durations_file = NULL;
 	modes = 0;
 
-	while ((ch = getopt(argc, argv, "I:b:c:m:r:s:v")) != -1) {
+	while ((ch = getopt(argc, argv, "B:I:b:c:d:j:m:r:s:v")) != -1) {
 		switch (ch) {
+		case 'B':
+			bench_count = optarg;
+			break;
 		case 'I':
 			start_script = optarg;
 			break;
@@ -94,6 +104,12 @@ main(int argc, char **argv)
 			client_port = optarg;
 			++modes;
 			break;
+		case 'd':
+			durations_file = optarg;
+			break;
+		case 'j':
+			bench_clients = optarg;
+			break;
 		case 'm':
 			master_port = optarg;
 			++modes;
@@ -129,6 +145,13 @@ main(int argc, char **argv)
 	(void)sigemptyset(&sa.sa_mask);
 	(void)sigaction(SIGPIPE, (struct sigaction *)&sa, NULL);
 
+	if (bench_count != NULL) {
+		if (argc != 0 || client_port != NULL || stat_port != NULL ||
+		    (master_port == NULL) != (bench_clients == NULL))
+			usage();
+		bench_mode(bench_count, master_port, bench_clients);
+	}
+
 	if (build_path == NULL && (modes == 0 || client_port != NULL))
 		usage();
 
@@ -158,7 +181,7 @@ main(int argc, char **argv)
 	if (verbosity >= 2)
 		tzset();
 
-	init_jobs(argv[0], argv[1], argv[2]);
+	init_jobs(argv[0], argv[1], argv[2], durations_file);
 
 	if (master_port != NULL)
 		master_mode(master_port, start_script);
@@ -32,6 +32,7 @@
  */
 
 #include <nbcompat/queue.h>
+#include <nbcompat/time.h>
 #ifdef HAVE_INTTYPES_H
 #include <inttypes.h>
 #endif
@@ -97,6 +98,23 @@ struct build_job {
 	enum job_state state;
 	int pkg_depth;
 
+	/**
+	 * The duration of the last successful build in seconds as
+	 * found in the durations file, or -1 if unknown.
+	 */
+	long build_duration;
+
+	/**
+	 * The sum of the (estimated) build durations along the longest
+	 * path from this package to a package nothing depends on.
+	 * Zero if no build durations are available, in which case
+	 * pkg_depth decides the build order.
+	 */
+	unsigned long pkg_weight;
+
+	/** The time the current build of this package was started. */
+	time_t build_start;
+
 	/**
 	 * The number of direct dependencies that must be built before
 	 * this package can be tried.
@@ -106,20 +124,22 @@ struct build_job {
 	/** The packages that depend on this package. */
 	SLIST_HEAD(, dependency_list) depending_pkgs;
 
-	TAILQ_ENTRY(build_job) build_link;
+	/** Insertion order into the build heap, used to break ties. */
+	unsigned long build_seq;
 	SLIST_ENTRY(build_job) hash_link;
-	SLIST_ENTRY(build_job) depth_tree_link;
 };
 
 extern int		 verbosity;
 
-void			 init_jobs(const char *, const char *, const char *);
+void			 init_jobs(const char *, const char *, const char *,
+			    const char *);
 struct build_job	*get_job(void);
 void			 process_job(struct build_job *, enum job_state, int);
 int			 build_package(const char *, size_t);
 void			 finish_build(const char *);
 void			 build_stats(struct build_stat *);
 
+void			 bench_mode(const char *, const char *, const char *);
 void			 client_mode(const char *);
 void			 master_mode(const char *, const char *);
 void			 stat_mode(const char *);
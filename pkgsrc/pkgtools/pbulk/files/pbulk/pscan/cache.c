@@ -0,0 +1,578 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Persistent scan cache. For every scanned location, the cache stores
+ * the pbulk-index output together with a hash of the content of each
+ * file listed in SCAN_DEPENDS. An entry is reused as long as all those
+ * files still have the same content, independent of their mtime.
+ * The files are hashed when the scan of the location finishes and the
+ * entry isn't stored if one of them was modified during the scan.
+ * The whole cache is discarded if the scan environment changes, i.e.
+ * the make command, the path of the pkgsrc tree or the environment
+ * variables passed to make.
+ *
+ * The file format is line based:
+ *
+ *	PBULK_SCAN_CACHE=1 <environment hash>
+ *	LOCATION=<pkg location>
+ *	FILE=<content hash> <path>
+ *	...
+ *	DATA=<length>
+ *	<length bytes of pbulk-index output>
+ *
+ * Entries of locations not scanned in this run are kept as long as
+ * the location still exists, so that limited scans don't drop them.
+ * A cache that can't be parsed is discarded with a warning and rebuilt.
+ */
+
+#include <nbcompat.h>
+
+#include <sys/stat.h>
+#include <nbcompat/err.h>
+#include <fcntl.h>
+#include <nbcompat/limits.h>
+#include <nbcompat/stdio.h>
+#include <nbcompat/stdlib.h>
+#include <nbcompat/string.h>
+#include <nbcompat/time.h>
+#include <nbcompat/unistd.h>
+
+#include "pbulk.h"
+#include "pscan.h"
+
+#define	CACHE_VERSION		1
+#define	CACHE_HASH_SIZE		32768
+#define	FILE_HASH_SIZE		131072
+
+extern char **environ;
+
+struct file_hash {
+	char *path;
+	int exists;
+	uint64_t hash;
+	time_t mtime;
+	off_t size;
+	time_t hashed;
+	unsigned long mark;
+	SLIST_ENTRY(file_hash) hash_link;
+};
+SLIST_HEAD(file_hash_head, file_hash);
+
+struct cache_file {
+	char *path;
+	uint64_t hash;
+};
+
+struct cache_entry {
+	char *location;
+	struct cache_file *files;
+	size_t len_files;
+	const char *data;
+	size_t data_len;
+	int superseded;
+	SLIST_ENTRY(cache_entry) hash_link;
+};
+SLIST_HEAD(cache_entry_head, cache_entry);
+
+static struct file_hash_head file_hash_table[FILE_HASH_SIZE];
+static struct cache_entry_head cache_hash_table[CACHE_HASH_SIZE];
+
+static int cache_enabled;
+static uint64_t env_hash;
+static unsigned long file_mark;
+static unsigned long cache_hits, cache_misses;
+
+static struct cache_entry *cached_jobs;
+static size_t len_cached_jobs, allocated_cached_jobs;
+
+#define	FNV_OFFSET	0xcbf29ce484222325ULL
+#define	FNV_PRIME	0x100000001b3ULL
+
+static uint64_t
+fnv_update(uint64_t h, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+
+	while (len-- > 0) {
+		h ^= *p++;
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+/*
+ * Return the content hash of path. Hashes are remembered, but a file
+ * is hashed again if its size or mtime changed or if it was modified
+ * in the same second it was hashed.
+ */
+static struct file_hash *
+hash_path(const char *path)
+{
+	struct file_hash_head *h;
+	struct file_hash *e;
+	struct stat sb;
+	char buf[65536];
+	ssize_t len;
+	int fd;
+
+	h = &file_hash_table[djb_hash(path) % FILE_HASH_SIZE];
+	SLIST_FOREACH(e, h, hash_link) {
+		if (strcmp(path, e->path) == 0)
+			break;
+	}
+	if (e == NULL) {
+		e = xmalloc(sizeof(*e));
+		e->path = xstrdup(path);
+		e->mark = 0;
+		SLIST_INSERT_HEAD(h, e, hash_link);
+	} else if (e->exists && stat(path, &sb) == 0 &&
+	    sb.st_mtime == e->mtime && sb.st_size == e->size &&
+	    e->mtime < e->hashed)
+		return e;
+
+	e->exists = 0;
+	e->hash = FNV_OFFSET;
+	e->hashed = time(NULL);
+	if ((fd = open(path, O_RDONLY)) != -1) {
+		while ((len = read(fd, buf, sizeof(buf))) > 0)
+			e->hash = fnv_update(e->hash, buf, len);
+		e->exists = len == 0 && fstat(fd, &sb) == 0;
+		if (e->exists) {
+			e->mtime = sb.st_mtime;
+			e->size = sb.st_size;
+		}
+		(void)close(fd);
+	}
+	return e;
+}
+
+static int
+env_cmp(const void *a, const void *b)
+{
+	return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+/* Variables that differ between invocations without affecting make. */
+static int
+env_ignored(const char *var)
+{
+	static const char * const ignored[] = {
+		"OLDPWD=", "PWD=", "SHLVL=", "_=", NULL
+	};
+	size_t i;
+
+	for (i = 0; ignored[i] != NULL; ++i) {
+		if (strncmp(var, ignored[i], strlen(ignored[i])) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+static uint64_t
+compute_env_hash(const char *bmake_path)
+{
+	const char **vars;
+	size_t i, len;
+	uint64_t h;
+
+	h = fnv_update(FNV_OFFSET, bmake_path, strlen(bmake_path) + 1);
+	h = fnv_update(h, pkgsrc_tree, strlen(pkgsrc_tree) + 1);
+
+	for (len = 0; environ[len] != NULL; ++len)
+		continue;
+	vars = xmalloc((len + 1) * sizeof(*vars));
+	for (i = 0; i < len; ++i)
+		vars[i] = environ[i];
+	qsort(vars, len, sizeof(*vars), env_cmp);
+	for (i = 0; i < len; ++i) {
+		if (!env_ignored(vars[i]))
+			h = fnv_update(h, vars[i], strlen(vars[i]) + 1);
+	}
+	free(vars);
+	return h;
+}
+
+/* Returns the start of the next line, or NULL if line isn't terminated. */
+static const char *
+next_line(const char *line, const char *buf_end)
+{
+	const char *eol;
+
+	if ((eol = memchr(line, '\n', buf_end - line)) == NULL)
+		return NULL;
+	return eol + 1;
+}
+
+/*
+ * Read the whole cache file. Unlike read_from_file, problems are not
+ * fatal: the cache is simply rebuilt.
+ */
+static char *
+read_cache_file(int fd, size_t *len)
+{
+	struct stat sb;
+	ssize_t bytes_read;
+	char *buf;
+
+	if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode) ||
+	    sb.st_size > SSIZE_MAX - 1)
+		return NULL;
+	*len = (size_t)sb.st_size;
+	buf = xmalloc(*len + 1);
+	bytes_read = read(fd, buf, *len);
+	if (bytes_read == -1 || (size_t)bytes_read != *len ||
+	    memchr(buf, '\0', *len) != NULL) {
+		free(buf);
+		return NULL;
+	}
+	buf[*len] = '\0';
+	return buf;
+}
+
+static void
+free_entry(struct cache_entry *e)
+{
+	size_t i;
+
+	for (i = 0; i < e->len_files; ++i)
+		free(e->files[i].path);
+	free(e->files);
+	free(e->location);
+	free(e);
+}
+
+static void
+free_cache_entries(void)
+{
+	struct cache_entry *e;
+	size_t i;
+
+	for (i = 0; i < CACHE_HASH_SIZE; ++i) {
+		while ((e = SLIST_FIRST(&cache_hash_table[i])) != NULL) {
+			SLIST_REMOVE_HEAD(&cache_hash_table[i], hash_link);
+			free_entry(e);
+		}
+	}
+}
+
+void
+read_scan_cache(const char *path, const char *bmake_path)
+{
+	struct cache_entry *e;
+	char *buf, *end;
+	const char *buf_end, *line, *eol;
+	unsigned long long hash;
+	size_t i, len, allocated_files;
+	int fd;
+
+	cache_enabled = 1;
+	env_hash = compute_env_hash(bmake_path);
+	for (i = 0; i < CACHE_HASH_SIZE; ++i)
+		SLIST_INIT(&cache_hash_table[i]);
+	for (i = 0; i < FILE_HASH_SIZE; ++i)
+		SLIST_INIT(&file_hash_table[i]);
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return;
+	buf = read_cache_file(fd, &len);
+	(void)close(fd);
+	if (buf == NULL) {
+		warnx("Cannot read scan cache %s, rebuilding it", path);
+		return;
+	}
+	buf_end = buf + len;
+	e = NULL;
+
+	line = buf;
+	if (strncmp(line, "PBULK_SCAN_CACHE=", 17) != 0 ||
+	    strtol(line + 17, &end, 10) != CACHE_VERSION || *end != ' ')
+		goto invalid;
+	hash = strtoull(end + 1, &end, 16);
+	if (*end != '\n')
+		goto invalid;
+	if (hash != env_hash) {
+		if (verbosity >= 1)
+			printf("Scan environment changed, "
+			    "ignoring scan cache\n");
+		free(buf);
+		return;
+	}
+	line = end + 1;
+
+	while (line < buf_end) {
+		if (strncmp(line, "LOCATION=", 9) != 0 ||
+		    (eol = next_line(line, buf_end)) == NULL)
+			goto invalid;
+		e = xmalloc(sizeof(*e));
+		e->location = xstrndup(line + 9, eol - 1 - (line + 9));
+		e->len_files = 0;
+		allocated_files = 16;
+		e->files = xmalloc(allocated_files * sizeof(*e->files));
+		line = eol;
+
+		while (strncmp(line, "FILE=", 5) == 0) {
+			if ((eol = next_line(line, buf_end)) == NULL)
+				goto invalid;
+			hash = strtoull(line + 5, &end, 16);
+			if (*end != ' ' || end + 1 >= eol - 1)
+				goto invalid;
+			if (e->len_files == allocated_files) {
+				allocated_files *= 2;
+				e->files = xrealloc(e->files,
+				    allocated_files * sizeof(*e->files));
+			}
+			e->files[e->len_files].path =
+			    xstrndup(end + 1, eol - 1 - (end + 1));
+			e->files[e->len_files].hash = hash;
+			++e->len_files;
+			line = eol;
+		}
+
+		if (strncmp(line, "DATA=", 5) != 0)
+			goto invalid;
+		e->data_len = strtoul(line + 5, &end, 10);
+		if (*end != '\n' || (size_t)(buf_end - (end + 1)) < e->data_len)
+			goto invalid;
+		e->data = end + 1;
+		e->superseded = 0;
+		line = e->data + e->data_len;
+
+		SLIST_INSERT_HEAD(
+		    &cache_hash_table[djb_hash(e->location) % CACHE_HASH_SIZE],
+		    e, hash_link);
+		e = NULL;
+	}
+	/* The entries point into buf, so it is not freed. */
+	return;
+
+invalid:
+	warnx("Invalid scan cache %s, rebuilding it", path);
+	if (e != NULL)
+		free_entry(e);
+	free_cache_entries();
+	free(buf);
+}
+
+static struct cache_entry *
+find_entry(const char *location)
+{
+	struct cache_entry *e;
+
+	SLIST_FOREACH(e,
+	    &cache_hash_table[djb_hash(location) % CACHE_HASH_SIZE],
+	    hash_link) {
+		if (strcmp(e->location, location) == 0)
+			return e;
+	}
+	return NULL;
+}
+
+char *
+find_scan_cache(const char *location)
+{
+	struct cache_entry *e;
+	struct file_hash *f;
+	size_t i;
+
+	if (!cache_enabled)
+		return NULL;
+
+	if ((e = find_entry(location)) == NULL) {
+		++cache_misses;
+		return NULL;
+	}
+	/* The location is rescanned if the entry is out of date. */
+	e->superseded = 1;
+	for (i = 0; i < e->len_files; ++i) {
+		f = hash_path(e->files[i].path);
+		if (!f->exists || f->hash != e->files[i].hash) {
+			++cache_misses;
+			return NULL;
+		}
+	}
+	++cache_hits;
+	return xstrndup(e->data, e->data_len);
+}
+
+/*
+ * Hash the files in the SCAN_DEPENDS lines of the job's output.
+ * Returns -1 if the output has no SCAN_DEPENDS, a file is missing or
+ * a file was modified after the scan started, in which case the entry
+ * can't be validated later.
+ */
+static int
+hash_scan_depends(struct cache_entry *e, const struct scan_job *job)
+{
+	struct file_hash *f;
+	const char *line;
+	char *deps, *deps_iter, *dep, *path;
+	size_t allocated_files;
+	int found;
+
+	++file_mark;
+	found = 0;
+	allocated_files = 16;
+	e->files = xmalloc(allocated_files * sizeof(*e->files));
+	e->len_files = 0;
+	for (line = job->scan_output; *line != '\0'; ) {
+		if (strncmp(line, "SCAN_DEPENDS=", 13) == 0) {
+			found = 1;
+			deps_iter = deps = xstrndup(line + 13,
+			    strcspn(line + 13, "\n"));
+			while ((dep = strtok(deps_iter, " ")) != NULL) {
+				deps_iter = NULL;
+				path = scan_depend_path(job->pkg_location, dep);
+				f = hash_path(path);
+				free(path);
+				if (!f->exists || (job->scan_start != 0 &&
+				    f->mtime >= job->scan_start)) {
+					free(deps);
+					return -1;
+				}
+				if (f->mark == file_mark)
+					continue;
+				f->mark = file_mark;
+				if (e->len_files == allocated_files) {
+					allocated_files *= 2;
+					e->files = xrealloc(e->files,
+					    allocated_files * sizeof(*e->files));
+				}
+				e->files[e->len_files].path = f->path;
+				e->files[e->len_files].hash = f->hash;
+				++e->len_files;
+			}
+			free(deps);
+		}
+		line += strcspn(line, "\n");
+		if (*line == '\n')
+			++line;
+	}
+	return found ? 0 : -1;
+}
+
+/*
+ * Remember a finished job for write_scan_cache. The files are hashed
+ * now, so that changes made later in the run don't end up in the
+ * cache together with the older output.
+ */
+void
+add_scan_cache(struct scan_job *job)
+{
+	struct cache_entry *e;
+
+	if (!cache_enabled)
+		return;
+	if ((e = find_entry(job->pkg_location)) != NULL)
+		e->superseded = 1;
+	if (job->scan_output == NULL)
+		return;
+	if (len_cached_jobs == allocated_cached_jobs) {
+		allocated_cached_jobs = allocated_cached_jobs ?
+		    allocated_cached_jobs * 2 : 1024;
+		cached_jobs = xrealloc(cached_jobs,
+		    allocated_cached_jobs * sizeof(*cached_jobs));
+	}
+	e = &cached_jobs[len_cached_jobs];
+	if (hash_scan_depends(e, job) == -1) {
+		free(e->files);
+		return;
+	}
+	e->location = job->pkg_location;
+	e->data = job->scan_output;
+	e->data_len = strlen(job->scan_output);
+	++len_cached_jobs;
+}
+
+static void
+write_entry(FILE *fp, const struct cache_entry *e)
+{
+	size_t i;
+
+	fprintf(fp, "LOCATION=%s\n", e->location);
+	for (i = 0; i < e->len_files; ++i)
+		fprintf(fp, "FILE=%016llx %s\n",
+		    (unsigned long long)e->files[i].hash, e->files[i].path);
+	fprintf(fp, "DATA=%lu\n%.*s", (unsigned long)e->data_len,
+	    (int)e->data_len, e->data);
+}
+
+static void
+write_old_entries(FILE *fp)
+{
+	struct cache_entry *e;
+	struct stat sb;
+	char *path;
+	size_t i;
+	int exists;
+
+	for (i = 0; i < CACHE_HASH_SIZE; ++i) {
+		SLIST_FOREACH(e, &cache_hash_table[i], hash_link) {
+			if (e->superseded)
+				continue;
+			path = xasprintf("%s/%s", pkgsrc_tree, e->location);
+			exists = stat(path, &sb) == 0;
+			free(path);
+			if (!exists)
+				continue;
+			write_entry(fp, e);
+		}
+	}
+}
+
+void
+write_scan_cache(const char *path)
+{
+	FILE *fp;
+	char *tmp_path;
+	size_t i;
+
+	if (!cache_enabled)
+		return;
+
+	if (verbosity >= 1)
+		printf("Scan cache: %lu hits, %lu misses\n", cache_hits,
+		    cache_misses);
+
+	tmp_path = xasprintf("%s.tmp", path);
+	if ((fp = fopen(tmp_path, "w")) == NULL)
+		err(1, "Cannot create scan cache");
+	fprintf(fp, "PBULK_SCAN_CACHE=%d %016llx\n", CACHE_VERSION,
+	    (unsigned long long)env_hash);
+	for (i = 0; i < len_cached_jobs; ++i)
+		write_entry(fp, &cached_jobs[i]);
+	write_old_entries(fp);
+	if (ferror(fp) || fclose(fp) == EOF)
+		err(1, "Cannot write scan cache");
+	if (rename(tmp_path, path) == -1)
+		err(1, "Cannot rename scan cache");
+	free(tmp_path);
+}
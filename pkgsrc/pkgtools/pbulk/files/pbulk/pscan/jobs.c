@@ -39,6 +39,7 @@
 #include <nbcompat/stdio.h>
 #include <nbcompat/stdlib.h>
 #include <nbcompat/string.h>
+#include <nbcompat/time.h>
 #include <nbcompat/unistd.h>
 
 #include "pbulk.h"
@@ -203,6 +204,26 @@ read_old_scan(const char *path)
 		    entry_start, line);
 }
 
+/*
+ * Resolve an entry of SCAN_DEPENDS of the given location
+ * to a path name.
+ */
+char *
+scan_depend_path(const char *location, const char *path)
+{
+	const char *s1, *s2;
+
+	if (*path == '/')
+		return xstrdup(path);
+	if (strncmp("../../", path, 6) == 0) {
+		s1 = strrchr(location, '/');
+		s2 = strchr(location, '/');
+		if (s1 == s2)
+			return xasprintf("%s/%s", pkgsrc_tree, path + 6);
+	}
+	return xasprintf("%s/%s/%s", pkgsrc_tree, location, path);
+}
+
 static struct scan_entry *
 find_old_scan(const char *location)
 {
@@ -229,28 +250,9 @@ find_old_scan(const char *location)
 		dep = NULL;
 		if (*path == '\0')
 			continue;
-		if (*path == '/') {
-			mtime = stat_path(path);
-			if (mtime == -1 || mtime >= scan_mtime) {
-				is_current = 0;
-				break;
-			}
-			continue;
-		}
-		if (strncmp("../../", path, 6) == 0) {
-			const char *s1 = strrchr(location, '/');
-			const char *s2 = strchr(location, '/');
-			if (s1 == s2)
-				fullpath = xasprintf("%s/%s", pkgsrc_tree,
-				    path + 6);
-			else
-				fullpath = xasprintf("%s/%s/%s", pkgsrc_tree,
-				    location, path);
-		} else {
-			fullpath = xasprintf("%s/%s/%s", pkgsrc_tree,
-			    location, path);
-		}
+		fullpath = scan_depend_path(location, path);
 		mtime = stat_path(fullpath);
+		free(fullpath);
 		if (mtime == -1 || mtime >= scan_mtime) {
 			is_current = 0;
 			break;
@@ -293,6 +295,7 @@ add_job_full(const char *location)
 	jobs[len_jobs].pkg_location = xstrdup(location);
 	jobs[len_jobs].scan_output = NULL;
 	jobs[len_jobs].state = JOB_OPEN;
+	jobs[len_jobs].scan_start = 0;
 	++len_jobs;
 }
 
@@ -308,11 +311,15 @@ get_job(void)
 		if (job->state != JOB_OPEN)
 			continue;
 		e = find_old_scan(job->pkg_location);
-		if (e == NULL) {
+		if (e != NULL)
+			job->scan_output = xstrdup(e->data);
+		else
+			job->scan_output = find_scan_cache(job->pkg_location);
+		if (job->scan_output == NULL) {
 			job->state = JOB_IN_PROCESSING;
+			job->scan_start = time(NULL);
 			return job;
 		}
-		job->scan_output = xstrdup(e->data);
 		process_job(job, JOB_DONE);
 		i = first_undone_job - 1;
 	}
@@ -331,6 +338,7 @@ process_job(struct scan_job *job, enum job_state state)
 	}
 
 	if (state == JOB_DONE) {
+		add_scan_cache(job);
 		++done_jobs;
 		if (verbosity >= 1) {
 			if (done_jobs % 50)
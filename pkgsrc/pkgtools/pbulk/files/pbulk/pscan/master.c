@@ -154,8 +154,13 @@ shutdown_master(void)
 	struct timeval tv;
 	struct scan_peer *peer;
 
+	/* Called again for each peer asking for more work. */
+	if (listen_event_socket == -1)
+		return;
+
 	event_del(&listen_event);
 	(void)close(listen_event_socket);
+	listen_event_socket = -1;
 	LIST_FOREACH(peer, &inactive_peers, peer_link)
 		(void)shutdown(peer->fd, SHUT_RDWR);
 	tv.tv_sec = 1;
@@ -209,6 +214,7 @@ listen_handler(int sock, void *arg)
 		warn("Could not set non-blocking IO");
 		return;
 	}
+	(void)set_nodelay(fd);
 
 	peer = xmalloc(sizeof(*peer));
 	peer->fd = fd;
@@ -282,5 +288,6 @@ master_mode(const char *master_port, const char *start_script)
 
 	event_dispatch();
 
-	(void)close(fd);
+	if (listen_event_socket != -1)
+		(void)close(listen_event_socket);
 }
@@ -53,6 +53,7 @@
 int verbosity;
 
 static const char *bmake_path;
+static int use_scan_server;
 static const char *output_file;
 const char *pkgsrc_tree;
 
@@ -63,9 +64,9 @@ static void	standalone_mode(void);
 static void
 usage(void)
 {
-	(void)fprintf(stderr, "usage: pbulk-scan -c <master> [ -v ] -M <make> <pkgsrc tree>\n");
-	(void)fprintf(stderr, "usage: pbulk-scan [ -I <start> ] [ -L <old scan> ] [ -l ] [ -v ]\n"
-			      "                  [ -m <port> ] -M <make> <pksgrc tree> <output file>\n");
+	(void)fprintf(stderr, "usage: pbulk-scan -c <master> [ -S ] [ -v ] -M <make> <pkgsrc tree>\n");
+	(void)fprintf(stderr, "usage: pbulk-scan [ -I <start> ] [ -L <old scan> ] [ -C <cache> ]\n"
+			      "                  [ -l ] [ -S ] [ -v ] [ -m <port> ] -M <make> <pksgrc tree> <output file>\n");
 	exit(1);
 }
 
@@ -73,7 +74,7 @@ int
 main(int argc, char **argv)
 {
 	const char *client_port = NULL, *last_scan = NULL, *master_port = NULL;
-	const char *start_script = NULL;
+	const char *start_script = NULL, *scan_cache = NULL;
 	int ch, limited_scan;
 	struct sigaction sa;
 
@@ -81,8 +82,11 @@ main(int argc, char **argv)
 
 	limited_scan = 0;
 
-	while ((ch = getopt(argc, argv, "I:M:L:lc:m:v")) != -1) {
+	while ((ch = getopt(argc, argv, "C:I:M:L:Slc:m:v")) != -1) {
 		switch (ch) {
+		case 'C':
+			scan_cache = optarg;
+			break;
 		case 'I':
 			start_script = optarg;
 			break;
@@ -101,6 +105,9 @@ main(int argc, char **argv)
 		case 'M':
 			bmake_path = optarg;
 			break;
+		case 'S':
+			use_scan_server = 1;
+			break;
 		case 'v':
 			++verbosity;
 			break;
@@ -145,6 +152,9 @@ main(int argc, char **argv)
 	pkgsrc_tree = argv[0];
 	output_file = argv[1];
 
+	if (scan_cache != NULL)
+		read_scan_cache(scan_cache, bmake_path);
+
 	if (limited_scan == 0)
 		find_full_tree();
 	else
@@ -156,6 +166,8 @@ main(int argc, char **argv)
 		standalone_mode();
 
 	write_jobs(output_file);
+	if (scan_cache != NULL)
+		write_scan_cache(scan_cache);
 
 	return 0;
 }
@@ -171,6 +183,11 @@ scan_pkglocation(const char *pkg_location)
 	char *path, *buf;
 
 	path = xasprintf("%s/%s", pkgsrc_tree, pkg_location);
+	if (use_scan_server && scan_server(bmake_path, path, &buf) == 0) {
+		free(path);
+		return buf;
+	}
+	use_scan_server = 0;
 	buf = read_from_child(path, bmake_path, extract_pbulk_index);
 	free(path);
 
@@ -45,6 +45,7 @@ struct scan_job {
 	char *pkg_location;
 	char *scan_output;
 	enum job_state state;
+	time_t scan_start;	/* when last handed out, 0 if never */
 };
 
 extern int	 verbosity;
@@ -62,3 +63,11 @@ void		 process_job(struct scan_job *, enum job_state);
 void		 write_jobs(const char *);
 
 void		read_old_scan(const char *);
+char		*scan_depend_path(const char *, const char *);
+
+void		 read_scan_cache(const char *, const char *);
+char		*find_scan_cache(const char *);
+void		 add_scan_cache(struct scan_job *);
+void		 write_scan_cache(const char *);
+
+int		 scan_server(const char *, const char *, char **);
@@ -0,0 +1,163 @@
+/* $NetBSD$ */
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Client side of the bmake scan server (bmake -Q). The server reads
+ * its startup files once and forks a child for every directory written
+ * to its stdin. The output of the child is terminated by a NUL byte,
+ * the exit status and a newline.
+ */
+
+#include <nbcompat.h>
+
+#include <sys/wait.h>
+#include <nbcompat/err.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <nbcompat/stdio.h>
+#include <nbcompat/stdlib.h>
+#include <nbcompat/string.h>
+#include <nbcompat/unistd.h>
+
+#include "pbulk.h"
+#include "pscan.h"
+
+static pid_t server_pid = -1;
+static int server_in = -1, server_out = -1;
+
+static void
+start_server(const char *bmake_path)
+{
+	const char * const argv[] = {
+		bmake_path,
+		"-Q",
+		"pbulk-index",
+		NULL
+	};
+	int to_server[2], from_server[2];
+
+	if (pipe(to_server) == -1 || pipe(from_server) == -1)
+		err(1, "Cannot create pipe for scan server");
+
+	if ((server_pid = vfork()) == 0) {
+		if (chdir(pkgsrc_tree) == -1 ||
+		    dup2(to_server[0], STDIN_FILENO) == -1 ||
+		    dup2(from_server[1], STDOUT_FILENO) == -1)
+			_exit(1);
+		(void)close(to_server[0]);
+		(void)close(to_server[1]);
+		(void)close(from_server[0]);
+		(void)close(from_server[1]);
+		(void)execvp(bmake_path, (char * const *)(uintptr_t)argv);
+		_exit(1);
+	}
+	if (server_pid == -1)
+		err(1, "Cannot fork scan server");
+
+	(void)close(to_server[0]);
+	(void)close(from_server[1]);
+	server_in = to_server[1];
+	server_out = from_server[0];
+	(void)fcntl(server_in, F_SETFD, FD_CLOEXEC);
+	(void)fcntl(server_out, F_SETFD, FD_CLOEXEC);
+}
+
+static void
+stop_server(void)
+{
+	int status;
+
+	(void)close(server_in);
+	(void)close(server_out);
+	(void)kill(server_pid, SIGTERM);
+	(void)waitpid(server_pid, &status, 0);
+	server_in = server_out = -1;
+}
+
+/*
+ * Run pbulk-index in path by the scan server. Returns -1 if the server
+ * doesn't work, 0 otherwise. *output is NULL if the scan failed.
+ */
+int
+scan_server(const char *bmake_path, const char *path, char **output)
+{
+	char *buf, *request, *nul, *eol;
+	size_t buf_len, cur_len, request_len;
+	ssize_t bytes_read;
+
+	if (server_pid == -1)
+		start_server(bmake_path);
+	else if (server_in == -1)
+		return -1;
+
+	request = xasprintf("%s\n", path);
+	request_len = strlen(request);
+	if (atomic_write(server_in, request, request_len) !=
+	    (ssize_t)request_len) {
+		free(request);
+		goto failed;
+	}
+	free(request);
+
+	cur_len = 0;
+	buf_len = 4096;
+	buf = xmalloc(buf_len + 1);
+	for (;;) {
+		bytes_read = read(server_out, buf + cur_len, buf_len - cur_len);
+		if (bytes_read <= 0) {
+			free(buf);
+			goto failed;
+		}
+		cur_len += bytes_read;
+		buf[cur_len] = '\0';
+		if ((nul = memchr(buf, '\0', cur_len)) != NULL &&
+		    (eol = strchr(nul + 1, '\n')) != NULL)
+			break;
+		if (cur_len * 2 < buf_len)
+			continue;
+		buf_len *= 2;
+		buf = xrealloc(buf, buf_len + 1);
+	}
+
+	if (eol + 1 != buf + cur_len)
+		errx(1, "Unexpected output from scan server");
+	if (atoi(nul + 1) != 0) {
+		free(buf);
+		*output = NULL;
+	} else
+		*output = buf;
+	return 0;
+
+failed:
+	warnx("Scan server failed, falling back to one make per package");
+	stop_server();
+	return -1;
+}
@@ -56,6 +56,7 @@ __RCSID("$NetBSD: perform.c,v 1.103 2013/01/31 10:25:30 wiz Exp $");
 
 #include <archive.h>
 #include <archive_entry.h>
+#include <fetch.h>
 
 #include "lib.h"
 #include "add.h"
@@ -101,6 +102,9 @@ struct pkg_task {
 
 	size_t dep_length, dep_allocated;
 	char **dependencies;
+
+	size_t files_length;
+	char **files;		/* full paths of the files, sorted */
 };
 
 static const struct pkg_meta_desc {
@@ -682,7 +686,8 @@ copy_data_to_disk(struct archive *reader, struct archive *writer,
 
 static const int extract_flags = ARCHIVE_EXTRACT_OWNER |
     ARCHIVE_EXTRACT_PERM | ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_UNLINK |
-    ARCHIVE_EXTRACT_ACL | ARCHIVE_EXTRACT_FFLAGS | ARCHIVE_EXTRACT_XATTR;
+    ARCHIVE_EXTRACT_ACL | ARCHIVE_EXTRACT_FFLAGS | ARCHIVE_EXTRACT_XATTR |
+    ARCHIVE_EXTRACT_CACHE_DIRS;
 
 static int
 extract_files(struct pkg_task *pkg)
@@ -694,6 +699,7 @@ extract_files(struct pkg_task *pkg)
 	plist_t *p;
 	const char *last_file;
 	char *fullpath;
+	size_t i;
 
 	if (Fake)
 		return 0;
@@ -738,9 +744,6 @@ extract_files(struct pkg_task *pkg)
 				    p->name, archive_entry_pathname(pkg->entry));
 				goto out;
 			}
-			fullpath = xasprintf("%s/%s", pkg->prefix, p->name);
-			pkgdb_store(fullpath, pkg->pkgname);
-			free(fullpath);
 			if (Verbose)
 				printf("%s", p->name);
 			break;
@@ -758,6 +761,8 @@ extract_files(struct pkg_task *pkg)
 			printf("Executing '%s'\n", cmd);
 			if (!Fake && system(cmd))
 				warnx("command '%s' failed", cmd); /* XXX bail out? */
+			/* Forget the directories, the command may have changed them. */
+			archive_write_disk_set_options(writer, extract_flags);
 			continue;
 
 		case PLIST_CHMOD:
@@ -827,6 +832,15 @@ extract_files(struct pkg_task *pkg)
 		goto out;
 	}
 
+	/*
+	 * Register the files in key order after extraction, so that
+	 * every btree page is touched once and written by pkgdb_close.
+	 */
+	if (!NoRecord) {
+		for (i = 0; i < pkg->files_length; ++i)
+			pkgdb_store(pkg->files[i], pkg->pkgname);
+	}
+
 	r = 0;
 
 out:
@@ -1062,12 +1076,51 @@ check_explicit_conflict(struct pkg_task *pkg)
 }
 
 static int
-check_implicit_conflict(struct pkg_task *pkg)
+cmp_path(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ * Collect the full paths of all files in the PLIST, sorted like the
+ * keys of pkgdb.
+ */
+static void
+collect_files(struct pkg_task *pkg)
 {
 	plist_t *p;
-	char *fullpath, *existing;
+	size_t allocated;
+
+	allocated = 0;
+	for (p = pkg->plist.head; p != NULL; p = p->next) {
+		if (p->type == PLIST_IGNORE) {
+			p = p->next;
+			continue;
+		} else if (p->type != PLIST_FILE)
+			continue;
+
+		if (pkg->files_length == allocated) {
+			allocated = allocated ? allocated * 2 : 256;
+			pkg->files = xrealloc(pkg->files,
+			    allocated * sizeof(*pkg->files));
+		}
+		pkg->files[pkg->files_length++] =
+		    xasprintf("%s/%s", pkg->prefix, p->name);
+	}
+	if (pkg->files_length > 0)
+		qsort(pkg->files, pkg->files_length, sizeof(*pkg->files),
+		    cmp_path);
+}
+
+static int
+check_implicit_conflict(struct pkg_task *pkg)
+{
+	char *existing;
+	size_t i;
 	int status;
 
+	collect_files(pkg);
+
 	if (!pkgdb_open(ReadOnly)) {
 #if notyet /* XXX empty pkgdb without database? */
 		warn("Can't open pkgdb for reading");
@@ -1079,23 +1132,16 @@ check_implicit_conflict(struct pkg_task *pkg)
 
 	status = 0;
 
-	for (p = pkg->plist.head; p != NULL; p = p->next) {
-		if (p->type == PLIST_IGNORE) {
-			p = p->next;
-			continue;
-		} else if (p->type != PLIST_FILE)
-			continue;
-
-		fullpath = xasprintf("%s/%s", pkg->prefix, p->name);
-		existing = pkgdb_retrieve(fullpath);
-		free(fullpath);
+	for (i = 0; i < pkg->files_length; ++i) {
+		existing = pkgdb_retrieve(pkg->files[i]);
 		if (existing == NULL)
 			continue;
 		if (pkg->other_version != NULL &&
 		    strcmp(pkg->other_version, existing) == 0)
 			continue;
 
-		warnx("Conflicting PLIST with %s: %s", existing, p->name);
+		warnx("Conflicting PLIST with %s: %s", existing,
+		    pkg->files[i] + strlen(pkg->prefix) + 1);
 		if (!Force) {
 			status = -1;
 			if (!Verbose)
@@ -1107,6 +1153,134 @@ check_implicit_conflict(struct pkg_task *pkg)
 	return status;
 }
 
+/*
+ * Add the dependencies of plist that are not installed to the list.
+ */
+static void
+add_missing_dependencies(package_t *plist, char ***deps, size_t *ndeps,
+    size_t *allocated)
+{
+	plist_t *p;
+	char *best_installed;
+	size_t i;
+
+	for (p = plist->head; p != NULL; p = p->next) {
+		if (p->type == PLIST_IGNORE) {
+			p = p->next;
+			continue;
+		} else if (p->type != PLIST_PKGDEP)
+			continue;
+
+		if ((best_installed = find_best_matching_installed_pkg(p->name))
+		    != NULL) {
+			free(best_installed);
+			continue;
+		}
+		for (i = 0; i < *ndeps; ++i) {
+			if (strcmp((*deps)[i], p->name) == 0)
+				break;
+		}
+		if (i < *ndeps)
+			continue;
+		if (*ndeps == *allocated) {
+			*allocated = 2 * *allocated + 8;
+			*deps = xrealloc(*deps, *allocated * sizeof(**deps));
+		}
+		(*deps)[(*ndeps)++] = xstrdup(p->name);
+	}
+}
+
+/*
+ * With PKG_CACHE_DIR set, find all packages check_dependencies()
+ * will have to install by reading only their meta data, then fetch
+ * them into the cache in one go.  Any failure here just means that
+ * the package is fetched again when it is installed.
+ */
+static void
+prefetch_dependencies(struct pkg_task *pkg)
+{
+	struct pkg_task *dep;
+	struct url **urls, *url;
+	char **deps, **names, *archive_name, *name;
+	size_t i, j, ndeps, nurls, allocated;
+
+	if (config_pkg_cache_dir == NULL || *config_pkg_cache_dir == '\0' ||
+	    Fake || NoRecord)
+		return;
+
+	deps = NULL;
+	ndeps = allocated = 0;
+	add_missing_dependencies(&pkg->plist, &deps, &ndeps, &allocated);
+	if (ndeps == 0)
+		return;
+
+	urls = NULL;
+	names = NULL;
+	nurls = 0;
+	for (i = 0; i < ndeps; ++i) {
+		if ((url = find_best_dependency(deps[i])) == NULL)
+			continue;
+		name = fetchStringifyURL(url);
+		for (j = 0; j < nurls; ++j) {
+			if (strcmp(names[j], name) == 0)
+				break;
+		}
+		if (j < nurls) {
+			free(name);
+			fetchFreeURL(url);
+			continue;
+		}
+		urls = xrealloc(urls, (nurls + 1) * sizeof(*urls));
+		names = xrealloc(names, (nurls + 1) * sizeof(*names));
+		urls[nurls] = url;
+		names[nurls++] = name;
+
+		/* Look for dependencies of the dependency. */
+		dep = xcalloc(1, sizeof(*dep));
+		dep->archive = open_archive_meta(name, &archive_name);
+		if (dep->archive != NULL) {
+			pkg_verify_signature(archive_name, &dep->archive,
+			    &dep->entry, &dep->pkgname);
+			free(archive_name);
+		}
+		if (dep->archive != NULL && read_meta_data(dep) == 0) {
+			parse_plist(&dep->plist, dep->meta_data.meta_contents);
+			add_missing_dependencies(&dep->plist, &deps, &ndeps,
+			    &allocated);
+			free_plist(&dep->plist);
+		}
+		free_meta_data(dep);
+		if (dep->archive != NULL)
+			archive_read_finish(dep->archive);
+		free(dep->pkgname);
+		free(dep);
+	}
+
+	/* Local packages don't need a copy. */
+	for (i = j = 0; i < nurls; ++i) {
+		free(names[i]);
+		if (strcmp(urls[i]->scheme, SCHEME_FILE) == 0)
+			fetchFreeURL(urls[i]);
+		else
+			urls[j++] = urls[i];
+	}
+	free(names);
+	nurls = j;
+
+	if (Verbose && nurls > 0)
+		printf("Prefetching %lu package%s into %s\n",
+		    (unsigned long)nurls, nurls == 1 ? "" : "s",
+		    config_pkg_cache_dir);
+	prefetch_packages(urls, nurls);
+
+	for (i = 0; i < nurls; ++i)
+		fetchFreeURL(urls[i]);
+	free(urls);
+	for (i = 0; i < ndeps; ++i)
+		free(deps[i]);
+	free(deps);
+}
+
 static int
 check_dependencies(struct pkg_task *pkg)
 {
@@ -1393,6 +1567,7 @@ pkg_do(const char *pkgpath, int mark_automatic, int top_level)
 	char *archive_name;
 	int status, invalid_sig;
 	struct pkg_task *pkg;
+	size_t i;
 
 	pkg = xcalloc(1, sizeof(*pkg));
 
@@ -1486,6 +1661,9 @@ pkg_do(const char *pkgpath, int mark_automatic, int top_level)
 	if (check_implicit_conflict(pkg))
 		goto clean_memory;
 
+	if (top_level)
+		prefetch_dependencies(pkg);
+
 	if (pkg->other_version != NULL) {
 		/*
 		 * Replacing an existing package.
@@ -1536,6 +1714,9 @@ pkg_do(const char *pkgpath, int mark_automatic, int top_level)
 
 	pkg_register_depends(pkg);
 
+	if (!NoRecord && !Fake)
+		conflicts_index_add(pkg->pkgname);
+
 	if (Verbose)
 		printf("Package %s registered in %s\n", pkg->pkgname, pkg->install_logdir);
 
@@ -1574,6 +1755,9 @@ clean_memory:
 		if (recursive_remove(pkg->install_logdir, 1))
 			warn("Couldn't remove %s", pkg->install_logdir);
 	}
+	for (i = 0; i < pkg->files_length; ++i)
+		free(pkg->files[i]);
+	free(pkg->files);
 	free(pkg->install_prefix);
 	free(pkg->install_logdir_real);
 	free(pkg->install_logdir);
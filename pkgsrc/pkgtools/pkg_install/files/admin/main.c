@@ -80,8 +80,6 @@ __RCSID("$NetBSD: main.c,v 1.61 2010/04/20 00:39:13 joerg Exp $");
 #include "admin.h"
 #include "lib.h"
 
-#define DEFAULT_SFX	".t[bg]z"	/* default suffix for ls{all,best} */
-
 struct pkgdb_count {
 	size_t files;
 	size_t directories;
@@ -239,6 +237,15 @@ rebuild(void)
 	count.directories = 0;
 	count.packages = 0;
 
+	/* Also migrates databases without the package to files index. */
+	cachename = pkgdb_get_index_database();
+	if (unlink(cachename) != 0 && errno != ENOENT)
+		err(EXIT_FAILURE, "unlink %s", cachename);
+	free(cachename);
+
+	/* Refilled from the +CONTENTS files by the next conflict check. */
+	conflicts_index_clear();
+
 	cachename = pkgdb_get_database();
 	if (unlink(cachename) != 0 && errno != ENOENT)
 		err(EXIT_FAILURE, "unlink %s", cachename);
@@ -352,7 +359,7 @@ rebuild_tree(void)
 int 
 main(int argc, char *argv[])
 {
-	Boolean		 use_default_sfx = TRUE;
+	Boolean		 use_default_sfx = TRUE;	/* see pkg_suffix_len() */
 	Boolean 	 show_basename_only = FALSE;
 	char		 lsdir[MaxPathSize];
 	char		 sfx[MaxPathSize];
@@ -424,9 +431,6 @@ main(int argc, char *argv[])
 	if (strcasecmp(argv[0], "config-var") != 0)
 		pkg_install_config();
 
-	if (use_default_sfx)
-		(void) strlcpy(sfx, DEFAULT_SFX, sizeof(sfx));
-
 	if (strcasecmp(argv[0], "pmatch") == 0) {
 
 		char *pattern, *pkg;
@@ -221,10 +221,59 @@ write_normal_file(const char *name, struct archive *archive,
 		write_entry(archive, sparse_entry);
 }
 
+/*
+ * Build the index for the start of gzip and zstd packages, see lib.h.
+ * Returns its length, or 0 if the compression type has no room for it.
+ */
+static size_t
+make_index(unsigned char *buf, int64_t meta_end, int64_t meta_tar_end)
+{
+	static const unsigned char gzip_header[] = {
+		0x1f, 0x8b, 8, 4 /* FEXTRA */, 0, 0, 0, 0, 0, 255,
+		PKG_INDEX_LEN + 4, 0, 'P', 'k', PKG_INDEX_LEN, 0
+	};
+	/* An empty final block, CRC and length of no data. */
+	static const unsigned char gzip_trailer[] = {
+		3, 0, 0, 0, 0, 0, 0, 0, 0, 0
+	};
+	unsigned char *p;
+	size_t len;
+	int i;
+
+	if (strcmp(CompressionType, "gzip") == 0) {
+		memcpy(buf, gzip_header, sizeof(gzip_header));
+		p = buf + sizeof(gzip_header);
+		memcpy(p + PKG_INDEX_LEN, gzip_trailer, sizeof(gzip_trailer));
+		len = sizeof(gzip_header) + PKG_INDEX_LEN +
+		    sizeof(gzip_trailer);
+	} else if (strcmp(CompressionType, "zstd") == 0) {
+		for (i = 0; i < 4; i++)
+			buf[i] = (PKG_INDEX_ZSTD_MAGIC >> (8 * i)) & 0xff;
+		buf[4] = PKG_INDEX_LEN;
+		buf[5] = buf[6] = buf[7] = 0;
+		p = buf + 8;
+		len = 8 + PKG_INDEX_LEN;
+	} else
+		return 0;
+
+	memcpy(p, PKG_INDEX_TAG, 8);
+	for (i = 0; i < 8; i++) {
+		p[8 + i] = (meta_end >> (8 * i)) & 0xff;
+		p[16 + i] = (meta_tar_end >> (8 * i)) & 0xff;
+	}
+	return len;
+}
+
 static void
 make_dist(const char *pkg, const char *suffix, const package_t *plist)
 {
 	char *archive_name;
+	unsigned char index[64];
+	char threads[32];
+	size_t index_len;
+	int64_t meta_end, meta_tar_end;
+	struct stat st;
+	int fd;
 	const char *owner, *group;
 	const plist_t *p;
 	struct archive *archive;
@@ -246,6 +295,9 @@ make_dist(const char *pkg, const char *suffix, const package_t *plist)
 		else if (strcmp(suffix, "tgz") == 0 ||
 		    strcmp(suffix, "tar.gz") == 0)
 			CompressionType = "gzip";
+		else if (strcmp(suffix, "tzst") == 0 ||
+		    strcmp(suffix, "tar.zst") == 0)
+			CompressionType = "zstd";
 		else
 			CompressionType = "none";
 	}
@@ -256,18 +308,38 @@ make_dist(const char *pkg, const char *suffix, const package_t *plist)
 		archive_write_set_compression_gzip(archive);
 	else if (strcmp(CompressionType, "xz") == 0)
 		archive_write_set_compression_xz(archive);
+	else if (strcmp(CompressionType, "zstd") == 0)
+		archive_write_set_compression_zstd(archive);
 	else if (strcmp(CompressionType, "none") == 0)
 		archive_write_set_compression_none(archive);
 	else
 		errx(1, "Unspported compression type for -F: %s",
 		    CompressionType);
 
+	/* 0 means all CPUs; ignored by compressors without threads. */
+	snprintf(threads, sizeof(threads), "compression-threads=%d",
+	    CompressionThreads);
+	(void)archive_write_set_compressor_options(archive, threads);
+
 	archive_name = xasprintf("%s.%s", pkg, suffix);
 
-	if (archive_write_open_file(archive, archive_name))
-		errx(2, "cannot create archive: %s", archive_error_string(archive));
+	if ((fd = open(archive_name, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1)
+		err(2, "cannot create archive %s", archive_name);
+
+	/*
+	 * The index is filled in after the rest has been written,
+	 * so only regular files get one.
+	 */
+	index_len = 0;
+	meta_end = meta_tar_end = 0;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+	    (index_len = make_index(index, 0, 0)) != 0) {
+		if (write(fd, index, index_len) != (ssize_t)index_len)
+			err(2, "cannot write archive %s", archive_name);
+	}
 
-	free(archive_name);
+	if (archive_write_open_fd(archive, fd))
+		errx(2, "cannot create archive: %s", archive_error_string(archive));
 
 	owner = DefaultOwner;
 	group = DefaultGroup;
@@ -295,6 +367,15 @@ make_dist(const char *pkg, const char *suffix, const package_t *plist)
 	if (create_views)
 		write_meta_file(views_file, archive);
 
+	/* Make the meta data decompressible without the rest. */
+	if (index_len != 0) {
+		if (archive_write_flush(archive) != ARCHIVE_OK)
+			errx(2, "cannot flush archive: %s",
+			    archive_error_string(archive));
+		meta_end = index_len + archive_position_compressed(archive);
+		meta_tar_end = archive_position_uncompressed(archive);
+	}
+
 	initial_cwd = getcwd(NULL, 0);
 
 	for (p = plist->head; p; p = p->next) {
@@ -331,6 +412,16 @@ make_dist(const char *pkg, const char *suffix, const package_t *plist)
 		errx(2, "cannot finish archive: %s", archive_error_string(archive));
 	archive_write_finish(archive);
 
+	if (index_len != 0) {
+		make_index(index, meta_end, meta_tar_end);
+		if (lseek(fd, 0, SEEK_SET) != 0 ||
+		    write(fd, index, index_len) != (ssize_t)index_len)
+			err(2, "cannot write archive %s", archive_name);
+	}
+	if (close(fd) == -1)
+		err(2, "cannot write archive %s", archive_name);
+
+	free(archive_name);
 	free(initial_cwd);
 }
 
@@ -55,6 +55,7 @@ extern char *realprefix;
 extern char *DefaultOwner;
 extern char *DefaultGroup;
 extern const char *CompressionType;
+extern int CompressionThreads;
 extern int PlistOnly;
 extern int RelativeLinks;
 extern int update_pkgdb;
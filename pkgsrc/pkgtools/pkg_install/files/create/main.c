@@ -26,7 +26,7 @@ __RCSID("$NetBSD: main.c,v 1.19 2010/01/22 13:30:41 joerg Exp $");
 #include "lib.h"
 #include "create.h"
 
-static const char Options[] = "B:C:D:EF:I:K:L:OP:S:T:UVb:c:d:f:g:i:k:ln:p:r:s:u:v";
+static const char Options[] = "B:C:D:EF:I:K:L:OP:S:T:UVb:c:d:f:g:i:j:k:ln:p:r:s:u:v";
 
 char   *Prefix = NULL;
 char   *Comment = NULL;
@@ -47,6 +47,7 @@ char   *DefaultOwner = NULL;
 char   *DefaultGroup = NULL;
 char   *realprefix = NULL;
 const char *CompressionType = NULL;
+int	CompressionThreads = 0;
 int	update_pkgdb = 1;
 int	create_views = 0;
 int     PlistOnly = 0;
@@ -59,7 +60,7 @@ usage(void)
 	fprintf(stderr,
 	    "usage: pkg_create [-ElOUVv] [-B build-info-file] [-b build-version-file]\n"
             "                  [-C cpkgs] [-D displayfile] [-F compression] \n"
-	    "                  [-I realprefix] [-i iscript]\n"
+	    "                  [-I realprefix] [-i iscript] [-j threads]\n"
             "                  [-K pkg_dbdir] [-k dscript]\n"
             "                  [-n preserve-file] [-P dpkgs] [-p prefix] [-r rscript]\n"
             "                  [-S size-all-file] [-s size-pkg-file]\n"
@@ -73,6 +74,7 @@ int
 main(int argc, char **argv)
 {
 	int     ch;
+	char   *p;
 
 	setprogname(argv[0]);
 	while ((ch = getopt(argc, argv, Options)) != -1)
@@ -133,6 +135,13 @@ main(int argc, char **argv)
 			Install = optarg;
 			break;
 
+		case 'j':
+			CompressionThreads = strtol(optarg, &p, 10);
+			if (*optarg == '\0' || *p != '\0' ||
+			    CompressionThreads < 0)
+				errx(1, "Invalid number of threads: %s", optarg);
+			break;
+
 		case 'K':
 			pkgdb_set_dir(optarg, 3);
 			break;
@@ -753,6 +753,7 @@ remove_pkg(const char *pkg)
 	pkgdir = pkgdb_pkg_dir(pkg);
 	(void) remove_files(pkgdir, "+*");
 	rv = 1;
+	conflicts_index_remove(pkg);
 	if (isemptydir(pkgdir)&& rmdir(pkgdir) == 0)
 		rv = 0;
 	else if (is_depoted_pkg)
@@ -348,7 +348,7 @@ pkg_do(const char *pkg)
 		struct archive_entry *entry;
 		char *archive_name, *pkgname;
 
-		archive = open_archive(pkg, &archive_name);
+		archive = open_archive_meta(pkg, &archive_name);
 		if (archive == NULL) {
 			warnx("can't find package `%s', skipped", pkg);
 			return -1;
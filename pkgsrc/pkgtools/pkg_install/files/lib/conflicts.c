@@ -30,12 +30,24 @@
  */
 
 /*
- * XXX: Reading the +CONTENTS files of all installed packages is
- * rather slow. Since this check is necessary to avoid conflicting
- * packages, it should not be removed.
+ * Reading the +CONTENTS files of all installed packages is rather
+ * slow. Since this check is necessary to avoid conflicting packages,
+ * the @pkgcfl lines of all packages are cached in pkgdb.conflicts.db.
+ * The index has three kinds of keys:
  *
- * TODO: Put all the information that is currently in the +CONTENTS
- * files into one large file or another database.
+ *	P<prefix>	<pattern>\0<pkgname>\0... for every @pkgcfl pattern
+ *			whose literal part up to the first wildcard or
+ *			version comparison is <prefix>
+ *	N<pkgname>	<pattern>\0... of that package
+ *	#installed	hash and number of the indexed packages
+ *
+ * A conflict check reads P<prefix> for every prefix of the new package
+ * name, so it doesn't depend on the number of installed packages.
+ * pkg_add and pkg_delete keep the index up to date. Packages added or
+ * removed by other tools change the set of package directories, which
+ * doesn't match #installed anymore; the index is rebuilt from the
+ * +CONTENTS files then. The +CONTENTS files stay the source of truth,
+ * the index can be removed any time.
  */
 
 #if HAVE_CONFIG_H
@@ -50,9 +62,17 @@
 
 __RCSID("$NetBSD: conflicts.c,v 1.10 2010/01/22 13:30:42 joerg Exp $");
 
+#ifdef NETBSD
+#include <db.h>
+#else
+#include <nbcompat/db.h>
+#endif
 #if HAVE_ERR_H
 #include <err.h>
 #endif
+#if HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
 
 #include "dewey.h"
 #include "lib.h"
@@ -72,6 +92,15 @@ struct package_conflict {
 	char **conflicting_pattern;
 };
 
+#define CONFLICTS_DB	"pkgdb.conflicts.db"
+#define INSTALLED_KEY	"#installed"
+
+/* Hash and number of the package directories, see installed_iter. */
+struct installed {
+	uint64_t hash;
+	unsigned long count;
+};
+
 static FILE *
 fopen_contents(const char *pkgname, const char *mode)
 {
@@ -89,6 +118,305 @@ fopen_contents(const char *pkgname, const char *mode)
 }
 
 
+static char *
+conflicts_db_name(void)
+{
+	return xasprintf("%s/%s", pkgdb_get_dir(), CONFLICTS_DB);
+}
+
+/*
+ * Open the conflicts index, read-write if possible and not in fake
+ * mode. Returns NULL if the index can't be used at all.
+ */
+static DB *
+open_conflicts_db(int *writable, int flags)
+{
+	char *fname;
+	DB *db;
+
+	fname = conflicts_db_name();
+	db = NULL;
+	if (!Fake)
+		db = dbopen(fname, O_RDWR | O_CREAT | flags, 0644, DB_BTREE,
+		    NULL);
+	*writable = db != NULL;
+	if (db == NULL)
+		db = dbopen(fname, O_RDONLY, 0644, DB_BTREE, NULL);
+	free(fname);
+	return db;
+}
+
+static uint64_t
+name_hash(const char *name)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (*name != '\0') {
+		h ^= (unsigned char)*name++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/*
+ * The set of installed packages is summarized by the number of package
+ * directories and the XOR of the hashes of their names, which can be
+ * updated for a single package.
+ */
+static int
+installed_iter(const char *pkgname, void *cookie)
+{
+	struct installed *inst = cookie;
+
+	inst->hash ^= name_hash(pkgname);
+	++inst->count;
+	return 0;
+}
+
+static int
+get_installed(DB *db, struct installed *inst)
+{
+	unsigned long long hash;
+	DBT key, data;
+
+	key.data = __UNCONST(INSTALLED_KEY);
+	key.size = sizeof(INSTALLED_KEY);
+	if ((*db->get)(db, &key, &data, 0) != 0 || data.size == 0 ||
+	    ((const char *)data.data)[data.size - 1] != '\0' ||
+	    sscanf(data.data, "%llx %lu", &hash, &inst->count) != 2)
+		return -1;
+	inst->hash = hash;
+	return 0;
+}
+
+static void
+put_installed(DB *db, const struct installed *inst)
+{
+	char buf[64];
+	DBT key, data;
+
+	(void)snprintf(buf, sizeof(buf), "%016llx %lu",
+	    (unsigned long long)inst->hash, inst->count);
+	key.data = __UNCONST(INSTALLED_KEY);
+	key.size = sizeof(INSTALLED_KEY);
+	data.data = buf;
+	data.size = strlen(buf) + 1;
+	(void)(*db->put)(db, &key, &data, 0);
+}
+
+/* Length of the literal part of pattern, which any match starts with. */
+static size_t
+pattern_prefix_len(const char *pattern)
+{
+	return strcspn(pattern, "*?[]{}<>=\\");
+}
+
+/* Fill in key for type followed by len bytes of name. */
+static void
+make_key(DBT *key, char type, const char *name, size_t len)
+{
+	char *buf;
+
+	buf = xmalloc(len + 1);
+	buf[0] = type;
+	memcpy(buf + 1, name, len);
+	key->data = buf;
+	key->size = len + 1;
+}
+
+/*
+ * Get the value of the key made of type and len bytes of name. Returns
+ * a copy the caller has to free, or NULL.
+ */
+static char *
+get_list(DB *db, char type, const char *name, size_t len, size_t *size)
+{
+	DBT key, data;
+	char *value;
+
+	make_key(&key, type, name, len);
+	value = NULL;
+	if ((*db->get)(db, &key, &data, 0) == 0) {
+		value = xmalloc(data.size + 1);
+		memcpy(value, data.data, data.size);
+		value[data.size] = '\0';
+		*size = data.size;
+	}
+	free(key.data);
+	return value;
+}
+
+static void
+put_list(DB *db, char type, const char *name, size_t len,
+    const char *value, size_t size)
+{
+	DBT key, data;
+
+	make_key(&key, type, name, len);
+	data.data = __UNCONST(value);
+	data.size = size;
+	(void)(*db->put)(db, &key, &data, 0);
+	free(key.data);
+}
+
+static void
+del_list(DB *db, char type, const char *name, size_t len)
+{
+	DBT key;
+
+	make_key(&key, type, name, len);
+	(void)(*db->del)(db, &key, 0);
+	free(key.data);
+}
+
+/*
+ * Add the @pkgcfl patterns of pkgname to the index. Returns 0 if the
+ * package was already indexed, 1 otherwise.
+ */
+static int
+index_package(DB *db, const char *pkgname)
+{
+	package_t pkg;
+	plist_t *p;
+	FILE *f;
+	char *names, *list;
+	size_t names_len, len, size, pkglen, plen;
+
+	if ((names = get_list(db, 'N', pkgname, strlen(pkgname),
+	    &names_len)) != NULL) {
+		free(names);
+		return 0;
+	}
+
+	f = fopen_contents(pkgname, "r");
+	read_plist(&pkg, f);
+	(void)fclose(f);
+
+	pkglen = strlen(pkgname) + 1;
+	names = NULL;
+	names_len = 0;
+	for (p = pkg.head; p; p = p->next) {
+		if (p->type != PLIST_PKGCFL)
+			continue;
+		plen = strlen(p->name) + 1;
+		names = xrealloc(names, names_len + plen);
+		memcpy(names + names_len, p->name, plen);
+		names_len += plen;
+
+		len = pattern_prefix_len(p->name);
+		if ((list = get_list(db, 'P', p->name, len, &size)) == NULL)
+			size = 0;
+		list = xrealloc(list, size + plen + pkglen);
+		memcpy(list + size, p->name, plen);
+		memcpy(list + size + plen, pkgname, pkglen);
+		put_list(db, 'P', p->name, len, list, size + plen + pkglen);
+		free(list);
+	}
+	free_plist(&pkg);
+
+	put_list(db, 'N', pkgname, pkglen - 1, names, names_len);
+	free(names);
+	return 1;
+}
+
+/*
+ * Remove the patterns of pkgname from the index. Returns 0 if the
+ * package wasn't indexed, 1 otherwise.
+ */
+static int
+unindex_package(DB *db, const char *pkgname)
+{
+	char *names, *pattern, *list, *iter, *next, *end;
+	size_t names_len, len, size;
+
+	if ((names = get_list(db, 'N', pkgname, strlen(pkgname),
+	    &names_len)) == NULL)
+		return 0;
+
+	for (pattern = names; pattern < names + names_len;
+	    pattern += strlen(pattern) + 1) {
+		len = pattern_prefix_len(pattern);
+		if ((list = get_list(db, 'P', pattern, len, &size)) == NULL)
+			continue;
+		/* Drop the pairs of pkgname, whatever the pattern. */
+		end = list + size;
+		for (iter = list; iter < end; ) {
+			next = iter + strlen(iter) + 1;
+			if (next >= end)
+				break;
+			if (strcmp(next, pkgname) == 0) {
+				next += strlen(next) + 1;
+				memmove(iter, next, end - next);
+				end -= next - iter;
+			} else
+				iter = next + strlen(next) + 1;
+		}
+		if (end == list)
+			del_list(db, 'P', pattern, len);
+		else
+			put_list(db, 'P', pattern, len, list, end - list);
+		free(list);
+	}
+	free(names);
+
+	del_list(db, 'N', pkgname, strlen(pkgname));
+	return 1;
+}
+
+static int
+index_package_iter(const char *pkgname, void *cookie)
+{
+	DB *db = cookie;
+
+	(void)index_package(db, pkgname);
+	return 0;
+}
+
+/*
+ * Return the index, rebuilt if it doesn't match the installed packages.
+ * Returns NULL if the index is out of date and can't be rebuilt.
+ */
+static DB *
+open_current_conflicts_db(void)
+{
+	struct installed inst, stored;
+	DB *db;
+	int writable;
+
+	inst.hash = 0;
+	inst.count = 0;
+	if (iterate_pkg_db(installed_iter, &inst) == -1) {
+		errx(EXIT_FAILURE, "Couldn't read list of installed packages.");
+		/* NOTREACHED */
+	}
+
+	if ((db = open_conflicts_db(&writable, 0)) == NULL)
+		return NULL;
+	if (get_installed(db, &stored) == 0 && stored.hash == inst.hash &&
+	    stored.count == inst.count)
+		return db;
+	(void)(*db->close)(db);
+	if (!writable)
+		return NULL;
+
+	if ((db = open_conflicts_db(&writable, O_TRUNC)) == NULL ||
+	    !writable) {
+		if (db != NULL)
+			(void)(*db->close)(db);
+		return NULL;
+	}
+	if (iterate_pkg_db(index_package_iter, db) == -1) {
+		errx(EXIT_FAILURE, "Couldn't read list of installed packages.");
+		/* NOTREACHED */
+	}
+	put_installed(db, &inst);
+	return db;
+}
+
+/*
+ * Check the @pkgcfl lines of pkgname directly, for when the index
+ * can't be used.
+ */
 static int
 check_package_conflict(const char *pkgname, void *v)
 {
@@ -124,6 +452,98 @@ check_package_conflict(const char *pkgname, void *v)
 	return rv;
 }
 
+/*
+ * Look up the patterns that could match conflict->pkgname in the index.
+ */
+static void
+check_index_conflict(DB *db, struct package_conflict *conflict)
+{
+	const char *pattern, *pkgname;
+	char *list;
+	size_t len, namelen, size;
+
+	namelen = strlen(conflict->pkgname);
+	for (len = 0; len <= namelen; ++len) {
+		if ((list = get_list(db, 'P', conflict->pkgname, len,
+		    &size)) == NULL)
+			continue;
+		for (pattern = list; pattern < list + size;
+		    pattern = pkgname + strlen(pkgname) + 1) {
+			pkgname = pattern + strlen(pattern) + 1;
+			if (pkgname >= list + size)
+				break;
+			if (conflict->skip_pkgname != NULL &&
+			    strcmp(conflict->skip_pkgname, pkgname) == 0)
+				continue;
+			if (pkg_match(pattern, conflict->pkgname) == 1) {
+				*(conflict->conflicting_pkgname) =
+				    xstrdup(pkgname);
+				*(conflict->conflicting_pattern) =
+				    xstrdup(pattern);
+				free(list);
+				return;
+			}
+		}
+		free(list);
+	}
+}
+
+/*
+ * Add the patterns of a newly registered package to the conflicts index.
+ */
+void
+conflicts_index_add(const char *pkgname)
+{
+	struct installed inst;
+	DB *db;
+	int writable;
+
+	if ((db = open_conflicts_db(&writable, 0)) == NULL)
+		return;
+	if (writable && index_package(db, pkgname) &&
+	    get_installed(db, &inst) == 0) {
+		inst.hash ^= name_hash(pkgname);
+		++inst.count;
+		put_installed(db, &inst);
+	}
+	(void)(*db->close)(db);
+}
+
+/*
+ * Drop the patterns of a removed package from the conflicts index.
+ */
+void
+conflicts_index_remove(const char *pkgname)
+{
+	struct installed inst;
+	DB *db;
+	int writable;
+
+	if ((db = open_conflicts_db(&writable, 0)) == NULL)
+		return;
+	if (writable && unindex_package(db, pkgname) &&
+	    get_installed(db, &inst) == 0) {
+		inst.hash ^= name_hash(pkgname);
+		--inst.count;
+		put_installed(db, &inst);
+	}
+	(void)(*db->close)(db);
+}
+
+/*
+ * Remove the conflicts index, it is recreated from the +CONTENTS files
+ * on demand.
+ */
+void
+conflicts_index_clear(void)
+{
+	char *fname;
+
+	fname = conflicts_db_name();
+	(void)unlink(fname);
+	free(fname);
+}
+
 /**
  * Checks if some installed package has a pkgcfl entry that matches
  * PkgName.  If such an entry is found, the package name is returned in
@@ -136,7 +556,7 @@ some_installed_package_conflicts_with(const char *pkgname,
     const char *skip_pkgname, char **inst_pkgname, char **inst_pattern)
 {
 	struct package_conflict cfl;
-	int rv;
+	DB *db;
 
 	cfl.pkgname = pkgname;
 	cfl.skip_pkgname = skip_pkgname;
@@ -144,8 +564,10 @@ some_installed_package_conflicts_with(const char *pkgname,
 	*inst_pattern = NULL;
 	cfl.conflicting_pkgname = inst_pkgname;
 	cfl.conflicting_pattern = inst_pattern;
-	rv = iterate_pkg_db(check_package_conflict, &cfl);
-	if (rv == -1) {
+	if ((db = open_current_conflicts_db()) != NULL) {
+		check_index_conflict(db, &cfl);
+		(void)(*db->close)(db);
+	} else if (iterate_pkg_db(check_package_conflict, &cfl) == -1) {
 		errx(EXIT_FAILURE, "Couldn't read list of installed packages.");
 		/* NOTREACHED */
 	}
@@ -72,6 +72,26 @@ struct pkg_dir_iter_arg {
 	int allow_nonfiles;
 };
 
+/*
+ * Returns the length of the binary package suffix of filename
+ * (.tgz, .tbz or .tzst), or 0 if there is none.
+ */
+size_t
+pkg_suffix_len(const char *filename)
+{
+	static const char * const suffixes[] = { ".tgz", ".tbz", ".tzst" };
+	size_t i, len, sfx_len;
+
+	len = strlen(filename);
+	for (i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+		sfx_len = strlen(suffixes[i]);
+		if (len > sfx_len &&
+		    memcmp(filename + len - sfx_len, suffixes[i], sfx_len) == 0)
+			return sfx_len;
+	}
+	return 0;
+}
+
 static const char *
 pkg_dir_iter(void *cookie)
 {
@@ -90,8 +110,7 @@ pkg_dir_iter(void *cookie)
 		if (len < 5)
 			continue;
 		if (arg->filter_suffix == 0 ||
-		    memcmp(dp->d_name + len - 4, ".tgz", 4) == 0 ||
-		    memcmp(dp->d_name + len - 4, ".tbz", 4) == 0)
+		    pkg_suffix_len(dp->d_name) != 0)
 			return dp->d_name;
 	}
 	return NULL;
@@ -132,6 +151,10 @@ pkg_db_iter(void *cookie)
 			continue;
 		if (strcmp(dp->d_name, "pkgdb.byfile.db") == 0)
 			continue;
+		if (strcmp(dp->d_name, "pkgdb.bypkg.db") == 0)
+			continue;
+		if (strcmp(dp->d_name, "pkgdb.conflicts.db") == 0)
+			continue;
 		if (strcmp(dp->d_name, ".cookie") == 0)
 			continue;
 		if (strcmp(dp->d_name, "pkg-vulnerabilities") == 0)
@@ -355,18 +378,16 @@ match_best_file(const char *filename, void *cookie)
 	char *filtered_filename;
 
 	if (arg->filter_suffix) {
-		size_t len;
+		size_t len, sfx_len;
 
-		len = strlen(filename);
-		if (len < 5 ||
-		    (memcmp(filename + len - 4, ".tgz", 4) != 0 &&
-		     memcmp(filename + len - 4, ".tbz", 4) != 0)) {
+		if ((sfx_len = pkg_suffix_len(filename)) == 0) {
 			warnx("filename %s does not contain a recognized suffix", filename);
 			return -1;
 		}
-		filtered_filename = xmalloc(len - 4 + 1);
-		memcpy(filtered_filename, filename, len - 4);
-		filtered_filename[len - 4] = '\0';
+		len = strlen(filename) - sfx_len;
+		filtered_filename = xmalloc(len + 1);
+		memcpy(filtered_filename, filename, len);
+		filtered_filename[len] = '\0';
 		active_filename = filtered_filename;
 	} else {
 		filtered_filename = NULL;
@@ -437,18 +458,16 @@ match_file_and_call(const char *filename, void *cookie)
 	int ret;
 
 	if (arg->filter_suffix) {
-		size_t len;
+		size_t len, sfx_len;
 
-		len = strlen(filename);
-		if (len < 5 ||
-		    (memcmp(filename + len - 4, ".tgz", 4) != 0 &&
-		     memcmp(filename + len - 4, ".tbz", 4) != 0)) {
+		if ((sfx_len = pkg_suffix_len(filename)) == 0) {
 			warnx("filename %s does not contain a recognized suffix", filename);
 			return -1;
 		}
-		filtered_filename = xmalloc(len - 4 + 1);
-		memcpy(filtered_filename, filename, len - 4);
-		filtered_filename[len - 4] = '\0';
+		len = strlen(filename) - sfx_len;
+		filtered_filename = xmalloc(len + 1);
+		memcpy(filtered_filename, filename, len);
+		filtered_filename[len] = '\0';
 		active_filename = filtered_filename;
 	} else {
 		filtered_filename = NULL;
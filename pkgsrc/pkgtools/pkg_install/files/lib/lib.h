@@ -253,6 +253,9 @@ struct pkg_vulnerabilities {
 
 /* Conflict handling (conflicts.c) */
 int	some_installed_package_conflicts_with(const char *, const char *, char **, char **);
+void	conflicts_index_add(const char *);
+void	conflicts_index_remove(const char *);
+void	conflicts_index_clear(void);
 
 
 /* Prototypes */
@@ -290,6 +293,7 @@ int	iterate_pkg_generic_src(int (*)(const char *, void *), void *,
 int	iterate_local_pkg_dir(const char *, int, int, int (*)(const char *, void *),
 			      void *);
 int	iterate_pkg_db(int (*)(const char *, void *), void *);
+size_t	pkg_suffix_len(const char *);
 
 int	add_installed_pkgs_by_basename(const char *, lpkg_head_t *);
 int	add_installed_pkgs_by_pattern(const char *, lpkg_head_t *);
@@ -322,10 +326,23 @@ int	has_pkgdir(const char *);
 struct archive;
 struct archive_entry;
 
+/*
+ * gzip and zstd packages start with an index: PKG_INDEX_TAG followed
+ * by the end of the meta data in the package file and in the tar
+ * archive, both as 64 bit little endian numbers.  It is stored in the
+ * extra field of an empty gzip member or in a skippable zstd frame.
+ */
+#define	PKG_INDEX_TAG		"pkgindx1"
+#define	PKG_INDEX_LEN		24
+#define	PKG_INDEX_ZSTD_MAGIC	0x184D2A5BU
+
 struct archive *open_archive(const char *, char **);
+struct archive *open_archive_meta(const char *, char **);
 struct archive *find_archive(const char *, int, char **);
 void	process_pkg_path(void);
 struct url *find_best_package(const char *, const char *, int);
+struct url *find_best_dependency(const char *);
+size_t	prefetch_packages(struct url **, size_t);
 
 /* Packing list */
 plist_t *new_plist_entry(void);
@@ -354,8 +371,11 @@ char   *pkgdb_retrieve(const char *);
 int	pkgdb_dump(void);
 int     pkgdb_remove(const char *);
 int	pkgdb_remove_pkg(const char *);
+int	pkgdb_iterate_pkg_files(const char *, int (*)(const char *, void *),
+	    void *);
 char   *pkgdb_refcount_dir(void);
 char   *pkgdb_get_database(void);
+char   *pkgdb_get_index_database(void);
 const char   *pkgdb_get_dir(void);
 /*
  * Priorities:
@@ -433,6 +453,7 @@ extern const char *certs_pkg_vulnerabilities;
 extern const char *check_eol;
 extern const char *check_vulnerabilities;
 extern const char *config_file;
+extern const char *config_pkg_cache_dir;
 extern const char *config_pkg_dbdir;
 extern const char *config_pkg_path;
 extern const char *config_pkg_refcount_dbdir;
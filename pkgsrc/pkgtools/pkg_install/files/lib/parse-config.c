@@ -69,6 +69,7 @@ const char *check_eol = "yes";
 const char *check_vulnerabilities;
 static const char *config_cache_connections;
 static const char *config_cache_connections_host;
+const char *config_pkg_cache_dir;
 const char *config_pkg_dbdir;
 const char *config_pkg_path;
 const char *config_pkg_refcount_dbdir;
@@ -109,6 +110,7 @@ static struct config_variable {
 	{ "GPG_SIGN_AS", &gpg_sign_as },
 	{ "IGNORE_PROXY", &ignore_proxy },
 	{ "IGNORE_URL", &ignore_advisories },
+	{ "PKG_CACHE_DIR", &config_pkg_cache_dir },
 	{ "PKG_DBDIR", &config_pkg_dbdir },
 	{ "PKG_PATH", &config_pkg_path },
 	{ "PKG_REFCOUNT_DBDIR", &config_pkg_refcount_dbdir },
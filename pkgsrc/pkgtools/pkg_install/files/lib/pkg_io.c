@@ -59,26 +59,106 @@ struct pkg_path {
 static char *orig_cwd, *last_toplevel;
 static TAILQ_HEAD(, pkg_path) pkg_path = TAILQ_HEAD_INITIALIZER(pkg_path);
 
+/* Packages fetched ahead into PKG_CACHE_DIR, see prefetch_packages(). */
+struct prefetched {
+	TAILQ_ENTRY(prefetched) pf_link;
+	char *pf_url;
+	char *pf_path;
+};
+
+static TAILQ_HEAD(, prefetched) prefetched =
+    TAILQ_HEAD_INITIALIZER(prefetched);
+
+/*
+ * When only the meta data of a remote package is wanted, the package
+ * is fetched in ranges, each twice as long as the one before, so that
+ * not much more than the start of the package is transferred.  If the
+ * package has an index, the first range after it covers all of the
+ * meta data.
+ */
+#define	META_CHUNK	65536
+
 struct fetch_archive {
 	struct url *url;
 	fetchIO *fetch;
 	char buffer[32768];
 	off_t size;
 	int restart;
+	int meta_only;
+	off_t chunk;
+	off_t meta_end;
 };
 
+static off_t
+parse_index(const unsigned char *p, size_t len)
+{
+	static const unsigned char gzip_header[] = {
+		0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 255,
+		PKG_INDEX_LEN + 4, 0, 'P', 'k', PKG_INDEX_LEN, 0
+	};
+	off_t meta_end;
+	int i;
+
+	if (len >= sizeof(gzip_header) + PKG_INDEX_LEN &&
+	    memcmp(p, gzip_header, 4) == 0 &&
+	    memcmp(p + 10, gzip_header + 10, 6) == 0) {
+		p += sizeof(gzip_header);
+	} else if (len >= 8 + PKG_INDEX_LEN) {
+		for (i = 0; i < 4; i++) {
+			if (p[i] != ((PKG_INDEX_ZSTD_MAGIC >> (8 * i)) & 0xff))
+				return 0;
+		}
+		if (p[4] != PKG_INDEX_LEN || p[5] || p[6] || p[7])
+			return 0;
+		p += 8;
+	} else
+		return 0;
+
+	if (memcmp(p, PKG_INDEX_TAG, 8) != 0)
+		return 0;
+	for (meta_end = 0, i = 7; i >= 0; i--)
+		meta_end = (meta_end << 8) | p[8 + i];
+	return meta_end;
+}
+
+static fetchIO *
+fetch_archive_get(struct fetch_archive *f, struct url_stat *us)
+{
+	fetchIO *fetch;
+	off_t offset;
+
+	offset = f->url->offset;
+	f->url->length = 0;
+	if (f->meta_only) {
+		if (f->meta_end > offset + f->chunk)
+			f->url->length = f->meta_end - offset;
+		else {
+			f->url->length = f->chunk;
+			f->chunk *= 2;
+		}
+	}
+	fetch = fetchXGet(f->url, us, fetch_flags);
+	if (fetch != NULL && f->url->offset != offset) {
+		fetchIO_close(fetch);
+		fetch = NULL;
+	}
+	return fetch;
+}
+
 static int
 fetch_archive_open(struct archive *a, void *client_data)
 {
 	struct fetch_archive *f = client_data;
 	struct url_stat us;
 
-	f->fetch = fetchXGet(f->url, &us, fetch_flags);
+	f->url->offset = 0;
+	f->chunk = META_CHUNK;
+	f->meta_end = 0;
+	f->fetch = fetch_archive_get(f, &us);
 	if (f->fetch == NULL)
 		return ENOENT;
 	f->size = us.size;
 	f->restart = 1;
-	f->url->offset = 0;
 	return 0;
 }
 
@@ -93,25 +173,31 @@ fetch_archive_read(struct archive *a, void *client_data,
 	*buffer = f->buffer;
 	rv = fetchIO_read(f->fetch, f->buffer, sizeof(f->buffer));
 	if (rv > 0) {
+		if (f->meta_only && f->url->offset == 0)
+			f->meta_end = parse_index(
+			    (const unsigned char *)f->buffer, rv);
 		f->url->offset += rv;
 		return rv;
 	}
-	if (f->restart == 0)
-		return rv;
 	if (rv == 0) {
 		if (f->size == -1)
 			return 0;
 		if (f->url->offset == f->size)
 			return 0;
 	}
-	f->restart = 0;
-	if (1) {
-		char *url = fetchStringifyURL(f->url);
-		fprintf(stderr, "Trying to reconnect %s\n", url);
-		free(url);
+	/* The end of a range just means going on with the next one. */
+	if (rv < 0 || !f->meta_only) {
+		if (f->restart == 0)
+			return rv;
+		f->restart = 0;
+		if (1) {
+			char *url = fetchStringifyURL(f->url);
+			fprintf(stderr, "Trying to reconnect %s\n", url);
+			free(url);
+		}
 	}
 	fetchIO_close(f->fetch);
-	f->fetch = fetchXGet(f->url, &us, fetch_flags);
+	f->fetch = fetch_archive_get(f, &us);
 	if (f->fetch == NULL)
 		return -1;
 	if (us.size != f->size)
@@ -135,15 +221,32 @@ fetch_archive_close(struct archive *a, void *client_data)
 }
 
 static struct archive *
-open_archive_by_url(struct url *url, char **archive_name)
+open_archive_by_url(struct url *url, char **archive_name, int meta_only)
 {
 	struct fetch_archive *f;
+	struct prefetched *pf;
 	struct archive *a;
 
+	*archive_name = fetchStringifyURL(url);
+
+	TAILQ_FOREACH(pf, &prefetched, pf_link) {
+		if (strcmp(pf->pf_url, *archive_name) == 0)
+			break;
+	}
+	if (pf != NULL) {
+		a = archive_read_new();
+		archive_read_support_compression_all(a);
+		archive_read_support_format_all(a);
+		if (archive_read_open_filename(a, pf->pf_path, 10240) == 0)
+			return a;
+		archive_read_finish(a);
+	}
+
 	f = xmalloc(sizeof(*f));
 	f->url = fetchCopyURL(url);
-
-	*archive_name = fetchStringifyURL(url);
+	f->meta_only = meta_only &&
+	    (strcmp(url->scheme, SCHEME_HTTP) == 0 ||
+	    strcmp(url->scheme, SCHEME_HTTPS) == 0);
 
 	a = archive_read_new();
 	archive_read_support_compression_all(a);
@@ -159,8 +262,8 @@ open_archive_by_url(struct url *url, char **archive_name)
 	return a;
 }
 
-struct archive *
-open_archive(const char *url, char **archive_name)
+static struct archive *
+open_archive_int(const char *url, char **archive_name, int meta_only)
 {
 	struct url *u;
 	struct archive *a;
@@ -182,23 +285,35 @@ open_archive(const char *url, char **archive_name)
 	if ((u = fetchParseURL(url)) == NULL)
 		return NULL;
 
-	a = open_archive_by_url(u, archive_name);
+	a = open_archive_by_url(u, archive_name, meta_only);
 
 	fetchFreeURL(u);
 	return a;
 }
 
+struct archive *
+open_archive(const char *url, char **archive_name)
+{
+	return open_archive_int(url, archive_name, 0);
+}
+
+/*
+ * Like open_archive, but the caller is only going to read the meta
+ * data at the start of the package.
+ */
+struct archive *
+open_archive_meta(const char *url, char **archive_name)
+{
+	return open_archive_int(url, archive_name, 1);
+}
+
 static int
 strip_suffix(char *filename)
 {
-	size_t len;
+	size_t sfx_len;
 
-	len = strlen(filename);
-	if (len <= 4)
-		return 0;
-	if (strcmp(filename + len - 4, ".tgz") == 0 ||
-	    strcmp(filename + len - 4, ".tbz") == 0) {
-		filename[len - 4] = '\0';
+	if ((sfx_len = pkg_suffix_len(filename)) != 0) {
+		filename[strlen(filename) - sfx_len] = '\0';
 		return 1;
 	} else
 		return 0;
@@ -334,6 +449,118 @@ find_best_package(const char *toplevel, const char *pattern, int do_path)
 	return best_match;
 }
 
+/*
+ * Find the package find_archive() would pick for a dependency.
+ */
+struct url *
+find_best_dependency(const char *pattern)
+{
+	return find_best_package(last_toplevel, pattern, 1);
+}
+
+struct prefetch_batch {
+	char **keys;
+	size_t errors;
+};
+
+static int
+prefetch_cb(void *cookie, size_t i, struct url *url, fetchIO *f,
+    const struct url_stat *us)
+{
+	struct prefetch_batch *batch = cookie;
+	struct prefetched *pf;
+	char buf[32768], *name, *path, *tmp;
+	ssize_t len;
+	off_t total;
+	FILE *fp;
+
+	if (f == NULL) {
+		warnx("Can't prefetch %s: %s", batch->keys[i],
+		    fetchLastErrString);
+		++batch->errors;
+		return 0;
+	}
+	if ((name = fetchUnquoteFilename(url)) == NULL)
+		return 0;
+	path = xasprintf("%s/%s", config_pkg_cache_dir, name);
+	tmp = xasprintf("%s.part", path);
+	free(name);
+
+	if ((fp = fopen(tmp, "w")) == NULL) {
+		warn("Can't create %s", tmp);
+		goto fail;
+	}
+	total = 0;
+	while ((len = fetchIO_read(f, buf, sizeof(buf))) > 0) {
+		if (fwrite(buf, 1, len, fp) != (size_t)len)
+			break;
+		total += len;
+	}
+	if (fclose(fp) != 0 || len != 0 ||
+	    (us->size != -1 && total != us->size)) {
+		warnx("Can't prefetch %s: %s", batch->keys[i],
+		    len == -1 ? fetchLastErrString : "short transfer");
+		unlink(tmp);
+		goto fail;
+	}
+	if (rename(tmp, path) == -1) {
+		warn("Can't rename %s", tmp);
+		unlink(tmp);
+		goto fail;
+	}
+	free(tmp);
+
+	TAILQ_FOREACH(pf, &prefetched, pf_link) {
+		if (strcmp(pf->pf_url, batch->keys[i]) == 0) {
+			free(path);
+			return 0;
+		}
+	}
+	pf = xmalloc(sizeof(*pf));
+	pf->pf_url = xstrdup(batch->keys[i]);
+	pf->pf_path = path;
+	TAILQ_INSERT_TAIL(&prefetched, pf, pf_link);
+	return 0;
+
+fail:
+	++batch->errors;
+	free(tmp);
+	free(path);
+	return 0;
+}
+
+/*
+ * Fetch the given packages into PKG_CACHE_DIR in one batch; requests
+ * to the same server are pipelined by fetchXGetMany().  Later
+ * find_archive() calls for them use the local copies.  Returns the
+ * number of packages that could not be fetched.
+ */
+size_t
+prefetch_packages(struct url **urls, size_t n)
+{
+	struct prefetch_batch batch;
+	size_t i;
+
+	if (n == 0)
+		return 0;
+	if (mkdir(config_pkg_cache_dir, 0755) == -1 && errno != EEXIST) {
+		warn("Can't create %s", config_pkg_cache_dir);
+		return n;
+	}
+
+	batch.keys = xcalloc(n, sizeof(*batch.keys));
+	batch.errors = 0;
+	for (i = 0; i < n; ++i)
+		batch.keys[i] = fetchStringifyURL(urls[i]);
+
+	fetchXGetMany(urls, n, prefetch_cb, &batch, fetch_flags);
+
+	for (i = 0; i < n; ++i)
+		free(batch.keys[i]);
+	free(batch.keys);
+	return batch.errors;
+}
+
 struct archive *
 find_archive(const char *fname, int top_level, char **archive_name)
 {
@@ -377,7 +604,7 @@ find_archive(const char *fname, int top_level, char **archive_name)
 
 	if (best_match == NULL)
 		return NULL;
-	a = open_archive_by_url(best_match, archive_name);
+	a = open_archive_by_url(best_match, archive_name, 0);
 	fetchFreeURL(best_match);
 	return a;
 }
@@ -61,10 +61,14 @@ __RCSID("$NetBSD: pkgdb.c,v 1.39 2010/04/20 21:22:38 joerg Exp $");
 #if HAVE_STRING_H
 #include <string.h>
 #endif
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 
 #include "lib.h"
 
 #define PKGDB_FILE	"pkgdb.byfile.db"	/* indexed by filename */
+#define PKGDB_PKG_FILE	"pkgdb.bypkg.db"	/* indexed by package */
 
 /*
  * Where we put logging information by default if PKG_DBDIR is unset.
@@ -77,6 +81,20 @@ __RCSID("$NetBSD: pkgdb.c,v 1.39 2010/04/20 21:22:38 joerg Exp $");
 #define PKG_DBDIR		"PKG_DBDIR"
 
 static DB   *pkgdbp;
+static DB   *pkgdb_bypkgp;	/* keys "pkg\0file\0", no data */
+static int  pkgdb_bypkg_writable;
+static int  pkgdb_bypkg_checked;	/* summary compared since opening */
+static char *pkgdb_bypkg_name;
+
+/*
+ * Summary of the records in the database: their number and the XOR of
+ * their hashes. It is kept up to date by our changes and stored in the
+ * index under the key "", which no "pkg\0file\0" key can be. Older
+ * versions of the package tools change the database without updating
+ * it, so the index isn't used for lookups if the summary doesn't match.
+ */
+static unsigned long pkgdb_nrecs;
+static uint64_t pkgdb_hash;
 static char pkgdb_dir_default[] = DEF_LOG_DIR;
 static char *pkgdb_dir = pkgdb_dir_default;
 static int pkgdb_dir_prio = 0;
@@ -90,11 +108,224 @@ pkgdb_get_database(void)
 	return xasprintf("%s/%s", pkgdb_get_dir(), PKGDB_FILE);
 }
 
+/*
+ *  Return name of the file of the package to files index.
+ */
+char *
+pkgdb_get_index_database(void)
+{
+	return xasprintf("%s/%s", pkgdb_get_dir(), PKGDB_PKG_FILE);
+}
+
+/*
+ * Build the key of the package to files index. Only files owned by
+ * a single package are indexed, not @pkgdir entries.
+ */
+static int
+pkgdb_index_key(DBT *keyd, const char *key, const char *val)
+{
+	size_t key_len, val_len;
+	char *buf;
+
+	if (pkgdb_bypkgp == NULL || *val == '@')
+		return 0;
+
+	key_len = strlen(key) + 1;
+	val_len = strlen(val) + 1;
+	buf = xmalloc(val_len + key_len);
+	memcpy(buf, val, val_len);
+	memcpy(buf + val_len, key, key_len);
+	keyd->data = buf;
+	keyd->size = val_len + key_len;
+	return 1;
+}
+
+static uint64_t
+pkgdb_record_hash(const DBT *key, const DBT *data)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	const unsigned char *p;
+	size_t i;
+
+	for (p = key->data, i = 0; i < key->size; ++i) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	for (p = data->data, i = 0; i < data->size; ++i) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/*
+ * Account for a record stored in or removed from the database.
+ */
+static void
+pkgdb_summary_update(const DBT *key, const DBT *data, int added)
+{
+	pkgdb_hash ^= pkgdb_record_hash(key, data);
+	if (added)
+		++pkgdb_nrecs;
+	else
+		--pkgdb_nrecs;
+}
+
+/*
+ * Read the summary stored in the index. Indexes written by earlier
+ * versions don't have one.
+ */
+static int
+pkgdb_index_read_summary(void)
+{
+	DBT	key, data;
+	char	buf[64];
+	unsigned long long hash;
+
+	key.data = __UNCONST("");
+	key.size = 1;
+	if ((*pkgdb_bypkgp->get)(pkgdb_bypkgp, &key, &data, 0) != 0 ||
+	    data.size == 0 || data.size >= sizeof(buf))
+		return -1;
+	memcpy(buf, data.data, data.size);
+	buf[data.size] = '\0';
+	if (sscanf(buf, "%lu %llx", &pkgdb_nrecs, &hash) != 2)
+		return -1;
+	pkgdb_hash = hash;
+	return 0;
+}
+
+static int
+pkgdb_index_write_summary(void)
+{
+	DBT	key, data;
+	char	buf[64];
+
+	key.data = __UNCONST("");
+	key.size = 1;
+	data.data = buf;
+	data.size = snprintf(buf, sizeof(buf), "%lu %llx", pkgdb_nrecs,
+	    (unsigned long long)pkgdb_hash);
+	return (*pkgdb_bypkgp->put)(pkgdb_bypkgp, &key, &data, 0);
+}
+
+static DB *
+pkgdb_index_dbopen(int flags)
+{
+	BTREEINFO info;
+
+	info.flags = 0;
+	info.cachesize = 512*1024;
+	info.maxkeypage = 0;
+	info.minkeypage = 0;
+	info.psize = 4096;
+	info.compare = NULL;
+	info.prefix = NULL;
+	info.lorder = 0;
+	return (DB *) dbopen(pkgdb_bypkg_name, flags, 0644, DB_BTREE,
+	    (void *) &info);
+}
+
+/*
+ * Recreate the package to files index from the database in one pass,
+ * computing the summary as well. Without an index, removing packages
+ * falls back to a full scan.
+ */
+static void
+pkgdb_index_rebuild(void)
+{
+	DBT	key, data, indexd, empty;
+	int	type, rv;
+
+	if (pkgdb_bypkgp != NULL)
+		(void) (*pkgdb_bypkgp->close) (pkgdb_bypkgp);
+	pkgdb_bypkgp = pkgdb_index_dbopen(O_RDWR | O_CREAT | O_TRUNC);
+	if (pkgdb_bypkgp == NULL) {
+		warn("Cannot create %s", pkgdb_bypkg_name);
+		return;
+	}
+
+	pkgdb_nrecs = 0;
+	pkgdb_hash = 0;
+	empty.data = __UNCONST("");
+	empty.size = 0;
+	for (type = R_FIRST;
+	    (rv = (*pkgdbp->seq)(pkgdbp, &key, &data, type)) == 0;
+	    type = R_NEXT) {
+		pkgdb_summary_update(&key, &data, 1);
+		if (key.size == 0 || data.size == 0 ||
+		    ((char *)key.data)[key.size - 1] != '\0' ||
+		    ((char *)data.data)[data.size - 1] != '\0')
+			continue;
+		if (pkgdb_index_key(&indexd, key.data, data.data)) {
+			rv = (*pkgdb_bypkgp->put)(pkgdb_bypkgp, &indexd,
+			    &empty, 0);
+			free(indexd.data);
+			if (rv == -1)
+				break;
+		}
+	}
+	if (rv == -1 || pkgdb_index_write_summary() == -1) {
+		warn("Cannot rebuild %s", pkgdb_bypkg_name);
+		(void) (*pkgdb_bypkgp->close) (pkgdb_bypkgp);
+		pkgdb_bypkgp = NULL;
+		(void) unlink(pkgdb_bypkg_name);
+		return;
+	}
+	pkgdb_bypkg_checked = 1;
+}
+
+/*
+ * Before the index is used for lookups, compare the stored summary
+ * with the database, once after opening it. A stale index is rebuilt
+ * if it is writable.
+ * Return value:
+ *   0: the index can be used
+ *  -1: no usable index
+ */
+static int
+pkgdb_index_check(void)
+{
+	DBT	key, data;
+	unsigned long nrecs;
+	uint64_t hash;
+	int	type, rv;
+
+	if (pkgdb_bypkgp == NULL)
+		return -1;
+	if (pkgdb_bypkg_checked)
+		return 0;
+
+	nrecs = 0;
+	hash = 0;
+	for (type = R_FIRST;
+	    (rv = (*pkgdbp->seq)(pkgdbp, &key, &data, type)) == 0;
+	    type = R_NEXT) {
+		hash ^= pkgdb_record_hash(&key, &data);
+		++nrecs;
+	}
+	if (rv == -1)
+		return -1;
+	if (nrecs == pkgdb_nrecs && hash == pkgdb_hash) {
+		pkgdb_bypkg_checked = 1;
+		return 0;
+	}
+	if (!pkgdb_bypkg_writable)
+		return -1;
+	pkgdb_index_rebuild();
+	return pkgdb_bypkgp == NULL ? -1 : 0;
+}
+
 /*
  *  Open the pkg-database
  *  Return value:
  *   1: everything ok
  *   0: error
+ *
+ *  The package to files index is rebuilt from the database if it is
+ *  missing or has no summary. Whether older versions of the package
+ *  tools changed the database is only checked when it is needed, see
+ *  pkgdb_index_check.
  */
 int
 pkgdb_open(int mode)
@@ -115,6 +346,23 @@ pkgdb_open(int mode)
 	pkgdbp = (DB *) dbopen(cachename,
 	    (mode == ReadOnly) ? O_RDONLY : O_RDWR | O_CREAT,
 	    0644, DB_BTREE, (void *) &info);
+	pkgdb_bypkgp = NULL;
+	pkgdb_bypkg_writable = 0;
+	pkgdb_bypkg_checked = 0;
+	if (pkgdbp != NULL) {
+		free(pkgdb_bypkg_name);
+		pkgdb_bypkg_name = pkgdb_get_index_database();
+		pkgdb_bypkgp = pkgdb_index_dbopen(
+		    (mode == ReadOnly) ? O_RDONLY : O_RDWR);
+		if (pkgdb_bypkgp != NULL &&
+		    pkgdb_index_read_summary() == -1) {
+			(void) (*pkgdb_bypkgp->close) (pkgdb_bypkgp);
+			pkgdb_bypkgp = NULL;
+		}
+		pkgdb_bypkg_writable = mode != ReadOnly;
+		if (pkgdb_bypkgp == NULL && pkgdb_bypkg_writable)
+			pkgdb_index_rebuild();
+	}
 	free(cachename);
 	return (pkgdbp != NULL);
 }
@@ -129,6 +377,12 @@ pkgdb_close(void)
 		(void) (*pkgdbp->close) (pkgdbp);
 		pkgdbp = NULL;
 	}
+	if (pkgdb_bypkgp != NULL) {
+		if (pkgdb_bypkg_writable)
+			(void) pkgdb_index_write_summary();
+		(void) (*pkgdb_bypkgp->close) (pkgdb_bypkgp);
+		pkgdb_bypkgp = NULL;
+	}
 }
 
 /*
@@ -141,7 +395,8 @@ pkgdb_close(void)
 int
 pkgdb_store(const char *key, const char *val)
 {
-	DBT     keyd, vald;
+	DBT     keyd, vald, indexd;
+	int	rv;
 
 	if (pkgdbp == NULL)
 		return -1;
@@ -154,7 +409,17 @@ pkgdb_store(const char *key, const char *val)
 	if (keyd.size > MaxPathSize || vald.size > MaxPathSize)
 		return -1;
 
-	return (*pkgdbp->put) (pkgdbp, &keyd, &vald, R_NOOVERWRITE);
+	rv = (*pkgdbp->put) (pkgdbp, &keyd, &vald, R_NOOVERWRITE);
+	if (rv == 0 && pkgdb_bypkgp != NULL)
+		pkgdb_summary_update(&keyd, &vald, 1);
+	if (rv == 0 && pkgdb_index_key(&indexd, key, val)) {
+		vald.data = __UNCONST("");
+		vald.size = 0;
+		if ((*pkgdb_bypkgp->put) (pkgdb_bypkgp, &indexd, &vald, 0) == -1)
+			rv = -1;
+		free(indexd.data);
+	}
+	return rv;
 }
 
 /*
@@ -225,7 +490,9 @@ pkgdb_dump(void)
 int
 pkgdb_remove(const char *key)
 {
-	DBT     keyd;
+	DBT     keyd, vald, indexd;
+	char	*val;
+	int	rv;
 
 	if (pkgdbp == NULL)
 		return -1;
@@ -235,11 +502,80 @@ pkgdb_remove(const char *key)
 	if (keyd.size > MaxPathSize)
 		return -1;
 
-	return (*pkgdbp->del) (pkgdbp, &keyd, 0);
+	if (pkgdb_bypkgp != NULL && (val = pkgdb_retrieve(key)) != NULL)
+		val = xstrdup(val);
+	else
+		val = NULL;
+
+	rv = (*pkgdbp->del) (pkgdbp, &keyd, 0);
+	if (rv == 0 && val != NULL) {
+		vald.data = val;
+		vald.size = strlen(val) + 1;
+		pkgdb_summary_update(&keyd, &vald, 0);
+	}
+	if (rv == 0 && val != NULL && pkgdb_index_key(&indexd, key, val)) {
+		if ((*pkgdb_bypkgp->del) (pkgdb_bypkgp, &indexd, 0) == -1)
+			rv = -1;
+		free(indexd.data);
+	}
+	free(val);
+	return rv;
+}
+
+/*
+ *  Call f for every file owned by `pkg' according to the package to files
+ *  index. The index must not be modified by f.
+ *  Return value:
+ *   0: everything ok
+ *  -1: no index or an error occurred
+ */
+int
+pkgdb_iterate_pkg_files(const char *pkg, int (*f)(const char *, void *),
+    void *cookie)
+{
+	DBT	key, data;
+	size_t	cc;
+	int	rv, status;
+
+	if (pkgdb_index_check() == -1)
+		return -1;
+
+	cc = strlen(pkg) + 1;
+	key.data = __UNCONST(pkg);
+	key.size = cc;
+	rv = 0;
+	for (status = (*pkgdb_bypkgp->seq)(pkgdb_bypkgp, &key, &data, R_CURSOR);
+	    status == 0;
+	    status = (*pkgdb_bypkgp->seq)(pkgdb_bypkgp, &key, &data, R_NEXT)) {
+		if (key.size <= cc || memcmp(key.data, pkg, cc) != 0)
+			break;
+		if ((rv = (*f)((const char *)key.data + cc, cookie)) != 0)
+			break;
+	}
+	return status == -1 ? -1 : rv;
+}
+
+struct pkg_files {
+	char	**files;
+	size_t	len, alloc;
+};
+
+static int
+collect_file(const char *file, void *cookie)
+{
+	struct pkg_files *pf = cookie;
+
+	if (pf->len == pf->alloc) {
+		pf->alloc = pf->alloc ? pf->alloc * 2 : 64;
+		pf->files = xrealloc(pf->files, pf->alloc * sizeof(char *));
+	}
+	pf->files[pf->len++] = xstrdup(file);
+	return 0;
 }
 
 /*
  *  Remove any entry from the cache which has a data field of `pkg'.
+ *  Uses the package to files index if present, a full scan otherwise.
  *  Return value:
  *   1: everything ok
  *   0: error
@@ -251,20 +587,54 @@ pkgdb_remove_pkg(const char *pkg)
 	DBT     key;
 	int	type;
 	int	ret;
-	size_t	cc;
+	size_t	cc, i;
 	char	*cachename;
+	const char *owner;
+	struct pkg_files pf;
+	uint64_t hash;
 
 	if (pkgdbp == NULL) {
 		return 0;
 	}
 	cachename = pkgdb_get_database();
 	cc = strlen(pkg);
+
+	pf.files = NULL;
+	pf.len = pf.alloc = 0;
+	if (pkgdb_iterate_pkg_files(pkg, collect_file, &pf) == 0) {
+		for (ret = 1, i = 0; i < pf.len; ++i) {
+			owner = pkgdb_retrieve(pf.files[i]);
+			if (owner != NULL && strcmp(owner, pkg) == 0) {
+				if (Verbose) {
+					printf("Removing file `%s' from %s\n", pf.files[i], cachename);
+				}
+				if (pkgdb_remove(pf.files[i]) == -1) {
+					warn("Error removing `%s' from %s", pf.files[i], cachename);
+					ret = 0;
+				}
+			} else if (pkgdb_index_key(&key, pf.files[i], pkg)) {
+				/* Stale index entry, the file isn't ours. */
+				(void)(*pkgdb_bypkgp->del)(pkgdb_bypkgp, &key, 0);
+				free(key.data);
+			}
+			free(pf.files[i]);
+		}
+		free(pf.files);
+		free(cachename);
+		return ret;
+	}
+
 	for (ret = 1, type = R_FIRST; (*pkgdbp->seq)(pkgdbp, &key, &data, type) == 0 ; type = R_NEXT) {
 		if ((cc + 1) == data.size && strncmp(data.data, pkg, cc) == 0) {
 			if (Verbose) {
 				printf("Removing file `%s' from %s\n", (char *)key.data, cachename);
 			}
+			hash = pkgdb_record_hash(&key, &data);
 			switch ((*pkgdbp->del)(pkgdbp, &key, 0)) {
+			case 0:
+				pkgdb_hash ^= hash;
+				--pkgdb_nrecs;
+				break;
 			case -1:
 				warn("Error removing `%s' from %s", (char *)key.data, cachename);
 				ret = 0;